@@ -1,4 +1,5 @@
 #include "semantic.hpp"
+#include "profile/trace.hpp"
 #include <iostream>
 #include <lexer/token.hpp>
 #include <sstream>
@@ -65,6 +66,7 @@ void SemanticAnalyser::analyseProgram(const Program *program) {
 }
 
 void SemanticAnalyser::analyseClass(const ClassDeclaration *clazz) {
+  TraceSpan span("analyse", clazz->name);
   for (const auto &member : clazz->members) {
     analyseVariableDeclaration(member.get());
   }
@@ -83,6 +85,7 @@ void SemanticAnalyser::analyseClass(const ClassDeclaration *clazz) {
 }
 
 void SemanticAnalyser::analyseFunction(const FunctionDeclaration *func) {
+  TraceSpan span("analyse", func->name);
   Symbol sym{func->name, func->returnType.get(), SymbolKind::Function, false};
   declare(func->name, sym);
 
@@ -101,8 +104,18 @@ void SemanticAnalyser::analyseFunction(const FunctionDeclaration *func) {
 
   if (hasQuantum) {
     Type *retType = func->returnType.get();
-    if (!isVoidType(retType) && !isBitType(retType)) {
-      reportError("@quantum functions must return void or bit");
+    if (!isVoidType(retType) && !isBitType(retType) && !isFloatType(retType)) {
+      reportError("@quantum functions must return void, bit or float");
+    }
+    // A float is the exact value of an observable, never a sampled one
+    if (isFloatType(retType)) {
+      for (const auto &stmt : func->body->statements) {
+        auto *ret = dynamic_cast<const ReturnStatement *>(stmt.get());
+        if (ret && !isExpectCall(ret->value.get())) {
+          reportError("@quantum function '" + func->name +
+                      "' returning float must return expect(...)");
+        }
+      }
     }
     inQuantumFunction = true;
   }
@@ -184,14 +197,23 @@ void SemanticAnalyser::analyseVariableDeclaration(
       static const std::unordered_set<std::string> validStates = {
           "0", "1", "+", "-", "i", "-i"};
 
-      if (validStates.find(ann->value) == validStates.end()) {
+      // The annotation keeps the quotes of its string or char literal
+      std::string state = ann->value;
+      if (state.size() >= 2 && (state.front() == '"' || state.front() == '\''))
+        state = state.substr(1, state.size() - 2);
+
+      if (validStates.find(state) == validStates.end()) {
         reportError("Invalid @state value: " + ann->value);
       }
     }
   }
 
-  if (inQuantumFunction) {
+  // Loop counters and `final` constants are resolved at compile time, so
+  // quantum code may use them to index qubit arrays
+  if (inQuantumFunction && !decl->isFinal && !inLoopHeader) {
     auto *type = decl->varType.get();
+    if (auto *at = dynamic_cast<ArrayType *>(type))
+      type = at->elementType.get();
     auto *pt = dynamic_cast<PrimitiveType *>(type);
     if (!pt || (pt->name != "qubit" && pt->name != "bit")) {
       reportError(
@@ -222,8 +244,11 @@ void SemanticAnalyser::analyseIf(const IfStatement *stmt) {
 
 void SemanticAnalyser::analyseFor(const ForStatement *stmt) {
   enterScope();
-  if (stmt->initializer)
+  if (stmt->initializer) {
+    inLoopHeader = true;
     analyseStatement(stmt->initializer.get());
+    inLoopHeader = false;
+  }
   if (stmt->condition)
     analyseExpression(stmt->condition.get());
   if (stmt->increment)
@@ -283,6 +308,8 @@ Type *SemanticAnalyser::analyseExpression(const Expression *expr) {
     return analyseConstructorCallExpr(constructor);
   } else if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr)) {
     return analyseExpression(paren->expression.get());
+  } else if (auto index = dynamic_cast<const IndexExpression *>(expr)) {
+    return analyseIndex(index);
   }
   reportError("Unknown expression type");
   return nullptr;
@@ -343,6 +370,23 @@ Type *SemanticAnalyser::analyseUnary(const UnaryExpression *expr) {
   return nullptr;
 }
 
+Type *SemanticAnalyser::analyseIndex(const IndexExpression *expr) {
+  auto collection = analyseExpression(expr->collection.get());
+  auto *array = dynamic_cast<ArrayType *>(collection);
+  if (!array) {
+    reportError("[Type Error] Cannot index non-array type: " +
+                typeToString(collection));
+  }
+
+  auto index = analyseExpression(expr->index.get());
+  auto *pt = dynamic_cast<PrimitiveType *>(index);
+  if (!pt || pt->name != "int") {
+    reportError("[Type Error] Array index must be an int (got " +
+                typeToString(index) + ")");
+  }
+  return array->elementType.get();
+}
+
 Type *SemanticAnalyser::analyseLiteral(const LiteralExpression *expr) {
   const std::string &val = expr->value;
 
@@ -369,9 +413,33 @@ Type *SemanticAnalyser::analyseVariable(const VariableExpression *expr) {
 }
 
 Type *SemanticAnalyser::analyseCall(const CallExpression *expr) {
-  // Case 1: calling a method on an instance, like `instance.getX()`
   if (auto member =
           dynamic_cast<MemberAccessExpression *>(expr->callee.get())) {
+    // Case 1: `f.adjoint(args)` or `f.gradient(k, args)` on a function
+    auto *fn = dynamic_cast<VariableExpression *>(member->object.get());
+    auto *sym = fn ? lookup(fn->name) : nullptr;
+    if (sym && sym->kind == SymbolKind::Function) {
+      for (const auto &arg : expr->arguments) {
+        analyseExpression(arg.get());
+      }
+      if (member->member == "adjoint")
+        return sym->type;
+      if (member->member == "gradient") {
+        if (!isFloatType(sym->type)) {
+          reportError("Function '" + fn->name +
+                      "' has no gradient: it does not return expect(...)");
+        }
+        if (expr->arguments.empty() ||
+            !isIntType(analyseExpression(expr->arguments[0].get()))) {
+          reportError("gradient() takes the index of a parameter first");
+        }
+        return new PrimitiveType("float");
+      }
+      reportError("Function '" + fn->name + "' has no member named '" +
+                  member->member + "'");
+    }
+
+    // Case 2: calling a method on an instance, like `instance.getX()`
     Type *calleeType = analyseMemberAccess(member);
 
     // Check arguments
@@ -382,12 +450,34 @@ Type *SemanticAnalyser::analyseCall(const CallExpression *expr) {
     return calleeType;
   }
 
-  // Case 2: calling a global function
+  // Case 3: calling a global function
   auto var = dynamic_cast<VariableExpression *>(expr->callee.get());
   if (!var) {
     reportError("Invalid function call target");
   }
 
+  // Built-in expect("0.5*ZZ + XI", qubits...)
+  if (var->name == "expect" && !lookup(var->name)) {
+    auto *text = expr->arguments.empty()
+                     ? nullptr
+                     : dynamic_cast<PrimitiveType *>(
+                           analyseExpression(expr->arguments[0].get()));
+    if (!text || text->name != "string") {
+      reportError("expect() takes a Pauli string first");
+    }
+    for (size_t i = 1; i < expr->arguments.size(); ++i) {
+      Type *type = analyseExpression(expr->arguments[i].get());
+      if (auto *array = dynamic_cast<ArrayType *>(type))
+        type = array->elementType.get();
+      auto *pt = dynamic_cast<PrimitiveType *>(type);
+      if (!pt || pt->name != "qubit") {
+        reportError("expect() measures qubits (got " + typeToString(type) +
+                    ")");
+      }
+    }
+    return new PrimitiveType("float");
+  }
+
   auto sym = lookup(var->name);
   if (!sym || sym->kind != SymbolKind::Function) {
     reportError("'" + var->name + "' is not a function");
@@ -522,6 +612,24 @@ bool SemanticAnalyser::isNumeric(Type *t) {
   return pt && (pt->name == "int" || pt->name == "float");
 }
 
+bool SemanticAnalyser::isIntType(Type *t) {
+  auto *pt = dynamic_cast<PrimitiveType *>(t);
+  return pt && pt->name == "int";
+}
+
+bool SemanticAnalyser::isFloatType(Type *t) {
+  auto *pt = dynamic_cast<PrimitiveType *>(t);
+  return pt && pt->name == "float";
+}
+
+bool SemanticAnalyser::isExpectCall(const Expression *expr) {
+  auto *call = dynamic_cast<const CallExpression *>(expr);
+  auto *callee =
+      call ? dynamic_cast<const VariableExpression *>(call->callee.get())
+           : nullptr;
+  return callee && callee->name == "expect";
+}
+
 bool SemanticAnalyser::isBitType(Type *t) {
   auto *pt = dynamic_cast<PrimitiveType *>(t);
   return pt && pt->name == "bit";
@@ -40,6 +40,7 @@ private:
   std::shared_ptr<Scope> currentScope;
   std::unordered_map<std::string, const ClassDeclaration *> classMap;
   bool inQuantumFunction = false;
+  bool inLoopHeader = false; // analysing a `for` initializer
 
   // Scope helpers
   void enterScope();
@@ -75,14 +76,19 @@ private:
   Type *analyseMeasure(const MeasureExpression *expr);
   Type *analyseAssignmentExpr(const AssignmentExpression *expr);
   Type *analyseConstructorCallExpr(const ConstructorCallExpression *expr);
+  Type *analyseIndex(const IndexExpression *expr);
 
   // Type utils
   Type *evaluateType(const std::unique_ptr<Type> &t);
   bool isSameType(Type *a, Type *b);
   bool isNumeric(Type *t);
+  bool isIntType(Type *t);
+  bool isFloatType(Type *t);
   bool isBitType(Type *t);
   bool isVoidType(Type *t);
   std::string typeToString(Type *t);
+  // A call to the built-in expect()
+  bool isExpectCall(const Expression *expr);
 
   // Error handling
   void reportError(const std::string &msg);
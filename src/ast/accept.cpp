@@ -1,8 +1,6 @@
 #include "ast/ast.hpp"
 #include "codegen/visitor_base.hpp"
 
-using namespace quanta;
-
 void Program::accept(CodegenVisitor &visitor) { visitor.visit(*this); }
 void ImportStatement::accept(CodegenVisitor &visitor) { visitor.visit(*this); }
 void VariableDeclaration::accept(CodegenVisitor &visitor) {
@@ -4,15 +4,18 @@
 #include <string>
 #include <vector>
 
-namespace quanta {
-class BaseCodegenVisitor;
-} // namespace quanta
+#include "profile/stats.hpp"
+
+struct BaseCodegenVisitor;
+using CodegenVisitor = BaseCodegenVisitor;
 
 #define ACCEPT_VISITOR virtual void accept(CodegenVisitor &visitor) override;
 
 // Base Node Interfaces
 struct ASTNode {
+  ASTNode() { Stats::add(Counter::AstNodes); }
   virtual ~ASTNode() = default;
+  virtual void accept(CodegenVisitor &visitor) = 0;
 };
 
 struct Statement : public ASTNode {};
@@ -271,9 +274,11 @@ struct LogicalType : public Type {
 
 struct ArrayType : public Type {
   std::unique_ptr<Type> elementType;
+  std::unique_ptr<Expression> size; // `qubit[n]`; null for `qubit[]`
 
-  ArrayType(std::unique_ptr<Type> elementType)
-      : elementType(std::move(elementType)) {}
+  ArrayType(std::unique_ptr<Type> elementType,
+            std::unique_ptr<Expression> size = nullptr)
+      : elementType(std::move(elementType)), size(std::move(size)) {}
 
   ACCEPT_VISITOR
 };
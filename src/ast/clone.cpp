@@ -0,0 +1,161 @@
+#include "clone.hpp"
+
+#include <stdexcept>
+
+namespace {
+
+std::vector<std::unique_ptr<Expression>>
+cloneAll(const std::vector<std::unique_ptr<Expression>> &exprs) {
+  std::vector<std::unique_ptr<Expression>> copies;
+  copies.reserve(exprs.size());
+  for (const auto &expr : exprs)
+    copies.push_back(clone(expr.get()));
+  return copies;
+}
+
+} // namespace
+
+std::unique_ptr<BlockStatement> clone(const BlockStatement *block) {
+  if (!block)
+    return nullptr;
+  auto copy = std::make_unique<BlockStatement>();
+  copy->statements.reserve(block->statements.size());
+  for (const auto &stmt : block->statements)
+    copy->statements.push_back(clone(stmt.get()));
+  return copy;
+}
+
+std::unique_ptr<Statement> clone(const Statement *stmt) {
+  if (!stmt)
+    return nullptr;
+
+  if (auto block = dynamic_cast<const BlockStatement *>(stmt))
+    return clone(block);
+  if (auto decl = dynamic_cast<const VariableDeclaration *>(stmt)) {
+    auto copy = std::make_unique<VariableDeclaration>();
+    copy->name = decl->name;
+    copy->access = decl->access;
+    copy->varType = clone(decl->varType.get());
+    copy->initializer = clone(decl->initializer.get());
+    for (const auto &ann : decl->annotations)
+      copy->annotations.push_back(
+          std::make_unique<AnnotationNode>(ann->name, ann->value));
+    copy->isFinal = decl->isFinal;
+    return copy;
+  }
+  if (auto exprStmt = dynamic_cast<const ExpressionStatement *>(stmt)) {
+    auto copy = std::make_unique<ExpressionStatement>();
+    copy->expression = clone(exprStmt->expression.get());
+    return copy;
+  }
+  if (auto ret = dynamic_cast<const ReturnStatement *>(stmt)) {
+    auto copy = std::make_unique<ReturnStatement>();
+    copy->value = clone(ret->value.get());
+    return copy;
+  }
+  if (auto ifStmt = dynamic_cast<const IfStatement *>(stmt)) {
+    auto copy = std::make_unique<IfStatement>();
+    copy->condition = clone(ifStmt->condition.get());
+    copy->thenBranch = clone(ifStmt->thenBranch.get());
+    copy->elseBranch = clone(ifStmt->elseBranch.get());
+    return copy;
+  }
+  if (auto forStmt = dynamic_cast<const ForStatement *>(stmt)) {
+    auto copy = std::make_unique<ForStatement>();
+    copy->initializer = clone(forStmt->initializer.get());
+    copy->condition = clone(forStmt->condition.get());
+    copy->increment = clone(forStmt->increment.get());
+    copy->body = clone(forStmt->body.get());
+    return copy;
+  }
+  if (auto echo = dynamic_cast<const EchoStatement *>(stmt)) {
+    auto copy = std::make_unique<EchoStatement>();
+    copy->value = clone(echo->value.get());
+    return copy;
+  }
+  if (auto reset = dynamic_cast<const ResetStatement *>(stmt)) {
+    auto copy = std::make_unique<ResetStatement>();
+    copy->target = clone(reset->target.get());
+    return copy;
+  }
+  if (auto meas = dynamic_cast<const MeasureStatement *>(stmt)) {
+    auto copy = std::make_unique<MeasureStatement>();
+    copy->qubit = clone(meas->qubit.get());
+    return copy;
+  }
+  if (auto assign = dynamic_cast<const AssignmentStatement *>(stmt)) {
+    auto copy = std::make_unique<AssignmentStatement>();
+    copy->name = assign->name;
+    copy->value = clone(assign->value.get());
+    return copy;
+  }
+  if (auto import = dynamic_cast<const ImportStatement *>(stmt)) {
+    auto copy = std::make_unique<ImportStatement>();
+    copy->module = import->module;
+    return copy;
+  }
+  throw std::logic_error("clone: unhandled statement type");
+}
+
+std::unique_ptr<Expression> clone(const Expression *expr) {
+  if (!expr)
+    return nullptr;
+
+  if (auto lit = dynamic_cast<const LiteralExpression *>(expr))
+    return std::make_unique<LiteralExpression>(lit->value);
+  if (auto var = dynamic_cast<const VariableExpression *>(expr))
+    return std::make_unique<VariableExpression>(var->name);
+  if (auto bin = dynamic_cast<const BinaryExpression *>(expr)) {
+    return std::make_unique<BinaryExpression>(
+        bin->op, clone(bin->left.get()), clone(bin->right.get()));
+  }
+  if (auto unary = dynamic_cast<const UnaryExpression *>(expr))
+    return std::make_unique<UnaryExpression>(unary->op,
+                                             clone(unary->right.get()));
+  if (auto call = dynamic_cast<const CallExpression *>(expr)) {
+    return std::make_unique<CallExpression>(clone(call->callee.get()),
+                                            cloneAll(call->arguments));
+  }
+  if (auto index = dynamic_cast<const IndexExpression *>(expr)) {
+    auto copy = std::make_unique<IndexExpression>();
+    copy->collection = clone(index->collection.get());
+    copy->index = clone(index->index.get());
+    return copy;
+  }
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return std::make_unique<ParenthesizedExpression>(
+        clone(paren->expression.get()));
+  if (auto meas = dynamic_cast<const MeasureExpression *>(expr))
+    return std::make_unique<MeasureExpression>(clone(meas->qubit.get()));
+  if (auto assign = dynamic_cast<const AssignmentExpression *>(expr))
+    return std::make_unique<AssignmentExpression>(assign->name,
+                                                  clone(assign->value.get()));
+  if (auto ctor = dynamic_cast<const ConstructorCallExpression *>(expr)) {
+    return std::make_unique<ConstructorCallExpression>(
+        ctor->className, cloneAll(ctor->arguments));
+  }
+  if (auto member = dynamic_cast<const MemberAccessExpression *>(expr)) {
+    return std::make_unique<MemberAccessExpression>(
+        clone(member->object.get()), member->member);
+  }
+  throw std::logic_error("clone: unhandled expression type");
+}
+
+std::unique_ptr<Type> clone(const Type *type) {
+  if (!type)
+    return nullptr;
+
+  if (auto pt = dynamic_cast<const PrimitiveType *>(type))
+    return std::make_unique<PrimitiveType>(pt->name);
+  if (auto at = dynamic_cast<const ArrayType *>(type)) {
+    return std::make_unique<ArrayType>(clone(at->elementType.get()),
+                                       clone(at->size.get()));
+  }
+  if (auto lt = dynamic_cast<const LogicalType *>(type))
+    return std::make_unique<LogicalType>(lt->code);
+  if (auto ot = dynamic_cast<const ObjectType *>(type))
+    return std::make_unique<ObjectType>(ot->className);
+  if (dynamic_cast<const VoidType *>(type))
+    return std::make_unique<VoidType>();
+  throw std::logic_error("clone: unhandled type");
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <memory>
+
+#include "ast.hpp"
+
+// Deep copies of AST subtrees, for passes that duplicate code (loop
+// unrolling, inlining). Null in, null out.
+std::unique_ptr<Statement> clone(const Statement *stmt);
+std::unique_ptr<Expression> clone(const Expression *expr);
+std::unique_ptr<Type> clone(const Type *type);
+std::unique_ptr<BlockStatement> clone(const BlockStatement *block);
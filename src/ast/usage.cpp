@@ -0,0 +1,91 @@
+#include "usage.hpp"
+
+void scanUsage(const Expression *expr, Usage &usage) {
+  if (!expr)
+    return;
+
+  if (auto var = dynamic_cast<const VariableExpression *>(expr)) {
+    usage.read.insert(var->name);
+  } else if (auto bin = dynamic_cast<const BinaryExpression *>(expr)) {
+    scanUsage(bin->left.get(), usage);
+    scanUsage(bin->right.get(), usage);
+  } else if (auto unary = dynamic_cast<const UnaryExpression *>(expr)) {
+    scanUsage(unary->right.get(), usage);
+  } else if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr)) {
+    scanUsage(paren->expression.get(), usage);
+  } else if (auto index = dynamic_cast<const IndexExpression *>(expr)) {
+    scanUsage(index->collection.get(), usage);
+    scanUsage(index->index.get(), usage);
+  } else if (auto call = dynamic_cast<const CallExpression *>(expr)) {
+    usage.hasEffects = true;
+    if (auto callee = dynamic_cast<const VariableExpression *>(
+            call->callee.get())) {
+      usage.called.insert(callee->name);
+    } else if (auto member = dynamic_cast<const MemberAccessExpression *>(
+                   call->callee.get())) {
+      // f.adjoint(...) calls f; obj.method(...) reads obj
+      if (auto object =
+              dynamic_cast<const VariableExpression *>(member->object.get()))
+        usage.called.insert(object->name);
+      scanUsage(member->object.get(), usage);
+    }
+    for (const auto &arg : call->arguments)
+      scanUsage(arg.get(), usage);
+  } else if (auto meas = dynamic_cast<const MeasureExpression *>(expr)) {
+    usage.hasEffects = true;
+    scanUsage(meas->qubit.get(), usage);
+  } else if (auto assign = dynamic_cast<const AssignmentExpression *>(expr)) {
+    usage.hasEffects = true;
+    usage.assigned.insert(assign->name);
+    scanUsage(assign->value.get(), usage);
+  } else if (auto ctor = dynamic_cast<const ConstructorCallExpression *>(expr)) {
+    usage.hasEffects = true;
+    for (const auto &arg : ctor->arguments)
+      scanUsage(arg.get(), usage);
+  } else if (auto member = dynamic_cast<const MemberAccessExpression *>(expr)) {
+    scanUsage(member->object.get(), usage);
+  }
+}
+
+void scanUsage(const Statement *stmt, Usage &usage) {
+  if (!stmt)
+    return;
+
+  if (auto block = dynamic_cast<const BlockStatement *>(stmt)) {
+    for (const auto &inner : block->statements)
+      scanUsage(inner.get(), usage);
+    return;
+  }
+
+  usage.statements++;
+  if (auto decl = dynamic_cast<const VariableDeclaration *>(stmt)) {
+    usage.declared.insert(decl->name);
+    if (auto at = dynamic_cast<const ArrayType *>(decl->varType.get()))
+      scanUsage(at->size.get(), usage);
+    scanUsage(decl->initializer.get(), usage);
+  } else if (auto exprStmt = dynamic_cast<const ExpressionStatement *>(stmt)) {
+    scanUsage(exprStmt->expression.get(), usage);
+  } else if (auto ret = dynamic_cast<const ReturnStatement *>(stmt)) {
+    usage.returns++;
+    scanUsage(ret->value.get(), usage);
+  } else if (auto ifStmt = dynamic_cast<const IfStatement *>(stmt)) {
+    scanUsage(ifStmt->condition.get(), usage);
+    scanUsage(ifStmt->thenBranch.get(), usage);
+    scanUsage(ifStmt->elseBranch.get(), usage);
+  } else if (auto forStmt = dynamic_cast<const ForStatement *>(stmt)) {
+    scanUsage(forStmt->initializer.get(), usage);
+    scanUsage(forStmt->condition.get(), usage);
+    scanUsage(forStmt->increment.get(), usage);
+    scanUsage(forStmt->body.get(), usage);
+  } else if (auto echo = dynamic_cast<const EchoStatement *>(stmt)) {
+    scanUsage(echo->value.get(), usage);
+  } else if (auto reset = dynamic_cast<const ResetStatement *>(stmt)) {
+    scanUsage(reset->target.get(), usage);
+  } else if (auto meas = dynamic_cast<const MeasureStatement *>(stmt)) {
+    usage.hasEffects = true;
+    scanUsage(meas->qubit.get(), usage);
+  } else if (auto assign = dynamic_cast<const AssignmentStatement *>(stmt)) {
+    usage.assigned.insert(assign->name);
+    scanUsage(assign->value.get(), usage);
+  }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <set>
+#include <string>
+
+#include "ast.hpp"
+
+// Name-based summary of a subtree, for passes that need to know whether
+// code can be moved, copied or dropped (inlining, dead-code elimination).
+// Scopes are not tracked: a name counts as read if any variable of that
+// name is.
+struct Usage {
+  std::set<std::string> declared;
+  std::set<std::string> assigned;
+  std::set<std::string> read; // variables; a plain callee is not a read
+  std::set<std::string> called; // functions, and `f` in f.adjoint(...)
+  size_t statements = 0; // blocks excluded
+  size_t returns = 0;
+  bool hasEffects = false; // calls, measurements, assignments
+};
+
+// Adds what `stmt` or `expr` does to `usage`. Null is allowed.
+void scanUsage(const Statement *stmt, Usage &usage);
+void scanUsage(const Expression *expr, Usage &usage);
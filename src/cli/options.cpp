@@ -0,0 +1,191 @@
+#include "options.hpp"
+
+#include <charconv>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+uint64_t parseUnsigned(std::string_view flag, std::string_view value) {
+  uint64_t result = 0;
+  auto [end, ec] =
+      std::from_chars(value.data(), value.data() + value.size(), result);
+  if (value.empty() || ec != std::errc() ||
+      end != value.data() + value.size()) {
+    throw std::runtime_error("Invalid value for " + std::string(flag) + ": '" +
+                             std::string(value) + "'");
+  }
+  return result;
+}
+
+// Flags that switch something on take no value
+void requireNoValue(std::string_view flag, size_t eq) {
+  if (eq != std::string_view::npos)
+    throw std::runtime_error(std::string(flag) + " takes no value");
+}
+
+} // namespace
+
+Options parseOptions(int argc, char **argv) {
+  Options options;
+  bool seedGiven = false;
+  bool execGiven = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+
+    if (!arg.starts_with("--")) {
+      if (!options.inputPath.empty()) {
+        throw std::runtime_error("Unexpected argument: " + std::string(arg));
+      }
+      options.inputPath = arg;
+      continue;
+    }
+
+    size_t eq = arg.find('=');
+    std::string_view flag = arg.substr(0, eq);
+    std::string_view value =
+        eq == std::string_view::npos ? std::string_view{} : arg.substr(eq + 1);
+
+    if (flag == "--shots") {
+      options.simulator.shots = parseUnsigned(flag, value);
+    } else if (flag == "--seed") {
+      options.simulator.seed = parseUnsigned(flag, value);
+      seedGiven = true;
+    } else if (flag == "--precision") {
+      options.simulator.precision = parsePrecision(std::string(value));
+    } else if (flag == "--out-of-core") {
+      if (value.empty())
+        throw std::runtime_error("--out-of-core needs a directory");
+      options.simulator.outOfCore.directory = value;
+    } else if (flag == "--chunk-qubits") {
+      // A chunk holds at least the two qubits a gate acts on, and its
+      // amplitude count must fit a 64-bit index
+      uint64_t chunkQubits = parseUnsigned(flag, value);
+      if (chunkQubits < 2 || chunkQubits > 63)
+        throw std::runtime_error("--chunk-qubits must be between 2 and 63");
+      options.simulator.outOfCore.chunkQubits =
+          static_cast<unsigned>(chunkQubits);
+    } else if (flag == "--ranks") {
+      uint64_t ranks = parseUnsigned(flag, value);
+      if (ranks == 0 || ranks > 1024 || (ranks & (ranks - 1)) != 0) {
+        throw std::runtime_error("--ranks must be a power of two up to 1024");
+      }
+      options.simulator.ranks = static_cast<unsigned>(ranks);
+    } else if (flag == "--fidelity-check") {
+      requireNoValue(flag, eq);
+      options.fidelityCheck = true;
+    } else if (flag == "--layout") {
+      requireNoValue(flag, eq);
+      options.layout = true;
+    } else if (flag == "--unroll-limit") {
+      options.unrollLimit = parseUnsigned(flag, value);
+    } else if (flag == "--inline-limit") {
+      options.inlineLimit = parseUnsigned(flag, value);
+    } else if (flag == "--run") {
+      requireNoValue(flag, eq);
+      options.run = true;
+    } else if (flag == "--exec") {
+      execGiven = true;
+      if (value == "vm")
+        options.exec = ExecMode::Vm;
+      else if (value == "native")
+        options.exec = ExecMode::Native;
+      else
+        throw std::runtime_error("Invalid value for --exec: '" +
+                                 std::string(value) + "'");
+    } else if (flag == "--jit-cache") {
+      if (value.empty())
+        throw std::runtime_error("--jit-cache needs a directory");
+      options.jitCache = value;
+    } else if (flag == "--sweep") {
+      if (value.empty())
+        throw std::runtime_error("--sweep needs a @quantum function name");
+      options.sweep = value;
+    } else if (flag == "--bindings") {
+      if (value.empty())
+        throw std::runtime_error("--bindings needs a file");
+      options.bindings = value;
+    } else if (flag == "--gradient") {
+      requireNoValue(flag, eq);
+      options.gradient = true;
+    } else if (flag == "--stats") {
+      if (value.empty() && eq == std::string_view::npos)
+        options.stats = StatsFormat::Text;
+      else if (value == "json")
+        options.stats = StatsFormat::Json;
+      else
+        throw std::runtime_error("Invalid value for --stats: '" +
+                                 std::string(value) + "'");
+    } else if (flag == "--trace") {
+      if (value.empty())
+        throw std::runtime_error("--trace needs a file");
+      options.trace = value;
+    } else {
+      throw std::runtime_error("Unknown option: " + std::string(flag));
+    }
+  }
+
+  if (options.inputPath.empty()) {
+    throw std::runtime_error("No input file given");
+  }
+  if (options.run && !options.sweep.empty()) {
+    throw std::runtime_error("--sweep cannot be combined with --run");
+  }
+  if (execGiven && !options.run) {
+    throw std::runtime_error("--exec needs --run");
+  }
+  if (!options.jitCache.empty() && options.exec != ExecMode::Native) {
+    throw std::runtime_error("--jit-cache needs --exec=native");
+  }
+  if (options.simulator.ranks > 1 &&
+      !options.simulator.outOfCore.directory.empty()) {
+    throw std::runtime_error("--ranks cannot be combined with --out-of-core");
+  }
+  if (options.simulator.ranks > 1 && options.run) {
+    throw std::runtime_error("--ranks cannot be combined with --run");
+  }
+  if (options.gradient && options.sweep.empty()) {
+    throw std::runtime_error("--gradient needs --sweep");
+  }
+
+  if (!seedGiven) {
+    std::random_device device;
+    options.simulator.seed = (uint64_t(device()) << 32) | device();
+  }
+
+  return options;
+}
+
+std::vector<std::vector<double>> readBindings(std::istream &in) {
+  std::vector<std::vector<double>> bindings;
+  std::string line;
+  for (size_t number = 1; std::getline(in, line); ++number) {
+    line = line.substr(0, line.find('#'));
+    std::vector<double> values;
+    size_t pos = 0;
+    while (true) {
+      pos = line.find_first_not_of(" \t\r,", pos);
+      if (pos == std::string::npos)
+        break;
+      size_t end = line.find_first_of(" \t\r,", pos);
+      std::string_view text(line.data() + pos,
+                            (end == std::string::npos ? line.size() : end) -
+                                pos);
+      double value = 0;
+      auto [stop, ec] =
+          std::from_chars(text.data(), text.data() + text.size(), value);
+      if (ec != std::errc() || stop != text.data() + text.size()) {
+        throw std::runtime_error("Invalid value '" + std::string(text) +
+                                 "' in bindings, line " +
+                                 std::to_string(number));
+      }
+      values.push_back(value);
+      pos = end;
+    }
+    if (!values.empty())
+      bindings.push_back(std::move(values));
+  }
+  return bindings;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "sim/simulator.hpp"
+
+// How --run executes classical code
+enum class ExecMode { Vm, Native };
+
+// What --stats prints, on stderr
+enum class StatsFormat { None, Text, Json };
+
+struct Options {
+  std::string inputPath;
+  SimulatorOptions simulator; // seed is random unless --seed is given
+  bool fidelityCheck = false;
+  bool layout = false; // run the qubit layout pass before simulating
+  size_t unrollLimit = 4096; // most copies of a @quantum loop body
+  size_t inlineLimit = 16;   // largest @quantum body inlined, in statements
+  bool run = false;    // compile and run the program instead of listing it
+  ExecMode exec = ExecMode::Vm;
+  std::string jitCache; // --exec=native only
+  std::string sweep;    // @quantum function simulated once per binding
+  std::string bindings = "-"; // where --sweep reads them; "-" is stdin
+  bool gradient = false; // --sweep also reports d<expect>/d(parameter)
+  StatsFormat stats = StatsFormat::None;
+  std::string trace; // file the --trace timeline is written to
+};
+
+// Parses `quanta <input.qt> [--flag=value ...]`. Throws std::runtime_error
+// on unknown flags or malformed values.
+Options parseOptions(int argc, char **argv);
+
+// Reads the parameter values for --sweep: one binding per line, values
+// separated by spaces or commas. Blank lines and `#` comments are skipped.
+// Throws std::runtime_error on a value that is not a number.
+std::vector<std::vector<double>> readBindings(std::istream &in);
@@ -0,0 +1,121 @@
+#include "code_buffer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// The chunk to append to, starting a new one when the last is full
+CodeBuffer::Chunk &CodeBuffer::writable() {
+  if (active > 0 && chunks[active - 1].size < kChunkSize)
+    return chunks[active - 1];
+  if (sink >= 0 && active == maxChunks)
+    flush();
+  if (active == chunks.size())
+    chunks.push_back({std::make_unique<char[]>(kChunkSize), 0});
+  chunks[active].size = 0;
+  return chunks[active++];
+}
+
+CodeBuffer &CodeBuffer::operator<<(std::string_view text) {
+  bytes += text.size();
+  while (!text.empty()) {
+    Chunk &chunk = writable();
+    size_t n = std::min(text.size(), kChunkSize - chunk.size);
+    std::memcpy(chunk.data.get() + chunk.size, text.data(), n);
+    chunk.size += n;
+    text.remove_prefix(n);
+  }
+  return *this;
+}
+
+CodeBuffer &CodeBuffer::operator<<(double value) {
+  char text[32];
+  auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+  return *this << std::string_view(text, end - text);
+}
+
+CodeBuffer &CodeBuffer::operator<<(CodeBuffer &&part) {
+  // Short parts are cheaper to copy than to leave a mostly empty chunk
+  // behind in the list
+  if (part.bytes < kChunkSize / 2) {
+    for (size_t k = 0; k < part.active; ++k)
+      *this << std::string_view(part.chunks[k].data.get(),
+                                part.chunks[k].size);
+  } else if (sink >= 0) {
+    // Streaming: the part goes out right after what is buffered
+    flush();
+    part.writeTo(sink);
+    bytes += part.bytes;
+  } else {
+    chunks.insert(chunks.begin() + active,
+                  std::make_move_iterator(part.chunks.begin()),
+                  std::make_move_iterator(part.chunks.begin() + part.active));
+    active += part.active;
+    bytes += part.bytes;
+  }
+  part.chunks.clear();
+  part.active = 0;
+  part.bytes = 0;
+  return *this;
+}
+
+std::string CodeBuffer::str() const {
+  std::string text;
+  for (size_t k = 0; k < active; ++k)
+    text.append(chunks[k].data.get(), chunks[k].size);
+  return text;
+}
+
+void CodeBuffer::writeTo(int fd) const {
+  std::vector<iovec> pending;
+  pending.reserve(active);
+  for (size_t k = 0; k < active; ++k) {
+    if (chunks[k].size > 0)
+      pending.push_back({chunks[k].data.get(), chunks[k].size});
+  }
+
+  size_t first = 0;
+  while (first < pending.size()) {
+    int count = static_cast<int>(std::min<size_t>(pending.size() - first,
+                                                  IOV_MAX));
+    ssize_t written = writev(fd, pending.data() + first, count);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("Failed to write output: ") +
+                               std::strerror(errno));
+    }
+    // Skip what went out; a short write leaves part of one chunk
+    size_t left = static_cast<size_t>(written);
+    while (first < pending.size() && left >= pending[first].iov_len)
+      left -= pending[first++].iov_len;
+    if (left > 0) {
+      pending[first].iov_base =
+          static_cast<char *>(pending[first].iov_base) + left;
+      pending[first].iov_len -= left;
+    }
+  }
+}
+
+void CodeBuffer::setSink(int fd, size_t maxChunks) {
+  sink = fd;
+  this->maxChunks = std::max<size_t>(maxChunks, 1);
+}
+
+void CodeBuffer::flush() {
+  if (sink < 0)
+    return;
+  writeTo(sink);
+  active = 0;
+  // Chunks taken over before the sink was set are not all kept for reuse
+  if (chunks.size() > maxChunks)
+    chunks.resize(maxChunks);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Output buffer for the code generators. Text is appended to a list of
+// fixed-size chunks, so the buffer grows without ever copying what it
+// already holds, and numbers are formatted with std::to_chars instead of
+// going through a stream and its locale. The chunks are handed to the
+// kernel with writev(), in place.
+//
+// With a sink attached the buffer streams: once `maxChunks` chunks are
+// full they are written to the sink and reused, so memory stays bounded
+// however much is emitted and a reader can start before generation ends.
+class CodeBuffer {
+public:
+  static constexpr size_t kChunkSize = size_t{64} << 10;
+  static constexpr size_t kStreamChunks = 16; // 1 MiB in flight
+
+  CodeBuffer() = default;
+  CodeBuffer(const CodeBuffer &) = delete;
+  CodeBuffer &operator=(const CodeBuffer &) = delete;
+  CodeBuffer(CodeBuffer &&) = default;
+  CodeBuffer &operator=(CodeBuffer &&) = default;
+
+  // Appends the text of `part`, taking over its chunks rather than
+  // copying them when it is large, or when streaming writing them straight
+  // to the sink; `part` is left empty. Used to join buffers filled on
+  // different threads.
+  CodeBuffer &operator<<(CodeBuffer &&part);
+
+  CodeBuffer &operator<<(std::string_view text);
+  CodeBuffer &operator<<(const char *text) {
+    return *this << std::string_view(text);
+  }
+  CodeBuffer &operator<<(const std::string &text) {
+    return *this << std::string_view(text);
+  }
+  CodeBuffer &operator<<(char c) { return *this << std::string_view(&c, 1); }
+
+  template <typename Int,
+            std::enable_if_t<std::is_integral_v<Int> &&
+                                 !std::is_same_v<Int, bool> &&
+                                 !std::is_same_v<Int, char>,
+                             int> = 0>
+  CodeBuffer &operator<<(Int value) {
+    char text[24];
+    auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+    return *this << std::string_view(text, end - text);
+  }
+
+  // Shortest text that reads back as the same double
+  CodeBuffer &operator<<(double value);
+
+  // Bytes emitted so far, streamed ones included
+  size_t size() const { return bytes; }
+  // What is still buffered: everything, unless a sink is attached
+  std::string str() const;
+
+  // Writes the buffered text to `fd`, retrying short writes; throws
+  // std::runtime_error if the descriptor fails
+  void writeTo(int fd) const;
+
+  // Streams to `fd` from now on; the caller keeps ownership of it
+  void setSink(int fd, size_t maxChunks = kStreamChunks);
+  // Writes whatever is buffered to the sink
+  void flush();
+
+private:
+  struct Chunk {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+  };
+  std::vector<Chunk> chunks; // the first `active` hold text
+  size_t active = 0;
+  size_t bytes = 0;
+  int sink = -1;
+  size_t maxChunks = 0;
+
+  Chunk &writable();
+};
@@ -1,17 +1,103 @@
 #include "ast/ast.hpp"
 #include "cppgen.hpp"
+#include "parallel.hpp"
+#include "profile/trace.hpp"
+#include "runtime/abi.hpp"
+
+std::string CppGenerator::str() const { return out.str(); }
 
 void CppGenerator::visit(Program &node) {
   out << "#include <iostream>\n#include <string>\n\n";
+  out << "using bit = bool;\n\n";
+
+  // Built with -DQUANTA_JIT, @quantum calls go back to the driver's
+  // simulator (see runtime/abi.hpp)
+  out << "#ifdef QUANTA_JIT\n";
+  out << "extern \"C\" { " << kRuntimeAbiSource << " }\n";
+  out << "static const QuantaRuntime *quanta_runtime__;\n\n";
+  for (auto &fn : node.functions)
+    if (fn->hasQuantumAnnotation)
+      emitQuantumStub(*fn);
+  out << "#endif\n\n";
+
+  // Classes and functions are generated independently, each by its own
+  // generator, and joined in source order
+  std::vector<ASTNode *> pieces;
   for (auto &cls : node.classes)
-    cls->accept(*this);
+    pieces.push_back(cls.get());
   for (auto &fn : node.functions)
     if (!fn->hasQuantumAnnotation)
-      fn->accept(*this);
-  out << "\nint main() { return main__(); }\n";
+      pieces.push_back(fn.get());
+  emitInOrder(out, pieces.size(), [&](size_t i, CodeBuffer &part) {
+    CppGenerator gen;
+    pieces[i]->accept(gen);
+    part << std::move(gen.out);
+  });
+
+  out << "\n#ifdef QUANTA_JIT\n";
+  out << "extern \"C\" int " << kRuntimeEntryPoint
+      << "(const QuantaRuntime *runtime) {\n";
+  out << "  quanta_runtime__ = runtime;\n  return main__();\n}\n";
+  out << "#else\n";
+  out << "int main() { return main__(); }\n";
+  out << "#endif\n";
+}
+
+void CppGenerator::emitQuantumStub(FunctionDeclaration &node) {
+  // Qubits cannot cross into classical code, so only functions with
+  // classical parameters get a stub
+  for (auto &param : node.params) {
+    auto *pt = dynamic_cast<PrimitiveType *>(param->type.get());
+    if (!pt || pt->name == "qubit")
+      return;
+  }
+
+  std::string ret = "void";
+  if (auto *pt = dynamic_cast<PrimitiveType *>(node.returnType.get()))
+    ret = pt->name;
+
+  out << ret << " " << node.name << "(";
+  for (size_t i = 0; i < node.params.size(); ++i) {
+    node.params[i]->accept(*this);
+    if (i + 1 < node.params.size())
+      out << ", ";
+  }
+  out << ") {\n";
+  out << "  const double args[] = {";
+  for (size_t i = 0; i < node.params.size(); ++i)
+    out << "double(" << node.params[i]->name << "), ";
+  out << "0.0};\n";
+  out << "  ";
+  if (ret != "void")
+    out << "return static_cast<" << ret << ">(";
+  out << "quanta_runtime__->callQuantum(quanta_runtime__->context, \""
+      << node.name << "\", args, " << node.params.size() << ")";
+  if (ret != "void")
+    out << ")";
+  out << ";\n}\n\n";
+
+  // f.gradient(k, args...), for functions returning expect(); the runtime
+  // rejects any other float function
+  if (ret != "float")
+    return;
+  out << "float " << node.name << "__gradient(int parameter__";
+  for (auto &param : node.params) {
+    out << ", ";
+    param->accept(*this);
+  }
+  out << ") {\n";
+  out << "  const double args[] = {";
+  for (size_t i = 0; i < node.params.size(); ++i)
+    out << "double(" << node.params[i]->name << "), ";
+  out << "0.0};\n";
+  out << "  return static_cast<float>(quanta_runtime__->gradientQuantum("
+         "quanta_runtime__->context, \""
+      << node.name << "\", args, " << node.params.size()
+      << ", parameter__));\n}\n\n";
 }
 
 void CppGenerator::visit(FunctionDeclaration &node) {
+  TraceSpan span("cppgen", node.name);
   std::string ret = "void";
   if (auto *pt = dynamic_cast<PrimitiveType *>(node.returnType.get()))
     ret = pt->name;
@@ -29,6 +115,7 @@ void CppGenerator::visit(FunctionDeclaration &node) {
 }
 
 void CppGenerator::visit(ClassDeclaration &node) {
+  TraceSpan span("cppgen", node.name);
   out << "class " << node.name << " {\npublic:\n";
   for (auto &var : node.members)
     var->accept(*this);
@@ -60,7 +147,15 @@ void CppGenerator::visit(ReturnStatement &node) {
 
 void CppGenerator::visit(BlockStatement &node) {
   for (auto &stmt : node.statements) {
-    stmt->accept(*this);
+    // The enclosing construct prints the braces of its own block; nested
+    // blocks (e.g. left by constant folding) need theirs to stay scoped
+    if (dynamic_cast<BlockStatement *>(stmt.get())) {
+      out << "  {\n";
+      stmt->accept(*this);
+      out << "  }\n";
+    } else {
+      stmt->accept(*this);
+    }
   }
 }
 
@@ -147,6 +242,19 @@ void CppGenerator::visit(CallExpression &node) {
         out << ", ";
     }
     out << ")";
+  } else if (auto *member =
+                 dynamic_cast<MemberAccessExpression *>(node.callee.get())) {
+    // f.gradient(k, args...) calls the stub emitted for @quantum f
+    auto *fn = dynamic_cast<VariableExpression *>(member->object.get());
+    if (!fn || member->member != "gradient")
+      return;
+    out << fn->name << "__gradient(";
+    for (size_t i = 0; i < node.arguments.size(); ++i) {
+      node.arguments[i]->accept(*this);
+      if (i + 1 < node.arguments.size())
+        out << ", ";
+    }
+    out << ")";
   }
 }
 
@@ -1,6 +1,6 @@
 #pragma once
+#include "code_buffer.hpp"
 #include "visitor_base.hpp"
-#include <sstream>
 
 // Forward declarations for C++-only nodes
 struct VariableDeclaration;
@@ -12,16 +12,19 @@ struct ConstructorCallExpression;
 struct MemberAccessExpression;
 struct IndexExpression;
 struct ParenthesizedExpression;
+struct AssignmentExpression;
 struct PrimitiveType;
 struct ObjectType;
 struct VoidType;
 struct ArrayType;
+struct LogicalType;
 struct AnnotationNode;
 struct Parameter;
 
 class CppGenerator : public BaseCodegenVisitor {
 public:
   std::string str() const;
+  CodeBuffer &code() { return out; }
 
   // Common visitor implementations
   void visit(Program &) override;
@@ -46,13 +49,18 @@ public:
   void visit(MemberAccessExpression &);
   void visit(IndexExpression &);
   void visit(ParenthesizedExpression &);
+  void visit(AssignmentExpression &);
   void visit(PrimitiveType &);
   void visit(ObjectType &);
   void visit(VoidType &);
   void visit(ArrayType &);
+  void visit(LogicalType &);
   void visit(AnnotationNode &);
   void visit(Parameter &);
 
 private:
-  std::ostringstream output;
+  CodeBuffer out;
+
+  // Body of a @quantum function for JIT builds: forwards to the runtime
+  void emitQuantumStub(FunctionDeclaration &node);
 };
@@ -2,25 +2,50 @@
 #include "driver.hpp"
 #include "cppgen.hpp"
 #include "oqasmgen.hpp"
+#include "ir/lower.hpp"
+#include "opt/cancel.hpp"
+#include "opt/lightcone.hpp"
+#include "opt/regalloc.hpp"
 
-#include <fstream>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
 
-void CodegenDriver::generate(const Program &program, const std::string &backend,
+void CodegenDriver::generate(Program &program, const std::string &backend,
                              const std::string &outputPath) {
-  std::ofstream out(outputPath);
-  if (!out.is_open()) {
+  if (backend != "cpp" && backend != "qasm")
+    throw std::runtime_error("Unsupported backend: " + backend);
+
+  // "-" is standard output, which may be a pipe into the next tool
+  const bool toStdout = outputPath == "-";
+  int fd = toStdout ? STDOUT_FILENO
+                    : open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                           0644);
+  if (fd < 0) {
     throw std::runtime_error("Failed to open output file: " + outputPath);
   }
 
-  if (backend == "cpp") {
-    CppGenerator gen;
-    program.accept(gen);
-    out << gen.str();
-  } else if (backend == "qasm") {
-    QasmGenerator gen;
-    program.accept(gen);
-    out << gen.str();
-  } else {
-    throw std::runtime_error("Unsupported backend: " + backend);
+  // Generators stream as they traverse: the output never sits in memory
+  // whole. The circuit for OpenQASM does, since its passes need every gate
+  try {
+    if (backend == "cpp") {
+      CppGenerator gen;
+      gen.code().setSink(fd);
+      program.accept(gen);
+      gen.code().flush();
+    } else {
+      Circuit circuit =
+          allocateQubits(pruneLightCone(cancelGates(lowerProgram(program))));
+      QasmGenerator gen(circuit);
+      gen.code().setSink(fd);
+      program.accept(gen);
+      gen.code().flush();
+    }
+  } catch (...) {
+    if (!toStdout)
+      close(fd);
+    throw;
   }
+  if (!toStdout && close(fd) != 0)
+    throw std::runtime_error("Failed to write output file: " + outputPath);
 }
@@ -7,6 +7,8 @@
 
 class CodegenDriver {
 public:
-  static void generate(const Program &program, const std::string &backend,
+  // Streams the `backend` ("cpp" or "qasm") listing of `program` into
+  // `outputFile`, or to standard output when it is "-"
+  static void generate(Program &program, const std::string &backend,
                        const std::string &outputFile);
 };
@@ -1,89 +1,297 @@
 #include "oqasmgen.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <stdexcept>
+
 #include "ast/ast.hpp"
+#include "ir/lower.hpp"
+#include "parallel.hpp"
+#include "profile/trace.hpp"
 
-void QasmGenerator::visit(Program &node) {
-  out << "OPENQASM 3.0;\n";
-  out << "include \"stdgates.inc\";\n";
+namespace {
+
+// Gates per piece when the circuit listing is generated in parallel
+constexpr size_t kGatesPerPiece = size_t{1} << 14;
+
+void emitRegisters(CodeBuffer &out, const Circuit &circuit) {
+  if (circuit.numQubits > 0)
+    out << "qubit[" << circuit.numQubits << "] q;\n";
+  if (!circuit.bitNames.empty())
+    out << "bit[" << circuit.bitNames.size() << "] c;\n";
+}
+
+// QASM qubits start in |0>: prepare the others with the shortest gate
+// sequence reaching them
+void emitPreparations(CodeBuffer &out, const Circuit &circuit) {
+  for (unsigned q = 0; q < circuit.numQubits; ++q) {
+    for (GateKind kind : preparation(circuit.initialStates[q]))
+      out << gateName(kind) << " q[" << q << "];\n";
+  }
+}
+
+// Angle node `index` of `tmpl` as an expression over its inputs
+void emitAngle(CodeBuffer &out, const CircuitTemplate &tmpl, unsigned index) {
+  const AngleNode &node = tmpl.nodes[index];
+  switch (node.op) {
+  case AngleNode::Op::Parameter:
+    out << tmpl.parameters[node.index];
+    return;
+  case AngleNode::Op::Constant:
+    out << node.value;
+    return;
+  case AngleNode::Op::Negate:
+    out << "(-";
+    emitAngle(out, tmpl, node.left);
+    out << ")";
+    return;
+  default:
+    break;
+  }
+  const char *op = node.op == AngleNode::Op::Add        ? " + "
+                   : node.op == AngleNode::Op::Subtract ? " - "
+                   : node.op == AngleNode::Op::Multiply ? " * "
+                                                        : " / ";
+  out << "(";
+  emitAngle(out, tmpl, node.left);
+  out << op;
+  emitAngle(out, tmpl, node.right);
+  out << ")";
+}
+
+// Names inside a def: qubits are the parameters they stand for and bits
+// go to a register of the def's own
+struct DefScope {
+  const Circuit &circuit;
+  std::string bits;
+};
+
+// Qubit `q`: an element of the register `q`, or in a def the parameter it
+// stands for
+void emitQubit(CodeBuffer &out, unsigned q, const DefScope *def) {
+  if (def)
+    out << def->circuit.qubitNames[q];
+  else
+    out << "q[" << q << "]";
+}
+
+void emitGate(CodeBuffer &out, const Gate &gate,
+              const CircuitTemplate *tmpl = nullptr,
+              const DefScope *def = nullptr) {
+  if (gate.kind == GateKind::Measure) {
+    out << (def ? def->bits : "c") << "[" << gate.bit << "] = measure ";
+    emitQubit(out, gate.qubits[0], def);
+    out << ";\n";
+    return;
+  }
+  out << gateName(gate.kind);
+  if (isParameterised(gate.kind)) {
+    out << "(";
+    if (tmpl && gate.angleNode >= 0)
+      emitAngle(out, *tmpl, static_cast<unsigned>(gate.angleNode));
+    else
+      out << gate.angle;
+    out << ")";
+  }
+  out << " ";
+  emitQubit(out, gate.qubits[0], def);
+  if (arity(gate.kind) == 2) {
+    out << ", ";
+    emitQubit(out, gate.qubits[1], def);
+  }
+  out << ";\n";
+}
 
-  // Count total qubits
-  for (const auto &stmt : node.statements) {
-    if (auto *decl = dynamic_cast<VariableDeclaration *>(stmt.get())) {
-      if (auto *type = dynamic_cast<PrimitiveType *>(decl->varType.get())) {
-        if (type->name == "qubit") {
-          qubitCount++;
-        }
+// OpenQASM has no expectation values: observables are listed as comments
+// over the final register
+void emitObservables(CodeBuffer &out, const Circuit &circuit,
+                     const DefScope *def = nullptr) {
+  for (const auto &observable : circuit.observables) {
+    out << (def ? "  " : "") << "// expect " << observable.name << " =";
+    for (size_t t = 0; t < observable.terms.size(); ++t) {
+      const PauliTerm &term = observable.terms[t];
+      double coefficient = term.coefficient;
+      if (t == 0)
+        out << " " << coefficient;
+      else
+        out << (coefficient < 0 ? " - " : " + ") << std::abs(coefficient);
+      for (const auto &[qubit, pauli] : term.factors) {
+        out << " " << (pauli == Pauli::X   ? "X"
+                       : pauli == Pauli::Y ? "Y"
+                                           : "Z")
+            << "(";
+        emitQubit(out, qubit, def);
+        out << ")";
       }
     }
+    out << "\n";
   }
+}
+
+// The OpenQASM type of a classical parameter, null if it has none
+const char *qasmType(const Type *type) {
+  auto *pt = dynamic_cast<const PrimitiveType *>(type);
+  if (!pt)
+    return nullptr;
+  if (pt->name == "float")
+    return "float[64]";
+  if (pt->name == "int")
+    return "int[32]";
+  if (pt->name == "bit")
+    return "bit";
+  if (pt->name == "bool")
+    return "bool";
+  return nullptr;
+}
+
+bool isQubitType(const Type *type) {
+  if (auto at = dynamic_cast<const ArrayType *>(type))
+    type = at->elementType.get();
+  auto *pt = dynamic_cast<const PrimitiveType *>(type);
+  return pt && pt->name == "qubit";
+}
 
-  if (qubitCount > 0) {
-    out << "qubit[" << qubitCount << "] q;\n";
+// OpenQASM sizes every array parameter of a subroutine
+const Parameter *unsizedArrayParameter(const FunctionDeclaration &func) {
+  for (const auto &param : func.params) {
+    auto *at = dynamic_cast<const ArrayType *>(param->type.get());
+    if (at && !at->size)
+      return param.get();
   }
+  return nullptr;
+}
+
+} // namespace
+
+std::string QasmGenerator::str() const { return out.str(); }
+
+void QasmGenerator::visit(Program &node) {
+  out << "OPENQASM 3.0;\n";
+  out << "include \"stdgates.inc\";\n";
 
+  emitRegisters(out, circuit);
+
+  std::vector<FunctionDeclaration *> quantum;
   for (const auto &func : node.functions) {
     if (func->hasQuantumAnnotation) {
-      func->accept(*this);
+      quantum.push_back(func.get());
     }
   }
+  program = &node;
+  emitInOrder(out, quantum.size(), [&](size_t i, CodeBuffer &part) {
+    QasmGenerator gen(circuit);
+    gen.program = &node;
+    quantum[i]->accept(gen);
+    part << std::move(gen.out);
+  });
+
+  emitCircuit();
+}
+
+void QasmGenerator::emitCircuit() {
+  if (circuit.numQubits == 0)
+    return;
+  out << "\n";
+  emitPreparations(out, circuit);
+
+  const auto &gates = circuit.gates;
+  size_t pieces = (gates.size() + kGatesPerPiece - 1) / kGatesPerPiece;
+  emitInOrder(out, pieces, [&](size_t i, CodeBuffer &part) {
+    TraceSpan span("qasmgen", "gates", "piece", static_cast<int64_t>(i));
+    size_t end = std::min(gates.size(), (i + 1) * kGatesPerPiece);
+    for (size_t g = i * kGatesPerPiece; g < end; ++g)
+      emitGate(part, gates[g]);
+  });
+  emitObservables(out, circuit);
 }
 
 void QasmGenerator::visit(FunctionDeclaration &node) {
-  out << "\ndef " << node.name << "(";
-  for (size_t i = 0; i < node.params.size(); ++i) {
-    auto &param = node.params[i];
-    if (auto *pt = dynamic_cast<PrimitiveType *>(param->type.get())) {
-      if (pt->name == "qubit") {
-        out << "qubit " << param->name;
-        if (i + 1 < node.params.size())
-          out << ", ";
-      }
+  TraceSpan span("qasmgen", node.name);
+  // Each call is expanded in the circuit, with the size of its argument
+  if (auto *param = unsizedArrayParameter(node)) {
+    out << "\n// " << node.name << " is expanded inline: its parameter "
+        << param->name << " has no size\n";
+    return;
+  }
+  for (const auto &param : node.params) {
+    if (!isQubitType(param->type.get()) && !qasmType(param->type.get())) {
+      out << "\n// " << node.name << " is expanded inline: its parameter "
+          << param->name << " has no OpenQASM type\n";
+      return;
     }
   }
-  out << ") {\n";
-  if (node.body)
-    node.body->accept(*this);
-  out << "}\n";
-}
 
-void QasmGenerator::visit(ReturnStatement &node) {
-  out << "  // return ";
-  if (node.value) {
-    node.value->accept(*this);
+  // The body is listed as lowered, with the functions it calls expanded
+  std::optional<LoweredSubroutine> def;
+  try {
+    def = lowerSubroutine(*program, node.name);
+  } catch (const std::runtime_error &) {
+  }
+  if (!def) {
+    out << "\n// " << node.name
+        << " is expanded inline: it does not lower on its own\n";
+    return;
+  }
+  const CircuitTemplate &body = def->body;
+  if (body.circuit.numQubits > def->parameterQubits) {
+    out << "\n// " << node.name
+        << " is expanded inline: a def cannot declare qubits\n";
+    return;
   }
-  out << "\n";
-}
 
-void QasmGenerator::visit(BlockStatement &node) {
-  for (const auto &stmt : node.statements) {
-    stmt->accept(*this);
+  out << "\ndef " << node.name << "(";
+  for (size_t i = 0; i < node.params.size(); ++i) {
+    const auto &param = node.params[i];
+    if (i > 0)
+      out << ", ";
+    if (auto *at = dynamic_cast<ArrayType *>(param->type.get())) {
+      out << "qubit[";
+      at->size->accept(*this);
+      out << "]";
+    } else if (isQubitType(param->type.get())) {
+      out << "qubit";
+    } else {
+      out << qasmType(param->type.get());
+    }
+    out << " " << param->name;
   }
-}
+  out << ")" << (body.result ? " -> bit" : "") << " {\n";
 
-void QasmGenerator::visit(ExpressionStatement &node) {
-  if (node.expression) {
+  // The def's bits, named apart from its parameters and the register c
+  DefScope scope{body.circuit, "m"};
+  auto isParameter = [&](const std::string &name) {
+    return std::any_of(node.params.begin(), node.params.end(),
+                       [&](const auto &param) { return param->name == name; });
+  };
+  while (isParameter(scope.bits))
+    scope.bits += "_";
+  if (!body.circuit.bitNames.empty()) {
+    out << "  bit[" << body.circuit.bitNames.size() << "] " << scope.bits
+        << ";\n";
+  }
+  for (const auto &gate : body.circuit.gates) {
     out << "  ";
-    node.expression->accept(*this);
-    out << ";\n";
+    emitGate(out, gate, &body, &scope);
   }
+  emitObservables(out, body.circuit, &scope);
+  if (body.result)
+    out << "  return " << scope.bits << "[" << *body.result << "];\n";
+  out << "}\n";
 }
 
-void QasmGenerator::visit(MeasureStatement &node) {
-  if (auto *ve = dynamic_cast<VariableExpression *>(node.qubit.get())) {
-    out << "  bit result = measure " << ve->name << ";\n";
-  }
-}
+// Function bodies are listed from their lowered circuits; of the AST
+// only the sizes of array parameters are printed
 
-void QasmGenerator::visit(ResetStatement &node) {
-  if (auto *ve = dynamic_cast<VariableExpression *>(node.target.get())) {
-    out << "  reset " << ve->name << ";\n";
-  }
-}
+void QasmGenerator::visit(BlockStatement &) {}
 
-void QasmGenerator::visit(AssignmentStatement &node) {
-  out << "  " << node.name << " = ";
-  node.value->accept(*this);
-  out << ";\n";
-}
+void QasmGenerator::visit(ReturnStatement &) {}
+
+void QasmGenerator::visit(ExpressionStatement &) {}
+
+void QasmGenerator::visit(AssignmentStatement &) {}
+
+void QasmGenerator::visit(CallExpression &) {}
 
 void QasmGenerator::visit(BinaryExpression &node) {
   out << "(";
@@ -103,24 +311,15 @@ void QasmGenerator::visit(LiteralExpression &node) { out << node.value; }
 
 void QasmGenerator::visit(VariableExpression &node) { out << node.name; }
 
-void QasmGenerator::visit(CallExpression &node) {
-  if (auto *callee = dynamic_cast<VariableExpression *>(node.callee.get())) {
-    out << "  " << callee->name << "(";
-    for (size_t i = 0; i < node.arguments.size(); ++i) {
-      node.arguments[i]->accept(*this);
-      if (i + 1 < node.arguments.size())
-        out << ", ";
-    }
-    out << ");\n";
-  }
-}
-
-void QasmGenerator::visit(MeasureExpression &node) {
-  out << "measure ";
-  node.qubit->accept(*this);
-}
-
-void QasmGenerator::visit(AssignmentExpression &node) {
-  out << node.name << " = ";
-  node.value->accept(*this);
+void emitQasmTemplate(const CircuitTemplate &tmpl, CodeBuffer &out) {
+  out << "OPENQASM 3.0;\n";
+  out << "include \"stdgates.inc\";\n";
+  for (const auto &param : tmpl.parameters)
+    out << "input float[64] " << param << ";\n";
+  emitRegisters(out, tmpl.circuit);
+  out << "\n";
+  emitPreparations(out, tmpl.circuit);
+  for (const auto &gate : tmpl.circuit.gates)
+    emitGate(out, gate, &tmpl);
+  emitObservables(out, tmpl.circuit);
 }
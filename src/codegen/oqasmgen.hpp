@@ -1,21 +1,22 @@
 #pragma once
+#include "code_buffer.hpp"
+#include "ir/circuit.hpp"
+#include "ir/template.hpp"
 #include "visitor_base.hpp"
-#include <sstream>
-
-// Forward declarations for QASM-only nodes
-struct MeasureStatement;
-struct ResetStatement;
-struct MeasureExpression;
-struct AnnotationNode;
-struct Parameter;
-struct PrimitiveType;
-struct ArrayType;
-struct VoidType;
-struct LogicalType;
 
+// Emits the @quantum functions as OpenQASM subroutines, each as lowered on
+// its own, followed by the program itself: `circuit`, the lowered top
+// level with its qubits already allocated to the physical register `q`
+// (see opt/regalloc.hpp) and its measurements writing the bit register
+// `c`. A function no subroutine can express, one declaring qubits say, is
+// named in a comment instead; its calls are expanded in the circuit like
+// all others.
 class QasmGenerator : public BaseCodegenVisitor {
 public:
+  explicit QasmGenerator(const Circuit &circuit) : circuit(circuit) {}
+
   std::string str() const;
+  CodeBuffer &code() { return out; }
 
   // Common visitor implementations
   void visit(Program &) override;
@@ -30,17 +31,15 @@ public:
   void visit(VariableExpression &) override;
   void visit(CallExpression &) override;
 
-  // QASM-specific extensions
-  void visit(MeasureStatement &);
-  void visit(ResetStatement &);
-  void visit(MeasureExpression &);
-  void visit(AnnotationNode &);
-  void visit(Parameter &);
-  void visit(PrimitiveType &);
-  void visit(ArrayType &);
-  void visit(VoidType &);
-  void visit(LogicalType &);
-
 private:
-  std::ostringstream output;
+  const Circuit &circuit;
+  const Program *program = nullptr; // whose functions are lowered as defs
+  CodeBuffer out;
+
+  void emitCircuit();
 };
+
+// Emits `tmpl` as a program of its own whose parameters are `input float`
+// declarations and whose angles are expressions over them, so one listing
+// serves every binding
+void emitQasmTemplate(const CircuitTemplate &tmpl, CodeBuffer &out);
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "code_buffer.hpp"
+
+// Generates `count` independent pieces of code on a pool of threads and
+// appends them to `out` in index order, so the text is byte-identical to
+// emitting them one after another on one thread.
+//
+// `emit(i, part)` writes piece `i` to `part` and may only read shared
+// state. Pieces are appended as soon as all earlier ones are done, and at
+// most a few per thread are generated ahead of that point, so a streaming
+// `out` stays bounded in memory. An exception thrown by `emit` is rethrown
+// here once the workers have stopped; the pieces before it are already
+// appended. `threads` defaults to one per hardware thread.
+template <typename Emit>
+void emitInOrder(CodeBuffer &out, size_t count, Emit emit,
+                 size_t threads = std::thread::hardware_concurrency()) {
+  // Below this many pieces starting threads costs more than it saves
+  constexpr size_t kMinParallel = 4;
+
+  threads = std::min(threads, count);
+  if (count < kMinParallel || threads < 2) {
+    for (size_t i = 0; i < count; ++i)
+      emit(i, out);
+    return;
+  }
+
+  // Piece i lives in slot i % window until it is appended
+  const size_t window = 4 * threads;
+  std::vector<CodeBuffer> parts(window);
+  std::vector<std::exception_ptr> errors(window);
+  std::vector<char> ready(window, 0);
+  size_t next = 0;     // next piece to hand out
+  size_t appended = 0; // pieces already in `out`
+  bool stop = false;
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  auto work = [&] {
+    for (;;) {
+      size_t i;
+      {
+        std::unique_lock lock(mutex);
+        changed.wait(lock, [&] {
+          return stop || next == count || next < appended + window;
+        });
+        if (stop || next == count)
+          return;
+        i = next++;
+      }
+      CodeBuffer part;
+      std::exception_ptr error;
+      try {
+        emit(i, part);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      {
+        std::lock_guard lock(mutex);
+        parts[i % window] = std::move(part);
+        errors[i % window] = error;
+        ready[i % window] = 1;
+      }
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(threads);
+  for (size_t t = 0; t < threads; ++t)
+    pool.emplace_back(work);
+
+  std::exception_ptr error;
+  for (size_t i = 0; i < count && !error; ++i) {
+    CodeBuffer part;
+    {
+      std::unique_lock lock(mutex);
+      changed.wait(lock, [&] { return ready[i % window] != 0; });
+      error = errors[i % window];
+      part = std::move(parts[i % window]);
+      ready[i % window] = 0;
+      ++appended;
+    }
+    changed.notify_all();
+    if (error)
+      break;
+    try {
+      out << std::move(part);
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+
+  {
+    std::lock_guard lock(mutex);
+    stop = true;
+  }
+  changed.notify_all();
+  for (auto &thread : pool)
+    thread.join();
+  if (error)
+    std::rethrow_exception(error);
+}
@@ -14,6 +14,29 @@ struct LiteralExpression;
 struct VariableExpression;
 struct CallExpression;
 
+// Forward declarations for backend-specific nodes
+struct ImportStatement;
+struct VariableDeclaration;
+struct IfStatement;
+struct ForStatement;
+struct EchoStatement;
+struct ResetStatement;
+struct MeasureStatement;
+struct IndexExpression;
+struct ParenthesizedExpression;
+struct MeasureExpression;
+struct AssignmentExpression;
+struct ConstructorCallExpression;
+struct MemberAccessExpression;
+struct PrimitiveType;
+struct LogicalType;
+struct ArrayType;
+struct VoidType;
+struct ObjectType;
+struct Parameter;
+struct AnnotationNode;
+struct ClassDeclaration;
+
 struct BaseCodegenVisitor {
   virtual ~BaseCodegenVisitor() = default;
 
@@ -28,4 +51,27 @@ struct BaseCodegenVisitor {
   virtual void visit(LiteralExpression &) = 0;
   virtual void visit(VariableExpression &) = 0;
   virtual void visit(CallExpression &) = 0;
+
+  // Backend-specific nodes default to emitting nothing
+  virtual void visit(ImportStatement &) {}
+  virtual void visit(VariableDeclaration &) {}
+  virtual void visit(IfStatement &) {}
+  virtual void visit(ForStatement &) {}
+  virtual void visit(EchoStatement &) {}
+  virtual void visit(ResetStatement &) {}
+  virtual void visit(MeasureStatement &) {}
+  virtual void visit(IndexExpression &) {}
+  virtual void visit(ParenthesizedExpression &) {}
+  virtual void visit(MeasureExpression &) {}
+  virtual void visit(AssignmentExpression &) {}
+  virtual void visit(ConstructorCallExpression &) {}
+  virtual void visit(MemberAccessExpression &) {}
+  virtual void visit(PrimitiveType &) {}
+  virtual void visit(LogicalType &) {}
+  virtual void visit(ArrayType &) {}
+  virtual void visit(VoidType &) {}
+  virtual void visit(ObjectType &) {}
+  virtual void visit(Parameter &) {}
+  virtual void visit(AnnotationNode &) {}
+  virtual void visit(ClassDeclaration &) {}
 };
@@ -0,0 +1,377 @@
+#include "circuit.hpp"
+
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+
+unsigned Circuit::addQubit(const std::string &name, QubitState initial) {
+  qubitNames.push_back(name);
+  initialStates.push_back(initial);
+  return numQubits++;
+}
+
+bool Circuit::startsInZero() const {
+  for (QubitState state : initialStates) {
+    if (state != QubitState::Zero)
+      return false;
+  }
+  return true;
+}
+
+int Circuit::addBit(const std::string &name) {
+  bitNames.push_back(name);
+  return static_cast<int>(bitNames.size()) - 1;
+}
+
+void Observable::relabel(const std::vector<unsigned> &map) {
+  for (auto &term : terms) {
+    for (auto &factor : term.factors)
+      factor.first = map[factor.first];
+  }
+}
+
+std::optional<std::vector<PauliTerm>>
+parsePauliSum(std::string_view text, const std::vector<unsigned> &qubits) {
+  std::string compact;
+  for (char c : text) {
+    if (!std::isspace(static_cast<unsigned char>(c)) && c != '"')
+      compact += c;
+  }
+
+  std::vector<PauliTerm> terms;
+  size_t pos = 0;
+  while (pos < compact.size()) {
+    PauliTerm term;
+    if (compact[pos] == '+' || compact[pos] == '-') {
+      term.coefficient = compact[pos] == '-' ? -1.0 : 1.0;
+      ++pos;
+    } else if (!terms.empty()) {
+      return std::nullopt;
+    }
+
+    size_t start = pos;
+    while (pos < compact.size() &&
+           (std::isdigit(static_cast<unsigned char>(compact[pos])) ||
+            compact[pos] == '.'))
+      ++pos;
+    if (pos > start) {
+      double value = 0.0;
+      auto [end, ec] =
+          std::from_chars(compact.data() + start, compact.data() + pos, value);
+      if (ec != std::errc() || end != compact.data() + pos)
+        return std::nullopt;
+      term.coefficient *= value;
+      if (pos < compact.size() && compact[pos] == '*')
+        ++pos;
+    }
+
+    size_t k = 0;
+    for (; pos < compact.size(); ++pos, ++k) {
+      char letter = compact[pos];
+      if (letter != 'I' && letter != 'X' && letter != 'Y' && letter != 'Z')
+        break;
+      if (k == qubits.size())
+        return std::nullopt;
+      if (letter != 'I') {
+        Pauli pauli = letter == 'X'   ? Pauli::X
+                      : letter == 'Y' ? Pauli::Y
+                                      : Pauli::Z;
+        term.factors.emplace_back(qubits[k], pauli);
+      }
+    }
+    if (k != qubits.size())
+      return std::nullopt;
+    terms.push_back(std::move(term));
+  }
+  if (terms.empty())
+    return std::nullopt;
+  return terms;
+}
+
+int arity(GateKind kind) {
+  switch (kind) {
+  case GateKind::CX:
+  case GateKind::CY:
+  case GateKind::CZ:
+  case GateKind::CPhase:
+  case GateKind::Swap:
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+bool isParameterised(GateKind kind) {
+  return kind == GateKind::Rx || kind == GateKind::Ry ||
+         kind == GateKind::Rz || kind == GateKind::Phase ||
+         kind == GateKind::CPhase;
+}
+
+bool isUnitary(GateKind kind) {
+  return kind != GateKind::Measure && kind != GateKind::Reset;
+}
+
+GateClass gateClass(GateKind kind) {
+  switch (kind) {
+  case GateKind::Z:
+  case GateKind::S:
+  case GateKind::Sdg:
+  case GateKind::T:
+  case GateKind::Tdg:
+  case GateKind::Rz:
+  case GateKind::Phase:
+  case GateKind::CZ:
+  case GateKind::CPhase:
+    return GateClass::Diagonal;
+  case GateKind::X:
+  case GateKind::CX:
+  case GateKind::Swap:
+    return GateClass::Permutation;
+  case GateKind::CY:
+    return GateClass::Controlled;
+  default:
+    return GateClass::Dense;
+  }
+}
+
+std::optional<QubitState> qubitStateFromName(const std::string &name) {
+  static const std::unordered_map<std::string, QubitState> states = {
+      {"0", QubitState::Zero},  {"1", QubitState::One},
+      {"+", QubitState::Plus},  {"-", QubitState::Minus},
+      {"i", QubitState::PlusI}, {"-i", QubitState::MinusI}};
+
+  std::string bare = name;
+  if (bare.size() >= 2 && (bare.front() == '"' || bare.front() == '\''))
+    bare = bare.substr(1, bare.size() - 2);
+
+  auto it = states.find(bare);
+  if (it == states.end())
+    return std::nullopt;
+  return it->second;
+}
+
+const char *qubitStateName(QubitState state) {
+  switch (state) {
+  case QubitState::Zero:
+    return "0";
+  case QubitState::One:
+    return "1";
+  case QubitState::Plus:
+    return "+";
+  case QubitState::Minus:
+    return "-";
+  case QubitState::PlusI:
+    return "i";
+  case QubitState::MinusI:
+    return "-i";
+  }
+  return "?";
+}
+
+std::array<std::complex<double>, 2> qubitAmplitudes(QubitState state) {
+  const double r = 1.0 / std::sqrt(2.0);
+  const std::complex<double> i{0, 1};
+  switch (state) {
+  case QubitState::Zero:
+    return {1, 0};
+  case QubitState::One:
+    return {0, 1};
+  case QubitState::Plus:
+    return {r, r};
+  case QubitState::Minus:
+    return {r, -r};
+  case QubitState::PlusI:
+    return {r, i * r};
+  case QubitState::MinusI:
+    return {r, -i * r};
+  }
+  return {1, 0};
+}
+
+std::vector<GateKind> preparation(QubitState state) {
+  switch (state) {
+  case QubitState::Zero:
+    return {};
+  case QubitState::One:
+    return {GateKind::X};
+  case QubitState::Plus:
+    return {GateKind::H};
+  case QubitState::Minus:
+    return {GateKind::X, GateKind::H};
+  case QubitState::PlusI:
+    return {GateKind::H, GateKind::S};
+  case QubitState::MinusI:
+    return {GateKind::H, GateKind::Sdg};
+  }
+  return {};
+}
+
+Gate inverse(const Gate &gate) {
+  Gate result = gate;
+  switch (gate.kind) {
+  case GateKind::S:
+    result.kind = GateKind::Sdg;
+    break;
+  case GateKind::Sdg:
+    result.kind = GateKind::S;
+    break;
+  case GateKind::T:
+    result.kind = GateKind::Tdg;
+    break;
+  case GateKind::Tdg:
+    result.kind = GateKind::T;
+    break;
+  case GateKind::Measure:
+  case GateKind::Reset:
+    throw std::logic_error(std::string("Gate has no inverse: ") +
+                           gateName(gate.kind));
+  default:
+    // The rest are self-inverse or rotations
+    if (isParameterised(gate.kind))
+      result.angle = -gate.angle;
+    break;
+  }
+  return result;
+}
+
+const char *gateName(GateKind kind) {
+  switch (kind) {
+  case GateKind::H:
+    return "h";
+  case GateKind::X:
+    return "x";
+  case GateKind::Y:
+    return "y";
+  case GateKind::Z:
+    return "z";
+  case GateKind::S:
+    return "s";
+  case GateKind::Sdg:
+    return "sdg";
+  case GateKind::T:
+    return "t";
+  case GateKind::Tdg:
+    return "tdg";
+  case GateKind::Rx:
+    return "rx";
+  case GateKind::Ry:
+    return "ry";
+  case GateKind::Rz:
+    return "rz";
+  case GateKind::Phase:
+    return "p";
+  case GateKind::CX:
+    return "cx";
+  case GateKind::CY:
+    return "cy";
+  case GateKind::CZ:
+    return "cz";
+  case GateKind::CPhase:
+    return "cp";
+  case GateKind::Swap:
+    return "swap";
+  case GateKind::Measure:
+    return "measure";
+  case GateKind::Reset:
+    return "reset";
+  }
+  return "?";
+}
+
+std::optional<GateKind> gateFromName(const std::string &name) {
+  static const std::unordered_map<std::string, GateKind> gates = {
+      {"h", GateKind::H},     {"x", GateKind::X},       {"y", GateKind::Y},
+      {"z", GateKind::Z},     {"s", GateKind::S},       {"sdg", GateKind::Sdg},
+      {"t", GateKind::T},     {"tdg", GateKind::Tdg},   {"rx", GateKind::Rx},
+      {"ry", GateKind::Ry},   {"rz", GateKind::Rz},     {"p", GateKind::Phase},
+      {"cx", GateKind::CX},   {"cy", GateKind::CY},     {"cz", GateKind::CZ},
+      {"cp", GateKind::CPhase}, {"swap", GateKind::Swap}};
+
+  auto it = gates.find(name);
+  if (it == gates.end())
+    return std::nullopt;
+  return it->second;
+}
+
+Matrix2 gateMatrix2(const Gate &gate) {
+  using C = std::complex<double>;
+  const double r = 1.0 / std::sqrt(2.0);
+  const double half = gate.angle / 2;
+  const C i{0, 1};
+
+  switch (gate.kind) {
+  case GateKind::H:
+    return {r, r, r, -r};
+  case GateKind::X:
+    return {0, 1, 1, 0};
+  case GateKind::Y:
+    return {0, -i, i, 0};
+  case GateKind::Z:
+    return {1, 0, 0, -1};
+  case GateKind::S:
+    return {1, 0, 0, i};
+  case GateKind::Sdg:
+    return {1, 0, 0, -i};
+  case GateKind::T:
+    return {1, 0, 0, std::polar(1.0, M_PI / 4)};
+  case GateKind::Tdg:
+    return {1, 0, 0, std::polar(1.0, -M_PI / 4)};
+  case GateKind::Rx:
+    return {std::cos(half), -i * std::sin(half), -i * std::sin(half),
+            std::cos(half)};
+  case GateKind::Ry:
+    return {std::cos(half), -std::sin(half), std::sin(half), std::cos(half)};
+  case GateKind::Rz:
+    return {std::polar(1.0, -half), 0, 0, std::polar(1.0, half)};
+  case GateKind::Phase:
+    return {1, 0, 0, std::polar(1.0, gate.angle)};
+  default:
+    throw std::logic_error(std::string("Not a single-qubit gate: ") +
+                           gateName(gate.kind));
+  }
+}
+
+Matrix4 gateMatrix4(const Gate &gate) {
+  using C = std::complex<double>;
+  const C i{0, 1};
+  Matrix4 m{};
+
+  switch (gate.kind) {
+  case GateKind::CX:
+    // control = bit 0, target = bit 1
+    m[0 * 4 + 0] = 1;
+    m[1 * 4 + 3] = 1;
+    m[2 * 4 + 2] = 1;
+    m[3 * 4 + 1] = 1;
+    return m;
+  case GateKind::CY:
+    m[0 * 4 + 0] = 1;
+    m[1 * 4 + 3] = -i;
+    m[2 * 4 + 2] = 1;
+    m[3 * 4 + 1] = i;
+    return m;
+  case GateKind::CZ:
+    m[0 * 4 + 0] = 1;
+    m[1 * 4 + 1] = 1;
+    m[2 * 4 + 2] = 1;
+    m[3 * 4 + 3] = -1;
+    return m;
+  case GateKind::CPhase:
+    m[0 * 4 + 0] = 1;
+    m[1 * 4 + 1] = 1;
+    m[2 * 4 + 2] = 1;
+    m[3 * 4 + 3] = std::polar(1.0, gate.angle);
+    return m;
+  case GateKind::Swap:
+    m[0 * 4 + 0] = 1;
+    m[1 * 4 + 2] = 1;
+    m[2 * 4 + 1] = 1;
+    m[3 * 4 + 3] = 1;
+    return m;
+  default:
+    throw std::logic_error(std::string("Not a two-qubit gate: ") +
+                           gateName(gate.kind));
+  }
+}
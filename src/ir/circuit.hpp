@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <complex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Flat gate-level representation of a quantum program. This is what the
+// simulator consumes and what the circuit passes operate on.
+
+enum class GateKind {
+  // Single-qubit
+  H,
+  X,
+  Y,
+  Z,
+  S,
+  Sdg,
+  T,
+  Tdg,
+  Rx,
+  Ry,
+  Rz,
+  Phase,
+
+  // Two-qubit; qubits[0] is the control where there is one
+  CX,
+  CY,
+  CZ,
+  CPhase,
+  Swap,
+
+  // Non-unitary
+  Measure,
+  Reset
+};
+
+// Product states a qubit can be declared in with @state
+enum class QubitState { Zero, One, Plus, Minus, PlusI, MinusI };
+
+struct Gate {
+  GateKind kind;
+  std::array<unsigned, 2> qubits{};
+  double angle = 0.0;
+  int bit = -1; // classical bit written by Measure
+  // Node of a CircuitTemplate computing `angle` from the template's
+  // parameters, -1 when the angle is fixed (see ir/template.hpp)
+  int angleNode = -1;
+};
+
+enum class Pauli { X, Y, Z };
+
+// `coefficient` times the product of its factors; qubits without a factor
+// carry the identity
+struct PauliTerm {
+  double coefficient = 1.0;
+  std::vector<std::pair<unsigned, Pauli>> factors; // (qubit, operator)
+};
+
+// A real combination of Pauli strings whose expectation value the
+// simulator reports exactly, on the state left by the circuit's gates
+struct Observable {
+  std::string name;
+  std::vector<PauliTerm> terms;
+
+  // Moves every factor on qubit q to qubit map[q]
+  void relabel(const std::vector<unsigned> &map);
+};
+
+struct Circuit {
+  unsigned numQubits = 0;
+  std::vector<std::string> qubitNames;
+  std::vector<std::string> bitNames;
+  std::vector<Gate> gates;
+  // Where each qubit starts; the simulator writes the product state
+  // directly instead of running preparation gates
+  std::vector<QubitState> initialStates;
+  // Read by expect(); only measurements may follow them
+  std::vector<Observable> observables;
+
+  unsigned addQubit(const std::string &name,
+                    QubitState initial = QubitState::Zero);
+  bool startsInZero() const;
+  int addBit(const std::string &name);
+};
+
+// Structure of a gate's matrix, which decides the kernel that applies it
+enum class GateClass {
+  Diagonal,    // only phases: z, s, t, rz, p, cz, cp, ...
+  Permutation, // only moves amplitudes: x, cx, swap
+  Controlled,  // a 2x2 block on the target where the control is 1
+  Dense
+};
+
+using Matrix2 = std::array<std::complex<double>, 4>;
+using Matrix4 = std::array<std::complex<double>, 16>;
+
+// Gate metadata
+int arity(GateKind kind);
+bool isParameterised(GateKind kind);
+bool isUnitary(GateKind kind);
+const char *gateName(GateKind kind);
+std::optional<GateKind> gateFromName(const std::string &name);
+GateClass gateClass(GateKind kind);
+
+// @state names: "0", "1", "+", "-", "i", "-i", with or without the quotes
+// the annotation value keeps from its literal
+std::optional<QubitState> qubitStateFromName(const std::string &name);
+const char *qubitStateName(QubitState state);
+// Amplitudes of |0> and |1>
+std::array<std::complex<double>, 2> qubitAmplitudes(QubitState state);
+// Shortest gate sequence preparing `state` from |0>
+std::vector<GateKind> preparation(QubitState state);
+
+// Parses a Pauli sum such as "0.5*ZZ - 0.25*XX + YI", whose strings hold
+// one letter (I, X, Y or Z) per qubit of `qubits`. Spaces and surrounding
+// quotes are ignored; the coefficient and its `*` are optional.
+std::optional<std::vector<PauliTerm>>
+parsePauliSum(std::string_view text, const std::vector<unsigned> &qubits);
+
+// The gate undoing `gate` (s -> sdg, rz(a) -> rz(-a), ...); unitary gates
+// only
+Gate inverse(const Gate &gate);
+
+// Row-major matrices. For two-qubit gates the basis index is
+// (bit of qubits[1]) << 1 | (bit of qubits[0]).
+Matrix2 gateMatrix2(const Gate &gate);
+Matrix4 gateMatrix4(const Gate &gate);
@@ -0,0 +1,831 @@
+#include "lower.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+
+namespace {
+
+struct Binding {
+  enum class Kind { Qubit, QubitArray, Bit, Number };
+
+  Kind kind;
+  unsigned index = 0; // qubit or bit index; first qubit of an array
+  double value = 0.0; // compile-time number
+  unsigned size = 0;  // qubits in an array
+  int node = -1;      // template node computing `value`, -1 if constant
+};
+
+// A number, and the template node computing it when it depends on the
+// parameters of the template being lowered
+struct Value {
+  double value = 0.0;
+  int node = -1;
+};
+
+using Env = std::unordered_map<std::string, Binding>;
+
+// Identifies one synthesised adjoint: the function, the number of qubits
+// behind each quantum parameter and the values of the classical ones
+using AdjointKey =
+    std::tuple<std::string, std::vector<unsigned>, std::vector<double>>;
+
+bool hasAnnotation(const FunctionDeclaration *func, const std::string &name) {
+  for (const auto &ann : func->annotations) {
+    if (ann->name == name)
+      return true;
+  }
+  return false;
+}
+
+// `expr` if it is a call to the built-in expect()
+const CallExpression *asExpectCall(const Expression *expr) {
+  while (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    expr = paren->expression.get();
+  auto *call = dynamic_cast<const CallExpression *>(expr);
+  if (!call)
+    return nullptr;
+  auto *callee = dynamic_cast<const VariableExpression *>(call->callee.get());
+  return callee && callee->name == "expect" ? call : nullptr;
+}
+
+// The state named by a declaration's @state annotation, |0> without one
+std::optional<QubitState> declaredState(const VariableDeclaration *decl) {
+  for (const auto &ann : decl->annotations) {
+    if (ann->name == "state")
+      return qubitStateFromName(ann->value);
+  }
+  return QubitState::Zero;
+}
+
+class Lowering {
+public:
+  explicit Lowering(const Program &program) : program(program) {
+    for (const auto &func : program.functions)
+      functions[func->name] = func.get();
+  }
+
+  Circuit run();
+  LoweredCall runCall(const std::string &name,
+                      const std::vector<double> &args);
+  CircuitTemplate runTemplate(const std::string &name);
+  LoweredSubroutine runSubroutine(const std::string &name);
+
+private:
+  const Program &program;
+  std::unordered_map<std::string, const FunctionDeclaration *> functions;
+  std::vector<std::string> callStack;
+  Circuit circuit;
+  // Inverse gate sequences on formal qubits 0..n-1, one per AdjointKey
+  std::map<AdjointKey, std::vector<Gate>> adjoints;
+  // The template being lowered, whose parameters are symbolic
+  CircuitTemplate *tmpl = nullptr;
+  // Gates in the circuit when the first observable was added
+  std::optional<size_t> observedAt;
+  // Returned by the entry function of runCall() and runTemplate()
+  std::optional<int> returnedObservable;
+
+  const FunctionDeclaration *entryFunction(const std::string &name);
+  void bindParameter(const Parameter &param, Env &env);
+
+  // Statements; returns the bit produced by `return measure ...`, if any
+  std::optional<int> lowerStatement(const Statement *stmt, Env &env,
+                                    const std::string &scope);
+  std::optional<int> lowerBlock(const BlockStatement *block, Env env,
+                                const std::string &scope);
+  void lowerDeclaration(const VariableDeclaration *decl, Env &env,
+                        const std::string &scope);
+
+  // Expressions
+  std::optional<int> lowerCall(const CallExpression *call, Env &env,
+                               const std::string &scope);
+  std::optional<int> lowerExpression(const Expression *expr, Env &env,
+                                     const std::string &scope);
+  int lowerMeasure(const Expression *target, const Env &env,
+                   const std::string &bitName);
+  void lowerGate(GateKind kind, const CallExpression *call, const Env &env);
+  int lowerExpect(const CallExpression *call, const Env &env,
+                  const std::string &name);
+  void checkObservables();
+  std::optional<int> inlineFunction(const FunctionDeclaration *func,
+                                    const CallExpression *call, Env &env);
+  void inlineAdjoint(const FunctionDeclaration *func,
+                     const CallExpression *call, Env &env);
+  Env bindArguments(const FunctionDeclaration *func,
+                    const CallExpression *call, const Env &env);
+  void checkRecursion(const FunctionDeclaration *func);
+
+  unsigned resolveQubit(const Expression *expr, const Env &env);
+  // `a` or `q[2]` as written, with the index evaluated, to name the bit
+  // of a measurement not assigned to a variable
+  std::string qubitLabel(const Expression *expr, const Env &env);
+  Binding resolveQubitArray(const Expression *expr, const Env &env);
+  // A number known at compile time, which may depend on template
+  // parameters
+  std::optional<Value> evaluateValue(const Expression *expr, const Env &env);
+  // A number that must not depend on them: sizes and indices
+  std::optional<double> evaluate(const Expression *expr, const Env &env);
+  unsigned operand(const Value &value);
+  int addNode(AngleNode node);
+
+  bool inQuantumScope() const { return !callStack.empty(); }
+  void reportError(const std::string &msg);
+};
+
+Circuit Lowering::run() {
+  Env env;
+  for (const auto &stmt : program.statements)
+    lowerStatement(stmt.get(), env, "");
+  checkObservables();
+  return std::move(circuit);
+}
+
+const FunctionDeclaration *Lowering::entryFunction(const std::string &name) {
+  auto fn = functions.find(name);
+  if (fn == functions.end() || !fn->second->hasQuantumAnnotation)
+    reportError("No @quantum function named '" + name + "'");
+  return fn->second;
+}
+
+LoweredCall Lowering::runCall(const std::string &name,
+                             const std::vector<double> &args) {
+  const FunctionDeclaration *func = entryFunction(name);
+  if (args.size() != func->params.size()) {
+    std::stringstream err;
+    err << "Function '" << name << "' expects " << func->params.size()
+        << " argument(s), got " << args.size();
+    reportError(err.str());
+  }
+
+  Env local;
+  for (size_t i = 0; i < args.size(); ++i)
+    local[func->params[i]->name] = Binding{Binding::Kind::Number, 0, args[i]};
+
+  callStack.push_back(name);
+  auto result = lowerBlock(func->body.get(), local, name + ".");
+  callStack.pop_back();
+  checkObservables();
+  return {std::move(circuit), result, returnedObservable};
+}
+
+CircuitTemplate Lowering::runTemplate(const std::string &name) {
+  const FunctionDeclaration *func = entryFunction(name);
+  CircuitTemplate result;
+  result.function = name;
+  tmpl = &result;
+
+  Env local;
+  for (const auto &param : func->params)
+    bindParameter(*param, local);
+
+  callStack.push_back(name);
+  result.result = lowerBlock(func->body.get(), local, name + ".");
+  callStack.pop_back();
+  checkObservables();
+  result.observable = returnedObservable;
+  result.circuit = std::move(circuit);
+  tmpl = nullptr;
+  return result;
+}
+
+LoweredSubroutine Lowering::runSubroutine(const std::string &name) {
+  const FunctionDeclaration *func = entryFunction(name);
+  LoweredSubroutine result;
+  result.body.function = name;
+  tmpl = &result.body;
+
+  // Qubit parameters are the first qubits, named after themselves
+  Env local;
+  for (const auto &param : func->params) {
+    auto *pt = dynamic_cast<const PrimitiveType *>(param->type.get());
+    auto *at = dynamic_cast<const ArrayType *>(param->type.get());
+    if (pt && pt->name == "qubit") {
+      local[param->name] =
+          Binding{Binding::Kind::Qubit, circuit.addQubit(param->name)};
+    } else if (at) {
+      auto size = at->size ? evaluate(at->size.get(), local) : std::nullopt;
+      if (!size || *size < 1 || *size != static_cast<unsigned>(*size)) {
+        reportError("Size of qubit array parameter '" + param->name +
+                    "' must be a positive compile-time constant");
+      }
+      Binding array{Binding::Kind::QubitArray};
+      array.size = static_cast<unsigned>(*size);
+      for (unsigned k = 0; k < array.size; ++k) {
+        unsigned q =
+            circuit.addQubit(param->name + "[" + std::to_string(k) + "]");
+        if (k == 0)
+          array.index = q;
+      }
+      local[param->name] = array;
+    } else {
+      bindParameter(*param, local);
+    }
+  }
+  result.parameterQubits = circuit.numQubits;
+
+  callStack.push_back(name);
+  result.body.result = lowerBlock(func->body.get(), local, name + ".");
+  callStack.pop_back();
+  checkObservables();
+  result.body.observable = returnedObservable;
+  result.body.circuit = std::move(circuit);
+  tmpl = nullptr;
+  return result;
+}
+
+// A classical parameter of the template being lowered. It is lowered as 0;
+// only the nodes see its real value.
+void Lowering::bindParameter(const Parameter &param, Env &env) {
+  AngleNode node{AngleNode::Op::Parameter};
+  node.index = static_cast<unsigned>(tmpl->parameters.size());
+  tmpl->parameters.push_back(param.name);
+  env[param.name] = Binding{Binding::Kind::Number, 0, 0.0, 0, addNode(node)};
+}
+
+std::optional<int> Lowering::lowerStatement(const Statement *stmt, Env &env,
+                                            const std::string &scope) {
+  if (auto decl = dynamic_cast<const VariableDeclaration *>(stmt)) {
+    lowerDeclaration(decl, env, scope);
+  } else if (auto exprStmt = dynamic_cast<const ExpressionStatement *>(stmt)) {
+    lowerExpression(exprStmt->expression.get(), env, scope);
+  } else if (auto meas = dynamic_cast<const MeasureStatement *>(stmt)) {
+    lowerMeasure(meas->qubit.get(), env,
+                 scope + qubitLabel(meas->qubit.get(), env));
+  } else if (auto reset = dynamic_cast<const ResetStatement *>(stmt)) {
+    Gate gate{GateKind::Reset, {resolveQubit(reset->target.get(), env), 0}};
+    circuit.gates.push_back(gate);
+  } else if (auto ret = dynamic_cast<const ReturnStatement *>(stmt)) {
+    if (auto expect = asExpectCall(ret->value.get())) {
+      int observable = lowerExpect(expect, env, scope + "expect");
+      if (callStack.size() == 1)
+        returnedObservable = observable;
+    } else if (ret->value) {
+      return lowerExpression(ret->value.get(), env, scope);
+    }
+  } else if (auto block = dynamic_cast<const BlockStatement *>(stmt)) {
+    return lowerBlock(block, env, scope);
+  } else if (inQuantumScope() && (dynamic_cast<const IfStatement *>(stmt) ||
+                                  dynamic_cast<const ForStatement *>(stmt))) {
+    reportError("Control flow inside @quantum function '" + callStack.back() +
+                "' cannot be lowered to a static circuit");
+  }
+  // Classical statements (echo, assignments, control flow) belong to the
+  // C++ backend
+  return std::nullopt;
+}
+
+std::optional<int> Lowering::lowerBlock(const BlockStatement *block, Env env,
+                                        const std::string &scope) {
+  for (const auto &stmt : block->statements) {
+    auto returned = lowerStatement(stmt.get(), env, scope);
+    if (dynamic_cast<const ReturnStatement *>(stmt.get()))
+      return returned;
+  }
+  return std::nullopt;
+}
+
+void Lowering::lowerDeclaration(const VariableDeclaration *decl, Env &env,
+                                const std::string &scope) {
+  if (auto at = dynamic_cast<const ArrayType *>(decl->varType.get())) {
+    auto *element = dynamic_cast<const PrimitiveType *>(at->elementType.get());
+    if (!element || element->name != "qubit")
+      return;
+    auto size = at->size ? evaluate(at->size.get(), env) : std::nullopt;
+    if (!size || *size < 1 || *size != static_cast<unsigned>(*size)) {
+      reportError("Size of qubit array '" + decl->name +
+                  "' must be a positive compile-time constant");
+    }
+
+    Binding array{Binding::Kind::QubitArray};
+    array.size = static_cast<unsigned>(*size);
+    for (unsigned k = 0; k < array.size; ++k) {
+      unsigned q = circuit.addQubit(scope + decl->name + "[" +
+                                    std::to_string(k) + "]");
+      if (k == 0)
+        array.index = q;
+    }
+    env[decl->name] = array;
+    return;
+  }
+
+  auto *pt = dynamic_cast<const PrimitiveType *>(decl->varType.get());
+  if (!pt)
+    return;
+
+  if (pt->name == "qubit") {
+    auto state = declaredState(decl);
+    if (!state)
+      reportError("Invalid @state value on qubit '" + decl->name + "'");
+    unsigned q = circuit.addQubit(scope + decl->name, *state);
+    env[decl->name] = Binding{Binding::Kind::Qubit, q};
+    return;
+  }
+
+  if (!decl->initializer)
+    return;
+
+  if (auto expect = asExpectCall(decl->initializer.get())) {
+    lowerExpect(expect, env, scope + decl->name);
+    return;
+  }
+
+  if (pt->name == "bit") {
+    if (auto bit = lowerExpression(decl->initializer.get(), env, scope)) {
+      circuit.bitNames[*bit] = scope + decl->name;
+      env[decl->name] = Binding{Binding::Kind::Bit, unsigned(*bit)};
+    }
+    return;
+  }
+
+  // Remember classical constants so they can feed gate angles
+  if (auto value = evaluateValue(decl->initializer.get(), env)) {
+    env[decl->name] =
+        Binding{Binding::Kind::Number, 0, value->value, 0, value->node};
+  }
+}
+
+std::optional<int> Lowering::lowerExpression(const Expression *expr, Env &env,
+                                             const std::string &scope) {
+  if (auto call = dynamic_cast<const CallExpression *>(expr))
+    return lowerCall(call, env, scope);
+  if (auto meas = dynamic_cast<const MeasureExpression *>(expr))
+    return lowerMeasure(meas->qubit.get(), env,
+                        scope + qubitLabel(meas->qubit.get(), env));
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return lowerExpression(paren->expression.get(), env, scope);
+  return std::nullopt;
+}
+
+std::optional<int> Lowering::lowerCall(const CallExpression *call, Env &env,
+                                       const std::string &scope) {
+  // f.adjoint(args) runs the inverse of @quantum function f
+  if (auto member =
+          dynamic_cast<const MemberAccessExpression *>(call->callee.get())) {
+    auto *target = dynamic_cast<const VariableExpression *>(member->object.get());
+    auto fn = target ? functions.find(target->name) : functions.end();
+    if (member->member == "adjoint" && fn != functions.end() &&
+        fn->second->hasQuantumAnnotation) {
+      inlineAdjoint(fn->second, call, env);
+    } else if (inQuantumScope()) {
+      reportError("Unknown gate or function: " +
+                  (target ? target->name + "." : std::string()) +
+                  member->member);
+    }
+    return std::nullopt;
+  }
+
+  auto *callee = dynamic_cast<const VariableExpression *>(call->callee.get());
+  if (!callee)
+    return std::nullopt;
+
+  auto fn = functions.find(callee->name);
+  if (fn != functions.end()) {
+    if (fn->second->hasQuantumAnnotation)
+      return inlineFunction(fn->second, call, env);
+    if (inQuantumScope()) {
+      reportError("Cannot call classical function '" + callee->name +
+                  "' from @quantum function '" + callStack.back() + "'");
+    }
+    return std::nullopt;
+  }
+
+  if (auto kind = gateFromName(callee->name)) {
+    lowerGate(*kind, call, env);
+    return std::nullopt;
+  }
+
+  if (asExpectCall(call)) {
+    lowerExpect(call, env, scope + "expect");
+    return std::nullopt;
+  }
+
+  if (inQuantumScope())
+    reportError("Unknown gate or function: " + callee->name);
+  return std::nullopt;
+}
+
+void Lowering::lowerGate(GateKind kind, const CallExpression *call,
+                         const Env &env) {
+  const size_t params = isParameterised(kind) ? 1 : 0;
+  const size_t expected = params + arity(kind);
+  if (call->arguments.size() != expected) {
+    std::stringstream err;
+    err << "Gate '" << gateName(kind) << "' expects " << expected
+        << " argument(s), got " << call->arguments.size();
+    reportError(err.str());
+  }
+
+  Gate gate{kind};
+  if (params) {
+    auto angle = evaluateValue(call->arguments[0].get(), env);
+    if (!angle) {
+      reportError(std::string("Angle of gate '") + gateName(kind) +
+                  "' is not a compile-time constant");
+    }
+    gate.angle = angle->value;
+    gate.angleNode = angle->node;
+  }
+  for (int k = 0; k < arity(kind); ++k)
+    gate.qubits[k] = resolveQubit(call->arguments[params + k].get(), env);
+
+  if (arity(kind) == 2 && gate.qubits[0] == gate.qubits[1]) {
+    reportError(std::string("Gate '") + gateName(kind) +
+                "' applied twice to the same qubit");
+  }
+  circuit.gates.push_back(gate);
+}
+
+int Lowering::lowerExpect(const CallExpression *call, const Env &env,
+                          const std::string &name) {
+  const auto &args = call->arguments;
+  auto *pauli = args.empty() ? nullptr
+                             : dynamic_cast<const LiteralExpression *>(
+                                   args[0].get());
+  if (!pauli || pauli->value.empty() || pauli->value[0] != '"') {
+    reportError("expect() takes a Pauli string such as \"0.5*ZZ + XI\" "
+                "followed by the qubits it acts on");
+  }
+
+  std::vector<unsigned> qubits;
+  for (size_t k = 1; k < args.size(); ++k) {
+    auto *ve = dynamic_cast<const VariableExpression *>(args[k].get());
+    auto it = ve ? env.find(ve->name) : env.end();
+    if (it != env.end() && it->second.kind == Binding::Kind::QubitArray) {
+      for (unsigned q = 0; q < it->second.size; ++q)
+        qubits.push_back(it->second.index + q);
+    } else {
+      qubits.push_back(resolveQubit(args[k].get(), env));
+    }
+  }
+  std::vector<unsigned> sorted = qubits;
+  std::sort(sorted.begin(), sorted.end());
+  if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+    reportError("expect() lists the same qubit twice");
+  // The value is taken before sampling, which a measured qubit has already
+  // been through
+  for (const Gate &gate : circuit.gates) {
+    if (gate.kind == GateKind::Measure &&
+        std::binary_search(sorted.begin(), sorted.end(), gate.qubits[0]))
+      reportError("expect() on a qubit that has already been measured");
+  }
+
+  auto terms = parsePauliSum(pauli->value, qubits);
+  if (!terms) {
+    std::stringstream err;
+    err << "Invalid Pauli string " << pauli->value << " for "
+        << qubits.size() << " qubit(s)";
+    reportError(err.str());
+  }
+
+  if (!observedAt)
+    observedAt = circuit.gates.size();
+  circuit.observables.push_back({name, std::move(*terms)});
+  return static_cast<int>(circuit.observables.size()) - 1;
+}
+
+// Observables read the final state, so nothing but measurements may come
+// after the first one
+void Lowering::checkObservables() {
+  if (!observedAt)
+    return;
+  for (size_t i = *observedAt; i < circuit.gates.size(); ++i) {
+    if (circuit.gates[i].kind != GateKind::Measure) {
+      reportError("expect() reads the final state: only measurements may "
+                  "follow it");
+    }
+  }
+}
+
+void Lowering::checkRecursion(const FunctionDeclaration *func) {
+  if (std::find(callStack.begin(), callStack.end(), func->name) !=
+      callStack.end()) {
+    reportError("Recursive @quantum function cannot be lowered: " +
+                func->name);
+  }
+}
+
+std::optional<int> Lowering::inlineFunction(const FunctionDeclaration *func,
+                                            const CallExpression *call,
+                                            Env &env) {
+  checkRecursion(func);
+  Env local = bindArguments(func, call, env);
+
+  callStack.push_back(func->name);
+  auto result = lowerBlock(func->body.get(), local, func->name + ".");
+  callStack.pop_back();
+  return result;
+}
+
+void Lowering::inlineAdjoint(const FunctionDeclaration *func,
+                             const CallExpression *call, Env &env) {
+  if (!hasAnnotation(func, "adjoint")) {
+    reportError("'" + func->name +
+                "' has no adjoint: annotate it with @adjoint");
+  }
+  checkRecursion(func);
+  Env actual = bindArguments(func, call, env);
+
+  // The inverse is synthesised on formal qubits standing for the
+  // arguments, so it can be reused for calls on other qubits
+  AdjointKey key{func->name, {}, {}};
+  std::vector<unsigned> targets; // formal qubit -> argument qubit
+  Env formal;
+  bool symbolic = false; // angles depend on template parameters
+  for (const auto &param : func->params) {
+    Binding binding = actual.at(param->name);
+    if (binding.kind == Binding::Kind::Qubit) {
+      formal[param->name] = Binding{Binding::Kind::Qubit,
+                                    static_cast<unsigned>(targets.size())};
+      targets.push_back(binding.index);
+      std::get<1>(key).push_back(1);
+    } else if (binding.kind == Binding::Kind::QubitArray) {
+      Binding array = binding;
+      array.index = static_cast<unsigned>(targets.size());
+      formal[param->name] = array;
+      for (unsigned k = 0; k < binding.size; ++k)
+        targets.push_back(binding.index + k);
+      std::get<1>(key).push_back(binding.size);
+    } else {
+      formal[param->name] = binding;
+      std::get<2>(key).push_back(binding.value);
+      symbolic = symbolic || binding.node >= 0;
+    }
+  }
+
+  // Inverses whose angles depend on the parameters are not shared: the
+  // nodes they refer to belong to this call
+  auto cached = symbolic ? adjoints.end() : adjoints.find(key);
+  std::vector<Gate> uncached;
+  if (cached == adjoints.end()) {
+    Circuit outer = std::move(circuit);
+    circuit = Circuit{};
+    for (size_t k = 0; k < targets.size(); ++k)
+      circuit.addQubit(outer.qubitNames[targets[k]]);
+
+    callStack.push_back(func->name);
+    lowerBlock(func->body.get(), formal, func->name + ".");
+    callStack.pop_back();
+    Circuit body = std::move(circuit);
+    circuit = std::move(outer);
+
+    if (body.numQubits != targets.size()) {
+      reportError("Cannot take the adjoint of '" + func->name +
+                  "': it allocates qubits");
+    }
+    if (!body.observables.empty()) {
+      reportError("Cannot take the adjoint of '" + func->name +
+                  "': it calls expect()");
+    }
+    std::vector<Gate> gates;
+    for (auto gate = body.gates.rbegin(); gate != body.gates.rend(); ++gate) {
+      if (!isUnitary(gate->kind)) {
+        reportError("Cannot take the adjoint of '" + func->name +
+                    "': it measures or resets qubits");
+      }
+      Gate undo = inverse(*gate);
+      if (undo.angleNode >= 0) {
+        AngleNode negate{AngleNode::Op::Negate};
+        negate.left = static_cast<unsigned>(gate->angleNode);
+        undo.angleNode = addNode(negate);
+      }
+      gates.push_back(undo);
+    }
+    if (symbolic)
+      uncached = std::move(gates);
+    else
+      cached = adjoints.emplace(std::move(key), std::move(gates)).first;
+  }
+
+  for (Gate gate : symbolic ? uncached : cached->second) {
+    for (int k = 0; k < arity(gate.kind); ++k)
+      gate.qubits[k] = targets[gate.qubits[k]];
+    if (arity(gate.kind) == 2 && gate.qubits[0] == gate.qubits[1]) {
+      reportError(std::string("Gate '") + gateName(gate.kind) +
+                  "' applied twice to the same qubit");
+    }
+    circuit.gates.push_back(gate);
+  }
+}
+
+Env Lowering::bindArguments(const FunctionDeclaration *func,
+                            const CallExpression *call, const Env &env) {
+  if (call->arguments.size() != func->params.size()) {
+    std::stringstream err;
+    err << "Function '" << func->name << "' expects " << func->params.size()
+        << " argument(s), got " << call->arguments.size();
+    reportError(err.str());
+  }
+
+  Env local;
+  for (size_t i = 0; i < func->params.size(); ++i) {
+    const auto &param = func->params[i];
+    const Expression *arg = call->arguments[i].get();
+    auto *pt = dynamic_cast<const PrimitiveType *>(param->type.get());
+    auto *at = dynamic_cast<const ArrayType *>(param->type.get());
+
+    if (pt && pt->name == "qubit") {
+      local[param->name] =
+          Binding{Binding::Kind::Qubit, resolveQubit(arg, env)};
+    } else if (at) {
+      Binding array = resolveQubitArray(arg, env);
+      auto size = at->size ? evaluate(at->size.get(), env) : std::nullopt;
+      if (size && *size != array.size) {
+        std::stringstream err;
+        err << "Argument '" << param->name << "' of '" << func->name
+            << "' expects " << *size << " qubits, got " << array.size;
+        reportError(err.str());
+      }
+      local[param->name] = array;
+    } else if (auto value = evaluateValue(arg, env)) {
+      local[param->name] =
+          Binding{Binding::Kind::Number, 0, value->value, 0, value->node};
+    } else {
+      reportError("Argument '" + param->name + "' of '" + func->name +
+                  "' is not a compile-time constant");
+    }
+  }
+  return local;
+}
+
+int Lowering::lowerMeasure(const Expression *target, const Env &env,
+                           const std::string &bitName) {
+  Gate gate{GateKind::Measure, {resolveQubit(target, env), 0}};
+  gate.bit = circuit.addBit(bitName);
+  circuit.gates.push_back(gate);
+  return gate.bit;
+}
+
+unsigned Lowering::resolveQubit(const Expression *expr, const Env &env) {
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return resolveQubit(paren->expression.get(), env);
+
+  if (auto ve = dynamic_cast<const VariableExpression *>(expr)) {
+    auto it = env.find(ve->name);
+    if (it != env.end() && it->second.kind == Binding::Kind::Qubit)
+      return it->second.index;
+    reportError("'" + ve->name + "' is not a qubit");
+  }
+
+  if (auto ie = dynamic_cast<const IndexExpression *>(expr)) {
+    Binding array = resolveQubitArray(ie->collection.get(), env);
+    auto index = evaluate(ie->index.get(), env);
+    if (!index || *index != static_cast<int64_t>(*index))
+      reportError("Qubit index is not a compile-time constant");
+    if (*index < 0 || *index >= array.size) {
+      std::stringstream err;
+      err << "Qubit index " << *index << " out of range for an array of "
+          << array.size;
+      reportError(err.str());
+    }
+    return array.index + static_cast<unsigned>(*index);
+  }
+  reportError("Expected a qubit operand");
+  return 0;
+}
+
+std::string Lowering::qubitLabel(const Expression *expr, const Env &env) {
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return qubitLabel(paren->expression.get(), env);
+  if (auto ve = dynamic_cast<const VariableExpression *>(expr))
+    return ve->name;
+  if (auto ie = dynamic_cast<const IndexExpression *>(expr)) {
+    auto *array =
+        dynamic_cast<const VariableExpression *>(ie->collection.get());
+    auto index = evaluate(ie->index.get(), env);
+    if (array && index) {
+      return array->name + "[" +
+             std::to_string(static_cast<int64_t>(*index)) + "]";
+    }
+  }
+  return "measure";
+}
+
+Binding Lowering::resolveQubitArray(const Expression *expr, const Env &env) {
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return resolveQubitArray(paren->expression.get(), env);
+
+  if (auto ve = dynamic_cast<const VariableExpression *>(expr)) {
+    auto it = env.find(ve->name);
+    if (it != env.end() && it->second.kind == Binding::Kind::QubitArray)
+      return it->second;
+    reportError("'" + ve->name + "' is not a qubit array");
+  }
+  reportError("Expected a qubit array");
+  return {};
+}
+
+std::optional<Value> Lowering::evaluateValue(const Expression *expr,
+                                             const Env &env) {
+  if (auto lit = dynamic_cast<const LiteralExpression *>(expr)) {
+    const std::string &text = lit->value;
+    if (text.empty() || !(isdigit(text[0]) || text[0] == '.'))
+      return std::nullopt;
+    return Value{std::stod(text)};
+  }
+  if (auto ve = dynamic_cast<const VariableExpression *>(expr)) {
+    auto it = env.find(ve->name);
+    if (it != env.end() && it->second.kind == Binding::Kind::Number)
+      return Value{it->second.value, it->second.node};
+    return std::nullopt;
+  }
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return evaluateValue(paren->expression.get(), env);
+  if (auto unary = dynamic_cast<const UnaryExpression *>(expr)) {
+    auto value = evaluateValue(unary->right.get(), env);
+    if (!value || unary->op != "-")
+      return std::nullopt;
+    if (value->node < 0)
+      return Value{-value->value};
+    AngleNode negate{AngleNode::Op::Negate};
+    negate.left = static_cast<unsigned>(value->node);
+    return Value{-value->value, addNode(negate)};
+  }
+  if (auto bin = dynamic_cast<const BinaryExpression *>(expr)) {
+    auto left = evaluateValue(bin->left.get(), env);
+    auto right = evaluateValue(bin->right.get(), env);
+    if (!left || !right)
+      return std::nullopt;
+    Value result;
+    AngleNode node{AngleNode::Op::Add};
+    if (bin->op == "+") {
+      result.value = left->value + right->value;
+    } else if (bin->op == "-") {
+      result.value = left->value - right->value;
+      node.op = AngleNode::Op::Subtract;
+    } else if (bin->op == "*") {
+      result.value = left->value * right->value;
+      node.op = AngleNode::Op::Multiply;
+    } else if (bin->op == "/" && (right->value != 0 || right->node >= 0)) {
+      result.value = left->value / right->value;
+      node.op = AngleNode::Op::Divide;
+    } else {
+      return std::nullopt;
+    }
+    if (left->node >= 0 || right->node >= 0) {
+      node.left = operand(*left);
+      node.right = operand(*right);
+      result.node = addNode(node);
+    }
+    return result;
+  }
+  return std::nullopt;
+}
+
+std::optional<double> Lowering::evaluate(const Expression *expr,
+                                         const Env &env) {
+  auto value = evaluateValue(expr, env);
+  if (!value)
+    return std::nullopt;
+  if (value->node >= 0) {
+    reportError("Parameters of '" + tmpl->function +
+                "' can only be used in gate angles: qubit indices and "
+                "array sizes must be compile-time constants");
+  }
+  return value->value;
+}
+
+// The node standing for `value` in an expression, a constant if it has
+// none
+unsigned Lowering::operand(const Value &value) {
+  if (value.node >= 0)
+    return static_cast<unsigned>(value.node);
+  AngleNode constant{AngleNode::Op::Constant};
+  constant.value = value.value;
+  return static_cast<unsigned>(addNode(constant));
+}
+
+int Lowering::addNode(AngleNode node) {
+  tmpl->nodes.push_back(node);
+  return static_cast<int>(tmpl->nodes.size()) - 1;
+}
+
+void Lowering::reportError(const std::string &msg) {
+  std::stringstream err;
+  err << "[Quanta Lowering Error]\n" << msg << "\n";
+  throw std::runtime_error(err.str());
+}
+
+} // namespace
+
+Circuit lowerProgram(const Program &program) {
+  return Lowering(program).run();
+}
+
+LoweredCall lowerCall(const Program &program, const std::string &name,
+                      const std::vector<double> &args) {
+  return Lowering(program).runCall(name, args);
+}
+
+CircuitTemplate lowerTemplate(const Program &program, const std::string &name) {
+  return Lowering(program).runTemplate(name);
+}
+
+LoweredSubroutine lowerSubroutine(const Program &program,
+                                  const std::string &name) {
+  return Lowering(program).runSubroutine(name);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../ast/ast.hpp"
+#include "circuit.hpp"
+#include "template.hpp"
+
+// Flattens the program's top-level quantum statements into a Circuit:
+// qubit declarations allocate qubits, gate calls resolve to the built-in
+// gate set and calls to @quantum functions are expanded inline. Classical
+// statements are left to the C++ backend and skipped here.
+//
+// `expect("0.5*ZZ + XI", a, b)` adds an Observable on the listed qubits (a
+// qubit array stands for all of its qubits) named after the variable it
+// initialises, or `expect` in the current scope.
+Circuit lowerProgram(const Program &program);
+
+struct LoweredCall {
+  Circuit circuit;
+  std::optional<int> result; // bit returned by the function, if any
+  // Observable of the `return expect(...)` ending the function, if any
+  std::optional<int> observable;
+};
+
+// Lowers a single call of the @quantum function `name` made from classical
+// code at run time, with the given argument values. The function must take
+// classical parameters only.
+LoweredCall lowerCall(const Program &program, const std::string &name,
+                      const std::vector<double> &args);
+
+// Lowers the @quantum function `name` once for any values of its classical
+// parameters, which may only feed gate angles. Throws std::runtime_error
+// like lowerCall(), and also when a parameter decides a qubit index or an
+// array size, which would change the circuit itself.
+CircuitTemplate lowerTemplate(const Program &program, const std::string &name);
+
+struct LoweredSubroutine {
+  CircuitTemplate body;
+  // Qubits standing for the function's qubit parameters, first in the
+  // circuit; any after them are declared by the function or its callees
+  unsigned parameterQubits = 0;
+};
+
+// Lowers the @quantum function `name` on its own, as the body of an
+// OpenQASM subroutine: qubit parameters become qubits named after them
+// (`a`, `q[0]`, ...) and classical ones are symbolic as in
+// lowerTemplate(). Throws std::runtime_error like lowerTemplate(), and
+// also when a qubit array parameter has no size.
+LoweredSubroutine lowerSubroutine(const Program &program,
+                                  const std::string &name);
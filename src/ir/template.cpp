@@ -0,0 +1,96 @@
+#include "template.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+std::vector<double>
+CircuitTemplate::evaluate(const std::vector<double> &values) const {
+  if (values.size() != parameters.size()) {
+    std::stringstream err;
+    err << "[Quanta Lowering Error]\nFunction '" << function << "' expects "
+        << parameters.size() << " argument(s), got " << values.size() << "\n";
+    throw std::runtime_error(err.str());
+  }
+
+  std::vector<double> result(nodes.size());
+  for (size_t k = 0; k < nodes.size(); ++k) {
+    const AngleNode &node = nodes[k];
+    switch (node.op) {
+    case AngleNode::Op::Parameter:
+      result[k] = values[node.index];
+      break;
+    case AngleNode::Op::Constant:
+      result[k] = node.value;
+      break;
+    case AngleNode::Op::Negate:
+      result[k] = -result[node.left];
+      break;
+    case AngleNode::Op::Add:
+      result[k] = result[node.left] + result[node.right];
+      break;
+    case AngleNode::Op::Subtract:
+      result[k] = result[node.left] - result[node.right];
+      break;
+    case AngleNode::Op::Multiply:
+      result[k] = result[node.left] * result[node.right];
+      break;
+    case AngleNode::Op::Divide:
+      result[k] = result[node.left] / result[node.right];
+      break;
+    }
+  }
+  return result;
+}
+
+void CircuitTemplate::bind(const std::vector<double> &values,
+                           Circuit &target) const {
+  std::vector<double> angles = evaluate(values);
+  for (Gate &gate : target.gates) {
+    if (gate.angleNode >= 0)
+      gate.angle = angles[gate.angleNode];
+  }
+}
+
+std::vector<double>
+CircuitTemplate::backpropagate(const std::vector<double> &values,
+                               std::vector<double> nodeDerivatives) const {
+  std::vector<double> node = evaluate(values);
+  std::vector<double> result(parameters.size(), 0.0);
+  for (size_t k = nodes.size(); k-- > 0;) {
+    const AngleNode &n = nodes[k];
+    const double d = nodeDerivatives[k];
+    switch (n.op) {
+    case AngleNode::Op::Parameter:
+      result[n.index] += d;
+      break;
+    case AngleNode::Op::Constant:
+      break;
+    case AngleNode::Op::Negate:
+      nodeDerivatives[n.left] -= d;
+      break;
+    case AngleNode::Op::Add:
+      nodeDerivatives[n.left] += d;
+      nodeDerivatives[n.right] += d;
+      break;
+    case AngleNode::Op::Subtract:
+      nodeDerivatives[n.left] += d;
+      nodeDerivatives[n.right] -= d;
+      break;
+    case AngleNode::Op::Multiply:
+      nodeDerivatives[n.left] += d * node[n.right];
+      nodeDerivatives[n.right] += d * node[n.left];
+      break;
+    case AngleNode::Op::Divide:
+      nodeDerivatives[n.left] += d / node[n.right];
+      nodeDerivatives[n.right] -= d * node[k] / node[n.right];
+      break;
+    }
+  }
+  return result;
+}
+
+Circuit CircuitTemplate::bind(const std::vector<double> &values) const {
+  Circuit bound = circuit;
+  bind(values, bound);
+  return bound;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "circuit.hpp"
+
+// One step of the arithmetic leading from a template's parameters to its
+// gate angles. Operands are earlier nodes, so the nodes are evaluated in
+// order.
+struct AngleNode {
+  enum class Op { Parameter, Constant, Negate, Add, Subtract, Multiply, Divide };
+
+  Op op;
+  double value = 0.0;           // Constant
+  unsigned index = 0;           // Parameter: position in the parameter list
+  unsigned left = 0, right = 0; // operands
+};
+
+// A @quantum function lowered once with its classical parameters left
+// symbolic. Its gate sequence does not depend on them; only the angles of
+// the gates with an `angleNode` do. Binding new values rewrites those
+// angles in place, without going back to the AST, so a function called
+// with many different angles is lowered and optimised once.
+struct CircuitTemplate {
+  std::string function;
+  std::vector<std::string> parameters;
+  // Angles hold the values the template was lowered with. The gate passes
+  // keep `angleNode`, so a template can be optimised like any circuit
+  // (cancelGates() leaves gates with one alone).
+  Circuit circuit;
+  std::optional<int> result;     // bit returned by the function, if any
+  std::optional<int> observable; // observable it returns, if any
+  std::vector<AngleNode> nodes;
+
+  // Values of every node for one set of parameters; throws
+  // std::runtime_error if the number of values is wrong
+  std::vector<double> evaluate(const std::vector<double> &values) const;
+
+  // Writes the angles for `values` into `target`, the template's circuit
+  // or a copy of it
+  void bind(const std::vector<double> &values, Circuit &target) const;
+  Circuit bind(const std::vector<double> &values) const;
+
+  // Chain rule through the nodes, last to first: given the derivative of
+  // some quantity with respect to every node at `values`, returns its
+  // derivative with respect to every parameter
+  std::vector<double>
+  backpropagate(const std::vector<double> &values,
+                std::vector<double> nodeDerivatives) const;
+};
@@ -1,4 +1,5 @@
 #include "lexer.hpp"
+#include "profile/stats.hpp"
 
 #include <cctype>
 #include <cstdlib>
@@ -19,6 +20,8 @@ std::vector<Token> Lexer::tokenize() {
     }
   }
   tokens.push_back(makeToken(TokenType::Eof, ""));
+  Stats::add(Counter::SourceBytes, source.size());
+  Stats::add(Counter::Tokens, tokens.size());
   return tokens;
 }
 
@@ -226,14 +229,19 @@ Token Lexer::scanString() {
                    source.substr(start - 1, position - start + 1));
 }
 
+// Up to the closing quote on the same line: a character, or longer text
+// such as the @state value '-i', which the parser accepts only there
 Token Lexer::scanChar() {
   size_t start = position;
   if (position < source.length())
     advance();
+  while (position < source.length() && peek() != '\'' && peek() != '\n')
+    advance();
 
   if (peek() == '\'') {
     advance();
-    return makeToken(TokenType::CharLiteral, source.substr(start - 1, 3));
+    return makeToken(TokenType::CharLiteral,
+                     source.substr(start - 1, position - start + 1));
   }
 
   reportError("Unterminated char literal");
@@ -1,20 +1,191 @@
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unistd.h>
 
+#include "cli/options.hpp"
 #include "codegen/cppgen.hpp"
 #include "codegen/oqasmgen.hpp"
+#include "ir/lower.hpp"
 #include "lexer/lexer.hpp"
+#include "opt/cancel.hpp"
+#include "opt/constfold.hpp"
+#include "opt/dce.hpp"
+#include "opt/inline.hpp"
+#include "opt/layout.hpp"
+#include "opt/lightcone.hpp"
+#include "opt/regalloc.hpp"
+#include "opt/unroll.hpp"
 #include "parser/parser.hpp"
+#include "profile/stats.hpp"
+#include "profile/trace.hpp"
+#include "runtime/jit.hpp"
+#include "sim/simulator.hpp"
+#include "vm/compiler.hpp"
+#include "vm/vm.hpp"
+
+// Both state vectors are held at once for the precision comparison
+constexpr unsigned kFidelityCheckMaxQubits = 24;
+
+// Prints the --stats report on stderr and writes the --trace file however
+// main() returns
+struct ProfileReport {
+  explicit ProfileReport(StatsFormat stats) : stats(stats) {}
+
+  StatsFormat stats;
+  std::ofstream trace;
+  ~ProfileReport() {
+    if (stats != StatsFormat::None)
+      Stats::print(std::cerr, stats == StatsFormat::Json);
+    if (trace.is_open())
+      Trace::write(trace);
+  }
+};
+
+void printExpectations(const Circuit &circuit,
+                       const SimulationResult &result) {
+  auto precision = std::cout.precision(12);
+  for (size_t k = 0; k < result.expectations.size(); ++k) {
+    std::cout << "  <" << circuit.observables[k].name
+              << "> = " << result.expectations[k] << "\n";
+  }
+  std::cout.precision(precision);
+}
+
+// --sweep: lists the function as a parameterised OpenQASM program, then
+// simulates it once per binding without lowering it again
+int sweep(const Program &program, const Options &options) {
+  std::vector<std::vector<double>> bindings;
+  CircuitTemplate tmpl;
+  try {
+    if (options.bindings == "-") {
+      bindings = readBindings(std::cin);
+    } else {
+      std::ifstream in(options.bindings);
+      if (!in.is_open())
+        throw std::runtime_error("could not open " + options.bindings);
+      bindings = readBindings(in);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  try {
+    PhaseTimer timer("lower");
+    tmpl = lowerTemplate(program, options.sweep);
+    tmpl.circuit = pruneLightCone(cancelGates(tmpl.circuit));
+  } catch (const std::exception &e) {
+    std::cerr << e.what();
+    return 1;
+  }
+  if (tmpl.parameters.empty() && bindings.empty())
+    bindings.emplace_back();
+  if (options.gradient && !tmpl.observable) {
+    std::cerr << "Error: --gradient needs '" << options.sweep
+              << "' to return expect(...)\n";
+    return 1;
+  }
+
+  CircuitTemplate allocated = tmpl;
+  {
+    PhaseTimer timer("regalloc");
+    allocated.circuit = allocateQubits(tmpl.circuit);
+  }
+
+  std::cout << "================= OPENQASM OUTPUT ==================\n";
+  std::cout.flush();
+  {
+    PhaseTimer timer("qasmgen");
+    CodeBuffer qasm;
+    qasm.setSink(STDOUT_FILENO);
+    emitQasmTemplate(allocated, qasm);
+    qasm.flush();
+  }
+  std::cout << "\n";
+
+  const SimulatorOptions &sim = options.simulator;
+  const unsigned logicalQubits = tmpl.circuit.numQubits;
+  if (cheaperToSimulate(allocated.circuit, tmpl.circuit, sim))
+    tmpl = std::move(allocated);
+
+  std::vector<SimulationResult> results;
+  std::vector<Gradient> gradients;
+  try {
+    PhaseTimer timer("simulate");
+    results = simulateSweep(tmpl, bindings, sim);
+    for (size_t k = 0; options.gradient && k < bindings.size(); ++k) {
+      gradients.push_back(adjointGradient(tmpl, bindings[k],
+                                          *tmpl.observable, sim.precision));
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  std::cout << "==================== SIMULATION ====================\n";
+  std::cout << "qubits: " << tmpl.circuit.numQubits;
+  if (tmpl.circuit.numQubits != logicalQubits)
+    std::cout << " (" << logicalQubits << " before reuse)";
+  std::cout << ", shots: " << sim.shots << ", seed: " << sim.seed
+            << ", precision: " << precisionName(sim.precision)
+            << ", bindings: " << bindings.size() << "\n";
+  if (!results.empty()) {
+    for (const auto &label : results[0].labels)
+      std::cout << label << " ";
+    std::cout << "\n";
+  }
+  for (size_t k = 0; k < results.size(); ++k) {
+    for (size_t p = 0; p < tmpl.parameters.size(); ++p)
+      std::cout << tmpl.parameters[p] << "=" << bindings[k][p] << " ";
+    std::cout << "\n";
+    for (const auto &[bits, count] : results[k].counts)
+      std::cout << "  " << bits << ": " << count << "\n";
+    printExpectations(tmpl.circuit, results[k]);
+    if (!gradients.empty()) {
+      auto precision = std::cout.precision(12);
+      const std::string &name = tmpl.circuit.observables[*tmpl.observable].name;
+      for (size_t p = 0; p < tmpl.parameters.size(); ++p) {
+        std::cout << "  d<" << name << ">/d" << tmpl.parameters[p] << " = "
+                  << gradients[k].derivatives[p] << "\n";
+      }
+      std::cout.precision(precision);
+    }
+  }
+  return 0;
+}
 
 int main(int argc, char **argv) {
-  if (argc < 2) {
-    std::cerr << "Usage: quanta <input.qt>\n";
+  Options options;
+  try {
+    options = parseOptions(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    std::cerr << "Usage: quanta <input.qt> [--shots=N] [--seed=N] "
+                 "[--precision=single|double] [--fidelity-check]\n"
+                 "       [--out-of-core=DIR] [--chunk-qubits=N] [--ranks=N] "
+                 "[--layout] [--unroll-limit=N]\n"
+                 "       [--inline-limit=N] [--run] [--exec=vm|native] [--jit-cache=DIR]\n"
+                 "       [--sweep=FUNCTION] [--bindings=FILE] [--gradient] "
+                 "[--stats[=json]]\n"
+                 "       [--trace=FILE]\n";
     return 1;
   }
+  ProfileReport report(options.stats);
+  if (options.stats != StatsFormat::None)
+    Stats::enable();
+  if (!options.trace.empty()) {
+    // Opened first, so an unwritable path fails before any work is done
+    report.trace.open(options.trace);
+    if (!report.trace.is_open()) {
+      std::cerr << "Error: could not open trace file.\n";
+      return 1;
+    }
+    Trace::enable();
+  }
 
-  std::ifstream in(argv[1]);
+  std::ifstream in(options.inputPath);
   if (!in.is_open()) {
     std::cerr << "Error: could not open input file.\n";
     return 1;
@@ -24,20 +195,177 @@ int main(int argc, char **argv) {
   buffer << in.rdbuf();
   std::string source = buffer.str();
 
-  Lexer lexer(source);
-  auto tokens = lexer.tokenize();
-  Parser parser(tokens);
-  auto program = parser.parse();
+  std::unique_ptr<Program> program;
+  try {
+    std::vector<Token> tokens;
+    {
+      PhaseTimer timer("lex");
+      tokens = Lexer(source).tokenize();
+    }
+    {
+      PhaseTimer timer("parse");
+      program = Parser(tokens).parse();
+    }
+    {
+      PhaseTimer timer("constfold");
+      foldConstants(*program);
+    }
+    {
+      PhaseTimer timer("unroll");
+      unrollLoops(*program, options.unrollLimit);
+    }
+    {
+      PhaseTimer timer("inline");
+      inlineFunctions(*program, options.inlineLimit);
+    }
+    PhaseTimer timer("dce");
+    std::vector<std::string> entryPoints;
+    if (!options.sweep.empty())
+      entryPoints.push_back(options.sweep);
+    eliminateDeadCode(*program, entryPoints);
+  } catch (const std::exception &e) {
+    std::cerr << e.what();
+    return 1;
+  }
+
+  if (!options.sweep.empty())
+    return sweep(*program, options);
+
+  if (options.run) {
+    try {
+      if (options.exec == ExecMode::Native) {
+        JitOptions jit{options.jitCache, options.simulator};
+        PhaseTimer timer("execute");
+        return runJit(*program, jit);
+      }
+      Module module;
+      {
+        PhaseTimer timer("bytecode");
+        module = compileBytecode(*program);
+      }
+      QuantumCalls quantum(*program, options.simulator);
+      PhaseTimer timer("execute");
+      return VirtualMachine(module, quantum, std::cout).run();
+    } catch (const std::exception &e) {
+      std::cerr << e.what();
+      return 1;
+    }
+  }
 
   std::cout << "==================== C++ OUTPUT ====================\n";
-  CppGenerator cpp;
-  program->accept(cpp);
-  std::cout << cpp.str() << "\n";
+  std::cout.flush();
+  {
+    PhaseTimer timer("cppgen");
+    CppGenerator cpp;
+    cpp.code().setSink(STDOUT_FILENO);
+    program->accept(cpp);
+    cpp.code().flush();
+  }
+  std::cout << "\n";
+
+  Circuit circuit;
+  try {
+    {
+      PhaseTimer timer("lower");
+      circuit = lowerProgram(*program);
+    }
+    {
+      PhaseTimer timer("cancel");
+      circuit = cancelGates(circuit);
+    }
+    PhaseTimer timer("lightcone");
+    circuit = pruneLightCone(circuit);
+  } catch (const std::exception &e) {
+    std::cerr << e.what();
+    return 1;
+  }
+  Circuit allocated;
+  {
+    PhaseTimer timer("regalloc");
+    allocated = allocateQubits(circuit);
+  }
 
   std::cout << "================= OPENQASM OUTPUT ==================\n";
-  QasmGenerator qasm;
-  program->accept(qasm);
-  std::cout << qasm.str() << "\n";
+  std::cout.flush();
+  {
+    PhaseTimer timer("qasmgen");
+    QasmGenerator qasm(allocated);
+    qasm.code().setSink(STDOUT_FILENO);
+    program->accept(qasm);
+    qasm.code().flush();
+  }
+  std::cout << "\n";
+
+  if (circuit.numQubits == 0)
+    return 0;
+
+  const SimulatorOptions &sim = options.simulator;
+  // Reusing qubits shrinks the state vector but can turn a circuit that
+  // is evolved once into one re-run for every shot
+  const unsigned logicalQubits = circuit.numQubits;
+  if (cheaperToSimulate(allocated, circuit, sim))
+    circuit = std::move(allocated);
+
+  // The out-of-core and distributed simulators manage their own qubit
+  // placement
+  if (options.layout && sim.outOfCore.directory.empty() && sim.ranks == 1) {
+    PhaseTimer timer("layout");
+    circuit = planLayout(circuit);
+  }
+
+  std::cout << "==================== SIMULATION ====================\n";
+  std::cout << "qubits: " << circuit.numQubits;
+  if (circuit.numQubits != logicalQubits)
+    std::cout << " (" << logicalQubits << " before reuse)";
+  std::cout << ", shots: " << sim.shots
+            << ", seed: " << sim.seed
+            << ", precision: " << precisionName(sim.precision) << "\n";
+
+  SimulationResult result;
+  try {
+    PhaseTimer timer("simulate");
+    result = simulate(circuit, sim);
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  for (const auto &label : result.labels)
+    std::cout << label << " ";
+  std::cout << "\n";
+  for (const auto &[bits, count] : result.counts)
+    std::cout << "  " << bits << ": " << count << "\n";
+  printExpectations(circuit, result);
+
+  if (!sim.outOfCore.directory.empty()) {
+    constexpr double GiB = 1024.0 * 1024.0 * 1024.0;
+    const IoStats &io = result.io;
+    std::cout << std::fixed << std::setprecision(3)
+              << "out-of-core I/O: " << io.bytesRead / GiB << " GiB read, "
+              << io.bytesWritten / GiB << " GiB written, " << io.chunkLoads
+              << " chunk loads, " << io.gateWindows << " gate windows, "
+              << io.qubitSwaps << " qubit swaps\n"
+              << std::defaultfloat;
+  }
+  if (sim.ranks > 1) {
+    constexpr double GiB = 1024.0 * 1024.0 * 1024.0;
+    const CommStats &comm = result.comm;
+    std::cout << std::fixed << std::setprecision(3)
+              << "distributed: " << comm.ranks << " ranks, "
+              << comm.bytesSent / GiB << " GiB exchanged, " << comm.gateWindows
+              << " gate windows, " << comm.qubitSwaps << " qubit swaps\n"
+              << std::defaultfloat;
+  }
+
+  if (options.fidelityCheck) {
+    if (circuit.numQubits > kFidelityCheckMaxQubits) {
+      std::cout << "fidelity check skipped (more than "
+                << kFidelityCheckMaxQubits << " qubits)\n";
+    } else {
+      PhaseTimer timer("fidelity");
+      std::cout << "single/double fidelity: " << std::setprecision(12)
+                << precisionFidelity(circuit) << "\n";
+    }
+  }
 
   return 0;
 }
@@ -0,0 +1,102 @@
+#include "cancel.hpp"
+
+#include <cmath>
+
+namespace {
+
+// Angles this close to zero are the identity
+constexpr double kAngleEpsilon = 1e-12;
+
+bool isSelfInverse(GateKind kind) {
+  switch (kind) {
+  case GateKind::H:
+  case GateKind::X:
+  case GateKind::Y:
+  case GateKind::Z:
+  case GateKind::CX:
+  case GateKind::CY:
+  case GateKind::CZ:
+  case GateKind::Swap:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Gates whose two qubits can be exchanged without changing the gate
+bool isSymmetric(GateKind kind) {
+  return kind == GateKind::CZ || kind == GateKind::CPhase ||
+         kind == GateKind::Swap;
+}
+
+bool sameQubits(const Gate &a, const Gate &b) {
+  if (arity(a.kind) != arity(b.kind))
+    return false;
+  if (arity(a.kind) == 1)
+    return a.qubits[0] == b.qubits[0];
+  if (a.qubits == b.qubits)
+    return true;
+  return isSymmetric(a.kind) && a.qubits[0] == b.qubits[1] &&
+         a.qubits[1] == b.qubits[0];
+}
+
+} // namespace
+
+Circuit cancelGates(const Circuit &circuit) {
+  std::vector<Gate> out;
+  std::vector<bool> alive;
+  // Indices into `out` of the live gates on each qubit, latest last
+  std::vector<std::vector<size_t>> onQubit(circuit.numQubits);
+
+  auto remove = [&](size_t index) {
+    alive[index] = false;
+    for (int k = 0; k < arity(out[index].kind); ++k)
+      onQubit[out[index].qubits[k]].pop_back();
+  };
+
+  for (const Gate &gate : circuit.gates) {
+    if (isUnitary(gate.kind)) {
+      // The latest gate on every qubit of `gate` must be the same one
+      const auto &first = onQubit[gate.qubits[0]];
+      bool adjacent = !first.empty();
+      if (adjacent && arity(gate.kind) == 2) {
+        const auto &second = onQubit[gate.qubits[1]];
+        adjacent = !second.empty() && second.back() == first.back();
+      }
+
+      if (adjacent) {
+        const size_t previous = first.back();
+        Gate &before = out[previous];
+        if (isUnitary(before.kind) && sameQubits(before, gate)) {
+          // Angles bound later by a template cannot be added up here
+          if (before.kind == gate.kind && isParameterised(gate.kind) &&
+              before.angleNode < 0 && gate.angleNode < 0) {
+            before.angle += gate.angle;
+            if (std::abs(before.angle) < kAngleEpsilon)
+              remove(previous);
+            continue;
+          }
+          if ((before.kind == gate.kind && isSelfInverse(gate.kind)) ||
+              (!isParameterised(gate.kind) &&
+               inverse(before).kind == gate.kind)) {
+            remove(previous);
+            continue;
+          }
+        }
+      }
+    }
+
+    for (int k = 0; k < arity(gate.kind); ++k)
+      onQubit[gate.qubits[k]].push_back(out.size());
+    out.push_back(gate);
+    alive.push_back(true);
+  }
+
+  Circuit result = circuit;
+  result.gates.clear();
+  for (size_t i = 0; i < out.size(); ++i) {
+    if (alive[i])
+      result.gates.push_back(out[i]);
+  }
+  return result;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "ir/circuit.hpp"
+
+// Peephole cancellation. A gate meeting its own inverse with nothing in
+// between on its qubits is removed together with it (h h, s sdg, cx cx,
+// rz(a) rz(-a), ...), and neighbouring rotations of the same kind on the
+// same qubits are merged into one. Removing a pair can expose another, so
+// a synthesised adjoint placed after the code it undoes collapses
+// completely. Measurements and resets are barriers on their qubit.
+// Rotations whose angle a template binds later (Gate::angleNode) are not
+// merged.
+Circuit cancelGates(const Circuit &circuit);
@@ -0,0 +1,484 @@
+#include "constfold.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Constant {
+  bool isFloat = false;
+  int64_t i = 0;
+  double f = 0.0;
+
+  double value() const { return isFloat ? f : static_cast<double>(i); }
+  bool isZero() const { return isFloat ? f == 0.0 : i == 0; }
+};
+
+bool fitsInt(int64_t value) {
+  return value >= std::numeric_limits<int32_t>::min() &&
+         value <= std::numeric_limits<int32_t>::max();
+}
+
+std::optional<Constant> constantOf(const Expression *expr) {
+  if (auto lit = dynamic_cast<const LiteralExpression *>(expr)) {
+    const std::string &text = lit->value;
+    if (text.empty() || !(isdigit(text[0]) || text[0] == '.'))
+      return std::nullopt;
+    Constant c;
+    if (text.find_first_of(".eEfF") != std::string::npos) {
+      c.isFloat = true;
+      c.f = std::stod(text);
+    } else {
+      auto [end, ec] =
+          std::from_chars(text.data(), text.data() + text.size(), c.i);
+      if (ec != std::errc() || end != text.data() + text.size())
+        return std::nullopt;
+    }
+    return c;
+  }
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return constantOf(paren->expression.get());
+  if (auto unary = dynamic_cast<const UnaryExpression *>(expr)) {
+    auto c = constantOf(unary->right.get());
+    if (!c || unary->op != "-")
+      return std::nullopt;
+    c->i = -c->i;
+    c->f = -c->f;
+    return c;
+  }
+  return std::nullopt;
+}
+
+std::unique_ptr<Expression> makeLiteral(Constant c) {
+  const bool negative = c.isFloat ? std::signbit(c.f) : c.i < 0;
+  std::string text;
+  if (c.isFloat) {
+    // Shortest round-trip form, always with a '.' and the 'f' suffix the
+    // lexer and analyser expect of float literals
+    char buffer[64];
+    auto end = std::to_chars(buffer, buffer + sizeof(buffer), std::fabs(c.f))
+                   .ptr;
+    text.assign(buffer, end);
+    if (text.find('.') == std::string::npos) {
+      size_t exponent = text.find('e');
+      text.insert(exponent == std::string::npos ? text.size() : exponent,
+                  ".0");
+    }
+    text += 'f';
+  } else {
+    text = std::to_string(negative ? -c.i : c.i);
+  }
+
+  std::unique_ptr<Expression> literal =
+      std::make_unique<LiteralExpression>(text);
+  if (negative)
+    return std::make_unique<UnaryExpression>("-", std::move(literal));
+  return literal;
+}
+
+std::optional<Constant> evaluateBinary(const std::string &op, Constant left,
+                                       Constant right) {
+  Constant result;
+  if (op == "<" || op == ">" || op == "<=" || op == ">=") {
+    double l = left.value(), r = right.value();
+    if (!left.isFloat && !right.isFloat) {
+      l = left.i; // exact for all int32 values
+      r = right.i;
+    }
+    result.i = op == "<"    ? l < r
+               : op == ">"  ? l > r
+               : op == "<=" ? l <= r
+                            : l >= r;
+    return result;
+  }
+
+  if (left.isFloat || right.isFloat) {
+    // Folded in double, as lowering evaluates gate angles; C++ rounds the
+    // folded literal to float once instead of after every operation
+    const double l = left.value(), r = right.value();
+    result.isFloat = true;
+    if (op == "+")
+      result.f = l + r;
+    else if (op == "-")
+      result.f = l - r;
+    else if (op == "*")
+      result.f = l * r;
+    else if (op == "/" && r != 0.0)
+      result.f = l / r;
+    else
+      return std::nullopt;
+    // Past the float range the literal would not mean what the program
+    // computes at run time either
+    if (!(std::fabs(result.f) <= std::numeric_limits<float>::max()))
+      return std::nullopt;
+    return result;
+  }
+
+  const int64_t l = left.i, r = right.i;
+  if (op == "+")
+    result.i = l + r;
+  else if (op == "-")
+    result.i = l - r;
+  else if (op == "*")
+    result.i = l * r;
+  else if (op == "/" && r != 0)
+    result.i = l / r;
+  else if (op == "%" && r != 0)
+    result.i = l % r;
+  else
+    return std::nullopt;
+  // Overflow is the program's business at run time; leave it alone
+  if (!fitsInt(l) || !fitsInt(r) || !fitsInt(result.i))
+    return std::nullopt;
+  return result;
+}
+
+// Converts a constant to the declared type of the `final` it initialises
+std::optional<Constant> convertTo(const Type *type, Constant c) {
+  auto *pt = dynamic_cast<const PrimitiveType *>(type);
+  if (!pt)
+    return std::nullopt;
+  Constant result;
+  if (pt->name == "float") {
+    result.isFloat = true;
+    result.f = c.value();
+  } else if (pt->name == "int") {
+    result.i = c.isFloat ? static_cast<int64_t>(c.f) : c.i;
+    if (!fitsInt(result.i))
+      return std::nullopt;
+  } else if (pt->name == "bit") {
+    result.i = !c.isZero();
+  } else {
+    return std::nullopt;
+  }
+  return result;
+}
+
+bool isEmptyBlock(const Statement *stmt) {
+  auto block = dynamic_cast<const BlockStatement *>(stmt);
+  return block && block->statements.empty();
+}
+
+class ConstantFolder {
+public:
+  void run(Program &program);
+  void run(BlockStatement &block);
+
+private:
+  // Innermost scope last; a name bound to nullopt shadows outer constants
+  std::vector<std::unordered_map<std::string, std::optional<Constant>>> scopes;
+
+  void foldFunction(FunctionDeclaration &func);
+  void foldStatement(std::unique_ptr<Statement> &stmt);
+  void foldStatements(std::vector<std::unique_ptr<Statement>> &statements);
+  void foldDeclaration(VariableDeclaration &decl);
+  void foldExpression(std::unique_ptr<Expression> &expr);
+  std::optional<Constant> lookup(const std::string &name) const;
+};
+
+void ConstantFolder::run(Program &program) {
+  // Top-level `final`s are global constants, visible in every function
+  scopes.assign(1, {});
+  foldStatements(program.statements);
+
+  for (auto &func : program.functions)
+    foldFunction(*func);
+
+  for (auto &cls : program.classes) {
+    scopes.resize(1);
+    scopes.emplace_back();
+    for (auto &member : cls->members)
+      foldDeclaration(*member);
+    for (auto &method : cls->methods)
+      foldFunction(*method);
+  }
+}
+
+void ConstantFolder::run(BlockStatement &block) {
+  scopes.assign(1, {});
+  foldStatements(block.statements);
+}
+
+void ConstantFolder::foldFunction(FunctionDeclaration &func) {
+  scopes.emplace_back();
+  for (const auto &param : func.params)
+    scopes.back()[param->name] = std::nullopt;
+  if (func.body)
+    foldStatements(func.body->statements);
+  scopes.pop_back();
+}
+
+void ConstantFolder::foldStatements(
+    std::vector<std::unique_ptr<Statement>> &statements) {
+  for (auto &stmt : statements)
+    foldStatement(stmt);
+  // Drop what folded `if`s left behind
+  std::erase_if(statements, [](const std::unique_ptr<Statement> &stmt) {
+    return isEmptyBlock(stmt.get());
+  });
+}
+
+void ConstantFolder::foldStatement(std::unique_ptr<Statement> &stmt) {
+  if (auto decl = dynamic_cast<VariableDeclaration *>(stmt.get())) {
+    foldDeclaration(*decl);
+  } else if (auto exprStmt = dynamic_cast<ExpressionStatement *>(stmt.get())) {
+    if (exprStmt->expression)
+      foldExpression(exprStmt->expression);
+  } else if (auto assign = dynamic_cast<AssignmentStatement *>(stmt.get())) {
+    foldExpression(assign->value);
+  } else if (auto echo = dynamic_cast<EchoStatement *>(stmt.get())) {
+    foldExpression(echo->value);
+  } else if (auto ret = dynamic_cast<ReturnStatement *>(stmt.get())) {
+    if (ret->value)
+      foldExpression(ret->value);
+  } else if (auto reset = dynamic_cast<ResetStatement *>(stmt.get())) {
+    foldExpression(reset->target);
+  } else if (auto meas = dynamic_cast<MeasureStatement *>(stmt.get())) {
+    foldExpression(meas->qubit);
+  } else if (auto block = dynamic_cast<BlockStatement *>(stmt.get())) {
+    scopes.emplace_back();
+    foldStatements(block->statements);
+    scopes.pop_back();
+  } else if (auto ifStmt = dynamic_cast<IfStatement *>(stmt.get())) {
+    foldExpression(ifStmt->condition);
+    auto condition = constantOf(ifStmt->condition.get());
+    if (!condition) {
+      foldStatement(ifStmt->thenBranch);
+      if (ifStmt->elseBranch)
+        foldStatement(ifStmt->elseBranch);
+      return;
+    }
+
+    // Keep the branch that runs, as a block so its names stay scoped
+    std::unique_ptr<Statement> taken = condition->isZero()
+                                           ? std::move(ifStmt->elseBranch)
+                                           : std::move(ifStmt->thenBranch);
+    if (!taken) {
+      taken = std::make_unique<BlockStatement>();
+    } else if (!dynamic_cast<BlockStatement *>(taken.get())) {
+      auto block = std::make_unique<BlockStatement>();
+      block->statements.push_back(std::move(taken));
+      taken = std::move(block);
+    }
+    stmt = std::move(taken);
+    foldStatement(stmt);
+  } else if (auto forStmt = dynamic_cast<ForStatement *>(stmt.get())) {
+    scopes.emplace_back();
+    if (forStmt->initializer)
+      foldStatement(forStmt->initializer);
+    if (forStmt->condition)
+      foldExpression(forStmt->condition);
+    if (forStmt->increment)
+      foldExpression(forStmt->increment);
+    foldStatement(forStmt->body);
+    scopes.pop_back();
+  }
+}
+
+void ConstantFolder::foldDeclaration(VariableDeclaration &decl) {
+  if (auto array = dynamic_cast<ArrayType *>(decl.varType.get())) {
+    if (array->size)
+      foldExpression(array->size);
+  }
+
+  std::optional<Constant> value;
+  if (decl.initializer) {
+    foldExpression(decl.initializer);
+    if (decl.isFinal) {
+      if (auto c = constantOf(decl.initializer.get()))
+        value = convertTo(decl.varType.get(), *c);
+    }
+  }
+  scopes.back()[decl.name] = value;
+}
+
+void ConstantFolder::foldExpression(std::unique_ptr<Expression> &expr) {
+  if (auto var = dynamic_cast<VariableExpression *>(expr.get())) {
+    if (auto c = lookup(var->name))
+      expr = makeLiteral(*c);
+  } else if (auto paren = dynamic_cast<ParenthesizedExpression *>(expr.get())) {
+    foldExpression(paren->expression);
+    if (auto c = constantOf(paren->expression.get()))
+      expr = makeLiteral(*c);
+  } else if (auto unary = dynamic_cast<UnaryExpression *>(expr.get())) {
+    foldExpression(unary->right);
+    // Already canonical when the operand is a plain literal
+    if (unary->op == "-" &&
+        !dynamic_cast<LiteralExpression *>(unary->right.get())) {
+      if (auto c = constantOf(unary))
+        expr = makeLiteral(*c);
+    }
+  } else if (auto bin = dynamic_cast<BinaryExpression *>(expr.get())) {
+    foldExpression(bin->left);
+    foldExpression(bin->right);
+    auto left = constantOf(bin->left.get());
+    auto right = constantOf(bin->right.get());
+    if (left && right) {
+      if (auto c = evaluateBinary(bin->op, *left, *right))
+        expr = makeLiteral(*c);
+    }
+  } else if (auto call = dynamic_cast<CallExpression *>(expr.get())) {
+    // The callee is a name, not a value
+    if (!dynamic_cast<VariableExpression *>(call->callee.get()))
+      foldExpression(call->callee);
+    for (auto &arg : call->arguments)
+      foldExpression(arg);
+  } else if (auto ctor = dynamic_cast<ConstructorCallExpression *>(expr.get())) {
+    for (auto &arg : ctor->arguments)
+      foldExpression(arg);
+  } else if (auto member = dynamic_cast<MemberAccessExpression *>(expr.get())) {
+    foldExpression(member->object);
+  } else if (auto index = dynamic_cast<IndexExpression *>(expr.get())) {
+    foldExpression(index->collection);
+    foldExpression(index->index);
+  } else if (auto assign = dynamic_cast<AssignmentExpression *>(expr.get())) {
+    foldExpression(assign->value);
+  } else if (auto meas = dynamic_cast<MeasureExpression *>(expr.get())) {
+    foldExpression(meas->qubit);
+  }
+}
+
+std::optional<Constant> ConstantFolder::lookup(const std::string &name) const {
+  for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+    auto it = scope->find(name);
+    if (it != scope->end())
+      return it->second;
+  }
+  return std::nullopt;
+}
+
+// Loop bounds
+
+bool assigns(const Statement *stmt, const std::string &name);
+
+bool assigns(const Expression *expr, const std::string &name) {
+  if (!expr)
+    return false;
+  if (auto assign = dynamic_cast<const AssignmentExpression *>(expr))
+    return assign->name == name || assigns(assign->value.get(), name);
+  if (auto bin = dynamic_cast<const BinaryExpression *>(expr))
+    return assigns(bin->left.get(), name) || assigns(bin->right.get(), name);
+  if (auto unary = dynamic_cast<const UnaryExpression *>(expr))
+    return assigns(unary->right.get(), name);
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return assigns(paren->expression.get(), name);
+  if (auto call = dynamic_cast<const CallExpression *>(expr)) {
+    for (const auto &arg : call->arguments) {
+      if (assigns(arg.get(), name))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool assigns(const Statement *stmt, const std::string &name) {
+  if (!stmt)
+    return false;
+  if (auto assign = dynamic_cast<const AssignmentStatement *>(stmt))
+    return assign->name == name || assigns(assign->value.get(), name);
+  if (auto exprStmt = dynamic_cast<const ExpressionStatement *>(stmt))
+    return assigns(exprStmt->expression.get(), name);
+  if (auto decl = dynamic_cast<const VariableDeclaration *>(stmt))
+    return assigns(decl->initializer.get(), name);
+  if (auto block = dynamic_cast<const BlockStatement *>(stmt)) {
+    for (const auto &inner : block->statements) {
+      // A redeclaration shadows the loop variable for the rest of the block
+      auto decl = dynamic_cast<const VariableDeclaration *>(inner.get());
+      if (assigns(inner.get(), name))
+        return true;
+      if (decl && decl->name == name)
+        return false;
+    }
+    return false;
+  }
+  if (auto ifStmt = dynamic_cast<const IfStatement *>(stmt)) {
+    return assigns(ifStmt->condition.get(), name) ||
+           assigns(ifStmt->thenBranch.get(), name) ||
+           assigns(ifStmt->elseBranch.get(), name);
+  }
+  if (auto forStmt = dynamic_cast<const ForStatement *>(stmt)) {
+    return assigns(forStmt->initializer.get(), name) ||
+           assigns(forStmt->condition.get(), name) ||
+           assigns(forStmt->increment.get(), name) ||
+           assigns(forStmt->body.get(), name);
+  }
+  return false;
+}
+
+std::optional<int64_t> intConstant(const Expression *expr) {
+  auto c = constantOf(expr);
+  if (!c || c->isFloat)
+    return std::nullopt;
+  return c->i;
+}
+
+bool isVariable(const Expression *expr, const std::string &name) {
+  auto var = dynamic_cast<const VariableExpression *>(expr);
+  return var && var->name == name;
+}
+
+} // namespace
+
+void foldConstants(Program &program) { ConstantFolder().run(program); }
+
+void foldConstants(BlockStatement &block) { ConstantFolder().run(block); }
+
+std::optional<LoopBounds> loopBounds(const ForStatement &loop) {
+  auto init = dynamic_cast<const VariableDeclaration *>(loop.initializer.get());
+  auto type = init ? dynamic_cast<const PrimitiveType *>(init->varType.get())
+                   : nullptr;
+  if (!type || type->name != "int" || !init->initializer)
+    return std::nullopt;
+
+  LoopBounds bounds;
+  bounds.variable = init->name;
+  auto start = intConstant(init->initializer.get());
+  if (!start)
+    return std::nullopt;
+  bounds.start = *start;
+
+  // i = i + step, i = i - step
+  auto inc = dynamic_cast<const AssignmentExpression *>(loop.increment.get());
+  auto incBin =
+      inc ? dynamic_cast<const BinaryExpression *>(inc->value.get()) : nullptr;
+  if (!incBin || inc->name != bounds.variable ||
+      !isVariable(incBin->left.get(), bounds.variable) ||
+      (incBin->op != "+" && incBin->op != "-"))
+    return std::nullopt;
+  auto step = intConstant(incBin->right.get());
+  if (!step || *step == 0)
+    return std::nullopt;
+  bounds.step = incBin->op == "+" ? *step : -*step;
+
+  // i < end, i <= end, i > end, i >= end
+  auto cond = dynamic_cast<const BinaryExpression *>(loop.condition.get());
+  if (!cond || !isVariable(cond->left.get(), bounds.variable))
+    return std::nullopt;
+  auto end = intConstant(cond->right.get());
+  if (!end)
+    return std::nullopt;
+
+  int64_t limit; // first value the loop does not run for
+  if (cond->op == "<" && bounds.step > 0)
+    limit = *end;
+  else if (cond->op == "<=" && bounds.step > 0)
+    limit = *end + 1;
+  else if (cond->op == ">" && bounds.step < 0)
+    limit = *end;
+  else if (cond->op == ">=" && bounds.step < 0)
+    limit = *end - 1;
+  else
+    return std::nullopt;
+
+  const int64_t span = bounds.step > 0 ? limit - bounds.start
+                                       : bounds.start - limit;
+  const int64_t stride = bounds.step > 0 ? bounds.step : -bounds.step;
+  bounds.tripCount = span <= 0 ? 0 : (span + stride - 1) / stride;
+
+  if (assigns(loop.body.get(), bounds.variable))
+    return std::nullopt;
+  return bounds;
+}
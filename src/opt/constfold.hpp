@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "ast/ast.hpp"
+
+// Constant folding and propagation over the AST, in place:
+//  - arithmetic and comparisons on numeric literals are evaluated, with C++
+//    semantics (int division truncates, int op float is float);
+//  - `final` variables with a constant initialiser are replaced by their
+//    value wherever they are in scope;
+//  - `if` statements with a constant condition are replaced by the branch
+//    that runs.
+// Negative results are written as unary minus applied to a literal, the
+// form the parser produces for them. Run it before code generation and
+// lowering; every backend sees the folded tree.
+void foldConstants(Program &program);
+
+// Folds a single block, seeing only the `final`s declared inside it
+void foldConstants(BlockStatement &block);
+
+// A counted `for` loop: `for (int i = start; i < end; i = i + step)` with
+// constant bounds (`<`, `<=`, `>` and `>=` conditions and `i = i - step`
+// are recognised too), whose body never assigns to `i`
+struct LoopBounds {
+  std::string variable;
+  int64_t start = 0;
+  int64_t step = 1;      // negative for counting down
+  int64_t tripCount = 0; // iterations the loop runs
+};
+
+// The bounds of `loop` if they are known at compile time, typically after
+// foldConstants() has substituted `final` bounds
+std::optional<LoopBounds> loopBounds(const ForStatement &loop);
@@ -0,0 +1,207 @@
+#include "dce.hpp"
+#include "ast/usage.hpp"
+
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+
+namespace {
+
+bool isQubitType(const Type *type) {
+  if (auto at = dynamic_cast<const ArrayType *>(type))
+    type = at->elementType.get();
+  auto *pt = dynamic_cast<const PrimitiveType *>(type);
+  return pt && pt->name == "qubit";
+}
+
+bool hasEffects(const Expression *expr) {
+  Usage usage;
+  scanUsage(expr, usage);
+  return usage.hasEffects;
+}
+
+using Statements = std::vector<std::unique_ptr<Statement>>;
+
+// Calls `visit` on every statement list in `statements`, nested ones
+// included
+template <typename Visit> void forEachList(Statements &statements, Visit visit) {
+  visit(statements);
+  for (auto &stmt : statements) {
+    if (auto block = dynamic_cast<BlockStatement *>(stmt.get())) {
+      forEachList(block->statements, visit);
+    } else if (auto ifStmt = dynamic_cast<IfStatement *>(stmt.get())) {
+      for (auto *branch : {ifStmt->thenBranch.get(), ifStmt->elseBranch.get()}) {
+        if (auto block = dynamic_cast<BlockStatement *>(branch))
+          forEachList(block->statements, visit);
+      }
+    } else if (auto forStmt = dynamic_cast<ForStatement *>(stmt.get())) {
+      if (auto block = dynamic_cast<BlockStatement *>(forStmt->body.get()))
+        forEachList(block->statements, visit);
+    }
+  }
+}
+
+// The variable a statement stores to, if it is a declaration or an
+// assignment statement
+const std::string *storedName(const Statement *stmt,
+                              const Expression **value) {
+  if (auto decl = dynamic_cast<const VariableDeclaration *>(stmt)) {
+    if (isQubitType(decl->varType.get()))
+      return nullptr;
+    *value = decl->initializer.get();
+    return &decl->name;
+  }
+  if (auto assign = dynamic_cast<const AssignmentStatement *>(stmt)) {
+    *value = assign->value.get();
+    return &assign->name;
+  }
+  return nullptr;
+}
+
+// Removes the stores to variables in `statements` that are never read
+// there or in `readElsewhere`. Names are not scoped, so a variable is only
+// dead if no variable of that name is read anywhere in the body.
+void removeDeadStores(Statements &statements,
+                      const std::set<std::string> &readElsewhere = {}) {
+  for (bool changed = true; changed;) {
+    changed = false;
+    Usage usage;
+    for (const auto &stmt : statements)
+      scanUsage(stmt.get(), usage);
+
+    // Candidates are stored but never read; any impure store keeps them
+    std::set<std::string> dead;
+    for (const auto &name : usage.declared) {
+      if (!usage.read.count(name) && !readElsewhere.count(name))
+        dead.insert(name);
+    }
+    forEachList(statements, [&](Statements &list) {
+      for (const auto &stmt : list) {
+        const Expression *value = nullptr;
+        if (const std::string *name = storedName(stmt.get(), &value)) {
+          if (hasEffects(value))
+            dead.erase(*name);
+          continue;
+        }
+        // Loop counters and variables written by assignment expressions
+        // are left alone
+        Usage other;
+        if (auto forStmt = dynamic_cast<const ForStatement *>(stmt.get())) {
+          scanUsage(forStmt->initializer.get(), other);
+          scanUsage(forStmt->condition.get(), other);
+          scanUsage(forStmt->increment.get(), other);
+          other.assigned.insert(other.declared.begin(), other.declared.end());
+        } else if (auto ifStmt = dynamic_cast<const IfStatement *>(stmt.get())) {
+          scanUsage(ifStmt->condition.get(), other);
+        } else if (!dynamic_cast<const BlockStatement *>(stmt.get())) {
+          scanUsage(stmt.get(), other);
+        }
+        for (const auto &name : other.assigned)
+          dead.erase(name);
+      }
+    });
+    if (dead.empty())
+      return;
+
+    forEachList(statements, [&](Statements &list) {
+      for (auto it = list.begin(); it != list.end();) {
+        const Expression *value = nullptr;
+        const std::string *name = storedName(it->get(), &value);
+        if (name && dead.count(*name)) {
+          it = list.erase(it);
+          changed = true;
+        } else {
+          ++it;
+        }
+      }
+    });
+  }
+}
+
+class DeadCodeEliminator {
+public:
+  DeadCodeEliminator(Program &program,
+                     const std::vector<std::string> &entryPoints)
+      : program(program), entryPoints(entryPoints) {}
+
+  void run();
+
+private:
+  Program &program;
+  const std::vector<std::string> &entryPoints;
+
+  std::set<std::string> reachableFunctions();
+};
+
+void DeadCodeEliminator::run() {
+  std::set<std::string> reachable = reachableFunctions();
+  bool isLibrary = program.statements.empty() && !reachable.count("main");
+  if (!isLibrary) {
+    auto &functions = program.functions;
+    functions.erase(std::remove_if(functions.begin(), functions.end(),
+                                   [&](const auto &func) {
+                                     return !reachable.count(func->name);
+                                   }),
+                    functions.end());
+  }
+
+  // Each body is its own scope; only the top level is visible elsewhere
+  Usage bodies;
+  for (auto &func : program.functions) {
+    if (!func->body)
+      continue;
+    removeDeadStores(func->body->statements);
+    scanUsage(func->body.get(), bodies);
+  }
+  for (auto &cls : program.classes) {
+    for (auto &method : cls->methods) {
+      if (!method->body)
+        continue;
+      removeDeadStores(method->body->statements);
+      scanUsage(method->body.get(), bodies);
+    }
+  }
+  removeDeadStores(program.statements, bodies.read);
+}
+
+std::set<std::string> DeadCodeEliminator::reachableFunctions() {
+  std::unordered_map<std::string, std::vector<FunctionDeclaration *>> byName;
+  for (auto &func : program.functions)
+    byName[func->name].push_back(func.get());
+
+  Usage roots;
+  for (const auto &stmt : program.statements)
+    scanUsage(stmt.get(), roots);
+  for (const auto &cls : program.classes) {
+    for (const auto &member : cls->members)
+      scanUsage(member.get(), roots);
+    for (const auto &method : cls->methods)
+      scanUsage(method->body.get(), roots);
+  }
+
+  std::set<std::string> reachable;
+  std::vector<std::string> work(roots.called.begin(), roots.called.end());
+  if (byName.count("main"))
+    work.push_back("main");
+  work.insert(work.end(), entryPoints.begin(), entryPoints.end());
+  while (!work.empty()) {
+    std::string name = work.back();
+    work.pop_back();
+    auto it = byName.find(name);
+    if (it == byName.end() || !reachable.insert(name).second)
+      continue;
+    for (FunctionDeclaration *func : it->second) {
+      Usage usage;
+      scanUsage(func->body.get(), usage);
+      work.insert(work.end(), usage.called.begin(), usage.called.end());
+    }
+  }
+  return reachable;
+}
+
+} // namespace
+
+void eliminateDeadCode(Program &program,
+                       const std::vector<std::string> &entryPoints) {
+  DeadCodeEliminator(program, entryPoints).run();
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ast/ast.hpp"
+
+// Dead-code elimination over the AST, in place:
+//  - functions not reachable from an entry point are removed. The entry
+//    points are `main`, the top-level statements, the class members and
+//    `entryPoints` (a function run from the command line with --sweep);
+//    a program with neither `main` nor top-level statements is a library
+//    and keeps all of its functions;
+//  - classical variables that are never read are removed together with
+//    the assignments to them, provided none of the values stored has a
+//    side effect. Constant folding leaves many of these behind as `final`s.
+// Qubits are left to the circuit passes (see opt/lightcone.hpp). Run after
+// the other AST passes, which can make code dead.
+void eliminateDeadCode(Program &program,
+                       const std::vector<std::string> &entryPoints = {});
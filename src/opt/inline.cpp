@@ -0,0 +1,434 @@
+#include "inline.hpp"
+#include "ast/clone.hpp"
+#include "ast/usage.hpp"
+#include "constfold.hpp"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+namespace {
+
+// Qubit parameters are substituted by their arguments
+using Substitution = std::unordered_map<std::string, const Expression *>;
+
+bool isQubitParameter(const Parameter &param) {
+  const Type *type = param.type.get();
+  if (auto at = dynamic_cast<const ArrayType *>(type))
+    type = at->elementType.get();
+  auto *pt = dynamic_cast<const PrimitiveType *>(type);
+  return pt && pt->name == "qubit";
+}
+
+// A literal, possibly negated: what constant folding leaves behind
+bool isConstant(const Expression *expr) {
+  if (auto unary = dynamic_cast<const UnaryExpression *>(expr)) {
+    return unary->op == "-" &&
+           dynamic_cast<const LiteralExpression *>(unary->right.get());
+  }
+  return dynamic_cast<const LiteralExpression *>(expr) != nullptr;
+}
+
+std::string constantText(const Expression *expr) {
+  if (auto unary = dynamic_cast<const UnaryExpression *>(expr))
+    return std::string("-").append(constantText(unary->right.get()));
+  return static_cast<const LiteralExpression *>(expr)->value;
+}
+
+const VariableExpression *calleeOf(const CallExpression &call) {
+  return dynamic_cast<const VariableExpression *>(call.callee.get());
+}
+
+Usage scanBody(const FunctionDeclaration &func) {
+  Usage usage;
+  scanUsage(func.body.get(), usage);
+  return usage;
+}
+
+void substitute(Statement *stmt, const Substitution &subst);
+
+void substitute(std::unique_ptr<Expression> &expr, const Substitution &subst) {
+  if (!expr)
+    return;
+
+  if (auto var = dynamic_cast<VariableExpression *>(expr.get())) {
+    auto it = subst.find(var->name);
+    if (it != subst.end())
+      expr = clone(it->second);
+  } else if (auto bin = dynamic_cast<BinaryExpression *>(expr.get())) {
+    substitute(bin->left, subst);
+    substitute(bin->right, subst);
+  } else if (auto unary = dynamic_cast<UnaryExpression *>(expr.get())) {
+    substitute(unary->right, subst);
+  } else if (auto paren = dynamic_cast<ParenthesizedExpression *>(expr.get())) {
+    substitute(paren->expression, subst);
+  } else if (auto index = dynamic_cast<IndexExpression *>(expr.get())) {
+    substitute(index->collection, subst);
+    substitute(index->index, subst);
+  } else if (auto call = dynamic_cast<CallExpression *>(expr.get())) {
+    // The callee names a function, never a parameter
+    for (auto &arg : call->arguments)
+      substitute(arg, subst);
+  } else if (auto meas = dynamic_cast<MeasureExpression *>(expr.get())) {
+    substitute(meas->qubit, subst);
+  } else if (auto assign = dynamic_cast<AssignmentExpression *>(expr.get())) {
+    substitute(assign->value, subst);
+  } else if (auto ctor = dynamic_cast<ConstructorCallExpression *>(expr.get())) {
+    for (auto &arg : ctor->arguments)
+      substitute(arg, subst);
+  }
+}
+
+void substitute(Statement *stmt, const Substitution &subst) {
+  if (!stmt)
+    return;
+
+  if (auto block = dynamic_cast<BlockStatement *>(stmt)) {
+    for (auto &inner : block->statements)
+      substitute(inner.get(), subst);
+  } else if (auto decl = dynamic_cast<VariableDeclaration *>(stmt)) {
+    if (auto at = dynamic_cast<ArrayType *>(decl->varType.get()))
+      substitute(at->size, subst);
+    substitute(decl->initializer, subst);
+  } else if (auto exprStmt = dynamic_cast<ExpressionStatement *>(stmt)) {
+    substitute(exprStmt->expression, subst);
+  } else if (auto ret = dynamic_cast<ReturnStatement *>(stmt)) {
+    substitute(ret->value, subst);
+  } else if (auto ifStmt = dynamic_cast<IfStatement *>(stmt)) {
+    substitute(ifStmt->condition, subst);
+    substitute(ifStmt->thenBranch.get(), subst);
+    substitute(ifStmt->elseBranch.get(), subst);
+  } else if (auto forStmt = dynamic_cast<ForStatement *>(stmt)) {
+    substitute(forStmt->initializer.get(), subst);
+    substitute(forStmt->condition, subst);
+    substitute(forStmt->increment, subst);
+    substitute(forStmt->body.get(), subst);
+  } else if (auto echo = dynamic_cast<EchoStatement *>(stmt)) {
+    substitute(echo->value, subst);
+  } else if (auto reset = dynamic_cast<ResetStatement *>(stmt)) {
+    substitute(reset->target, subst);
+  } else if (auto meas = dynamic_cast<MeasureStatement *>(stmt)) {
+    substitute(meas->qubit, subst);
+  } else if (auto assign = dynamic_cast<AssignmentStatement *>(stmt)) {
+    substitute(assign->value, subst);
+  }
+}
+
+// `final <type> <param> = <arg>;`, which constant folding substitutes
+// through the body when the argument is a constant
+std::unique_ptr<VariableDeclaration> bindParameter(const Parameter &param,
+                                                   const Expression *arg) {
+  auto decl = std::make_unique<VariableDeclaration>();
+  decl->name = param.name;
+  decl->varType = clone(param.type.get());
+  decl->initializer = clone(arg);
+  decl->isFinal = true;
+  return decl;
+}
+
+// Drops the leading `final` bindings that folding has substituted away
+void eraseFoldedBindings(BlockStatement &block, size_t bindings) {
+  auto it = block.statements.begin();
+  for (size_t k = 0; k < bindings && it != block.statements.end(); ++k) {
+    auto *decl = dynamic_cast<VariableDeclaration *>(it->get());
+    if (decl && decl->isFinal && isConstant(decl->initializer.get()))
+      it = block.statements.erase(it);
+    else
+      ++it;
+  }
+}
+
+class Inliner {
+public:
+  Inliner(Program &program, size_t limit);
+
+  void run();
+
+private:
+  Program &program;
+  size_t limit;
+  std::unordered_map<std::string, FunctionDeclaration *> quantum;
+  std::set<std::string> recursive;
+  std::unordered_map<std::string, size_t> sizes; // statements, once done
+  std::map<std::pair<std::string, std::vector<std::string>>, std::string>
+      specialisations;
+  std::vector<std::unique_ptr<FunctionDeclaration>> added;
+
+  std::vector<FunctionDeclaration *> bottomUp();
+  bool isCandidate(const CallExpression &call) const;
+
+  void rewrite(std::vector<std::unique_ptr<Statement>> &statements);
+  void rewrite(std::unique_ptr<Statement> &stmt);
+  void rewrite(std::unique_ptr<Expression> &expr);
+  std::unique_ptr<BlockStatement> inlineCall(const CallExpression &call);
+  void specialise(CallExpression &call);
+  std::string freshName(const std::string &base) const;
+};
+
+Inliner::Inliner(Program &program, size_t limit)
+    : program(program), limit(limit) {
+  for (const auto &func : program.functions) {
+    if (func->hasQuantumAnnotation && func->body)
+      quantum[func->name] = func.get();
+  }
+}
+
+void Inliner::run() {
+  for (FunctionDeclaration *func : bottomUp()) {
+    rewrite(func->body->statements);
+    sizes[func->name] = scanBody(*func).statements;
+  }
+  for (auto &func : added)
+    program.functions.push_back(std::move(func));
+}
+
+// Callees before callers. Functions on a call cycle are marked recursive.
+std::vector<FunctionDeclaration *> Inliner::bottomUp() {
+  enum class Mark { Unvisited, Active, Done };
+  std::unordered_map<std::string, Mark> marks;
+  std::vector<std::string> active;
+  std::vector<FunctionDeclaration *> order;
+
+  auto visit = [&](auto &self, FunctionDeclaration *func) -> void {
+    marks[func->name] = Mark::Active;
+    active.push_back(func->name);
+    for (const auto &name : scanBody(*func).called) {
+      auto callee = quantum.find(name);
+      if (callee == quantum.end())
+        continue;
+      if (marks[name] == Mark::Active) {
+        auto first = std::find(active.begin(), active.end(), name);
+        recursive.insert(first, active.end());
+      } else if (marks[name] == Mark::Unvisited) {
+        self(self, callee->second);
+      }
+    }
+    active.pop_back();
+    marks[func->name] = Mark::Done;
+    order.push_back(func);
+  };
+
+  // Declaration order, so the result does not depend on hashing
+  for (const auto &func : program.functions) {
+    if (quantum.count(func->name) && marks[func->name] == Mark::Unvisited)
+      visit(visit, func.get());
+  }
+  return order;
+}
+
+bool Inliner::isCandidate(const CallExpression &call) const {
+  auto *callee = calleeOf(call);
+  if (!callee || !quantum.count(callee->name) ||
+      recursive.count(callee->name))
+    return false;
+  const FunctionDeclaration *func = quantum.at(callee->name);
+  if (call.arguments.size() != func->params.size())
+    return false;
+
+  // Arguments are evaluated once, in the caller; parameters are never
+  // written in the body
+  Usage body = scanBody(*func);
+  for (size_t i = 0; i < call.arguments.size(); ++i) {
+    Usage arg;
+    scanUsage(call.arguments[i].get(), arg);
+    if (arg.hasEffects || body.assigned.count(func->params[i]->name))
+      return false;
+  }
+  return true;
+}
+
+void Inliner::rewrite(std::vector<std::unique_ptr<Statement>> &statements) {
+  for (auto &stmt : statements)
+    rewrite(stmt);
+}
+
+void Inliner::rewrite(std::unique_ptr<Statement> &stmt) {
+  if (auto exprStmt = dynamic_cast<ExpressionStatement *>(stmt.get())) {
+    auto *call = dynamic_cast<CallExpression *>(exprStmt->expression.get());
+    if (call && isCandidate(*call)) {
+      if (auto block = inlineCall(*call)) {
+        stmt = std::move(block);
+        return;
+      }
+    }
+    // Too large to inline: specialise it instead
+    rewrite(exprStmt->expression);
+  } else if (auto block = dynamic_cast<BlockStatement *>(stmt.get())) {
+    rewrite(block->statements);
+  } else if (auto decl = dynamic_cast<VariableDeclaration *>(stmt.get())) {
+    rewrite(decl->initializer);
+  } else if (auto ret = dynamic_cast<ReturnStatement *>(stmt.get())) {
+    rewrite(ret->value);
+  } else if (auto assign = dynamic_cast<AssignmentStatement *>(stmt.get())) {
+    rewrite(assign->value);
+  } else if (auto ifStmt = dynamic_cast<IfStatement *>(stmt.get())) {
+    rewrite(ifStmt->thenBranch);
+    if (ifStmt->elseBranch)
+      rewrite(ifStmt->elseBranch);
+  }
+}
+
+void Inliner::rewrite(std::unique_ptr<Expression> &expr) {
+  if (!expr)
+    return;
+  if (auto call = dynamic_cast<CallExpression *>(expr.get())) {
+    if (isCandidate(*call))
+      specialise(*call);
+  } else if (auto paren = dynamic_cast<ParenthesizedExpression *>(expr.get())) {
+    rewrite(paren->expression);
+  }
+}
+
+std::unique_ptr<BlockStatement>
+Inliner::inlineCall(const CallExpression &call) {
+  const FunctionDeclaration &func = *quantum.at(calleeOf(call)->name);
+  if (sizes.at(func.name) > limit)
+    return nullptr;
+
+  // Only a trailing return: the body then runs straight through
+  Usage body = scanBody(func);
+  const auto &statements = func.body->statements;
+  if (body.returns > 1 ||
+      (body.returns == 1 &&
+       (statements.empty() ||
+        !dynamic_cast<const ReturnStatement *>(statements.back().get()))))
+    return nullptr;
+
+  // The block is scoped, so the callee's locals cannot clash with the
+  // caller's; but an argument must not name one of them, or substituting
+  // it would capture the local
+  Usage args;
+  for (const auto &arg : call.arguments)
+    scanUsage(arg.get(), args);
+  for (const auto &name : args.read) {
+    if (body.declared.count(name))
+      return nullptr;
+  }
+
+  auto block = std::make_unique<BlockStatement>();
+  Substitution subst;
+  size_t bindings = 0;
+  for (size_t i = 0; i < func.params.size(); ++i) {
+    const Parameter &param = *func.params[i];
+    const Expression *arg = call.arguments[i].get();
+    // A classical argument that is not a constant is read in place, as a
+    // binding to it would leave a local for listings to declare
+    if (isQubitParameter(param) || !isConstant(arg)) {
+      if (body.declared.count(param.name))
+        return nullptr;
+      subst[param.name] = arg;
+    } else {
+      block->statements.push_back(bindParameter(param, arg));
+      bindings++;
+    }
+  }
+
+  for (const auto &stmt : statements) {
+    auto copy = clone(stmt.get());
+    substitute(copy.get(), subst);
+    if (auto ret = dynamic_cast<ReturnStatement *>(copy.get())) {
+      // The caller discards the value; a measurement still happens
+      if (dynamic_cast<MeasureExpression *>(ret->value.get()) ||
+          dynamic_cast<CallExpression *>(ret->value.get())) {
+        auto effect = std::make_unique<ExpressionStatement>();
+        effect->expression = std::move(ret->value);
+        block->statements.push_back(std::move(effect));
+      }
+      continue;
+    }
+    block->statements.push_back(std::move(copy));
+  }
+
+  foldConstants(*block);
+  eraseFoldedBindings(*block, bindings);
+  return block;
+}
+
+void Inliner::specialise(CallExpression &call) {
+  const FunctionDeclaration &func = *quantum.at(calleeOf(call)->name);
+
+  // Unused parameters do not tell copies apart
+  Usage body = scanBody(func);
+  std::vector<std::string> key;
+  bool classical = false;
+  for (size_t i = 0; i < func.params.size(); ++i) {
+    if (isQubitParameter(*func.params[i]))
+      continue;
+    if (!isConstant(call.arguments[i].get()))
+      return;
+    classical = true;
+    key.push_back(body.read.count(func.params[i]->name)
+                      ? constantText(call.arguments[i].get())
+                      : "_");
+  }
+  if (!classical)
+    return;
+
+  auto [it, inserted] =
+      specialisations.try_emplace({func.name, key}, std::string());
+  if (inserted) {
+    auto copy = std::make_unique<FunctionDeclaration>();
+    copy->name = it->second = freshName(func.name);
+    copy->returnType = clone(func.returnType.get());
+    for (const auto &ann : func.annotations)
+      copy->annotations.push_back(
+          std::make_unique<AnnotationNode>(ann->name, ann->value));
+    copy->hasQuantumAnnotation = true;
+
+    copy->body = std::make_unique<BlockStatement>();
+    size_t bindings = 0;
+    for (size_t i = 0; i < func.params.size(); ++i) {
+      const Parameter &param = *func.params[i];
+      if (isQubitParameter(param)) {
+        auto kept = std::make_unique<Parameter>();
+        kept->name = param.name;
+        kept->type = clone(param.type.get());
+        copy->params.push_back(std::move(kept));
+      } else {
+        copy->body->statements.push_back(
+            bindParameter(param, call.arguments[i].get()));
+        bindings++;
+      }
+    }
+    for (const auto &stmt : func.body->statements)
+      copy->body->statements.push_back(clone(stmt.get()));
+    foldConstants(*copy->body);
+    eraseFoldedBindings(*copy->body, bindings);
+    added.push_back(std::move(copy));
+  }
+
+  std::vector<std::unique_ptr<Expression>> qubits;
+  for (size_t i = 0; i < func.params.size(); ++i) {
+    if (isQubitParameter(*func.params[i]))
+      qubits.push_back(std::move(call.arguments[i]));
+  }
+  call.arguments = std::move(qubits);
+  call.callee = std::make_unique<VariableExpression>(it->second);
+}
+
+std::string Inliner::freshName(const std::string &base) const {
+  auto taken = [&](const std::string &name) {
+    if (quantum.count(name))
+      return true;
+    for (const auto &func : program.functions) {
+      if (func->name == name)
+        return true;
+    }
+    return std::any_of(added.begin(), added.end(),
+                       [&](const auto &func) { return func->name == name; });
+  };
+  for (size_t k = 1;; ++k) {
+    std::string name = base + "_" + std::to_string(k);
+    if (!taken(name))
+      return name;
+  }
+}
+
+} // namespace
+
+void inlineFunctions(Program &program, size_t limit) {
+  if (limit == 0)
+    return;
+  Inliner(program, limit).run();
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ast/ast.hpp"
+
+// Inlines and specialises calls between @quantum functions, walking the
+// call graph bottom-up so a caller sees its callees already flattened.
+// Recursive functions are left alone.
+//
+// A call made as a statement, `f(a, q[1], 0.5f);`, is replaced by a block
+// holding f's body when the body has at most `limit` statements. Qubit
+// parameters, and classical ones given a non-constant argument, are
+// substituted by the arguments; the others become `final` locals bound to
+// their constants, which fold into the body and specialise it. A trailing `return measure q;` stays as a measurement.
+//
+// Larger callees whose classical arguments are all constants are
+// specialised instead: the call is redirected to a copy of the function
+// with those arguments folded in, one copy per distinct argument list.
+//
+// Both leave gate sequences that cancellation and fusion can work on in
+// the function's own listing. A limit of 0 turns the pass off. Run after
+// unrollLoops().
+void inlineFunctions(Program &program, size_t limit);
@@ -0,0 +1,144 @@
+#include "layout.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Diagonal gates scale each amplitude in place, so the bits they act on
+// make no difference to memory access
+bool needsLocality(const Gate &gate) {
+  return isUnitary(gate.kind) && gateClass(gate.kind) != GateClass::Diagonal;
+}
+
+// Upper bound on how far ahead a remap looks for its run of gates
+constexpr size_t kMaxScan = 4096;
+
+class Layout {
+public:
+  Layout(unsigned numQubits, unsigned localQubits)
+      : localQubits(localQubits) {
+    for (unsigned q = 0; q < numQubits; ++q) {
+      bitOf.push_back(q);
+      qubitAt.push_back(q);
+    }
+  }
+
+  bool isLocal(const Gate &gate) const {
+    for (int k = 0; k < arity(gate.kind); ++k) {
+      if (bitOf[gate.qubits[k]] >= localQubits)
+        return false;
+    }
+    return true;
+  }
+
+  Gate relabel(Gate gate) const {
+    for (int k = 0; k < arity(gate.kind); ++k)
+      gate.qubits[k] = bitOf[gate.qubits[k]];
+    return gate;
+  }
+
+  // Exchanges the qubits held by two bits and records the Swap gate
+  void swapBits(unsigned a, unsigned b, std::vector<Gate> &out) {
+    Gate swap{GateKind::Swap, {a, b}};
+    out.push_back(swap);
+    std::swap(qubitAt[a], qubitAt[b]);
+    bitOf[qubitAt[a]] = a;
+    bitOf[qubitAt[b]] = b;
+  }
+
+  // Moves every qubit in `hot` onto a local bit, evicting local qubits
+  // that are not in `hot`
+  void makeLocal(const std::vector<unsigned> &hot, std::vector<Gate> &out) {
+    std::vector<bool> wanted(bitOf.size(), false);
+    for (unsigned q : hot)
+      wanted[q] = true;
+
+    unsigned victim = 0;
+    for (unsigned q : hot) {
+      if (bitOf[q] < localQubits)
+        continue;
+      while (wanted[qubitAt[victim]])
+        victim++;
+      swapBits(victim, bitOf[q], out);
+    }
+  }
+
+  // Returns every qubit to the bit of the same index
+  void restore(std::vector<Gate> &out) {
+    for (unsigned bit = 0; bit < qubitAt.size(); ++bit) {
+      if (qubitAt[bit] != bit)
+        swapBits(bit, bitOf[bit], out);
+    }
+  }
+
+private:
+  unsigned localQubits;
+  std::vector<unsigned> bitOf;   // qubit -> bit
+  std::vector<unsigned> qubitAt; // bit -> qubit
+};
+
+// The distinct qubits of the longest run of gates starting at `first` that
+// fits in `capacity` qubits; `run` receives the number of gates in it that
+// need locality
+std::vector<unsigned> upcomingQubits(const std::vector<Gate> &gates,
+                                     size_t first, unsigned capacity,
+                                     size_t &run) {
+  std::vector<unsigned> hot;
+  size_t end = std::min(gates.size(), first + kMaxScan);
+  run = 0;
+  for (size_t i = first; i < end; ++i) {
+    const Gate &gate = gates[i];
+    if (!needsLocality(gate))
+      continue;
+    std::vector<unsigned> added;
+    for (int k = 0; k < arity(gate.kind); ++k) {
+      unsigned q = gate.qubits[k];
+      if (std::find(hot.begin(), hot.end(), q) == hot.end() &&
+          std::find(added.begin(), added.end(), q) == added.end())
+        added.push_back(q);
+    }
+    if (hot.size() + added.size() > capacity)
+      break;
+    hot.insert(hot.end(), added.begin(), added.end());
+    run++;
+  }
+  return hot;
+}
+
+// Index of the run of measurements that ends the circuit
+size_t finalMeasurements(const Circuit &circuit) {
+  size_t first = circuit.gates.size();
+  while (first > 0 && circuit.gates[first - 1].kind == GateKind::Measure)
+    first--;
+  return first;
+}
+
+} // namespace
+
+Circuit planLayout(const Circuit &circuit, const LayoutOptions &options) {
+  if (circuit.numQubits <= options.localQubits)
+    return circuit;
+
+  Circuit result = circuit;
+  result.gates.clear();
+  Layout layout(circuit.numQubits, options.localQubits);
+
+  // The final measurements are sampled from the whole state, in index
+  // order; they read it in the original layout so a seed gives the
+  // counts it gives without this pass
+  const size_t end = finalMeasurements(circuit);
+  for (size_t i = 0; i < end; ++i) {
+    const Gate &gate = circuit.gates[i];
+    if (needsLocality(gate) && !layout.isLocal(gate)) {
+      size_t run = 0;
+      auto hot = upcomingQubits(circuit.gates, i, options.localQubits, run);
+      if (run >= options.minRun)
+        layout.makeLocal(hot, result.gates);
+    }
+    result.gates.push_back(layout.relabel(gate));
+  }
+  layout.restore(result.gates);
+  result.gates.insert(result.gates.end(), circuit.gates.begin() + end,
+                      circuit.gates.end());
+  return result;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ir/circuit.hpp"
+
+struct LayoutOptions {
+  // Bits below this index address amplitudes within one cache-sized block
+  // (2^14 amplitudes: 256 KiB in double precision)
+  unsigned localQubits = 14;
+
+  // Only remap when the new layout keeps at least this many upcoming gates
+  // on local bits; a remap costs about as much as one gate
+  size_t minRun = 8;
+};
+
+// Qubit layout pass. Rewrites `circuit` so that runs of upcoming gates act
+// on low-order (cache-local) bits, in the style of qHiPSTER and qsim: when
+// a gate reaches a high-order bit, the qubits used next are swapped into
+// the low bits in one go and the following gates are relabelled. The
+// swaps are ordinary Swap gates on disjoint bit pairs, which the simulator
+// merges into a single cache-blocked transpose.
+//
+// The result is equivalent to `circuit`: measurements before the end are
+// relabelled, and the original layout is restored before the final
+// measurements, so sampling and expect() see every qubit under its own
+// index and a seed gives the same counts as without the pass.
+Circuit planLayout(const Circuit &circuit, const LayoutOptions &options = {});
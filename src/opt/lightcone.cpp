@@ -0,0 +1,104 @@
+#include "lightcone.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+bool hasMeasurements(const Circuit &circuit) {
+  return std::any_of(
+      circuit.gates.begin(), circuit.gates.end(),
+      [](const Gate &gate) { return gate.kind == GateKind::Measure; });
+}
+
+} // namespace
+
+Circuit pruneLightCone(const Circuit &circuit) {
+  if (!hasMeasurements(circuit))
+    return circuit;
+
+  std::vector<bool> live(circuit.numQubits, false);
+  std::vector<bool> measuredNext(circuit.numQubits, false);
+  std::vector<bool> keep(circuit.gates.size(), false);
+
+  // Observables read their qubits at the very end, phases included
+  for (const auto &observable : circuit.observables) {
+    for (const auto &term : observable.terms) {
+      for (const auto &[q, pauli] : term.factors)
+        live[q] = true;
+    }
+  }
+
+  for (size_t i = circuit.gates.size(); i-- > 0;) {
+    const Gate &gate = circuit.gates[i];
+    const int n = arity(gate.kind);
+
+    if (gate.kind == GateKind::Measure) {
+      keep[i] = true;
+      live[gate.qubits[0]] = true;
+      measuredNext[gate.qubits[0]] = true;
+      continue;
+    }
+    if (gate.kind == GateKind::Reset) {
+      // Whatever the qubit held before is discarded
+      keep[i] = live[gate.qubits[0]];
+      live[gate.qubits[0]] = false;
+      measuredNext[gate.qubits[0]] = false;
+      continue;
+    }
+
+    bool touchesLive = false;
+    bool onlyPhases = gateClass(gate.kind) == GateClass::Diagonal;
+    for (int k = 0; k < n; ++k) {
+      unsigned q = gate.qubits[k];
+      touchesLive = touchesLive || live[q];
+      if (live[q] && !measuredNext[q])
+        onlyPhases = false;
+    }
+    if (!touchesLive || onlyPhases)
+      continue;
+
+    keep[i] = true;
+    for (int k = 0; k < n; ++k) {
+      live[gate.qubits[k]] = true;
+      measuredNext[gate.qubits[k]] = false;
+    }
+  }
+
+  // Renumber the qubits that still have gates
+  constexpr unsigned kUnused = std::numeric_limits<unsigned>::max();
+  std::vector<unsigned> renumbered(circuit.numQubits, kUnused);
+  for (size_t i = 0; i < circuit.gates.size(); ++i) {
+    if (!keep[i])
+      continue;
+    const Gate &gate = circuit.gates[i];
+    for (int k = 0; k < arity(gate.kind); ++k)
+      renumbered[gate.qubits[k]] = 0;
+  }
+  for (const auto &observable : circuit.observables) {
+    for (const auto &term : observable.terms) {
+      for (const auto &[q, pauli] : term.factors)
+        renumbered[q] = 0;
+    }
+  }
+
+  Circuit result;
+  result.bitNames = circuit.bitNames;
+  for (unsigned q = 0; q < circuit.numQubits; ++q) {
+    if (renumbered[q] != kUnused)
+      renumbered[q] =
+          result.addQubit(circuit.qubitNames[q], circuit.initialStates[q]);
+  }
+  for (size_t i = 0; i < circuit.gates.size(); ++i) {
+    if (!keep[i])
+      continue;
+    Gate gate = circuit.gates[i];
+    for (int k = 0; k < arity(gate.kind); ++k)
+      gate.qubits[k] = renumbered[gate.qubits[k]];
+    result.gates.push_back(gate);
+  }
+  result.observables = circuit.observables;
+  for (auto &observable : result.observables)
+    observable.relabel(renumbered);
+  return result;
+}
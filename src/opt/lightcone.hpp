@@ -0,0 +1,17 @@
+#pragma once
+
+#include "ir/circuit.hpp"
+
+// Backward light-cone pruning. Once a circuit has measurements, only the
+// measured bits are reported, so a gate matters only if its effect can
+// reach a measurement or an observable. Walking the gates backwards from
+// the end, a qubit becomes live at a measurement, or from the start of the
+// walk if an observable reads it, and dead again before a reset. Gates are
+// dropped when:
+//  - none of their qubits is live;
+//  - they are diagonal and every live qubit they touch is measured next,
+//    since a phase in front of a measurement cannot be observed.
+// Qubits left without gates are removed and the rest renumbered in order.
+// A circuit without measurements reports every qubit and is returned as
+// is.
+Circuit pruneLightCone(const Circuit &circuit);
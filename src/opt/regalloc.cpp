@@ -0,0 +1,113 @@
+#include "regalloc.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+bool hasMeasurements(const Circuit &circuit) {
+  return std::any_of(
+      circuit.gates.begin(), circuit.gates.end(),
+      [](const Gate &gate) { return gate.kind == GateKind::Measure; });
+}
+
+class Allocator {
+public:
+  explicit Allocator(const Circuit &circuit)
+      : circuit(circuit), physicalOf(circuit.numQubits, kUnassigned) {
+    result.bitNames = circuit.bitNames;
+  }
+
+  Circuit run();
+
+private:
+  static constexpr unsigned kUnassigned =
+      std::numeric_limits<unsigned>::max();
+
+  const Circuit &circuit;
+  Circuit result;
+  std::vector<unsigned> physicalOf; // logical -> physical
+  std::vector<unsigned> clean;      // free physical qubits in |0>
+  std::vector<unsigned> dirty;      // free physical qubits in any state
+
+  unsigned place(unsigned logical);
+};
+
+Circuit Allocator::run() {
+  std::vector<size_t> lastUse(circuit.numQubits, 0);
+  for (size_t i = 0; i < circuit.gates.size(); ++i) {
+    const Gate &gate = circuit.gates[i];
+    for (int k = 0; k < arity(gate.kind); ++k)
+      lastUse[gate.qubits[k]] = i;
+  }
+  // Observed qubits stay live to the end and are never handed on
+  std::vector<unsigned> observed;
+  for (const auto &observable : circuit.observables) {
+    for (const auto &term : observable.terms) {
+      for (const auto &[q, pauli] : term.factors) {
+        lastUse[q] = circuit.gates.size();
+        observed.push_back(q);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < circuit.gates.size(); ++i) {
+    Gate gate = circuit.gates[i];
+    for (int k = 0; k < arity(gate.kind); ++k) {
+      unsigned logical = gate.qubits[k];
+      if (physicalOf[logical] == kUnassigned)
+        physicalOf[logical] = place(logical);
+      gate.qubits[k] = physicalOf[logical];
+    }
+    result.gates.push_back(gate);
+
+    for (int k = 0; k < arity(gate.kind); ++k) {
+      if (lastUse[circuit.gates[i].qubits[k]] != i)
+        continue;
+      if (gate.kind == GateKind::Reset)
+        clean.push_back(gate.qubits[k]);
+      else
+        dirty.push_back(gate.qubits[k]);
+    }
+  }
+
+  // An observed qubit without gates still gets a qubit of its own; it is
+  // added fresh so no reset lands after the measurements
+  for (unsigned q : observed) {
+    if (physicalOf[q] == kUnassigned)
+      physicalOf[q] =
+          result.addQubit(circuit.qubitNames[q], circuit.initialStates[q]);
+  }
+  result.observables = circuit.observables;
+  for (auto &observable : result.observables)
+    observable.relabel(physicalOf);
+  return std::move(result);
+}
+
+unsigned Allocator::place(unsigned logical) {
+  const QubitState state = circuit.initialStates[logical];
+  unsigned physical;
+  if (!clean.empty()) {
+    physical = clean.back();
+    clean.pop_back();
+  } else if (!dirty.empty()) {
+    physical = dirty.back();
+    dirty.pop_back();
+    result.gates.push_back(Gate{GateKind::Reset, {physical, 0}});
+  } else {
+    // A fresh qubit is untouched until now, so it can start in its state
+    return result.addQubit(circuit.qubitNames[logical], state);
+  }
+
+  for (GateKind kind : preparation(state))
+    result.gates.push_back(Gate{kind, {physical, 0}});
+  return physical;
+}
+
+} // namespace
+
+Circuit allocateQubits(const Circuit &circuit) {
+  if (!hasMeasurements(circuit))
+    return circuit;
+  return Allocator(circuit).run();
+}
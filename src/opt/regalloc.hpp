@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ir/circuit.hpp"
+
+// Qubit register allocation. Lowering gives every qubit the program
+// declares its own logical index: top-level qubits, array elements and the
+// locals of each inlined @quantum call. This pass maps them onto as few
+// physical qubits as liveness allows, scanning the gates in order:
+//  - a logical qubit takes a physical one at its first gate;
+//  - it frees it after its last gate. Outcomes are read from explicit
+//    measurements only, so whatever a dead qubit is left holding can no
+//    longer be observed;
+//  - a freed qubit whose last gate was not a reset is reset before reuse,
+//    and the @state of its new occupant is prepared with gates.
+// Qubits read by an observable are live until the end. Qubits that are
+// never used get no physical qubit. A circuit without
+// measurements reports every qubit at the end, so it is returned as is.
+Circuit allocateQubits(const Circuit &circuit);
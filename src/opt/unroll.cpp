@@ -0,0 +1,121 @@
+#include "unroll.hpp"
+#include "ast/clone.hpp"
+#include "constfold.hpp"
+
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+class LoopUnroller {
+public:
+  explicit LoopUnroller(size_t limit) : limit(limit) {}
+
+  void run(FunctionDeclaration &func);
+
+private:
+  size_t limit;
+  std::string function; // for diagnostics
+
+  void unrollStatements(std::vector<std::unique_ptr<Statement>> &statements,
+                        size_t copies);
+  void unrollStatement(std::unique_ptr<Statement> &stmt, size_t copies);
+  std::unique_ptr<BlockStatement> unrollLoop(const ForStatement &loop,
+                                             size_t copies);
+  [[noreturn]] void reportError(const std::string &msg);
+};
+
+void LoopUnroller::run(FunctionDeclaration &func) {
+  function = func.name;
+  if (func.body)
+    unrollStatements(func.body->statements, 1);
+}
+
+void LoopUnroller::unrollStatements(
+    std::vector<std::unique_ptr<Statement>> &statements, size_t copies) {
+  for (auto &stmt : statements)
+    unrollStatement(stmt, copies);
+}
+
+void LoopUnroller::unrollStatement(std::unique_ptr<Statement> &stmt,
+                                   size_t copies) {
+  if (auto loop = dynamic_cast<ForStatement *>(stmt.get())) {
+    stmt = unrollLoop(*loop, copies);
+  } else if (auto block = dynamic_cast<BlockStatement *>(stmt.get())) {
+    unrollStatements(block->statements, copies);
+  } else if (auto ifStmt = dynamic_cast<IfStatement *>(stmt.get())) {
+    unrollStatement(ifStmt->thenBranch, copies);
+    if (ifStmt->elseBranch)
+      unrollStatement(ifStmt->elseBranch, copies);
+  }
+}
+
+std::unique_ptr<BlockStatement>
+LoopUnroller::unrollLoop(const ForStatement &loop, size_t copies) {
+  auto bounds = loopBounds(loop);
+  if (!bounds) {
+    reportError("Loop in @quantum function '" + function +
+                "' cannot be unrolled: it must count an int variable between "
+                "compile-time constant bounds");
+  }
+  const size_t total = copies * static_cast<size_t>(bounds->tripCount);
+  if (bounds->tripCount > 0 &&
+      (total / static_cast<size_t>(bounds->tripCount) != copies ||
+       total > limit)) {
+    std::stringstream err;
+    err << "Loop over '" << bounds->variable << "' in @quantum function '"
+        << function << "' would copy its body " << total
+        << " times, more than the unroll limit of " << limit;
+    reportError(err.str());
+  }
+
+  auto unrolled = std::make_unique<BlockStatement>();
+  const auto *body = dynamic_cast<const BlockStatement *>(loop.body.get());
+  int64_t value = bounds->start;
+  for (int64_t k = 0; k < bounds->tripCount; ++k, value += bounds->step) {
+    // { final int i = value; body } folds every use of i to the literal
+    auto iteration = std::make_unique<BlockStatement>();
+    auto counter = std::make_unique<VariableDeclaration>();
+    counter->name = bounds->variable;
+    counter->varType = std::make_unique<PrimitiveType>("int");
+    counter->initializer =
+        std::make_unique<LiteralExpression>(std::to_string(std::abs(value)));
+    if (value < 0) {
+      counter->initializer = std::make_unique<UnaryExpression>(
+          "-", std::move(counter->initializer));
+    }
+    counter->isFinal = true;
+    iteration->statements.push_back(std::move(counter));
+    if (body) {
+      for (const auto &stmt : body->statements)
+        iteration->statements.push_back(clone(stmt.get()));
+    } else {
+      iteration->statements.push_back(clone(loop.body.get()));
+    }
+
+    foldConstants(*iteration);
+    // The counter has been substituted everywhere; it is not a variable of
+    // the quantum program
+    iteration->statements.erase(iteration->statements.begin());
+    unrollStatements(iteration->statements, total);
+    unrolled->statements.push_back(std::move(iteration));
+  }
+  return unrolled;
+}
+
+void LoopUnroller::reportError(const std::string &msg) {
+  std::stringstream err;
+  err << "[Quanta Unroll Error]\n" << msg << "\n";
+  throw std::runtime_error(err.str());
+}
+
+} // namespace
+
+void unrollLoops(Program &program, size_t limit) {
+  LoopUnroller unroller(limit);
+  for (auto &func : program.functions) {
+    if (func->hasQuantumAnnotation)
+      unroller.run(*func);
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ast/ast.hpp"
+
+// Fully unrolls `for` loops inside @quantum functions, so lowering and the
+// OpenQASM backend see a straight-line gate sequence. Each iteration
+// becomes a block in which the loop variable is replaced by its value and
+// the body is constant-folded, which resolves indices such as `q[i + 1]`
+// and the bounds of nested loops.
+//
+// Loops must have compile-time bounds (see loopBounds()); anything else is
+// reported as an error, as is a loop whose body would be copied more than
+// `limit` times, counting the copies made by enclosing loops. Run after
+// foldConstants(), which resolves `final` bounds.
+void unrollLoops(Program &program, size_t limit);
@@ -597,7 +597,9 @@ std::unique_ptr<Expression> Parser::parseCall() {
 
   while (true) {
     if (match(TokenType::Dot)) {
-      expect(TokenType::Identifier, "Expected member name after '.'");
+      // `f.adjoint(...)` calls the inverse of an @adjoint function
+      if (!match(TokenType::Adjoint))
+        expect(TokenType::Identifier, "Expected member name after '.'");
       std::string member = previous().value;
       expr = std::make_unique<MemberAccessExpression>(std::move(expr), member);
     } else if (match(TokenType::LParen)) {
@@ -609,6 +611,12 @@ std::unique_ptr<Expression> Parser::parseCall() {
       }
       expect(TokenType::RParen, "Expected ')' after arguments");
       expr = std::make_unique<CallExpression>(std::move(expr), std::move(args));
+    } else if (match(TokenType::LBracket)) {
+      auto index = std::make_unique<IndexExpression>();
+      index->collection = std::move(expr);
+      index->index = parseExpression();
+      expect(TokenType::RBracket, "Expected ']' after index");
+      expr = std::move(index);
     } else {
       break;
     }
@@ -620,6 +628,10 @@ std::unique_ptr<Expression> Parser::parseCall() {
 std::unique_ptr<Expression> Parser::parsePrimary() {
   if (match(TokenType::IntegerLiteral) || match(TokenType::FloatLiteral) ||
       match(TokenType::StringLiteral) || match(TokenType::CharLiteral)) {
+    if (previous().type == TokenType::CharLiteral &&
+        previous().value.size() != 3) {
+      reportError("Character literal must hold exactly one character");
+    }
     return std::make_unique<LiteralExpression>(
         LiteralExpression{previous().value});
   }
@@ -678,8 +690,11 @@ std::unique_ptr<Type> Parser::parseType() {
 
     // Array types are only allowed for primitive types
     if (match(TokenType::LBracket)) {
+      std::unique_ptr<Expression> size;
+      if (!check(TokenType::RBracket))
+        size = parseExpression();
       expect(TokenType::RBracket, "Expected ']' after '[' in array type");
-      return parseArrayType(std::move(baseType));
+      return parseArrayType(std::move(baseType), std::move(size));
     }
 
     return baseType;
@@ -724,8 +739,9 @@ std::unique_ptr<Type> Parser::parsePrimitiveType() {
 }
 
 std::unique_ptr<Type>
-Parser::parseArrayType(std::unique_ptr<Type> elementType) {
-  return std::make_unique<ArrayType>(ArrayType{std::move(elementType)});
+Parser::parseArrayType(std::unique_ptr<Type> elementType,
+                       std::unique_ptr<Expression> size) {
+  return std::make_unique<ArrayType>(std::move(elementType), std::move(size));
 }
 
 // Parameters and Argments
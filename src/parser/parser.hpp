@@ -72,7 +72,8 @@ private:
   // Types
   std::unique_ptr<Type> parseType();
   std::unique_ptr<Type> parsePrimitiveType();
-  std::unique_ptr<Type> parseArrayType(std::unique_ptr<Type> elementType);
+  std::unique_ptr<Type> parseArrayType(std::unique_ptr<Type> elementType,
+                                       std::unique_ptr<Expression> size);
 
   // Parameters and Arguments
   std::vector<std::unique_ptr<Parameter>> parseParameterList();
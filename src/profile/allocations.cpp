@@ -0,0 +1,44 @@
+#include <cstdlib>
+#include <new>
+
+#include "stats.hpp"
+
+// Replaces the global allocation functions to count every allocation for
+// --stats; off, they cost one relaxed load on top of malloc(). Linked into
+// the `quanta` executable only, so the library and its tests keep the
+// standard allocator. The nothrow forms are replaced too, so every
+// unaligned allocation is counted and freed alike; the aligned forms are
+// left to the standard library, which pairs them with its own delete.
+
+void *operator new(size_t size) {
+  Stats::add(Counter::Allocations);
+  Stats::add(Counter::AllocatedBytes, size);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return ::operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return ::operator new(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return ::operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
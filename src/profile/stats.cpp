@@ -0,0 +1,195 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+struct PhaseRecord {
+  const char *name;
+  double seconds = 0.0;
+  uint64_t calls = 0;
+  uint64_t rssBytes = 0; // at the end of its last run
+};
+
+// Entries are only ever appended, and at most kMaxKernels of them, so
+// lookups scan without the lock
+constexpr size_t kMaxKernels = 64;
+
+struct KernelRecord {
+  std::atomic<const char *> name{nullptr};
+  std::atomic<uint64_t> runs{0};
+  std::atomic<uint64_t> nanos{0};
+  std::atomic<uint64_t> bytes{0};
+};
+
+std::mutex lock;
+std::vector<PhaseRecord> phases;
+KernelRecord kernels[kMaxKernels];
+std::atomic<size_t> kernelCount{0};
+
+constexpr const char *kCounterNames[] = {
+    "source_bytes",    "tokens",        "ast_nodes",  "allocations",
+    "allocated_bytes", "gates_applied", "bytes_moved"};
+static_assert(std::size(kCounterNames) ==
+              static_cast<size_t>(Counter::Count));
+
+constexpr double MiB = 1024.0 * 1024.0;
+
+uint64_t residentBytes() {
+  long pages = 0, resident = 0;
+  if (FILE *statm = std::fopen("/proc/self/statm", "r")) {
+    if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    std::fclose(statm);
+  }
+  return static_cast<uint64_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// The kernel updates its high-water mark lazily; the samples taken after
+// each phase may be ahead of it
+uint64_t peakResidentBytes() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  uint64_t peak = std::max<uint64_t>(
+      static_cast<uint64_t>(usage.ru_maxrss) * 1024, residentBytes());
+  for (const auto &phase : phases)
+    peak = std::max(peak, phase.rssBytes);
+  return peak;
+}
+
+// Names are compared by content: the same literal in two translation
+// units may have two addresses
+KernelRecord *findKernel(const char *name, size_t count) {
+  for (size_t k = 0; k < count; ++k) {
+    if (std::strcmp(kernels[k].name.load(std::memory_order_relaxed), name) ==
+        0)
+      return &kernels[k];
+  }
+  return nullptr;
+}
+
+KernelRecord &kernelRecord(const char *name) {
+  if (KernelRecord *record =
+          findKernel(name, kernelCount.load(std::memory_order_acquire)))
+    return *record;
+  std::lock_guard<std::mutex> guard(lock);
+  const size_t count = kernelCount.load(std::memory_order_relaxed);
+  if (KernelRecord *record = findKernel(name, count))
+    return *record;
+  // Past the table's end everything lands in its last entry
+  if (count == kMaxKernels)
+    return kernels[kMaxKernels - 1];
+  kernels[count].name.store(name, std::memory_order_relaxed);
+  kernelCount.store(count + 1, std::memory_order_release);
+  return kernels[count];
+}
+
+double secondsOf(const char *name) {
+  for (const auto &phase : phases) {
+    if (std::strcmp(phase.name, name) == 0)
+      return phase.seconds;
+  }
+  return 0.0;
+}
+
+} // namespace
+
+void Stats::kernel(const char *name, Clock::time_point start,
+                   uint64_t bytes) {
+  const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         Clock::now() - start)
+                         .count();
+  KernelRecord &record = kernelRecord(name);
+  record.runs.fetch_add(1, std::memory_order_relaxed);
+  record.nanos.fetch_add(nanos, std::memory_order_relaxed);
+  record.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  add(Counter::BytesMoved, bytes);
+}
+
+void Stats::phase(const char *name, Clock::time_point start) {
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  const uint64_t rss = residentBytes();
+  std::lock_guard<std::mutex> guard(lock);
+  for (auto &phase : phases) {
+    if (std::strcmp(phase.name, name) == 0) {
+      phase.seconds += seconds;
+      phase.calls++;
+      phase.rssBytes = rss;
+      return;
+    }
+  }
+  phases.push_back({name, seconds, 1, rss});
+}
+
+void Stats::print(std::ostream &out, bool json) {
+  std::lock_guard<std::mutex> guard(lock);
+  const double lexSeconds = secondsOf("lex");
+  const double tokensPerSecond =
+      lexSeconds > 0 ? get(Counter::Tokens) / lexSeconds : 0.0;
+  const size_t kernelTotal = kernelCount.load(std::memory_order_acquire);
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+
+  if (json) {
+    out << std::fixed << std::setprecision(3) << "{\"phases\":[";
+    for (size_t k = 0; k < phases.size(); ++k) {
+      out << (k ? "," : "") << "{\"name\":\"" << phases[k].name
+          << "\",\"ms\":" << phases[k].seconds * 1e3
+          << ",\"calls\":" << phases[k].calls
+          << ",\"rss_mib\":" << phases[k].rssBytes / MiB << "}";
+    }
+    out << "],\"counters\":{";
+    for (int c = 0; c < static_cast<int>(Counter::Count); ++c) {
+      out << (c ? "," : "") << "\"" << kCounterNames[c]
+          << "\":" << get(static_cast<Counter>(c));
+    }
+    out << "},\"tokens_per_sec\":" << tokensPerSecond
+        << ",\"peak_rss_mib\":" << peakResidentBytes() / MiB
+        << ",\"kernels\":[";
+    for (size_t k = 0; k < kernelTotal; ++k) {
+      const KernelRecord &r = kernels[k];
+      out << (k ? "," : "") << "{\"name\":\"" << r.name.load()
+          << "\",\"runs\":" << r.runs.load()
+          << ",\"ms\":" << r.nanos.load() / 1e6
+          << ",\"bytes\":" << r.bytes.load() << "}";
+    }
+    out << "]}\n";
+  } else {
+    out << "====================== STATS =======================\n";
+    out << std::fixed << std::setprecision(3);
+    out << "phase                 ms   calls  rss MiB\n";
+    for (const auto &phase : phases) {
+      out << "  " << std::left << std::setw(14) << phase.name << std::right
+          << std::setw(10) << phase.seconds * 1e3 << std::setw(8)
+          << phase.calls << std::setw(9) << phase.rssBytes / MiB << "\n";
+    }
+    out << "peak rss: " << peakResidentBytes() / MiB << " MiB\n";
+    for (int c = 0; c < static_cast<int>(Counter::Count); ++c) {
+      out << kCounterNames[c] << ": " << get(static_cast<Counter>(c))
+          << "\n";
+    }
+    out << std::setprecision(0) << "tokens/sec: " << tokensPerSecond << "\n"
+        << std::setprecision(3);
+    if (kernelTotal) {
+      out << "kernel               runs          ms   MiB moved\n";
+      for (size_t k = 0; k < kernelTotal; ++k) {
+        const KernelRecord &r = kernels[k];
+        out << "  " << std::left << std::setw(14) << r.name.load()
+            << std::right << std::setw(10) << r.runs.load() << std::setw(12)
+            << r.nanos.load() / 1e6 << std::setw(12)
+            << r.bytes.load() / MiB << "\n";
+      }
+    }
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "trace.hpp"
+
+// Counters kept while --stats is on
+enum class Counter {
+  SourceBytes,
+  Tokens,
+  AstNodes,       // constructed, by the parser or by passes copying code
+  Allocations,    // calls to operator new
+  AllocatedBytes,
+  GatesApplied,   // gates applied to a state vector, or to a batch of them
+  BytesMoved,     // state-vector bytes read and written by gate kernels
+  Count
+};
+
+// Process-wide instrumentation behind --stats: phase timers with a
+// resident-set sample at the end of each phase, counters, and time spent
+// in each gate kernel. Everything is off until enable(). While off, a
+// counter or timer costs one relaxed atomic load, so the calls stay in
+// the hot paths. Counters are atomic and may be bumped from any thread.
+class Stats {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static void enable() { on.store(true, std::memory_order_relaxed); }
+  static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+  static void add(Counter counter, uint64_t n = 1) {
+    if (enabled())
+      counters[static_cast<int>(counter)].fetch_add(
+          n, std::memory_order_relaxed);
+  }
+  static uint64_t get(Counter counter) {
+    return counters[static_cast<int>(counter)].load(
+        std::memory_order_relaxed);
+  }
+
+  // One run of the kernel `kernel` (a gate name or a batched step, a
+  // string literal) over `bytes` of amplitudes, started at `start`
+  static void kernel(const char *kernel, Clock::time_point start,
+                     uint64_t bytes);
+
+  // Closes phase `name`, begun at `start`; repeated phases add up
+  static void phase(const char *name, Clock::time_point start);
+
+  // Phases in the order they first ran, counters, throughput and the
+  // kernel table, as text or as one JSON object
+  static void print(std::ostream &out, bool json);
+
+private:
+  static inline std::atomic<bool> on{false};
+  static inline std::atomic<uint64_t> counters[static_cast<int>(
+      Counter::Count)]{};
+};
+
+// Times the enclosing scope as phase `name`, and traces it as a span
+class PhaseTimer {
+public:
+  explicit PhaseTimer(const char *name) : name(name) {
+    if (Stats::enabled() || Trace::enabled())
+      start = Stats::Clock::now();
+  }
+  ~PhaseTimer() {
+    if (Stats::enabled())
+      Stats::phase(name, start);
+    if (Trace::enabled())
+      Trace::span("phase", name, start, Stats::Clock::now());
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+  const char *name;
+  Stats::Clock::time_point start{};
+};
@@ -0,0 +1,161 @@
+#include "trace.hpp"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Event {
+  const char *category;
+  std::string name;
+  int64_t startNanos; // since enable()
+  int64_t nanos;
+  const char *arg;
+  int64_t value;
+};
+
+// Only its own thread appends to a buffer; the events are read once that
+// thread is done
+struct ThreadBuffer {
+  unsigned tid;
+  std::vector<Event> events;
+};
+
+std::mutex lock;
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+std::vector<std::string> adopted; // events of forked processes
+Trace::Clock::time_point origin;
+thread_local ThreadBuffer *local = nullptr;
+
+ThreadBuffer &threadBuffer() {
+  if (!local) {
+    std::lock_guard<std::mutex> guard(lock);
+    buffers.push_back(std::make_unique<ThreadBuffer>());
+    buffers.back()->tid = static_cast<unsigned>(buffers.size());
+    local = buffers.back().get();
+  }
+  return *local;
+}
+
+int64_t nanosSince(Trace::Clock::time_point from, Trace::Clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from)
+      .count();
+}
+
+void appendQuoted(std::string &out, std::string_view text) {
+  out += '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof escaped, "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+// Trace timestamps are in microseconds
+void appendMicros(std::string &out, int64_t nanos) {
+  char text[32];
+  std::snprintf(text, sizeof text, "%lld.%03lld",
+                static_cast<long long>(nanos / 1000),
+                static_cast<long long>(nanos % 1000));
+  out += text;
+}
+
+void appendMetadata(std::string &out, const char *kind, unsigned pid,
+                    unsigned tid, std::string_view name) {
+  out += "{\"name\":\"";
+  out += kind;
+  out += "\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) +
+         ",\"tid\":" + std::to_string(tid) + ",\"args\":{\"name\":";
+  appendQuoted(out, name);
+  out += "}},\n";
+}
+
+// Every event is followed by ",\n", so fragments concatenate
+std::string eventsOf(unsigned pid) {
+  std::string out;
+  for (const auto &buffer : buffers) {
+    if (buffer->events.empty())
+      continue;
+    appendMetadata(out, "thread_name", pid, buffer->tid,
+                   buffer->tid == 1
+                       ? std::string("main")
+                       : "worker " + std::to_string(buffer->tid - 1));
+    for (const Event &event : buffer->events) {
+      out += "{\"name\":";
+      appendQuoted(out, event.name);
+      out += ",\"cat\":\"";
+      out += event.category;
+      out += "\",\"ph\":\"X\",\"ts\":";
+      appendMicros(out, event.startNanos);
+      out += ",\"dur\":";
+      appendMicros(out, event.nanos);
+      out += ",\"pid\":" + std::to_string(pid) +
+             ",\"tid\":" + std::to_string(buffer->tid);
+      if (event.arg) {
+        out += ",\"args\":{\"";
+        out += event.arg;
+        out += "\":" + std::to_string(event.value) + "}";
+      }
+      out += "},\n";
+    }
+  }
+  return out;
+}
+
+} // namespace
+
+void Trace::enable() {
+  origin = Clock::now();
+  threadBuffer(); // the calling thread is tid 1
+  on.store(true, std::memory_order_relaxed);
+}
+
+void Trace::span(const char *category, std::string_view name,
+                 Clock::time_point start, Clock::time_point end,
+                 const char *arg, int64_t value) {
+  threadBuffer().events.push_back({category, std::string(name),
+                                   nanosSince(origin, start),
+                                   nanosSince(start, end), arg, value});
+}
+
+void Trace::write(std::ostream &out) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::string text = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  text += eventsOf(0);
+  for (const auto &events : adopted)
+    text += events;
+  std::string last;
+  appendMetadata(last, "process_name", 0, 0, "quanta");
+  last.resize(last.size() - 2); // no comma after the last event
+  text += last + "\n]}\n";
+  out << text;
+}
+
+void Trace::reset() {
+  std::lock_guard<std::mutex> guard(lock);
+  for (auto &buffer : buffers)
+    buffer->events.clear();
+  adopted.clear();
+}
+
+std::string Trace::events(unsigned pid) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::string out;
+  appendMetadata(out, "process_name", pid, 0, "rank " + std::to_string(pid));
+  return out + eventsOf(pid);
+}
+
+void Trace::adopt(std::string events) {
+  std::lock_guard<std::mutex> guard(lock);
+  adopted.push_back(std::move(events));
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Timeline behind --trace: spans of work, each on the thread that did it,
+// written as Chrome Trace Event JSON for chrome://tracing or Perfetto.
+// Every thread records into a buffer of its own, taking a lock only the
+// first time it records, so workers do not contend with each other. As
+// with Stats, a span costs one relaxed atomic load until enable().
+class Trace {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Starts the clock; the calling thread is shown as "main"
+  static void enable();
+  static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+  // Records a span of `category` on the calling thread. `arg`, if not
+  // null, is shown with `value` in the span's details.
+  static void span(const char *category, std::string_view name,
+                   Clock::time_point start, Clock::time_point end,
+                   const char *arg = nullptr, int64_t value = 0);
+
+  // Writes every span as one JSON object. No other thread may be
+  // recording.
+  static void write(std::ostream &out);
+
+  // For processes forked from this one (the ranks of --ranks): reset()
+  // drops the spans inherited from the parent, events() returns the
+  // child's spans as process `pid` for the parent to adopt() into its
+  // own output
+  static void reset();
+  static std::string events(unsigned pid);
+  static void adopt(std::string events);
+
+private:
+  static inline std::atomic<bool> on{false};
+};
+
+// Records the enclosing scope as a span. `name` must outlive it.
+class TraceSpan {
+public:
+  TraceSpan(const char *category, std::string_view name,
+            const char *arg = nullptr, int64_t value = 0)
+      : category(category), name(name), arg(arg), value(value) {
+    if (Trace::enabled())
+      start = Trace::Clock::now();
+  }
+  ~TraceSpan() {
+    if (Trace::enabled())
+      Trace::span(category, name, start, Trace::Clock::now(), arg, value);
+  }
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  const char *category;
+  std::string_view name;
+  const char *arg;
+  int64_t value;
+  Trace::Clock::time_point start{};
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+// Interface between the driver and C++ code generated with QUANTA_JIT.
+// The generated translation unit exports
+//
+//   extern "C" int quanta_entry(const QuantaRuntime *runtime);
+//
+// and calls back through `runtime` whenever classical code calls a
+// @quantum function. Arguments are passed as doubles; the return value is
+// the bit the function returns, the value of the expect() it returns, or 0
+// for void functions. `f.gradient(k, args...)` goes through
+// `gradientQuantum`, which returns the derivative of that expect() value
+// with respect to parameter k.
+//
+// The declaration lives in a macro so the same text is compiled here and
+// pasted into generated code, which cannot include this header.
+#define QUANTA_RUNTIME_ABI                                                     \
+  struct QuantaRuntime {                                                       \
+    void *context;                                                             \
+    double (*callQuantum)(void *context, const char *function,                 \
+                          const double *args, unsigned long count);            \
+    double (*gradientQuantum)(void *context, const char *function,             \
+                              const double *args, unsigned long count,         \
+                              long parameter);                                 \
+  };
+
+extern "C" {
+QUANTA_RUNTIME_ABI
+}
+
+#define QUANTA_STRINGIFY_(...) #__VA_ARGS__
+#define QUANTA_STRINGIFY(...) QUANTA_STRINGIFY_(__VA_ARGS__)
+
+inline constexpr const char *kRuntimeAbiSource =
+    QUANTA_STRINGIFY(QUANTA_RUNTIME_ABI);
+
+// Symbol looked up in the compiled shared object
+inline constexpr const char *kRuntimeEntryPoint = "quanta_entry";
@@ -0,0 +1,177 @@
+#include "jit.hpp"
+#include "abi.hpp"
+#include "codegen/cppgen.hpp"
+#include "quantum_calls.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr const char *kCompileFlags =
+    "-std=c++20 -O2 -shared -fPIC -DQUANTA_JIT";
+
+[[noreturn]] void reportError(const std::string &msg) {
+  std::stringstream err;
+  err << "[Quanta JIT Error]\n" << msg << "\n";
+  throw std::runtime_error(err.str());
+}
+
+std::string compiler() {
+  for (const char *var : {"QUANTA_CXX", "CXX"}) {
+    if (const char *value = std::getenv(var); value && *value)
+      return value;
+  }
+  return "c++";
+}
+
+// FNV-1a, 64-bit
+std::string contentHash(const std::string &text) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : text) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx",
+                static_cast<unsigned long long>(hash));
+  return hex;
+}
+
+fs::path cacheDirectory(const JitOptions &options) {
+  if (!options.cacheDirectory.empty())
+    return options.cacheDirectory;
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    return fs::path(xdg) / "quanta";
+  if (const char *home = std::getenv("HOME"); home && *home)
+    return fs::path(home) / ".cache" / "quanta";
+  return fs::temp_directory_path() / "quanta-cache";
+}
+
+std::string shellQuote(const std::string &text) {
+  std::string quoted = "'";
+  for (char c : text)
+    quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  return quoted + "'";
+}
+
+// Returns the shared object for `source`, compiling it on a cache miss
+fs::path compile(const std::string &source, const JitOptions &options) {
+  const std::string cxx = compiler();
+  const fs::path dir = cacheDirectory(options);
+  const std::string hash = contentHash(cxx + '\n' + kCompileFlags + '\n' +
+                                       source);
+  const fs::path object = dir / (hash + ".so");
+  if (fs::exists(object))
+    return object;
+
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec)
+    reportError("Cannot create cache directory " + dir.string() + ": " +
+                ec.message());
+
+  // The source, log and private object are only needed while compiling;
+  // they are removed however the compile ends
+  const fs::path cpp = dir / (hash + ".cpp");
+  const fs::path log = dir / (hash + ".log");
+  const fs::path partial =
+      dir / (hash + ".so." + std::to_string(getpid()));
+  struct Cleanup {
+    std::vector<fs::path> paths;
+    ~Cleanup() {
+      std::error_code ignored;
+      for (const auto &path : paths)
+        fs::remove(path, ignored);
+    }
+  } cleanup{{cpp, log, partial}};
+
+  if (!(std::ofstream(cpp) << source))
+    reportError("Cannot write " + cpp.string());
+
+  // Build under a private name and rename, so concurrent runs never load
+  // a half-written object
+  std::string command = cxx + " " + kCompileFlags + " -o " +
+                        shellQuote(partial.string()) + " " +
+                        shellQuote(cpp.string()) + " 2> " +
+                        shellQuote(log.string());
+  if (std::system(command.c_str()) != 0) {
+    std::stringstream diagnostics;
+    diagnostics << std::ifstream(log).rdbuf();
+    reportError("Compiling generated C++ failed:\n" + diagnostics.str());
+  }
+  fs::rename(partial, object, ec);
+  if (ec)
+    reportError("Cannot install " + object.string() + ": " + ec.message());
+  return object;
+}
+
+// Exceptions must not unwind through the generated code
+[[noreturn]] void abortCall(const std::exception &e) {
+  std::cout.flush();
+  std::cerr << e.what();
+  std::exit(1);
+}
+
+double callQuantum(void *context, const char *function, const double *args,
+                   unsigned long count) {
+  try {
+    return static_cast<QuantumCalls *>(context)->call(
+        function, std::vector<double>(args, args + count));
+  } catch (const std::exception &e) {
+    abortCall(e);
+  }
+}
+
+double gradientQuantum(void *context, const char *function,
+                       const double *args, unsigned long count,
+                       long parameter) {
+  try {
+    return static_cast<QuantumCalls *>(context)->gradient(
+        function, std::vector<double>(args, args + count), parameter);
+  } catch (const std::exception &e) {
+    abortCall(e);
+  }
+}
+
+} // namespace
+
+int runJit(Program &program, const JitOptions &options) {
+  bool hasMain = false;
+  for (const auto &func : program.functions)
+    hasMain = hasMain || func->name == "main";
+  if (!hasMain)
+    reportError("Nothing to run: the program defines no `function main()`");
+
+  CppGenerator generator;
+  program.accept(generator);
+  const fs::path object = compile(generator.str(), options);
+
+  void *handle = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle)
+    reportError(std::string("Cannot load compiled program: ") + dlerror());
+
+  using Entry = int (*)(const QuantaRuntime *);
+  auto entry = reinterpret_cast<Entry>(dlsym(handle, kRuntimeEntryPoint));
+  if (!entry) {
+    dlclose(handle);
+    reportError(std::string("Compiled program has no ") + kRuntimeEntryPoint);
+  }
+
+  QuantumCalls calls(program, options.simulator);
+  QuantaRuntime runtime{&calls, callQuantum, gradientQuantum};
+  int status = entry(&runtime);
+  std::cout.flush();
+  dlclose(handle);
+  return status;
+}
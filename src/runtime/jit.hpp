@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+#include "ast/ast.hpp"
+#include "sim/simulator.hpp"
+
+struct JitOptions {
+  // Where compiled programs are kept; empty means $XDG_CACHE_HOME/quanta,
+  // falling back to ~/.cache/quanta
+  std::string cacheDirectory;
+  SimulatorOptions simulator;
+};
+
+// Runs `program` natively: the C++ generated for it is compiled into a
+// shared object, loaded with dlopen and its main function called. Objects
+// are cached by a hash of the source, compiler and flags, so an unchanged
+// program is compiled once. Calls to @quantum functions from classical
+// code are lowered and simulated as they happen; call k uses random stream
+// k of the seed. Returns the program's exit code.
+int runJit(Program &program, const JitOptions &options);
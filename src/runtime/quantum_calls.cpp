@@ -0,0 +1,108 @@
+#include "quantum_calls.hpp"
+#include "opt/cancel.hpp"
+#include "opt/lightcone.hpp"
+#include "opt/regalloc.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+Circuit optimise(const Circuit &circuit) {
+  Circuit result = pruneLightCone(cancelGates(circuit));
+  // Every call is a single trajectory, so fewer qubits is always cheaper
+  Circuit allocated = allocateQubits(result);
+  if (allocated.numQubits < result.numQubits)
+    return allocated;
+  return result;
+}
+
+void reportError(const std::string &msg) {
+  throw std::runtime_error("[Quanta Lowering Error]\n" + msg + "\n");
+}
+
+} // namespace
+
+QuantumCalls::Compiled &QuantumCalls::compile(const std::string &function) {
+  auto [entry, fresh] = templates.try_emplace(function);
+  Compiled &compiled = entry->second;
+  if (fresh) {
+    // A function that cannot be a template is lowered per call below,
+    // which reports any error that is not about its parameters
+    try {
+      compiled.tmpl = lowerTemplate(program, function);
+      compiled.tmpl.circuit = optimise(compiled.tmpl.circuit);
+      compiled.bound = true;
+    } catch (const std::runtime_error &) {
+    }
+  }
+  return compiled;
+}
+
+double QuantumCalls::call(const std::string &function,
+                          const std::vector<double> &args) {
+  Compiled &compiled = compile(function);
+  const Circuit *circuit;
+  std::optional<int> result, observable;
+  if (compiled.bound) {
+    compiled.tmpl.bind(args, compiled.tmpl.circuit);
+    circuit = &compiled.tmpl.circuit;
+    result = compiled.tmpl.result;
+    observable = compiled.tmpl.observable;
+  } else {
+    auto key = std::make_pair(function, args);
+    auto it = lowered.find(key);
+    if (it == lowered.end()) {
+      LoweredCall lowering = lowerCall(program, function, args);
+      lowering.circuit = optimise(lowering.circuit);
+      it = lowered.emplace(key, std::move(lowering)).first;
+    }
+    circuit = &it->second.circuit;
+    result = it->second.result;
+    observable = it->second.observable;
+  }
+
+  // The call still takes its random stream, so later calls see the same
+  // streams whatever the earlier ones returned
+  if (observable) {
+    ++calls;
+    return expectationValues(*circuit, options.precision)[*observable];
+  }
+
+  uint64_t bits =
+      simulateShot(*circuit, options.precision, Philox(options.seed, calls++));
+  return result ? static_cast<int>((bits >> *result) & 1) : 0;
+}
+
+double QuantumCalls::gradient(const std::string &function,
+                              const std::vector<double> &args,
+                              int64_t parameter) {
+  Compiled &compiled = compile(function);
+  if (!compiled.bound) {
+    // Reports the function's own errors before the one about gradients
+    lowerCall(program, function, args);
+  }
+  if (!compiled.bound || !compiled.tmpl.observable) {
+    reportError("Cannot differentiate '" + function +
+                "': it must return expect(...) and use its parameters only "
+                "in gate angles");
+  }
+  if (parameter < 0 ||
+      static_cast<size_t>(parameter) >= compiled.tmpl.parameters.size()) {
+    std::stringstream err;
+    err << "'" << function << "' has no parameter " << parameter;
+    reportError(err.str());
+  }
+
+  // Takes a random stream like every other call, though it draws nothing
+  ++calls;
+  auto key = std::make_pair(function, args);
+  if (gradientKey != key) {
+    lastGradient = adjointGradient(compiled.tmpl, args,
+                                   *compiled.tmpl.observable,
+                                   options.precision)
+                       .derivatives;
+    gradientKey = std::move(key);
+  }
+  return lastGradient[parameter];
+}
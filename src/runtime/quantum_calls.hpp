@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ast/ast.hpp"
+#include "ir/lower.hpp"
+#include "sim/simulator.hpp"
+
+// Runs the @quantum functions that classical code calls while the program
+// executes, for both the native and the bytecode backends. Every call is
+// one shot: call k is simulated on random stream k of the seed. Each
+// function is lowered and optimised once, as a template whose angles are
+// bound to the arguments of every call (see ir/template.hpp). Functions
+// whose arguments change the circuit itself are lowered once per distinct
+// argument list instead.
+class QuantumCalls {
+public:
+  QuantumCalls(const Program &program, const SimulatorOptions &options)
+      : program(program), options(options) {}
+
+  // Returns the bit the function returns, or 0 for void functions. A
+  // function returning expect() returns its exact value instead, computed
+  // from the state rather than sampled.
+  double call(const std::string &function, const std::vector<double> &args);
+
+  // Derivative of the expect() value a function returns with respect to
+  // its parameter `parameter`, by the adjoint method (see
+  // adjointGradient()). The whole gradient is kept for the last argument
+  // list, so asking for each parameter in turn costs one computation.
+  double gradient(const std::string &function,
+                  const std::vector<double> &args, int64_t parameter);
+
+private:
+  const Program &program;
+  SimulatorOptions options;
+  uint64_t calls = 0;
+  // Per function; `bound` set when the function has a template
+  struct Compiled {
+    CircuitTemplate tmpl;
+    bool bound = false;
+  };
+  std::map<std::string, Compiled> templates;
+  std::pair<std::string, std::vector<double>> gradientKey;
+  std::vector<double> lastGradient;
+
+  Compiled &compile(const std::string &function);
+  std::map<std::pair<std::string, std::vector<double>>, LoweredCall> lowered;
+};
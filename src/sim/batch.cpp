@@ -0,0 +1,256 @@
+#include "batch.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// Lanes is the lane count when known at compile time, otherwise 0 and
+// `width` (at most 64) is used. Every pair is loaded into locals before
+// it is written, so the lane loops vectorise without alias checks.
+template <typename Real, unsigned Lanes>
+void pairKernel(Real *re, Real *im, uint64_t size, unsigned width,
+                uint64_t bit, uint64_t control, const Real *mre,
+                const Real *mim) {
+  constexpr unsigned kMax = Lanes ? Lanes : 64;
+  const unsigned w = Lanes ? Lanes : width;
+  Real m[8][kMax]; // re and im of entries 0..3
+  for (int e = 0; e < 4; ++e) {
+    std::copy_n(mre + e * w, w, m[2 * e]);
+    std::copy_n(mim + e * w, w, m[2 * e + 1]);
+  }
+  // Phase gates leave the pairs unmixed: one multiply per amplitude
+  const bool diagonal = std::all_of(mre + w, mre + 3 * w,
+                                    [](Real v) { return v == 0; }) &&
+                        std::all_of(mim + w, mim + 3 * w,
+                                    [](Real v) { return v == 0; });
+
+  for (uint64_t base = 0; base < size; base += 2 * bit) {
+    for (uint64_t i = base; i < base + bit; ++i) {
+      if ((i & control) != control)
+        continue;
+      Real *ar = re + i * w, *ai = im + i * w;
+      Real *br = re + (i | bit) * w, *bi = im + (i | bit) * w;
+      Real xr[kMax], xi[kMax], yr[kMax], yi[kMax];
+      for (unsigned k = 0; k < w; ++k) {
+        xr[k] = ar[k];
+        xi[k] = ai[k];
+        yr[k] = br[k];
+        yi[k] = bi[k];
+      }
+      if (diagonal) {
+        for (unsigned k = 0; k < w; ++k) {
+          ar[k] = m[0][k] * xr[k] - m[1][k] * xi[k];
+          ai[k] = m[0][k] * xi[k] + m[1][k] * xr[k];
+        }
+        for (unsigned k = 0; k < w; ++k) {
+          br[k] = m[6][k] * yr[k] - m[7][k] * yi[k];
+          bi[k] = m[6][k] * yi[k] + m[7][k] * yr[k];
+        }
+        continue;
+      }
+      for (unsigned k = 0; k < w; ++k) {
+        ar[k] = m[0][k] * xr[k] - m[1][k] * xi[k] + m[2][k] * yr[k] -
+                m[3][k] * yi[k];
+        ai[k] = m[0][k] * xi[k] + m[1][k] * xr[k] + m[2][k] * yi[k] +
+                m[3][k] * yr[k];
+      }
+      for (unsigned k = 0; k < w; ++k) {
+        br[k] = m[4][k] * xr[k] - m[5][k] * xi[k] + m[6][k] * yr[k] -
+                m[7][k] * yi[k];
+        bi[k] = m[4][k] * xi[k] + m[5][k] * xr[k] + m[6][k] * yi[k] +
+                m[7][k] * yr[k];
+      }
+    }
+  }
+}
+
+} // namespace
+
+template <typename Real>
+BatchedStateVector<Real>::BatchedStateVector(unsigned numQubits,
+                                             unsigned lanes)
+    : numQubits(numQubits), width(lanes),
+      re((uint64_t{1} << numQubits) * lanes),
+      im((uint64_t{1} << numQubits) * lanes), mre(4 * lanes),
+      mim(4 * lanes) {
+  if (numQubits > kMaxQubits || lanes == 0 || lanes > 64)
+    throw std::logic_error("Unsupported batch shape");
+  std::fill(re.begin(), re.begin() + lanes, Real(1));
+}
+
+template <typename Real>
+void BatchedStateVector<Real>::prepare(const std::vector<QubitState> &states) {
+  if (states.size() != numQubits)
+    throw std::logic_error("Initial state does not match the qubit count");
+  const uint64_t size = uint64_t{1} << numQubits;
+  std::vector<std::complex<Real>> one(size);
+  fillProductState(one.data(), size, 0, states);
+  for (uint64_t i = 0; i < size; ++i) {
+    std::fill_n(re.data() + i * width, width, one[i].real());
+    std::fill_n(im.data() + i * width, width, one[i].imag());
+  }
+}
+
+template <typename Real>
+void BatchedStateVector<Real>::apply(const Gate &gate, const double *angles) {
+  if (!isUnitary(gate.kind)) {
+    throw std::logic_error(std::string("Not a unitary gate: ") +
+                           gateName(gate.kind));
+  }
+  const uint64_t size = uint64_t{1} << numQubits;
+  const uint64_t bit0 = uint64_t{1} << gate.qubits[0];
+  const uint64_t bit1 = uint64_t{1} << gate.qubits[1];
+  const auto start =
+      Stats::enabled() ? Stats::Clock::now() : Stats::Clock::time_point{};
+  auto record = [&] {
+    if (Stats::enabled()) {
+      Stats::add(Counter::GatesApplied);
+      Stats::kernel(gateName(gate.kind), start,
+                    2 * (re.size() + im.size()) * sizeof(Real));
+    }
+  };
+
+  // x, cx and swap move whole runs of lanes
+  if (gateClass(gate.kind) == GateClass::Permutation) {
+    for (uint64_t i = 0; i < size; ++i) {
+      uint64_t j;
+      if (gate.kind == GateKind::X && !(i & bit0))
+        j = i | bit0;
+      else if (gate.kind == GateKind::CX && (i & bit0) && !(i & bit1))
+        j = i | bit1;
+      else if (gate.kind == GateKind::Swap && (i & bit0) && !(i & bit1))
+        j = i ^ bit0 ^ bit1;
+      else
+        continue;
+      std::swap_ranges(re.data() + i * width, re.data() + (i + 1) * width,
+                       re.data() + j * width);
+      std::swap_ranges(im.data() + i * width, im.data() + (i + 1) * width,
+                       im.data() + j * width);
+    }
+    record();
+    return;
+  }
+
+  // The rest act as a 2x2 matrix on their last qubit, where a two-qubit
+  // gate's control is 1. Without per-lane angles every lane shares it.
+  Gate lane = gate;
+  for (unsigned k = 0; k < width; ++k) {
+    if (k > 0 && !angles) {
+      for (int e = 0; e < 4; ++e) {
+        mre[e * width + k] = mre[e * width];
+        mim[e * width + k] = mim[e * width];
+      }
+      continue;
+    }
+    if (angles)
+      lane.angle = angles[k];
+    Matrix2 m;
+    if (arity(gate.kind) == 1) {
+      m = gateMatrix2(lane);
+    } else {
+      Matrix4 full = gateMatrix4(lane);
+      m = {full[5], full[7], full[13], full[15]};
+    }
+    for (int e = 0; e < 4; ++e) {
+      mre[e * width + k] = static_cast<Real>(m[e].real());
+      mim[e * width + k] = static_cast<Real>(m[e].imag());
+    }
+  }
+  if (arity(gate.kind) == 1)
+    applyPairs(bit0, 0);
+  else
+    applyPairs(bit1, bit0);
+  record();
+}
+
+template <typename Real>
+void BatchedStateVector<Real>::applyPairs(uint64_t bit, uint64_t control) {
+  const uint64_t size = uint64_t{1} << numQubits;
+  // A fixed lane count lets the lane loops compile to straight vector code
+  if (width == kLanes)
+    pairKernel<Real, kLanes>(re.data(), im.data(), size, kLanes, bit,
+                             control, mre.data(), mim.data());
+  else
+    pairKernel<Real, 0>(re.data(), im.data(), size, width, bit, control,
+                        mre.data(), mim.data());
+}
+
+template <typename Real>
+uint64_t BatchedStateVector<Real>::measure(unsigned q, const double *u) {
+  const uint64_t size = uint64_t{1} << numQubits;
+  const uint64_t bit = uint64_t{1} << q;
+  std::vector<double> p1(width, 0.0);
+  for (uint64_t i = bit; i < size; i = (i + 1) | bit) {
+    for (unsigned k = 0; k < width; ++k) {
+      double r = re[i * width + k], m = im[i * width + k];
+      p1[k] += r * r + m * m;
+    }
+  }
+
+  // Amplitudes are scaled by keep[bit of their index] in one pass
+  uint64_t outcomes = 0;
+  std::vector<Real> keep0(width), keep1(width);
+  for (unsigned k = 0; k < width; ++k) {
+    const bool one = u[k] < p1[k];
+    const double p = one ? p1[k] : 1.0 - p1[k];
+    const Real scale = static_cast<Real>(1.0 / std::sqrt(p));
+    keep0[k] = one ? Real(0) : scale;
+    keep1[k] = one ? scale : Real(0);
+    outcomes |= uint64_t{one} << k;
+  }
+  for (uint64_t i = 0; i < size; ++i) {
+    const Real *keep = (i & bit) ? keep1.data() : keep0.data();
+    for (unsigned k = 0; k < width; ++k) {
+      re[i * width + k] *= keep[k];
+      im[i * width + k] *= keep[k];
+    }
+  }
+  return outcomes;
+}
+
+template <typename Real>
+void BatchedStateVector<Real>::reset(unsigned q, const double *u) {
+  const uint64_t outcomes = measure(q, u);
+  if (!outcomes)
+    return;
+  // x on the lanes that read 1, the identity on the others
+  std::fill(mim.begin(), mim.end(), Real(0));
+  for (unsigned k = 0; k < width; ++k) {
+    const bool flip = (outcomes >> k) & 1;
+    mre[0 * width + k] = mre[3 * width + k] = flip ? Real(0) : Real(1);
+    mre[1 * width + k] = mre[2 * width + k] = flip ? Real(1) : Real(0);
+  }
+  applyPairs(uint64_t{1} << q, 0);
+}
+
+template <typename Real>
+std::vector<double>
+BatchedStateVector<Real>::probabilities(unsigned lane) const {
+  const uint64_t size = uint64_t{1} << numQubits;
+  std::vector<double> probs(size);
+  for (uint64_t i = 0; i < size; ++i) {
+    double r = re[i * width + lane];
+    double m = im[i * width + lane];
+    probs[i] = r * r + m * m;
+  }
+  return probs;
+}
+
+template <typename Real>
+double BatchedStateVector<Real>::expectation(
+    unsigned lane, const Observable &observable) const {
+  const uint64_t size = uint64_t{1} << numQubits;
+  std::vector<std::complex<Real>> amps(size);
+  for (uint64_t i = 0; i < size; ++i)
+    amps[i] = {re[i * width + lane], im[i * width + lane]};
+  double total = 0.0;
+  for (const auto &group : groupPauliTerms(observable.terms))
+    total += pauliExpectation(amps.data(), size, group);
+  return total;
+}
+
+template class BatchedStateVector<float>;
+template class BatchedStateVector<double>;
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "ir/circuit.hpp"
+
+// `lanes` state vectors over the same qubits, interleaved: amplitude i of
+// lane k is element i * lanes + k of separate real and imaginary arrays.
+// Each gate is decoded once and applied to every lane in one pass whose
+// innermost loop runs over the lanes, so small circuits, where per-gate
+// overhead rather than memory traffic dominates, use the full vector
+// width. Lanes may differ in their gate angles and measurement outcomes.
+// Instantiated for float and double.
+template <typename Real> class BatchedStateVector {
+public:
+  // Beyond this evolving states one at a time is as fast. A double lane
+  // set fills as many vector registers as the same states one at a time
+  // do (one complex amplitude per SSE2 register), so only the per-gate
+  // overhead saved counts, and that only while states are tiny. Float
+  // lanes pack twice as densely and win until the batch leaves L2.
+  static constexpr unsigned kMaxQubits = sizeof(Real) == sizeof(float) ? 16 : 7;
+  // One 64-byte line of real parts, and one of imaginary parts, per
+  // amplitude
+  static constexpr unsigned kLanes = 64 / sizeof(Real);
+
+  BatchedStateVector(unsigned numQubits, unsigned lanes);
+
+  unsigned qubits() const { return numQubits; }
+  unsigned lanes() const { return width; }
+
+  // Puts every lane in the same product state
+  void prepare(const std::vector<QubitState> &states);
+
+  // Applies a unitary gate to every lane. With `angles`, lane k uses
+  // angles[k] instead of gate.angle.
+  void apply(const Gate &gate, const double *angles = nullptr);
+
+  // Measures qubit q in every lane, lane k with uniform draw u[k]; bit k
+  // of the result is lane k's outcome
+  uint64_t measure(unsigned q, const double *u);
+  void reset(unsigned q, const double *u);
+
+  std::vector<double> probabilities(unsigned lane) const;
+  double expectation(unsigned lane, const Observable &observable) const;
+
+private:
+  unsigned numQubits;
+  unsigned width;
+  std::vector<Real> re, im;
+  // Lane k's 2x2 matrix, entry e, is at m[e * width + k]
+  std::vector<Real> mre, mim;
+
+  // Applies the matrices in mre/mim to the pairs differing in `bit` whose
+  // `control` bits are all set
+  void applyPairs(uint64_t bit, uint64_t control);
+};
+
+extern template class BatchedStateVector<float>;
+extern template class BatchedStateVector<double>;
@@ -0,0 +1,415 @@
+#include "distributed.hpp"
+#include "kernels.hpp"
+#include "schedule.hpp"
+#include "statevector.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// Amplitudes a half exchange packs and trades at a time; bounds the
+// buffers it needs whatever the shard size
+constexpr size_t kSliceBytes = size_t{4} << 20;
+
+[[noreturn]] void fail(const std::string &what) {
+  throw std::runtime_error("Distributed simulation: " + what + ": " +
+                           std::strerror(errno));
+}
+
+[[noreturn]] void peerExited(unsigned rank) {
+  throw std::runtime_error("Distributed simulation: rank " +
+                           std::to_string(rank) + " exited");
+}
+
+bool connected(unsigned a, unsigned b) {
+  return a != b && (a == 0 || b == 0 || std::has_single_bit(a ^ b));
+}
+
+} // namespace
+
+void Communicator::launch(unsigned ranks,
+                          const std::function<void(Communicator &)> &body) {
+  if (!std::has_single_bit(ranks))
+    throw std::logic_error("Rank count is not a power of two");
+
+  // sockets[a][b] is a's end of the pair connecting a and b
+  std::vector<std::vector<int>> sockets(ranks, std::vector<int>(ranks, -1));
+  for (unsigned a = 0; a < ranks; ++a) {
+    for (unsigned b = a + 1; b < ranks; ++b) {
+      if (!connected(a, b))
+        continue;
+      int pair[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+        fail("cannot connect ranks");
+      sockets[a][b] = pair[0];
+      sockets[b][a] = pair[1];
+    }
+  }
+  auto closeAllBut = [&](unsigned keep) {
+    for (unsigned a = 0; a < ranks; ++a) {
+      if (a == keep)
+        continue;
+      for (int fd : sockets[a]) {
+        if (fd >= 0)
+          close(fd);
+      }
+    }
+  };
+
+  std::vector<pid_t> children;
+  for (unsigned r = 1; r < ranks; ++r) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      const int error = errno;
+      for (pid_t child : children)
+        kill(child, SIGKILL);
+      for (pid_t child : children)
+        waitpid(child, nullptr, 0);
+      closeAllBut(ranks);
+      errno = error;
+      fail("cannot start rank " + std::to_string(r));
+    }
+    if (pid == 0) {
+      // Never returns into the caller: its buffered output and state
+      // belong to rank 0
+      closeAllBut(r);
+      int status = 0;
+      try {
+        Communicator comm(r, sockets[r]);
+        body(comm);
+      } catch (const std::exception &e) {
+        std::cerr << "rank " << r << ": " << e.what() << "\n";
+        status = 1;
+      }
+      _exit(status);
+    }
+    children.push_back(pid);
+  }
+
+  closeAllBut(0);
+  Communicator comm(0, sockets[0]);
+  std::string error;
+  try {
+    body(comm);
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+  for (int fd : comm.peers) {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  // Closing rank 0's sockets has already unblocked any rank waiting on it
+  for (unsigned r = 1; r < ranks; ++r) {
+    int status = 0;
+    while (waitpid(children[r - 1], &status, 0) < 0 && errno == EINTR) {
+    }
+    const bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!ok && error.empty())
+      error = "Distributed simulation: rank " + std::to_string(r) + " failed";
+  }
+  if (!error.empty())
+    throw std::runtime_error(error);
+}
+
+int Communicator::socketTo(unsigned rank) const {
+  if (rank >= peers.size() || peers[rank] < 0)
+    throw std::logic_error("Ranks are not connected");
+  return peers[rank];
+}
+
+void Communicator::send(unsigned to, const void *data, size_t bytes) {
+  const int fd = socketTo(to);
+  const char *p = static_cast<const char *>(data);
+  for (size_t done = 0; done < bytes;) {
+    ssize_t n = ::send(fd, p + done, bytes - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EPIPE)
+      peerExited(to);
+    if (n < 0)
+      fail("cannot send to rank " + std::to_string(to));
+    done += n;
+  }
+}
+
+void Communicator::receive(unsigned from, void *data, size_t bytes) {
+  const int fd = socketTo(from);
+  char *p = static_cast<char *>(data);
+  for (size_t done = 0; done < bytes;) {
+    ssize_t n = ::recv(fd, p + done, bytes - done, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      fail("cannot receive from rank " + std::to_string(from));
+    if (n == 0)
+      peerExited(from);
+    done += n;
+  }
+}
+
+void Communicator::exchange(unsigned partner, const void *out, void *in,
+                            size_t bytes) {
+  const int fd = socketTo(partner);
+  const char *src = static_cast<const char *>(out);
+  char *dst = static_cast<char *>(in);
+  size_t sentBytes = 0, receivedBytes = 0;
+  while (sentBytes < bytes || receivedBytes < bytes) {
+    pollfd p{fd, 0, 0};
+    if (sentBytes < bytes)
+      p.events |= POLLOUT;
+    if (receivedBytes < bytes)
+      p.events |= POLLIN;
+    if (poll(&p, 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("cannot wait for rank " + std::to_string(partner));
+    }
+
+    if (receivedBytes < bytes && (p.revents & (POLLIN | POLLHUP | POLLERR))) {
+      ssize_t n = ::recv(fd, dst + receivedBytes, bytes - receivedBytes,
+                         MSG_DONTWAIT);
+      if (n == 0)
+        peerExited(partner);
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        fail("cannot receive from rank " + std::to_string(partner));
+      if (n > 0)
+        receivedBytes += n;
+    }
+    if (sentBytes < bytes && (p.revents & (POLLOUT | POLLERR))) {
+      ssize_t n = ::send(fd, src + sentBytes, bytes - sentBytes,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n < 0 && errno == EPIPE)
+        peerExited(partner);
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        fail("cannot send to rank " + std::to_string(partner));
+      if (n > 0)
+        sentBytes += n;
+    }
+  }
+}
+
+template <typename Real>
+DistributedStateVector<Real>::DistributedStateVector(unsigned numQubits,
+                                                     Communicator &comm)
+    : numQubits(numQubits), comm(comm) {
+  const unsigned globalQubits = std::countr_zero(comm.size());
+  if (numQubits >= 64)
+    throw std::runtime_error("Distributed simulation: too many qubits");
+  if (numQubits < globalQubits + 2)
+    throw std::runtime_error("Distributed simulation: " +
+                             std::to_string(comm.size()) +
+                             " ranks need at least " +
+                             std::to_string(globalQubits + 2) + " qubits");
+
+  localQubits = numQubits - globalQubits;
+  amps.resize(uint64_t{1} << localQubits);
+  if (comm.rank() == 0)
+    amps[0] = 1;
+  for (unsigned q = 0; q < numQubits; ++q)
+    logicalAt.push_back(q);
+  traffic.ranks = comm.size();
+}
+
+template <typename Real>
+void DistributedStateVector<Real>::prepare(
+    const std::vector<QubitState> &states) {
+  if (states.size() != numQubits)
+    throw std::logic_error("Initial state does not match the qubit count");
+  for (unsigned q = 0; q < numQubits; ++q) {
+    if (logicalAt[q] != q)
+      throw std::logic_error("Distributed state prepared after a relabel");
+  }
+  fillProductState(amps.data(), amps.size(),
+                   uint64_t{comm.rank()} * amps.size(), states);
+}
+
+template <typename Real>
+void DistributedStateVector<Real>::run(const std::vector<Gate> &gates) {
+  const uint64_t first = uint64_t{comm.rank()} * amps.size();
+  for (const auto &step : placeQubits(gates, localQubits, logicalAt)) {
+    if (step.gates.empty()) {
+      swapQubits(step.localBit, step.globalBit);
+    } else {
+      runGates(amps.data(), amps.size(), first, step.gates);
+      traffic.gateWindows++;
+    }
+  }
+}
+
+template <typename Real>
+void DistributedStateVector<Real>::swapQubits(unsigned localBit,
+                                              unsigned globalBit) {
+  TraceSpan span("sim", "qubit swap", "bit", globalBit);
+  // Amplitudes with (local=1, global=0) trade places with (local=0,
+  // global=1). Both ranks of a pair walk the indices with the local bit
+  // clear in the same order; the rank whose global bit is 0 trades the
+  // ones with the local bit set.
+  const unsigned rankBit = 1u << (globalBit - localQubits);
+  const unsigned partner = comm.rank() ^ rankBit;
+  const uint64_t set = (comm.rank() & rankBit) ? 0 : uint64_t{1} << localBit;
+
+  const uint64_t half = amps.size() / 2;
+  const uint64_t slice = std::min<uint64_t>(half, kSliceBytes / sizeof(Complex));
+  std::vector<Complex> out(slice), in(slice);
+  for (uint64_t start = 0; start < half; start += slice) {
+    for (uint64_t k = 0; k < slice; ++k)
+      out[k] = amps[insertZeroBit(start + k, localBit) | set];
+    comm.exchange(partner, out.data(), in.data(), slice * sizeof(Complex));
+    for (uint64_t k = 0; k < slice; ++k)
+      amps[insertZeroBit(start + k, localBit) | set] = in[k];
+  }
+
+  std::swap(logicalAt[localBit], logicalAt[globalBit]);
+  traffic.bytesSent += half * sizeof(Complex);
+  traffic.qubitSwaps++;
+}
+
+template <typename Real>
+void DistributedStateVector<Real>::swapLocalBits(unsigned a, unsigned b) {
+  const uint64_t maskA = uint64_t{1} << a, maskB = uint64_t{1} << b;
+  for (uint64_t i = 0; i < amps.size(); ++i) {
+    if ((i & maskA) && !(i & maskB))
+      std::swap(amps[i], amps[i ^ maskA ^ maskB]);
+  }
+  std::swap(logicalAt[a], logicalAt[b]);
+}
+
+template <typename Real> void DistributedStateVector<Real>::restoreLayout() {
+  auto physicalOf = [&](unsigned qubit) {
+    return static_cast<unsigned>(
+        std::find(logicalAt.begin(), logicalAt.end(), qubit) -
+        logicalAt.begin());
+  };
+  // Global bits first, each taking its qubit back from a local bit; one
+  // held by another global bit goes through local bit 0
+  for (unsigned bit = localQubits; bit < numQubits; ++bit) {
+    unsigned at = physicalOf(bit);
+    if (at == bit)
+      continue;
+    if (at >= localQubits) {
+      swapQubits(0, at);
+      at = 0;
+    }
+    swapQubits(at, bit);
+  }
+  // Then the local bits, which need no exchange
+  for (unsigned bit = 0; bit < localQubits; ++bit) {
+    unsigned at = physicalOf(bit);
+    if (at != bit)
+      swapLocalBits(bit, at);
+  }
+}
+
+template <typename Real>
+std::vector<uint64_t> DistributedStateVector<Real>::sample(size_t shots,
+                                                           Philox rng) {
+  // Walking the amplitudes in logical order draws the outcomes an
+  // in-memory run would
+  restoreLayout();
+
+  double local = 0.0;
+  for (const Complex &a : amps)
+    local += std::norm(std::complex<double>(a));
+  const std::vector<double> totals = comm.allGather(local);
+
+  // Every rank draws the same targets and resolves those that fall in its
+  // share of the cumulative sum. Rounding can leave the largest targets
+  // past the final sum; they go to the last rank with any probability.
+  double offset = 0.0, total = 0.0;
+  unsigned lastRank = 0;
+  for (unsigned r = 0; r < totals.size(); ++r) {
+    if (r < comm.rank())
+      offset += totals[r];
+    total += totals[r];
+    if (totals[r] > 0.0)
+      lastRank = r;
+  }
+  const double end =
+      comm.rank() == lastRank ? std::numeric_limits<double>::infinity()
+                              : offset + local;
+
+  std::vector<double> uniforms(shots);
+  rng.fillUniform(uniforms.data(), shots);
+  std::vector<std::pair<double, uint64_t>> targets;
+  for (size_t s = 0; s < shots; ++s) {
+    const double target = uniforms[s] * total;
+    if (local > 0.0 && target >= offset && target < end)
+      targets.push_back({target, s});
+  }
+  std::sort(targets.begin(), targets.end());
+
+  // Pairs of (shot, outcome)
+  std::vector<uint64_t> resolved;
+  resolved.reserve(2 * targets.size());
+  const uint64_t first = uint64_t{comm.rank()} * amps.size();
+  double cdf = offset;
+  size_t t = 0;
+  uint64_t lastNonZero = 0;
+  for (uint64_t i = 0; i < amps.size() && t < targets.size(); ++i) {
+    double p = std::norm(std::complex<double>(amps[i]));
+    if (p == 0.0)
+      continue;
+    cdf += p;
+    lastNonZero = first + i;
+    while (t < targets.size() && targets[t].first < cdf) {
+      resolved.push_back(targets[t++].second);
+      resolved.push_back(lastNonZero);
+    }
+  }
+  for (; t < targets.size(); ++t) {
+    resolved.push_back(targets[t].second);
+    resolved.push_back(lastNonZero);
+  }
+
+  if (comm.rank() != 0) {
+    const uint64_t count = resolved.size();
+    comm.send(0, &count, sizeof(count));
+    comm.send(0, resolved.data(), count * sizeof(uint64_t));
+    return {};
+  }
+  std::vector<uint64_t> outcomes(shots);
+  auto collect = [&](const std::vector<uint64_t> &pairs) {
+    for (size_t k = 0; k < pairs.size(); k += 2)
+      outcomes[pairs[k]] = pairs[k + 1];
+  };
+  collect(resolved);
+  for (unsigned r = 1; r < comm.size(); ++r) {
+    uint64_t count = 0;
+    comm.receive(r, &count, sizeof(count));
+    std::vector<uint64_t> pairs(count);
+    comm.receive(r, pairs.data(), count * sizeof(uint64_t));
+    collect(pairs);
+  }
+  return outcomes;
+}
+
+template <typename Real>
+std::vector<typename DistributedStateVector<Real>::Complex>
+DistributedStateVector<Real>::amplitudes() {
+  restoreLayout();
+  if (comm.rank() != 0) {
+    comm.send(0, amps.data(), amps.size() * sizeof(Complex));
+    return {};
+  }
+  std::vector<Complex> all(amps.size() * comm.size());
+  std::copy(amps.begin(), amps.end(), all.begin());
+  for (unsigned r = 1; r < comm.size(); ++r)
+    comm.receive(r, all.data() + r * amps.size(),
+                 amps.size() * sizeof(Complex));
+  return all;
+}
+
+template class DistributedStateVector<float>;
+template class DistributedStateVector<double>;
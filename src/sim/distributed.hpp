@@ -0,0 +1,119 @@
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ir/circuit.hpp"
+#include "rng.hpp"
+
+struct CommStats {
+  unsigned ranks = 1;
+  uint64_t bytesSent = 0;
+  uint64_t gateWindows = 0;
+  uint64_t qubitSwaps = 0; // each one a half exchange between rank pairs
+};
+
+// Ranks are local processes connected by Unix socket pairs. Only ranks
+// that differ in one bit, the partners of a half exchange, and rank 0 and
+// every other rank, for gathering results, are connected. Messages are
+// ordered byte streams; a rank that exits early makes its peers' reads
+// fail rather than hang.
+class Communicator {
+public:
+  // Runs `body` on `ranks` processes, a power of two. Rank 0 is the
+  // calling process and the others are forked from it, sharing whatever
+  // it had built. Returns on rank 0 once every rank has finished; the
+  // other ranks exit. Throws std::runtime_error if any rank failed.
+  static void launch(unsigned ranks,
+                     const std::function<void(Communicator &)> &body);
+
+  unsigned rank() const { return self; }
+  unsigned size() const { return static_cast<unsigned>(peers.size()); }
+
+  void send(unsigned to, const void *data, size_t bytes);
+  void receive(unsigned from, void *data, size_t bytes);
+
+  // Sends `bytes` to `partner` while receiving as many from it, so two
+  // ranks can trade buffers of any size without either blocking the other
+  void exchange(unsigned partner, const void *out, void *in, size_t bytes);
+
+  // Every rank's `value`, in rank order, on every rank
+  template <typename T> std::vector<T> allGather(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    std::vector<T> all(size());
+    all[self] = value;
+    if (self == 0) {
+      for (unsigned r = 1; r < size(); ++r)
+        receive(r, &all[r], sizeof(T));
+      for (unsigned r = 1; r < size(); ++r)
+        send(r, all.data(), all.size() * sizeof(T));
+    } else {
+      send(0, &value, sizeof(T));
+      receive(0, all.data(), all.size() * sizeof(T));
+    }
+    return all;
+  }
+
+private:
+  Communicator(unsigned self, std::vector<int> peers)
+      : self(self), peers(std::move(peers)) {}
+
+  unsigned self;
+  std::vector<int> peers; // socket to each rank, or -1 if not connected
+
+  int socketTo(unsigned rank) const;
+};
+
+// One rank's share of a state vector split across comm.size() ranks: rank
+// r holds the 2^l amplitudes whose physical index has r as its high bits.
+// Gates run on the local bits as on a StateVector. A gate on a global
+// qubit first swaps it with a local one (see placeQubits()), for which
+// every rank trades half its amplitudes with the rank that differs in
+// that bit, in slices of bounded size. Diagonal gates need no exchange.
+template <typename Real> class DistributedStateVector {
+public:
+  using Complex = std::complex<Real>;
+
+  DistributedStateVector(unsigned numQubits, Communicator &comm);
+
+  // Replaces the state with a product state. Only valid before run(),
+  // while logical and physical qubits coincide
+  void prepare(const std::vector<QubitState> &states);
+
+  // Applies unitary gates; every rank must pass the same list
+  void run(const std::vector<Gate> &gates);
+
+  // Outcomes as logical basis indices, shot s using draw s of `rng` as in
+  // sampleOutcomes(), so a seed gives the counts of an in-memory run. The
+  // qubits are first swapped back to their own bits. Every rank takes
+  // part; the outcomes are returned on rank 0 and the others get an
+  // empty list.
+  std::vector<uint64_t> sample(size_t shots, Philox rng);
+
+  // The whole state in logical order, on rank 0; the other ranks get an
+  // empty list. Every rank takes part.
+  std::vector<Complex> amplitudes();
+
+  // This rank's traffic
+  const CommStats &stats() const { return traffic; }
+
+private:
+  unsigned numQubits;
+  unsigned localQubits;
+  Communicator &comm;
+  std::vector<Complex> amps;
+  std::vector<unsigned> logicalAt; // physical bit -> logical qubit
+  CommStats traffic;
+
+  void swapQubits(unsigned localBit, unsigned globalBit);
+  void swapLocalBits(unsigned a, unsigned b);
+  // Swaps qubits back until every one sits at its own physical bit
+  void restoreLayout();
+};
+
+extern template class DistributedStateVector<float>;
+extern template class DistributedStateVector<double>;
@@ -0,0 +1,640 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <complex>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "ir/circuit.hpp"
+#include "profile/stats.hpp"
+
+// State-vector kernels, templated on the scalar type so the same code runs
+// in single and double precision. They work on a raw amplitude span rather
+// than a StateVector so blocked and chunked execution can reuse them.
+//
+// Complex arithmetic is spelled out on real and imaginary parts: the
+// std::complex operators carry NaN/Inf recovery that blocks vectorisation.
+
+template <typename Real> struct Mat2 {
+  Real re[4];
+  Real im[4];
+
+  explicit Mat2(const Matrix2 &m) {
+    for (int k = 0; k < 4; ++k) {
+      re[k] = static_cast<Real>(m[k].real());
+      im[k] = static_cast<Real>(m[k].imag());
+    }
+  }
+};
+
+template <typename Real> struct Mat4 {
+  Real re[16];
+  Real im[16];
+
+  explicit Mat4(const Matrix4 &m) {
+    for (int k = 0; k < 16; ++k) {
+      re[k] = static_cast<Real>(m[k].real());
+      im[k] = static_cast<Real>(m[k].imag());
+    }
+  }
+};
+
+// Inserts a zero bit at position `bit` of `value`
+inline uint64_t insertZeroBit(uint64_t value, unsigned bit) {
+  uint64_t low = value & ((uint64_t{1} << bit) - 1);
+  return ((value >> bit) << (bit + 1)) | low;
+}
+
+template <typename Real>
+inline void applyPair(std::complex<Real> &lo, std::complex<Real> &hi,
+                      const Mat2<Real> &m) {
+  Real ar = lo.real(), ai = lo.imag();
+  Real br = hi.real(), bi = hi.imag();
+  lo = {m.re[0] * ar - m.im[0] * ai + m.re[1] * br - m.im[1] * bi,
+        m.re[0] * ai + m.im[0] * ar + m.re[1] * bi + m.im[1] * br};
+  hi = {m.re[2] * ar - m.im[2] * ai + m.re[3] * br - m.im[3] * bi,
+        m.re[2] * ai + m.im[2] * ar + m.re[3] * bi + m.im[3] * br};
+}
+
+template <typename Real>
+void applyMatrix1(std::complex<Real> *amps, uint64_t size, unsigned q,
+                  const Mat2<Real> &m) {
+  const uint64_t stride = uint64_t{1} << q;
+
+  // Qubit 0 pairs neighbours; one flat loop instead of `size / 2` blocks
+  if (stride == 1) {
+    for (uint64_t i = 0; i < size; i += 2)
+      applyPair(amps[i], amps[i + 1], m);
+    return;
+  }
+
+  for (uint64_t base = 0; base < size; base += 2 * stride) {
+    std::complex<Real> *lo = amps + base;
+    std::complex<Real> *hi = amps + base + stride;
+    for (uint64_t j = 0; j < stride; ++j)
+      applyPair(lo[j], hi[j], m);
+  }
+}
+
+// Basis order follows gateMatrix4: index = (bit q1) << 1 | (bit q0). The
+// loops walk the index space around the two target bits so the innermost
+// loop runs over contiguous amplitudes.
+template <typename Real>
+void applyMatrix2(std::complex<Real> *amps, uint64_t size, unsigned q0,
+                  unsigned q1, const Mat4<Real> &m) {
+  const uint64_t lowStride = uint64_t{1} << (q0 < q1 ? q0 : q1);
+  const uint64_t highStride = uint64_t{1} << (q0 < q1 ? q1 : q0);
+  const uint64_t offset[4] = {0, uint64_t{1} << q0, uint64_t{1} << q1,
+                              (uint64_t{1} << q0) | (uint64_t{1} << q1)};
+
+  for (uint64_t outer = 0; outer < size; outer += 2 * highStride) {
+    for (uint64_t mid = outer; mid < outer + highStride;
+         mid += 2 * lowStride) {
+      std::complex<Real> *p[4] = {amps + mid + offset[0],
+                                  amps + mid + offset[1],
+                                  amps + mid + offset[2],
+                                  amps + mid + offset[3]};
+      for (uint64_t j = 0; j < lowStride; ++j) {
+        Real vr[4], vi[4];
+        for (int c = 0; c < 4; ++c) {
+          vr[c] = p[c][j].real();
+          vi[c] = p[c][j].imag();
+        }
+        for (int r = 0; r < 4; ++r) {
+          Real sr = 0, si = 0;
+          for (int c = 0; c < 4; ++c) {
+            sr += m.re[r * 4 + c] * vr[c] - m.im[r * 4 + c] * vi[c];
+            si += m.re[r * 4 + c] * vi[c] + m.im[r * 4 + c] * vr[c];
+          }
+          p[r][j] = {sr, si};
+        }
+      }
+    }
+  }
+}
+
+// Calls body(i) for every index below `size` with bits qa and qb clear;
+// the innermost loop runs over contiguous indices
+template <typename Body>
+inline void forEachQuarter(uint64_t size, unsigned qa, unsigned qb,
+                           Body body) {
+  const uint64_t lowStride = uint64_t{1} << std::min(qa, qb);
+  const uint64_t highStride = uint64_t{1} << std::max(qa, qb);
+  for (uint64_t outer = 0; outer < size; outer += 2 * highStride) {
+    for (uint64_t mid = outer; mid < outer + highStride;
+         mid += 2 * lowStride) {
+      for (uint64_t j = 0; j < lowStride; ++j)
+        body(mid + j);
+    }
+  }
+}
+
+// x, cx and swap only move amplitudes: no arithmetic at all
+template <typename Real>
+void applyPermutation(std::complex<Real> *amps, uint64_t size,
+                      const Gate &gate) {
+  const uint64_t bit0 = uint64_t{1} << gate.qubits[0];
+  const uint64_t bit1 = uint64_t{1} << gate.qubits[1];
+  switch (gate.kind) {
+  case GateKind::X:
+    for (uint64_t base = 0; base < size; base += 2 * bit0) {
+      for (uint64_t j = 0; j < bit0; ++j)
+        std::swap(amps[base + j], amps[base + bit0 + j]);
+    }
+    break;
+  case GateKind::CX:
+    forEachQuarter(size, gate.qubits[0], gate.qubits[1], [&](uint64_t i) {
+      std::swap(amps[i | bit0], amps[i | bit0 | bit1]);
+    });
+    break;
+  case GateKind::Swap:
+    forEachQuarter(size, gate.qubits[0], gate.qubits[1], [&](uint64_t i) {
+      std::swap(amps[i | bit0], amps[i | bit1]);
+    });
+    break;
+  default:
+    break;
+  }
+}
+
+// Applies `target` to qubit t on the quarter of the state where qubit c is 1
+template <typename Real>
+void applyControlled1(std::complex<Real> *amps, uint64_t size, unsigned c,
+                      unsigned t, const Mat2<Real> &target) {
+  const uint64_t controlBit = uint64_t{1} << c;
+  const uint64_t targetBit = uint64_t{1} << t;
+  forEachQuarter(size, c, t, [&](uint64_t i) {
+    applyPair(amps[i | controlBit], amps[i | controlBit | targetBit], target);
+  });
+}
+
+// Diagonal gates commute with each other, so a run of them folds into one
+// table of phases indexed by the bits of the qubits they touch and costs a
+// single pass over the state however many gates it holds.
+template <typename Real> class DiagonalBatch {
+public:
+  static constexpr unsigned kMaxQubits = 10;
+
+  bool empty() const { return qubits.empty(); }
+
+  // Folds `gate` into the table; false if that would exceed kMaxQubits
+  bool add(const Gate &gate) {
+    const int n = arity(gate.kind);
+    int fresh = 0;
+    for (int k = 0; k < n; ++k)
+      fresh += std::find(qubits.begin(), qubits.end(), gate.qubits[k]) ==
+               qubits.end();
+    if (qubits.size() + fresh > kMaxQubits)
+      return false;
+
+    unsigned position[2] = {0, 0};
+    for (int k = 0; k < n; ++k) {
+      auto it = std::find(qubits.begin(), qubits.end(), gate.qubits[k]);
+      position[k] = static_cast<unsigned>(it - qubits.begin());
+      if (it == qubits.end()) {
+        qubits.push_back(gate.qubits[k]);
+        size_t half = phases.size();
+        phases.resize(2 * half);
+        std::copy_n(phases.begin(), half, phases.begin() + half);
+      }
+    }
+
+    std::complex<double> diagonal[4];
+    if (n == 1) {
+      Matrix2 m = gateMatrix2(gate);
+      diagonal[0] = m[0];
+      diagonal[1] = m[3];
+    } else {
+      Matrix4 m = gateMatrix4(gate);
+      for (int k = 0; k < 4; ++k)
+        diagonal[k] = m[k * 5];
+    }
+
+    for (size_t t = 0; t < phases.size(); ++t) {
+      size_t local = (t >> position[0]) & 1;
+      if (n == 2)
+        local |= ((t >> position[1]) & 1) << 1;
+      phases[t] *= diagonal[local];
+    }
+    return true;
+  }
+
+  // `first` is the state index of amps[0], for spans that are one block of
+  // a larger state
+  void apply(std::complex<Real> *amps, uint64_t size,
+             uint64_t first = 0) const {
+    std::vector<Real> re(phases.size()), im(phases.size());
+    for (size_t t = 0; t < phases.size(); ++t) {
+      re[t] = static_cast<Real>(phases[t].real());
+      im[t] = static_cast<Real>(phases[t].imag());
+    }
+
+    const uint64_t lowest = uint64_t{1}
+                            << *std::min_element(qubits.begin(), qubits.end());
+
+    // Every run of 2^lowest amplitudes shares one phase, so the inner loop
+    // is a contiguous multiply by a constant
+    if (lowest >= kSpan || size <= lowest) {
+      const uint64_t run = std::min(size, lowest);
+      for (uint64_t base = 0; base < size; base += run)
+        scale(amps + base, run, re[index(first + base)],
+              im[index(first + base)]);
+      return;
+    }
+
+    // Otherwise the phase changes within a span: the low bits' part of the
+    // table index comes from a lookup rather than a per-amplitude gather
+    const uint64_t span = std::min(size, kSpan);
+    size_t low[kSpan];
+    for (uint64_t j = 0; j < span; ++j)
+      low[j] = index(j);
+    for (uint64_t base = 0; base < size; base += span) {
+      const size_t high = index((first + base) & ~(span - 1));
+      std::complex<Real> *p = amps + base;
+      for (uint64_t j = 0; j < span; ++j) {
+        const size_t t = high | low[j];
+        Real ar = p[j].real(), ai = p[j].imag();
+        p[j] = {re[t] * ar - im[t] * ai, re[t] * ai + im[t] * ar};
+      }
+    }
+  }
+
+private:
+  static constexpr uint64_t kSpan = 256;
+
+  std::vector<unsigned> qubits;
+  std::vector<std::complex<double>> phases{1.0};
+
+  // Table index of state index i: the bits of i at `qubits`
+  size_t index(uint64_t i) const {
+    size_t t = 0;
+    for (size_t b = 0; b < qubits.size(); ++b)
+      t |= ((i >> qubits[b]) & 1) << b;
+    return t;
+  }
+
+  static void scale(std::complex<Real> *p, uint64_t n, Real pr, Real pi) {
+    for (uint64_t j = 0; j < n; ++j) {
+      Real ar = p[j].real(), ai = p[j].imag();
+      p[j] = {pr * ar - pi * ai, pr * ai + pi * ar};
+    }
+  }
+};
+
+// Swap gates on disjoint bit pairs, applied as one bit permutation. The
+// state is walked in tiles: a tile is the 2^(2k) runs of contiguous
+// amplitudes (below the lowest swapped bit) that the k swaps permute among
+// themselves, and consecutive tiles are neighbours in memory, so every
+// cache line is brought in once rather than once per swap.
+template <typename Real> class SwapBatch {
+public:
+  static constexpr unsigned kMaxSwaps = 6;
+
+  bool empty() const { return pairs.empty(); }
+
+  // Adds a Swap gate; false if it shares a bit with the batch or the batch
+  // is full
+  bool add(const Gate &gate) {
+    const uint64_t bits =
+        (uint64_t{1} << gate.qubits[0]) | (uint64_t{1} << gate.qubits[1]);
+    if (pairs.size() == kMaxSwaps || (mask & bits))
+      return false;
+    mask |= bits;
+    pairs.push_back({gate.qubits[0], gate.qubits[1]});
+
+    // Tile offsets of every pair of runs the batch exchanges: run (a, b)
+    // holds a on the first bits of the pairs and b on the second
+    const size_t k = pairs.size();
+    offsets.clear();
+    for (uint64_t a = 0; a < (uint64_t{1} << k); ++a) {
+      for (uint64_t b = a + 1; b < (uint64_t{1} << k); ++b)
+        offsets.push_back({place(a, b), place(b, a)});
+    }
+    return true;
+  }
+
+  void apply(std::complex<Real> *amps, uint64_t size) const {
+    const uint64_t run = mask & -mask;
+    const uint64_t fixed = mask | (run - 1);
+    for (uint64_t base = 0; base < size;
+         base = ((base | fixed) + 1) & ~fixed) {
+      for (const auto &[from, to] : offsets) {
+        std::complex<Real> *x = amps + base + from;
+        std::complex<Real> *y = amps + base + to;
+        for (uint64_t j = 0; j < run; ++j)
+          std::swap(x[j], y[j]);
+      }
+    }
+  }
+
+private:
+  std::vector<std::pair<unsigned, unsigned>> pairs;
+  std::vector<std::pair<uint64_t, uint64_t>> offsets;
+  uint64_t mask = 0;
+
+  uint64_t place(uint64_t first, uint64_t second) const {
+    uint64_t offset = 0;
+    for (size_t j = 0; j < pairs.size(); ++j) {
+      offset |= ((first >> j) & 1) << pairs[j].first;
+      offset |= ((second >> j) & 1) << pairs[j].second;
+    }
+    return offset;
+  }
+};
+
+// Applies a unitary gate with the kernel for its class
+template <typename Real>
+void applyGate(std::complex<Real> *amps, uint64_t size, const Gate &gate) {
+  switch (gateClass(gate.kind)) {
+  case GateClass::Diagonal: {
+    DiagonalBatch<Real> batch;
+    batch.add(gate);
+    batch.apply(amps, size);
+    break;
+  }
+  case GateClass::Permutation:
+    applyPermutation(amps, size, gate);
+    break;
+  case GateClass::Controlled: {
+    // Lower-right block of the control=1 rows: basis indices 1 and 3
+    Matrix4 m = gateMatrix4(gate);
+    Matrix2 target = {m[5], m[7], m[13], m[15]};
+    applyControlled1(amps, size, gate.qubits[0], gate.qubits[1],
+                     Mat2<Real>(target));
+    break;
+  }
+  case GateClass::Dense:
+    if (arity(gate.kind) == 1) {
+      applyMatrix1(amps, size, gate.qubits[0], Mat2<Real>(gateMatrix2(gate)));
+    } else {
+      applyMatrix2(amps, size, gate.qubits[0], gate.qubits[1],
+                   Mat4<Real>(gateMatrix4(gate)));
+    }
+    break;
+  }
+}
+
+// A gate list prepared once and applied to one or more amplitude spans
+// (the whole state, or each chunk of an out-of-core state). Consecutive
+// diagonal gates are merged into one batch, and so are consecutive swaps
+// on disjoint bits.
+template <typename Real> class GateSequence {
+public:
+  explicit GateSequence(const std::vector<Gate> &gates) {
+    for (const auto &gate : gates) {
+      if (gateClass(gate.kind) == GateClass::Diagonal) {
+        if (!extends(Step::Diagonal, diagonals, gate)) {
+          diagonals.emplace_back();
+          diagonals.back().add(gate);
+          steps.push_back({Step::Diagonal, gate, diagonals.size() - 1});
+        }
+      } else if (gate.kind == GateKind::Swap) {
+        if (!extends(Step::Swaps, swaps, gate)) {
+          swaps.emplace_back();
+          swaps.back().add(gate);
+          steps.push_back({Step::Swaps, gate, swaps.size() - 1});
+        }
+      } else {
+        steps.push_back({Step::Single, gate, 0});
+      }
+    }
+  }
+
+  // `first` is the state index of amps[0]. Only diagonal gates may act on
+  // bits at or above log2(size); they read those bits from `first`.
+  void apply(std::complex<Real> *amps, uint64_t size,
+             uint64_t first = 0) const {
+    const bool timed = Stats::enabled();
+    for (const auto &step : steps) {
+      const auto start =
+          timed ? Stats::Clock::now() : Stats::Clock::time_point{};
+      const char *kernel = nullptr;
+      switch (step.kind) {
+      case Step::Single:
+        applyGate(amps, size, step.gate);
+        kernel = gateName(step.gate.kind);
+        break;
+      case Step::Diagonal:
+        diagonals[step.batch].apply(amps, size, first);
+        kernel = "diagonal batch";
+        break;
+      case Step::Swaps:
+        swaps[step.batch].apply(amps, size);
+        kernel = "swap batch";
+        break;
+      }
+      // Every amplitude is read and written once per step
+      if (timed)
+        Stats::kernel(kernel, start, 2 * size * sizeof(std::complex<Real>));
+    }
+  }
+
+private:
+  struct Step {
+    enum Kind { Single, Diagonal, Swaps } kind;
+    Gate gate;
+    size_t batch; // index into `diagonals` or `swaps`
+  };
+  std::vector<Step> steps;
+  std::vector<DiagonalBatch<Real>> diagonals;
+  std::vector<SwapBatch<Real>> swaps;
+
+  // Adds `gate` to the batch of the previous step if that step is a batch
+  // of the same kind with room for it
+  template <typename Batch>
+  bool extends(typename Step::Kind kind, std::vector<Batch> &batches,
+               const Gate &gate) {
+    return !steps.empty() && steps.back().kind == kind &&
+           batches[steps.back().batch].add(gate);
+  }
+};
+
+// Probability of reading 1 on qubit q, accumulated in double
+template <typename Real>
+double probabilityOne(const std::complex<Real> *amps, uint64_t size,
+                      unsigned q) {
+  const uint64_t stride = uint64_t{1} << q;
+  double p = 0.0;
+  for (uint64_t base = stride; base < size; base += 2 * stride) {
+    for (uint64_t j = 0; j < stride; ++j) {
+      double re = amps[base + j].real();
+      double im = amps[base + j].imag();
+      p += re * re + im * im;
+    }
+  }
+  return p;
+}
+
+// Pauli strings that flip the same bits. String t maps |i> to
+// phase[t] * (-1)^popcount(i & z[t]) |i ^ flip>, with its coefficient and
+// the i of every Y folded into phase[t].
+struct PauliGroup {
+  uint64_t flip = 0;
+  std::vector<uint64_t> z;
+  std::vector<std::complex<double>> phase;
+};
+
+// Groups the terms of a Pauli sum by the bits they flip
+inline std::vector<PauliGroup>
+groupPauliTerms(const std::vector<PauliTerm> &terms) {
+  static const std::complex<double> kPowersOfI[] = {1.0, {0.0, 1.0}, -1.0,
+                                                    {0.0, -1.0}};
+  std::map<uint64_t, PauliGroup> groups;
+  for (const auto &term : terms) {
+    uint64_t x = 0, z = 0;
+    unsigned ys = 0;
+    for (const auto &[q, pauli] : term.factors) {
+      const uint64_t bit = uint64_t{1} << q;
+      if (pauli != Pauli::Z)
+        x |= bit;
+      if (pauli != Pauli::X)
+        z |= bit;
+      ys += pauli == Pauli::Y;
+    }
+    PauliGroup &group = groups[x];
+    group.flip = x;
+    group.z.push_back(z);
+    group.phase.push_back(term.coefficient * kPowersOfI[ys % 4]);
+  }
+
+  std::vector<PauliGroup> result;
+  for (auto &[flip, group] : groups)
+    result.push_back(std::move(group));
+  return result;
+}
+
+// <psi| sum of the group |psi> in one pass over the state, accumulated in
+// double
+template <typename Real>
+double pauliExpectation(const std::complex<Real> *amps, uint64_t size,
+                        const PauliGroup &group) {
+  const size_t terms = group.z.size();
+  std::vector<double> phaseRe(terms), phaseIm(terms);
+  for (size_t t = 0; t < terms; ++t) {
+    phaseRe[t] = group.phase[t].real();
+    phaseIm[t] = group.phase[t].imag();
+  }
+
+  double total = 0.0;
+  for (uint64_t i = 0; i < size; ++i) {
+    double wr = 0.0, wi = 0.0;
+    for (size_t t = 0; t < terms; ++t) {
+      const double sign = (std::popcount(i & group.z[t]) & 1) ? -1.0 : 1.0;
+      wr += sign * phaseRe[t];
+      wi += sign * phaseIm[t];
+    }
+    // Re(conj(amps[i ^ flip]) * amps[i] * w)
+    const double ar = amps[i].real(), ai = amps[i].imag();
+    const double br = amps[i ^ group.flip].real();
+    const double bi = amps[i ^ group.flip].imag();
+    const double pr = br * ar + bi * ai;
+    const double pi = br * ai - bi * ar;
+    total += pr * wr - pi * wi;
+  }
+  return total;
+}
+
+// <bra| sum of the group |ket> in one pass, accumulated in double
+template <typename Real>
+std::complex<double> pauliOverlap(const std::complex<Real> *bra,
+                                  const std::complex<Real> *ket,
+                                  uint64_t size, const PauliGroup &group) {
+  const size_t terms = group.z.size();
+  double totalRe = 0.0, totalIm = 0.0;
+  for (uint64_t i = 0; i < size; ++i) {
+    double wr = 0.0, wi = 0.0;
+    for (size_t t = 0; t < terms; ++t) {
+      const double sign = (std::popcount(i & group.z[t]) & 1) ? -1.0 : 1.0;
+      wr += sign * group.phase[t].real();
+      wi += sign * group.phase[t].imag();
+    }
+    // conj(bra[i ^ flip]) * ket[i] * w
+    const double ar = ket[i].real(), ai = ket[i].imag();
+    const double br = bra[i ^ group.flip].real();
+    const double bi = bra[i ^ group.flip].imag();
+    const double pr = br * ar + bi * ai;
+    const double pi = br * ai - bi * ar;
+    totalRe += pr * wr - pi * wi;
+    totalIm += pr * wi + pi * wr;
+  }
+  return {totalRe, totalIm};
+}
+
+// out += (sum of the group) |in>
+template <typename Real>
+void applyPauliGroup(const std::complex<Real> *in, std::complex<Real> *out,
+                     uint64_t size, const PauliGroup &group) {
+  const size_t terms = group.z.size();
+  for (uint64_t i = 0; i < size; ++i) {
+    double wr = 0.0, wi = 0.0;
+    for (size_t t = 0; t < terms; ++t) {
+      const double sign = (std::popcount(i & group.z[t]) & 1) ? -1.0 : 1.0;
+      wr += sign * group.phase[t].real();
+      wi += sign * group.phase[t].imag();
+    }
+    const double ar = in[i].real(), ai = in[i].imag();
+    std::complex<Real> &target = out[i ^ group.flip];
+    target = {static_cast<Real>(target.real() + wr * ar - wi * ai),
+              static_cast<Real>(target.imag() + wr * ai + wi * ar)};
+  }
+}
+
+// Projects qubit q onto `outcome` and rescales by `scale`
+template <typename Real>
+void collapse(std::complex<Real> *amps, uint64_t size, unsigned q,
+              bool outcome, Real scale) {
+  const uint64_t stride = uint64_t{1} << q;
+  for (uint64_t base = 0; base < size; base += 2 * stride) {
+    std::complex<Real> *keep = amps + base + (outcome ? stride : 0);
+    std::complex<Real> *drop = amps + base + (outcome ? 0 : stride);
+    for (uint64_t j = 0; j < stride; ++j) {
+      keep[j] = {keep[j].real() * scale, keep[j].imag() * scale};
+      drop[j] = {0, 0};
+    }
+  }
+}
+
+// Writes the product state prod_q amplitude_q(bit q of first + i) over a
+// span of 2^k amplitudes starting at basis index `first` (a multiple of the
+// span size). The low qubits are expanded once into a table; every block
+// of the span is that table times the factor of the high qubits, so each
+// amplitude costs one complex multiply and one store.
+template <typename Real>
+void fillProductState(std::complex<Real> *amps, uint64_t size, uint64_t first,
+                      const std::vector<QubitState> &states) {
+  const unsigned n = states.size();
+  unsigned low = 0;
+  while (low < n && low < 12 && (uint64_t{2} << low) <= size)
+    ++low;
+
+  const uint64_t tableSize = uint64_t{1} << low;
+  std::vector<std::complex<double>> table(tableSize);
+  table[0] = 1;
+  for (unsigned q = 0; q < low; ++q) {
+    auto amplitude = qubitAmplitudes(states[q]);
+    const uint64_t half = uint64_t{1} << q;
+    for (uint64_t i = 0; i < half; ++i) {
+      table[i + half] = table[i] * amplitude[1];
+      table[i] *= amplitude[0];
+    }
+  }
+  std::vector<Real> re(tableSize), im(tableSize);
+  for (uint64_t i = 0; i < tableSize; ++i) {
+    re[i] = static_cast<Real>(table[i].real());
+    im[i] = static_cast<Real>(table[i].imag());
+  }
+
+  for (uint64_t block = 0; block < size; block += tableSize) {
+    const uint64_t index = first + block;
+    std::complex<double> high = 1;
+    for (unsigned q = low; q < n; ++q)
+      high *= qubitAmplitudes(states[q])[(index >> q) & 1];
+    const Real hr = static_cast<Real>(high.real());
+    const Real hi = static_cast<Real>(high.imag());
+    std::complex<Real> *out = amps + block;
+    for (uint64_t i = 0; i < tableSize; ++i)
+      out[i] = {hr * re[i] - hi * im[i], hr * im[i] + hi * re[i]};
+  }
+}
@@ -0,0 +1,289 @@
+#include "outofcore.hpp"
+#include "kernels.hpp"
+#include "schedule.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+[[noreturn]] void fail(const std::string &what) {
+  throw std::runtime_error("Out-of-core simulation: " + what + ": " +
+                           std::strerror(errno));
+}
+
+} // namespace
+
+template <typename Real>
+ChunkedStateVector<Real>::ChunkedStateVector(unsigned numQubits,
+                                             unsigned chunkQubits,
+                                             const std::string &directory)
+    : numQubits(numQubits), chunkQubits(std::min(chunkQubits, numQubits)) {
+  if (numQubits >= 64)
+    throw std::runtime_error("Out-of-core simulation: too many qubits");
+  if (this->chunkQubits < 2 && numQubits >= 2)
+    throw std::runtime_error("Out-of-core simulation: chunks need at least "
+                             "2 qubits");
+
+  chunkAmps = uint64_t{1} << this->chunkQubits;
+  chunkBytes = chunkAmps * sizeof(Complex);
+
+  for (unsigned q = 0; q < numQubits; ++q) {
+    physicalOf.push_back(q);
+    logicalAt.push_back(q);
+  }
+
+  // Chunk files are unlinked as soon as they exist, so nothing is left
+  // behind if the run dies
+  uint64_t chunks = uint64_t{1} << (numQubits - this->chunkQubits);
+  std::string prefix =
+      directory + "/quanta-" + std::to_string(getpid()) + "-chunk-";
+  for (uint64_t k = 0; k < chunks; ++k) {
+    std::string path = prefix + std::to_string(k) + ".amp";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+      fail("cannot create " + path);
+    files.push_back(fd);
+    unlink(path.c_str());
+    if (ftruncate(fd, chunkBytes) != 0)
+      fail("cannot size " + path);
+  }
+
+  const Complex one = 1;
+  if (pwrite(files[0], &one, sizeof(one), 0) != sizeof(one))
+    fail("cannot initialise state");
+}
+
+template <typename Real> ChunkedStateVector<Real>::~ChunkedStateVector() {
+  for (int fd : files)
+    close(fd);
+}
+
+template <typename Real>
+typename ChunkedStateVector<Real>::Complex *
+ChunkedStateVector<Real>::load(uint64_t chunk) {
+  void *data = mmap(nullptr, chunkBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    files[chunk], 0);
+  if (data == MAP_FAILED)
+    fail("cannot map chunk " + std::to_string(chunk));
+
+  // Starts asynchronous readahead; callers load chunk k+1 before working
+  // on chunk k so the read overlaps the compute
+  madvise(data, chunkBytes, MADV_WILLNEED);
+
+  io.bytesRead += chunkBytes;
+  io.chunkLoads++;
+  return static_cast<Complex *>(data);
+}
+
+template <typename Real>
+void ChunkedStateVector<Real>::store(Complex *data, bool dirty) {
+  if (dirty) {
+    msync(data, chunkBytes, MS_ASYNC);
+    io.bytesWritten += chunkBytes;
+  }
+  munmap(data, chunkBytes);
+}
+
+template <typename Real>
+void ChunkedStateVector<Real>::prepare(const std::vector<QubitState> &states) {
+  if (states.size() != numQubits)
+    throw std::logic_error("Initial state does not match the qubit count");
+  for (unsigned q = 0; q < numQubits; ++q) {
+    if (physicalOf[q] != q)
+      throw std::logic_error("Out-of-core state prepared after a relabel");
+  }
+
+  for (uint64_t chunk = 0; chunk < files.size(); ++chunk) {
+    Complex *data = load(chunk);
+    fillProductState(data, chunkAmps, chunk * chunkAmps, states);
+    store(data, true);
+  }
+}
+
+template <typename Real>
+void ChunkedStateVector<Real>::run(const std::vector<Gate> &gates) {
+  for (const auto &step : placeQubits(gates, chunkQubits, logicalAt)) {
+    if (step.gates.empty())
+      swapQubits(step.localBit, step.globalBit);
+    else
+      applyWindow(step.gates);
+  }
+}
+
+template <typename Real>
+void ChunkedStateVector<Real>::applyWindow(const std::vector<Gate> &window) {
+  TraceSpan span("sim", "gate window", "gates",
+                 static_cast<int64_t>(window.size()));
+  const GateSequence<Real> sequence(window);
+  Stats::add(Counter::GatesApplied, window.size());
+
+  const uint64_t chunks = files.size();
+  Complex *current = load(0);
+  for (uint64_t k = 0; k < chunks; ++k) {
+    Complex *next = k + 1 < chunks ? load(k + 1) : nullptr;
+    sequence.apply(current, chunkAmps, k * chunkAmps);
+    store(current, true);
+    current = next;
+  }
+  io.gateWindows++;
+}
+
+template <typename Real>
+void ChunkedStateVector<Real>::swapQubits(unsigned localBit,
+                                          unsigned globalBit) {
+  TraceSpan span("sim", "qubit swap", "bit", globalBit);
+  // Amplitudes with (local=1, global=0) trade places with (local=0,
+  // global=1): the first half of every chunk pair crosses over
+  const uint64_t chunkBit = uint64_t{1} << (globalBit - chunkQubits);
+  const uint64_t stride = uint64_t{1} << localBit;
+
+  std::vector<uint64_t> lows;
+  for (uint64_t a = 0; a < files.size(); ++a) {
+    if (!(a & chunkBit))
+      lows.push_back(a);
+  }
+
+  Complex *a = load(lows[0]);
+  Complex *b = load(lows[0] | chunkBit);
+  for (size_t p = 0; p < lows.size(); ++p) {
+    Complex *nextA = nullptr, *nextB = nullptr;
+    if (p + 1 < lows.size()) {
+      nextA = load(lows[p + 1]);
+      nextB = load(lows[p + 1] | chunkBit);
+    }
+    for (uint64_t base = 0; base < chunkAmps; base += 2 * stride) {
+      for (uint64_t j = 0; j < stride; ++j)
+        std::swap(a[base + stride + j], b[base + j]);
+    }
+    store(a, true);
+    store(b, true);
+    a = nextA;
+    b = nextB;
+  }
+
+  unsigned localQubit = logicalAt[localBit];
+  unsigned globalQubit = logicalAt[globalBit];
+  logicalAt[localBit] = globalQubit;
+  logicalAt[globalBit] = localQubit;
+  physicalOf[globalQubit] = localBit;
+  physicalOf[localQubit] = globalBit;
+  io.qubitSwaps++;
+}
+
+template <typename Real>
+void ChunkedStateVector<Real>::swapLocalBits(unsigned a, unsigned b) {
+  TraceSpan span("sim", "qubit swap", "bit", b);
+  const uint64_t maskA = uint64_t{1} << a, maskB = uint64_t{1} << b;
+  const uint64_t chunks = files.size();
+  Complex *current = load(0);
+  for (uint64_t k = 0; k < chunks; ++k) {
+    Complex *next = k + 1 < chunks ? load(k + 1) : nullptr;
+    for (uint64_t i = 0; i < chunkAmps; ++i) {
+      if ((i & maskA) && !(i & maskB))
+        std::swap(current[i], current[i ^ maskA ^ maskB]);
+    }
+    store(current, true);
+    current = next;
+  }
+  std::swap(logicalAt[a], logicalAt[b]);
+  physicalOf[logicalAt[a]] = a;
+  physicalOf[logicalAt[b]] = b;
+  io.qubitSwaps++;
+}
+
+template <typename Real> void ChunkedStateVector<Real>::restoreLayout() {
+  // Global bits first, each taking its qubit back from a local bit; one
+  // held by another global bit goes through local bit 0
+  for (unsigned bit = chunkQubits; bit < numQubits; ++bit) {
+    unsigned at = physicalOf[bit];
+    if (at == bit)
+      continue;
+    if (at >= chunkQubits) {
+      swapQubits(0, at);
+      at = 0;
+    }
+    swapQubits(at, bit);
+  }
+  // Then the chunk-local bits, one pass over the chunks each
+  for (unsigned bit = 0; bit < chunkQubits; ++bit) {
+    if (physicalOf[bit] != bit)
+      swapLocalBits(bit, physicalOf[bit]);
+  }
+}
+
+template <typename Real>
+std::vector<typename ChunkedStateVector<Real>::Complex>
+ChunkedStateVector<Real>::amplitudes() {
+  restoreLayout();
+  std::vector<Complex> all(files.size() * chunkAmps);
+  for (uint64_t k = 0; k < files.size(); ++k) {
+    Complex *data = load(k);
+    std::copy(data, data + chunkAmps, all.begin() + k * chunkAmps);
+    store(data, false);
+  }
+  return all;
+}
+
+template <typename Real>
+std::vector<uint64_t> ChunkedStateVector<Real>::sample(size_t shots,
+                                                       Philox rng) {
+  // Walking the amplitudes in logical order draws the outcomes an
+  // in-memory run would
+  restoreLayout();
+
+  std::vector<uint64_t> outcomes(shots);
+  const uint64_t chunks = files.size();
+
+  // Pass 1: total probability
+  double total = 0.0;
+  Complex *current = load(0);
+  for (uint64_t k = 0; k < chunks; ++k) {
+    Complex *next = k + 1 < chunks ? load(k + 1) : nullptr;
+    for (uint64_t i = 0; i < chunkAmps; ++i)
+      total += std::norm(std::complex<double>(current[i]));
+    store(current, false);
+    current = next;
+  }
+
+  // Pass 2: sweep the running sum past the sorted targets. Shot s keeps
+  // draw s of `rng`, whatever order the targets are resolved in.
+  std::vector<std::pair<double, size_t>> targets(shots);
+  std::vector<double> uniforms(shots);
+  rng.fillUniform(uniforms.data(), shots);
+  for (size_t s = 0; s < shots; ++s)
+    targets[s] = {uniforms[s] * total, s};
+  std::sort(targets.begin(), targets.end());
+
+  double cdf = 0.0;
+  size_t t = 0;
+  uint64_t lastNonZero = 0;
+  current = load(0);
+  for (uint64_t k = 0; k < chunks; ++k) {
+    Complex *next = k + 1 < chunks ? load(k + 1) : nullptr;
+    for (uint64_t i = 0; i < chunkAmps && t < shots; ++i) {
+      double p = std::norm(std::complex<double>(current[i]));
+      if (p == 0.0)
+        continue;
+      cdf += p;
+      lastNonZero = k * chunkAmps + i;
+      while (t < shots && targets[t].first < cdf)
+        outcomes[targets[t++].second] = lastNonZero;
+    }
+    store(current, false);
+    current = next;
+  }
+  // Rounding can leave the largest targets just past the final sum
+  for (; t < shots; ++t)
+    outcomes[targets[t].second] = lastNonZero;
+
+  return outcomes;
+}
+
+template class ChunkedStateVector<float>;
+template class ChunkedStateVector<double>;
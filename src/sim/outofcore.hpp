@@ -0,0 +1,77 @@
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ir/circuit.hpp"
+#include "rng.hpp"
+
+struct IoStats {
+  uint64_t bytesRead = 0;
+  uint64_t bytesWritten = 0;
+  uint64_t chunkLoads = 0;
+  uint64_t gateWindows = 0;
+  uint64_t qubitSwaps = 0;
+};
+
+// State vector stored as 2^g memory-mapped chunk files of 2^c amplitudes
+// each, for qubit counts that do not fit in RAM. The low c physical bits
+// are chunk-local; gates other than diagonal ones only ever run on local
+// bits, so such a gate on a global qubit first swaps that qubit with a
+// local one (see placeQubits()). Consecutive local
+// gates are applied as a window: one load and store of every chunk
+// regardless of how many gates the window holds.
+template <typename Real> class ChunkedStateVector {
+public:
+  using Complex = std::complex<Real>;
+
+  ChunkedStateVector(unsigned numQubits, unsigned chunkQubits,
+                     const std::string &directory);
+  ~ChunkedStateVector();
+
+  ChunkedStateVector(const ChunkedStateVector &) = delete;
+  ChunkedStateVector &operator=(const ChunkedStateVector &) = delete;
+
+  // Replaces the state with a product state, one chunk at a time. Only
+  // valid before run(), while logical and physical qubits coincide
+  void prepare(const std::vector<QubitState> &states);
+
+  // Applies unitary gates, reordering commuting gates into windows
+  void run(const std::vector<Gate> &gates);
+
+  // Two streaming passes over the chunks (total, then cumulative sweep),
+  // once the qubits are swapped back to their own bits. Outcomes are
+  // logical basis indices; shot s uses draw s of `rng`, as in
+  // sampleOutcomes(), so a seed gives the counts of an in-memory run
+  std::vector<uint64_t> sample(size_t shots, Philox rng);
+
+  // The whole state in logical order, read into memory
+  std::vector<Complex> amplitudes();
+
+  const IoStats &stats() const { return io; }
+
+private:
+  unsigned numQubits;
+  unsigned chunkQubits;
+  uint64_t chunkAmps;
+  uint64_t chunkBytes;
+  std::vector<int> files;
+
+  std::vector<unsigned> physicalOf; // logical qubit -> physical bit
+  std::vector<unsigned> logicalAt;  // physical bit -> logical qubit
+  IoStats io;
+
+  Complex *load(uint64_t chunk);
+  void store(Complex *data, bool dirty);
+
+  void applyWindow(const std::vector<Gate> &window);
+  void swapQubits(unsigned localBit, unsigned globalBit);
+  void swapLocalBits(unsigned a, unsigned b);
+  // Swaps qubits back until every one sits at its own physical bit
+  void restoreLayout();
+};
+
+extern template class ChunkedStateVector<float>;
+extern template class ChunkedStateVector<double>;
@@ -0,0 +1,145 @@
+#include "rng.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+constexpr uint32_t kMul0 = 0xD2511F53;
+constexpr uint32_t kMul1 = 0xCD9E8D57;
+constexpr uint32_t kWeyl0 = 0x9E3779B9;
+constexpr uint32_t kWeyl1 = 0xBB67AE85;
+constexpr int kRounds = 10;
+constexpr size_t kLanes = 8;
+
+// Top 52 bits as the mantissa of a double in [1, 2), shifted down to [0, 1).
+// Unlike an int-to-float conversion this stays in integer SIMD lanes.
+constexpr uint64_t kOneBits = 0x3FF0000000000000ull;
+
+inline double toUnit(uint64_t bits) {
+  return std::bit_cast<double>(kOneBits | (bits >> 12)) - 1.0;
+}
+
+// Eight Philox blocks side by side in structure-of-arrays form. The lane
+// loops are free of cross-lane dependencies, so the compiler maps them onto
+// vector registers (widening 32x32->64 multiplies) and, failing that, the
+// eight independent chains still keep the scalar multipliers busy.
+void philox8(uint64_t seed, uint64_t stream, uint64_t first, double *out) {
+  uint32_t c0[kLanes], c1[kLanes], c2[kLanes], c3[kLanes];
+  for (size_t l = 0; l < kLanes; ++l) {
+    c0[l] = static_cast<uint32_t>(first + l);
+    c1[l] = static_cast<uint32_t>((first + l) >> 32);
+    c2[l] = static_cast<uint32_t>(stream);
+    c3[l] = static_cast<uint32_t>(stream >> 32);
+  }
+  uint32_t k0 = static_cast<uint32_t>(seed);
+  uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+
+  for (int r = 0; r < kRounds; ++r) {
+    for (size_t l = 0; l < kLanes; ++l) {
+      uint64_t p0 = uint64_t{kMul0} * c0[l];
+      uint64_t p1 = uint64_t{kMul1} * c2[l];
+      c0[l] = static_cast<uint32_t>(p1 >> 32) ^ c1[l] ^ k0;
+      c1[l] = static_cast<uint32_t>(p1);
+      c2[l] = static_cast<uint32_t>(p0 >> 32) ^ c3[l] ^ k1;
+      c3[l] = static_cast<uint32_t>(p0);
+    }
+    k0 += kWeyl0;
+    k1 += kWeyl1;
+  }
+
+  for (size_t l = 0; l < kLanes; ++l) {
+    out[2 * l] = toUnit((uint64_t(c1[l]) << 32) | c0[l]);
+    out[2 * l + 1] = toUnit((uint64_t(c3[l]) << 32) | c2[l]);
+  }
+}
+
+} // namespace
+
+Philox::Philox(uint64_t seed, uint64_t stream)
+    : key(seed), stream(stream), position(0), cache{},
+      cacheIndex(std::numeric_limits<uint64_t>::max()) {}
+
+Philox::Block Philox::block(uint64_t seed, uint64_t stream, uint64_t counter) {
+  uint32_t c0 = static_cast<uint32_t>(counter);
+  uint32_t c1 = static_cast<uint32_t>(counter >> 32);
+  uint32_t c2 = static_cast<uint32_t>(stream);
+  uint32_t c3 = static_cast<uint32_t>(stream >> 32);
+  uint32_t k0 = static_cast<uint32_t>(seed);
+  uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+
+  for (int r = 0; r < kRounds; ++r) {
+    uint64_t p0 = uint64_t{kMul0} * c0;
+    uint64_t p1 = uint64_t{kMul1} * c2;
+    c0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+    c1 = static_cast<uint32_t>(p1);
+    c2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+    c3 = static_cast<uint32_t>(p0);
+    k0 += kWeyl0;
+    k1 += kWeyl1;
+  }
+  return {c0, c1, c2, c3};
+}
+
+Philox Philox::split(uint64_t childStream) const {
+  return Philox(key, childStream);
+}
+
+void Philox::discard(uint64_t draws) { position += draws; }
+
+uint64_t Philox::nextU64() {
+  uint64_t index = position >> 1;
+  if (index != cacheIndex) {
+    cache = block(key, stream, index);
+    cacheIndex = index;
+  }
+  bool odd = position & 1;
+  position++;
+  return odd ? (uint64_t(cache[3]) << 32) | cache[2]
+             : (uint64_t(cache[1]) << 32) | cache[0];
+}
+
+double Philox::nextDouble() { return toUnit(nextU64()); }
+
+void Philox::fillUniform(double *out, size_t n) {
+  size_t i = 0;
+
+  // Finish a half-consumed block so the bulk loop starts on a boundary
+  if ((position & 1) && i < n)
+    out[i++] = nextDouble();
+
+  while (n - i >= 2 * kLanes) {
+    philox8(key, stream, position >> 1, out + i);
+    position += 2 * kLanes;
+    i += 2 * kLanes;
+  }
+
+  while (i < n)
+    out[i++] = nextDouble();
+}
+
+std::vector<uint64_t> sampleOutcomes(const std::vector<double> &probabilities,
+                                     size_t shots, Philox rng) {
+  std::vector<uint64_t> outcomes(shots);
+  if (probabilities.empty() || shots == 0)
+    return outcomes;
+
+  std::vector<double> cdf(probabilities.size());
+  std::partial_sum(probabilities.begin(), probabilities.end(), cdf.begin());
+  double total = cdf.back();
+  uint64_t last = probabilities.size() - 1;
+
+  constexpr size_t batch = 4096;
+  std::vector<double> uniforms(std::min(batch, shots));
+  for (size_t base = 0; base < shots; base += batch) {
+    size_t n = std::min(batch, shots - base);
+    rng.fillUniform(uniforms.data(), n);
+    for (size_t j = 0; j < n; ++j) {
+      auto it = std::upper_bound(cdf.begin(), cdf.end(), uniforms[j] * total);
+      outcomes[base + j] = std::min<uint64_t>(it - cdf.begin(), last);
+    }
+  }
+  return outcomes;
+}
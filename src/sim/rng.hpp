@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Counter-based Philox4x32-10 generator (Salmon et al., "Parallel Random
+// Numbers: As Easy as 1, 2, 3"). Every output block is a pure function of
+// (seed, stream, counter), so streams can be split or jumped ahead in O(1)
+// and a draw never depends on how work was divided between threads.
+class Philox {
+public:
+  using Block = std::array<uint32_t, 4>;
+
+  explicit Philox(uint64_t seed, uint64_t stream = 0);
+
+  // Raw Philox4x32-10 bijection
+  static Block block(uint64_t seed, uint64_t stream, uint64_t counter);
+
+  // Independent generator for sub-stream `stream` of the same seed
+  Philox split(uint64_t stream) const;
+
+  // Jump ahead by `draws` 64-bit outputs
+  void discard(uint64_t draws);
+
+  uint64_t nextU64();
+  double nextDouble();
+
+  // Bulk uniform doubles in [0, 1). Produces exactly the values `n` calls
+  // to nextDouble() would, but eight blocks at a time in vector registers.
+  void fillUniform(double *out, size_t n);
+
+  uint64_t seed() const { return key; }
+
+private:
+  uint64_t key;
+  uint64_t stream;
+  uint64_t position; // index of the next 64-bit draw within the stream
+
+  Block cache;
+  uint64_t cacheIndex;
+};
+
+// Draws `shots` outcomes from `probabilities` (which need not be normalised).
+// Shot i always consumes draw i of `rng`, so results are bit-identical no
+// matter how shots are batched or distributed.
+std::vector<uint64_t> sampleOutcomes(const std::vector<double> &probabilities,
+                                     size_t shots, Philox rng);
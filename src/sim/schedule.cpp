@@ -0,0 +1,179 @@
+#include "schedule.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// How far ahead of the oldest pending gate the scheduler looks
+constexpr size_t kLookahead = 4096;
+
+bool isBlockLocal(const Gate &gate, unsigned blockQubits) {
+  if (gateClass(gate.kind) == GateClass::Diagonal)
+    return true;
+  for (int k = 0; k < arity(gate.kind); ++k) {
+    if (gate.qubits[k] >= blockQubits)
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+std::vector<GateWindow> scheduleWindows(const std::vector<Gate> &gates,
+                                        unsigned blockQubits) {
+  std::vector<GateWindow> windows;
+  std::vector<bool> done(gates.size(), false);
+  unsigned numQubits = 0;
+  for (const auto &gate : gates) {
+    for (int k = 0; k < arity(gate.kind); ++k)
+      numQubits = std::max(numQubits, gate.qubits[k] + 1);
+  }
+
+  size_t head = 0;
+  while (head < gates.size()) {
+    // A gate that cannot join blocks its qubits for everything after it
+    GateWindow local{true, {}};
+    std::vector<bool> blocked(numQubits, false);
+    size_t end = std::min(gates.size(), head + kLookahead);
+    for (size_t i = head; i < end; ++i) {
+      if (done[i])
+        continue;
+      const Gate &gate = gates[i];
+      bool ready = isBlockLocal(gate, blockQubits);
+      for (int k = 0; k < arity(gate.kind); ++k)
+        ready = ready && !blocked[gate.qubits[k]];
+
+      if (ready) {
+        local.gates.push_back(gate);
+        done[i] = true;
+      } else {
+        for (int k = 0; k < arity(gate.kind); ++k)
+          blocked[gate.qubits[k]] = true;
+      }
+    }
+    if (!local.gates.empty())
+      windows.push_back(std::move(local));
+
+    while (head < gates.size() && done[head])
+      head++;
+
+    // The oldest pending gate is not block-local; it and the pending gates
+    // that directly follow it run over the full state
+    GateWindow global{false, {}};
+    while (head < gates.size() &&
+           (done[head] || !isBlockLocal(gates[head], blockQubits))) {
+      if (!done[head])
+        global.gates.push_back(gates[head]);
+      done[head++] = true;
+    }
+    if (!global.gates.empty())
+      windows.push_back(std::move(global));
+  }
+  return windows;
+}
+
+std::vector<PlacementStep> placeQubits(const std::vector<Gate> &gates,
+                                       unsigned localQubits,
+                                       std::vector<unsigned> logicalAt) {
+  std::vector<unsigned> physicalOf(logicalAt.size());
+  for (unsigned bit = 0; bit < logicalAt.size(); ++bit)
+    physicalOf[logicalAt[bit]] = bit;
+
+  std::vector<PlacementStep> steps;
+  std::vector<bool> done(gates.size(), false);
+  size_t head = 0;
+
+  // Diagonal gates read global bits from a span's offset instead
+  auto isLocal = [&](const Gate &gate) {
+    if (gateClass(gate.kind) == GateClass::Diagonal)
+      return true;
+    for (int k = 0; k < arity(gate.kind); ++k) {
+      if (physicalOf[gate.qubits[k]] >= localQubits)
+        return false;
+    }
+    return true;
+  };
+
+  while (head < gates.size()) {
+    // Greedily collect local gates. A gate that cannot run yet blocks its
+    // qubits, so later gates are only pulled forward past gates they
+    // commute with (disjoint qubits).
+    PlacementStep window;
+    std::vector<bool> blocked(logicalAt.size(), false);
+    size_t end = std::min(gates.size(), head + kLookahead);
+    for (size_t i = head; i < end; ++i) {
+      if (done[i])
+        continue;
+      const Gate &gate = gates[i];
+      bool ready = isLocal(gate);
+      for (int k = 0; k < arity(gate.kind); ++k)
+        ready = ready && !blocked[gate.qubits[k]];
+
+      if (ready) {
+        Gate physical = gate;
+        for (int k = 0; k < arity(gate.kind); ++k)
+          physical.qubits[k] = physicalOf[gate.qubits[k]];
+        window.gates.push_back(physical);
+        done[i] = true;
+      } else {
+        for (int k = 0; k < arity(gate.kind); ++k)
+          blocked[gate.qubits[k]] = true;
+      }
+    }
+    if (!window.gates.empty())
+      steps.push_back(std::move(window));
+
+    while (head < gates.size() && done[head])
+      head++;
+    if (head == gates.size())
+      break;
+
+    // The oldest pending gate touches a global qubit. Swap each of its
+    // global qubits with the local qubit whose next use is furthest away.
+    const Gate &blockedGate = gates[head];
+    for (int k = 0; k < arity(blockedGate.kind); ++k) {
+      unsigned q = blockedGate.qubits[k];
+      if (physicalOf[q] < localQubits)
+        continue;
+
+      unsigned victim = localQubits;
+      size_t furthest = 0;
+      for (unsigned bit = 0; bit < localQubits; ++bit) {
+        unsigned candidate = logicalAt[bit];
+        bool usedNow = false;
+        for (int j = 0; j < arity(blockedGate.kind); ++j)
+          usedNow = usedNow || blockedGate.qubits[j] == candidate;
+        if (usedNow)
+          continue;
+
+        size_t next = std::numeric_limits<size_t>::max();
+        size_t limit = std::min(gates.size(), head + kLookahead);
+        for (size_t i = head; i < limit; ++i) {
+          const Gate &later = gates[i];
+          if (done[i] || gateClass(later.kind) == GateClass::Diagonal)
+            continue;
+          if (later.qubits[0] == candidate ||
+              (arity(later.kind) == 2 && later.qubits[1] == candidate)) {
+            next = i;
+            break;
+          }
+        }
+        if (victim == localQubits || next > furthest) {
+          victim = bit;
+          furthest = next;
+        }
+      }
+
+      const unsigned globalBit = physicalOf[q];
+      PlacementStep swap;
+      swap.localBit = victim;
+      swap.globalBit = globalBit;
+      steps.push_back(std::move(swap));
+      std::swap(logicalAt[victim], logicalAt[globalBit]);
+      physicalOf[logicalAt[victim]] = victim;
+      physicalOf[logicalAt[globalBit]] = globalBit;
+    }
+  }
+  return steps;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+#include "ir/circuit.hpp"
+
+// A group of gates executed together. A block-local window only touches
+// bits below the block size (or is diagonal), so it can be applied to each
+// cache-sized block of the state in turn: the block stays in cache for the
+// whole window instead of the state streaming from DRAM once per gate.
+struct GateWindow {
+  bool blockLocal = false;
+  std::vector<Gate> gates;
+};
+
+// Splits a unitary gate list into alternating block-local and full-state
+// windows. Block-local gates are pulled forward past pending gates on
+// disjoint qubits, which they commute with, to make the local windows as
+// long as possible.
+std::vector<GateWindow> scheduleWindows(const std::vector<Gate> &gates,
+                                        unsigned blockQubits);
+
+// One step of a run on a state split at bit `localQubits`, whose higher
+// bits pick a chunk file or a rank: a window of gates on physical bits,
+// or, when `gates` is empty, an exchange of a local bit with a global one.
+struct PlacementStep {
+  std::vector<Gate> gates;
+  unsigned localBit = 0;
+  unsigned globalBit = 0;
+};
+
+// Orders a unitary gate list for a split state, given which logical qubit
+// each physical bit holds at the start. Gates that are local under the
+// current placement are gathered into windows, pulled forward past pending
+// gates on disjoint qubits. Diagonal gates count as local wherever their
+// qubits are: GateSequence::apply() reads global bits from `first`. A
+// gate on a global qubit swaps it with the local qubit whose next use is
+// furthest away, so that exchanges, the expensive step, are as rare as
+// the lookahead can make them.
+std::vector<PlacementStep> placeQubits(const std::vector<Gate> &gates,
+                                       unsigned localQubits,
+                                       std::vector<unsigned> logicalAt);
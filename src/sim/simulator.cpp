@@ -0,0 +1,613 @@
+#include "simulator.hpp"
+#include "batch.hpp"
+#include "kernels.hpp"
+#include "rng.hpp"
+#include "statevector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+// True when no gate acts on a qubit after it has been measured, so the
+// whole circuit can be evolved once and sampled instead of re-run per shot
+bool hasOnlyTerminalMeasurements(const Circuit &circuit) {
+  std::vector<bool> measured(circuit.numQubits, false);
+  for (const auto &gate : circuit.gates) {
+    if (gate.kind == GateKind::Reset)
+      return false;
+    for (int k = 0; k < arity(gate.kind); ++k) {
+      if (measured[gate.qubits[k]])
+        return false;
+    }
+    if (gate.kind == GateKind::Measure)
+      measured[gate.qubits[0]] = true;
+  }
+  return true;
+}
+
+bool hasMeasurements(const Circuit &circuit) {
+  for (const auto &gate : circuit.gates) {
+    if (gate.kind == GateKind::Measure)
+      return true;
+  }
+  return false;
+}
+
+std::string toKey(uint64_t bits, size_t width) {
+  std::string key(width, '0');
+  for (size_t k = 0; k < width; ++k) {
+    if ((bits >> k) & 1)
+      key[k] = '1';
+  }
+  return key;
+}
+
+// Maps each reported bit to the qubit it reads; without explicit
+// measurements every qubit is reported
+std::vector<unsigned> reportedQubits(const Circuit &circuit) {
+  std::vector<unsigned> qubitOfBit;
+  bool explicitBits = false;
+  for (const auto &gate : circuit.gates) {
+    if (gate.kind == GateKind::Measure) {
+      if (qubitOfBit.size() <= static_cast<size_t>(gate.bit))
+        qubitOfBit.resize(gate.bit + 1);
+      qubitOfBit[gate.bit] = gate.qubits[0];
+      explicitBits = true;
+    }
+  }
+  if (!explicitBits) {
+    for (unsigned q = 0; q < circuit.numQubits; ++q)
+      qubitOfBit.push_back(q);
+  }
+  return qubitOfBit;
+}
+
+std::vector<Gate> unitaryGates(const Circuit &circuit) {
+  std::vector<Gate> gates;
+  for (const auto &gate : circuit.gates) {
+    if (isUnitary(gate.kind))
+      gates.push_back(gate);
+  }
+  return gates;
+}
+
+// Outcomes are tallied as packed integers and only turned into strings
+// once per distinct value
+using Tally = std::unordered_map<uint64_t, size_t>;
+
+void tallyOutcomes(const std::vector<uint64_t> &outcomes,
+                   const std::vector<unsigned> &qubitOfBit, Tally &tally) {
+  for (uint64_t basis : outcomes) {
+    uint64_t bits = 0;
+    for (size_t b = 0; b < qubitOfBit.size(); ++b)
+      bits |= ((basis >> qubitOfBit[b]) & 1) << b;
+    tally[bits]++;
+  }
+}
+
+// Observables are read off the state after the last gate, which only
+// exists as one state when the measurements all come at the end
+void checkObservables(const Circuit &circuit) {
+  if (!circuit.observables.empty() && !hasOnlyTerminalMeasurements(circuit)) {
+    throw std::runtime_error("expect() needs a circuit whose measurements "
+                             "all come after its last gate");
+  }
+}
+
+template <typename Real>
+std::vector<double> observe(const Circuit &circuit,
+                            const StateVector<Real> &state) {
+  std::vector<double> values;
+  for (const auto &observable : circuit.observables)
+    values.push_back(state.expectation(observable));
+  return values;
+}
+
+SimulationResult startResult(const Circuit &circuit) {
+  checkObservables(circuit);
+  SimulationResult result;
+  result.labels =
+      hasMeasurements(circuit) ? circuit.bitNames : circuit.qubitNames;
+  if (result.labels.size() > 64)
+    throw std::runtime_error("Cannot report more than 64 measured bits");
+  return result;
+}
+
+void finishResult(const Tally &tally, SimulationResult &result) {
+  for (const auto &[bits, count] : tally)
+    result.counts[toKey(bits, result.labels.size())] += count;
+}
+
+// One shot with measurements and resets applied as they come. Without
+// explicit measurements the final state is sampled on every qubit.
+template <typename Real>
+uint64_t trajectory(const Circuit &circuit, bool explicitBits, Philox &rng) {
+  StateVector<Real> state(circuit.numQubits);
+  if (!circuit.startsInZero())
+    state.prepare(circuit.initialStates);
+  uint64_t bits = 0;
+  for (const auto &gate : circuit.gates) {
+    if (gate.kind == GateKind::Measure) {
+      uint64_t mask = uint64_t{1} << gate.bit;
+      bits = state.measure(gate.qubits[0], rng.nextDouble()) ? bits | mask
+                                                             : bits & ~mask;
+    } else if (gate.kind == GateKind::Reset) {
+      state.reset(gate.qubits[0], rng.nextDouble());
+    } else {
+      state.apply(gate);
+    }
+  }
+  if (!explicitBits)
+    bits = sampleOutcomes(state.probabilities(), 1, rng)[0];
+  return bits;
+}
+
+// Shots first .. first + lanes - 1 of trajectory(), one per lane of a
+// batch, each on its own random stream
+template <typename Real>
+void trajectoryBatch(const Circuit &circuit, bool explicitBits,
+                     uint64_t seed, size_t first,
+                     BatchedStateVector<Real> &state,
+                     std::vector<uint64_t> &bits) {
+  const unsigned lanes = state.lanes();
+  if (circuit.startsInZero())
+    state.prepare(std::vector<QubitState>(circuit.numQubits));
+  else
+    state.prepare(circuit.initialStates);
+  std::vector<Philox> rngs;
+  for (unsigned k = 0; k < lanes; ++k)
+    rngs.emplace_back(seed, first + k);
+  std::vector<double> u(lanes);
+  bits.assign(lanes, 0);
+
+  for (const auto &gate : circuit.gates) {
+    if (gate.kind == GateKind::Measure || gate.kind == GateKind::Reset) {
+      for (unsigned k = 0; k < lanes; ++k)
+        u[k] = rngs[k].nextDouble();
+    }
+    if (gate.kind == GateKind::Measure) {
+      uint64_t outcomes = state.measure(gate.qubits[0], u.data());
+      uint64_t mask = uint64_t{1} << gate.bit;
+      for (unsigned k = 0; k < lanes; ++k)
+        bits[k] = (outcomes >> k) & 1 ? bits[k] | mask : bits[k] & ~mask;
+    } else if (gate.kind == GateKind::Reset) {
+      state.reset(gate.qubits[0], u.data());
+    } else {
+      state.apply(gate);
+    }
+  }
+  if (!explicitBits) {
+    for (unsigned k = 0; k < lanes; ++k)
+      bits[k] = sampleOutcomes(state.probabilities(k), 1, rngs[k])[0];
+  }
+}
+
+// Shot s of a circuit that is re-run per shot is trajectory() on stream s.
+// Small circuits run a batch of shots at a time.
+template <typename Real>
+void trajectories(const Circuit &circuit, bool explicitBits,
+                  const SimulatorOptions &options, Tally &tally) {
+  using Batch = BatchedStateVector<Real>;
+  if (circuit.numQubits > Batch::kMaxQubits || options.shots < 2) {
+    for (size_t shot = 0; shot < options.shots; ++shot) {
+      TraceSpan span("sim", "shot", "shot", static_cast<int64_t>(shot));
+      Philox rng(options.seed, shot);
+      tally[trajectory<Real>(circuit, explicitBits, rng)]++;
+    }
+    return;
+  }
+
+  // The last batch may run past the shots; those lanes are dropped
+  Batch state(circuit.numQubits,
+              static_cast<unsigned>(std::min<size_t>(Batch::kLanes,
+                                                     options.shots)));
+  std::vector<uint64_t> bits;
+  for (size_t first = 0; first < options.shots; first += state.lanes()) {
+    TraceSpan span("sim", "shot batch", "first", static_cast<int64_t>(first));
+    trajectoryBatch(circuit, explicitBits, options.seed, first, state, bits);
+    const size_t used = std::min<size_t>(state.lanes(), options.shots - first);
+    for (size_t k = 0; k < used; ++k)
+      tally[bits[k]]++;
+  }
+}
+
+template <typename Real>
+SimulationResult run(const Circuit &circuit, const SimulatorOptions &options) {
+  SimulationResult result = startResult(circuit);
+  const bool explicitBits = hasMeasurements(circuit);
+  Tally tally;
+
+  if (hasOnlyTerminalMeasurements(circuit)) {
+    StateVector<Real> state(circuit.numQubits);
+    if (!circuit.startsInZero())
+      state.prepare(circuit.initialStates);
+    state.run(unitaryGates(circuit));
+    result.expectations = observe(circuit, state);
+
+    TraceSpan span("sim", "sample", "shots",
+                   static_cast<int64_t>(options.shots));
+    auto outcomes = sampleOutcomes(state.probabilities(), options.shots,
+                                   Philox(options.seed));
+    tallyOutcomes(outcomes, reportedQubits(circuit), tally);
+  } else {
+    // Mid-circuit measurement or reset: one trajectory per shot, each on
+    // its own random stream
+    trajectories<Real>(circuit, explicitBits, options, tally);
+  }
+
+  finishResult(tally, result);
+  return result;
+}
+
+// Sweep of a small circuit measured only at the end: one binding per lane
+// of a batch, each lane with its own angles
+template <typename Real>
+std::vector<SimulationResult>
+sweepBatched(const CircuitTemplate &tmpl,
+             const std::vector<std::vector<double>> &bindings,
+             const SimulatorOptions &options) {
+  using Batch = BatchedStateVector<Real>;
+  const Circuit &circuit = tmpl.circuit;
+  const SimulationResult start = startResult(circuit);
+  const std::vector<unsigned> qubitOfBit = reportedQubits(circuit);
+  const std::vector<Gate> gates = unitaryGates(circuit);
+  Batch state(circuit.numQubits,
+              static_cast<unsigned>(
+                  std::min<size_t>(Batch::kLanes, bindings.size())));
+  const unsigned lanes = state.lanes();
+  std::vector<std::vector<double>> nodes(lanes);
+  std::vector<double> angles(lanes);
+
+  std::vector<SimulationResult> results;
+  results.reserve(bindings.size());
+  for (size_t first = 0; first < bindings.size(); first += lanes) {
+    TraceSpan span("sim", "binding batch", "first",
+                   static_cast<int64_t>(first));
+    // Lanes past the last binding repeat it and are dropped
+    const size_t used = std::min<size_t>(lanes, bindings.size() - first);
+    for (unsigned k = 0; k < lanes; ++k)
+      nodes[k] = tmpl.evaluate(bindings[first + std::min<size_t>(k, used - 1)]);
+
+    state.prepare(circuit.initialStates);
+    for (const Gate &gate : gates) {
+      if (gate.angleNode < 0) {
+        state.apply(gate);
+        continue;
+      }
+      for (unsigned k = 0; k < lanes; ++k)
+        angles[k] = nodes[k][gate.angleNode];
+      state.apply(gate, angles.data());
+    }
+
+    for (unsigned k = 0; k < used; ++k) {
+      SimulationResult result = start;
+      for (const auto &observable : circuit.observables)
+        result.expectations.push_back(state.expectation(k, observable));
+      Tally tally;
+      auto outcomes = sampleOutcomes(state.probabilities(k), options.shots,
+                                     Philox(options.seed));
+      tallyOutcomes(outcomes, qubitOfBit, tally);
+      finishResult(tally, result);
+      results.push_back(std::move(result));
+    }
+  }
+  return results;
+}
+
+template <typename Real>
+std::vector<SimulationResult>
+sweep(const CircuitTemplate &tmpl,
+      const std::vector<std::vector<double>> &bindings,
+      const SimulatorOptions &options) {
+  Circuit circuit = tmpl.circuit; // bound in place for every binding
+  const SimulationResult start = startResult(circuit);
+  const bool explicitBits = hasMeasurements(circuit);
+  const bool terminal = hasOnlyTerminalMeasurements(circuit);
+  if (terminal && bindings.size() > 1 &&
+      circuit.numQubits <= BatchedStateVector<Real>::kMaxQubits)
+    return sweepBatched<Real>(tmpl, bindings, options);
+  const std::vector<unsigned> qubitOfBit = reportedQubits(circuit);
+  std::vector<Gate> gates = unitaryGates(circuit);
+  StateVector<Real> state(terminal ? circuit.numQubits : 0);
+
+  std::vector<SimulationResult> results;
+  results.reserve(bindings.size());
+  for (const auto &values : bindings) {
+    TraceSpan span("sim", "binding", "binding",
+                   static_cast<int64_t>(results.size()));
+    SimulationResult result = start;
+    Tally tally;
+    if (terminal) {
+      std::vector<double> angles = tmpl.evaluate(values);
+      for (Gate &gate : gates) {
+        if (gate.angleNode >= 0)
+          gate.angle = angles[gate.angleNode];
+      }
+      state.prepare(circuit.initialStates);
+      state.run(gates);
+      result.expectations = observe(circuit, state);
+      auto outcomes = sampleOutcomes(state.probabilities(), options.shots,
+                                     Philox(options.seed));
+      tallyOutcomes(outcomes, qubitOfBit, tally);
+    } else {
+      tmpl.bind(values, circuit);
+      trajectories<Real>(circuit, explicitBits, options, tally);
+    }
+    finishResult(tally, result);
+    results.push_back(std::move(result));
+  }
+  return results;
+}
+
+template <typename Real>
+SimulationResult runOutOfCore(const Circuit &circuit,
+                              const SimulatorOptions &options) {
+  if (!hasOnlyTerminalMeasurements(circuit)) {
+    throw std::runtime_error("Out-of-core simulation supports measurements "
+                             "only at the end of the circuit");
+  }
+  if (!circuit.observables.empty())
+    throw std::runtime_error("Out-of-core simulation does not support expect()");
+  SimulationResult result = startResult(circuit);
+
+  ChunkedStateVector<Real> state(circuit.numQubits,
+                                 options.outOfCore.chunkQubits,
+                                 options.outOfCore.directory);
+  if (!circuit.startsInZero())
+    state.prepare(circuit.initialStates);
+  state.run(unitaryGates(circuit));
+
+  Tally tally;
+  tallyOutcomes(state.sample(options.shots, Philox(options.seed)),
+                reportedQubits(circuit), tally);
+  finishResult(tally, result);
+  result.io = state.stats();
+  return result;
+}
+
+// The spans of the forked ranks go to rank 0, to be written with its own
+void gatherTrace(Communicator &comm) {
+  if (comm.rank() != 0) {
+    const std::string events = Trace::events(comm.rank());
+    const uint64_t bytes = events.size();
+    comm.send(0, &bytes, sizeof bytes);
+    comm.send(0, events.data(), bytes);
+    return;
+  }
+  for (unsigned r = 1; r < comm.size(); ++r) {
+    uint64_t bytes = 0;
+    comm.receive(r, &bytes, sizeof bytes);
+    std::string events(bytes, '\0');
+    comm.receive(r, events.data(), bytes);
+    Trace::adopt(std::move(events));
+  }
+}
+
+template <typename Real>
+SimulationResult runDistributed(const Circuit &circuit,
+                                const SimulatorOptions &options) {
+  if (!hasOnlyTerminalMeasurements(circuit)) {
+    throw std::runtime_error("Distributed simulation supports measurements "
+                             "only at the end of the circuit");
+  }
+  if (!circuit.observables.empty())
+    throw std::runtime_error("Distributed simulation does not support expect()");
+  SimulationResult result = startResult(circuit);
+
+  // Every shard keeps at least two local qubits; small circuits use fewer
+  // ranks than asked for
+  unsigned ranks = options.ranks;
+  while (ranks > 1 && uint64_t{ranks} * 4 > uint64_t{1} << circuit.numQubits)
+    ranks /= 2;
+
+  const std::vector<Gate> gates = unitaryGates(circuit);
+  std::vector<uint64_t> outcomes;
+  Communicator::launch(ranks, [&](Communicator &comm) {
+    if (Trace::enabled() && comm.rank() != 0)
+      Trace::reset();
+    DistributedStateVector<Real> state(circuit.numQubits, comm);
+    if (!circuit.startsInZero())
+      state.prepare(circuit.initialStates);
+    state.run(gates);
+    outcomes = state.sample(options.shots, Philox(options.seed));
+
+    // Every rank runs the same windows and swaps; only the bytes add up
+    result.comm = state.stats();
+    result.comm.bytesSent = 0;
+    for (const CommStats &stats : comm.allGather(state.stats()))
+      result.comm.bytesSent += stats.bytesSent;
+    if (Trace::enabled())
+      gatherTrace(comm);
+  });
+
+  Tally tally;
+  tallyOutcomes(outcomes, reportedQubits(circuit), tally);
+  finishResult(tally, result);
+  return result;
+}
+
+template <typename Real> StateVector<Real> evolve(const Circuit &circuit) {
+  StateVector<Real> state(circuit.numQubits);
+  if (!circuit.startsInZero())
+    state.prepare(circuit.initialStates);
+  state.run(unitaryGates(circuit));
+  return state;
+}
+
+// The derivative of a gate with respect to its angle is -i/2 * G * gate,
+// G given here as a Pauli sum: rotations are generated by their Pauli,
+// p(a) by -2|1><1| = Z - I and cp(a) by -2|11><11|
+PauliGroup generator(const Gate &gate) {
+  const uint64_t a = uint64_t{1} << gate.qubits[0];
+  const uint64_t b = uint64_t{1} << gate.qubits[1];
+  switch (gate.kind) {
+  case GateKind::Rx:
+    return {a, {0}, {1.0}};
+  case GateKind::Ry:
+    return {a, {a}, {{0.0, 1.0}}};
+  case GateKind::Rz:
+    return {0, {a}, {1.0}};
+  case GateKind::Phase:
+    return {0, {0, a}, {-1.0, 1.0}};
+  case GateKind::CPhase:
+    return {0, {0, a, b, a | b}, {-0.5, 0.5, 0.5, -0.5}};
+  default:
+    throw std::logic_error(std::string("Gate has no angle: ") +
+                           gateName(gate.kind));
+  }
+}
+
+// With lambda = H|psi> carried back alongside |psi>, the derivative of
+// <psi|H|psi> by the angle of the gate last applied is Im <lambda|G|psi>
+template <typename Real>
+Gradient differentiate(const CircuitTemplate &tmpl, const Circuit &circuit,
+                       const std::vector<double> &values,
+                       unsigned observable) {
+  StateVector<Real> psi = evolve<Real>(circuit);
+  StateVector<Real> lambda(circuit.numQubits);
+  std::fill(lambda.data(), lambda.data() + lambda.size(),
+            std::complex<Real>(0));
+  for (const auto &group :
+       groupPauliTerms(circuit.observables[observable].terms))
+    applyPauliGroup(psi.data(), lambda.data(), psi.size(), group);
+
+  Gradient result;
+  for (uint64_t i = 0; i < psi.size(); ++i) {
+    result.value += double(psi.data()[i].real()) * lambda.data()[i].real() +
+                    double(psi.data()[i].imag()) * lambda.data()[i].imag();
+  }
+
+  // Gates before the first symbolic angle need not be undone
+  const std::vector<Gate> gates = unitaryGates(circuit);
+  size_t first = 0;
+  while (first < gates.size() && gates[first].angleNode < 0)
+    ++first;
+
+  std::vector<double> nodes(tmpl.nodes.size(), 0.0);
+  for (size_t g = gates.size(); g-- > first;) {
+    const Gate &gate = gates[g];
+    if (gate.angleNode >= 0) {
+      nodes[gate.angleNode] += pauliOverlap(lambda.data(), psi.data(),
+                                            psi.size(), generator(gate))
+                                   .imag();
+    }
+    if (g == first)
+      break;
+    const Gate undo = inverse(gate);
+    psi.apply(undo);
+    lambda.apply(undo);
+  }
+  result.derivatives = tmpl.backpropagate(values, std::move(nodes));
+  return result;
+}
+
+} // namespace
+
+bool cheaperToSimulate(const Circuit &candidate, const Circuit &current,
+                       const SimulatorOptions &options) {
+  // Out-of-core and distributed runs cannot follow mid-circuit
+  // measurements
+  if ((!options.outOfCore.directory.empty() || options.ranks > 1) &&
+      !hasOnlyTerminalMeasurements(candidate))
+    return false;
+
+  auto cost = [&](const Circuit &circuit) {
+    double runs = hasOnlyTerminalMeasurements(circuit)
+                      ? 1.0
+                      : static_cast<double>(options.shots);
+    return runs * std::ldexp(1.0, static_cast<int>(circuit.numQubits));
+  };
+  return cost(candidate) < cost(current);
+}
+
+SimulationResult simulate(const Circuit &circuit,
+                          const SimulatorOptions &options) {
+  if (!options.outOfCore.directory.empty()) {
+    if (options.precision == Precision::Single)
+      return runOutOfCore<float>(circuit, options);
+    return runOutOfCore<double>(circuit, options);
+  }
+  if (options.ranks > 1) {
+    if (options.precision == Precision::Single)
+      return runDistributed<float>(circuit, options);
+    return runDistributed<double>(circuit, options);
+  }
+  if (options.precision == Precision::Single)
+    return run<float>(circuit, options);
+  return run<double>(circuit, options);
+}
+
+std::vector<SimulationResult>
+simulateSweep(const CircuitTemplate &tmpl,
+              const std::vector<std::vector<double>> &bindings,
+              const SimulatorOptions &options) {
+  if (!options.outOfCore.directory.empty() || options.ranks > 1) {
+    // Chunk files and ranks are set up per run; there is nothing to share
+    std::vector<SimulationResult> results;
+    for (const auto &values : bindings)
+      results.push_back(simulate(tmpl.bind(values), options));
+    return results;
+  }
+  if (options.precision == Precision::Single)
+    return sweep<float>(tmpl, bindings, options);
+  return sweep<double>(tmpl, bindings, options);
+}
+
+uint64_t simulateShot(const Circuit &circuit, Precision precision,
+                      Philox rng) {
+  if (circuit.bitNames.size() > 64)
+    throw std::runtime_error("Cannot report more than 64 measured bits");
+  TraceSpan span("sim", "shot");
+  if (precision == Precision::Single)
+    return trajectory<float>(circuit, true, rng);
+  return trajectory<double>(circuit, true, rng);
+}
+
+std::vector<double> expectationValues(const Circuit &circuit,
+                                      Precision precision) {
+  checkObservables(circuit);
+  if (precision == Precision::Single)
+    return observe(circuit, evolve<float>(circuit));
+  return observe(circuit, evolve<double>(circuit));
+}
+
+Gradient adjointGradient(const CircuitTemplate &tmpl,
+                         const std::vector<double> &values,
+                         unsigned observable, Precision precision) {
+  Circuit circuit = tmpl.bind(values);
+  checkObservables(circuit);
+  if (observable >= circuit.observables.size())
+    throw std::logic_error("No such observable");
+  if (precision == Precision::Single)
+    return differentiate<float>(tmpl, circuit, values, observable);
+  return differentiate<double>(tmpl, circuit, values, observable);
+}
+
+double precisionFidelity(const Circuit &circuit) {
+  auto single = evolve<float>(circuit);
+  auto reference = evolve<double>(circuit);
+
+  std::complex<double> overlap = 0;
+  for (uint64_t i = 0; i < reference.size(); ++i) {
+    std::complex<double> a(single.data()[i].real(), single.data()[i].imag());
+    overlap += std::conj(a) * reference.data()[i];
+  }
+  return std::norm(overlap);
+}
+
+Precision parsePrecision(const std::string &name) {
+  if (name == "single")
+    return Precision::Single;
+  if (name == "double")
+    return Precision::Double;
+  throw std::runtime_error("Unknown precision '" + name +
+                           "' (expected 'single' or 'double')");
+}
+
+const char *precisionName(Precision precision) {
+  return precision == Precision::Single ? "single" : "double";
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ir/circuit.hpp"
+#include "distributed.hpp"
+#include "ir/template.hpp"
+#include "outofcore.hpp"
+#include "rng.hpp"
+
+enum class Precision { Single, Double };
+
+// Disk-backed state vector; used when `directory` is set
+struct OutOfCoreOptions {
+  std::string directory;
+  unsigned chunkQubits = 24;
+};
+
+struct SimulatorOptions {
+  Precision precision = Precision::Double;
+  size_t shots = 1024;
+  uint64_t seed = 0;
+  OutOfCoreOptions outOfCore;
+  // Local processes the state vector is split across, a power of two;
+  // above 1 the state is distributed (see DistributedStateVector)
+  unsigned ranks = 1;
+};
+
+struct SimulationResult {
+  // Names of the reported bits; character k of every key in `counts` is
+  // the value of labels[k]. Circuits without measurements report every
+  // qubit as if measured at the end.
+  std::vector<std::string> labels;
+  std::map<std::string, size_t> counts;
+  // Exact value of each of the circuit's observables, in order
+  std::vector<double> expectations;
+  IoStats io;     // out-of-core runs only
+  CommStats comm; // distributed runs only, summed over ranks
+};
+
+SimulationResult simulate(const Circuit &circuit,
+                          const SimulatorOptions &options);
+
+// Simulates `tmpl` once for every set of parameter values in `bindings`.
+// Result k is what simulate() returns for tmpl.bind(bindings[k]), but the
+// circuit is analysed once and a single state vector serves all of them.
+std::vector<SimulationResult>
+simulateSweep(const CircuitTemplate &tmpl,
+              const std::vector<std::vector<double>> &bindings,
+              const SimulatorOptions &options);
+
+// True when `candidate`, another circuit for the same program, is cheaper
+// to simulate than `current`: a circuit whose measurements all come last
+// is evolved once, any other is re-run for every shot
+bool cheaperToSimulate(const Circuit &candidate, const Circuit &current,
+                       const SimulatorOptions &options);
+
+// Runs one trajectory of `circuit` on `rng` and returns its classical bits,
+// bit k of the result being circuit.bitNames[k]
+uint64_t simulateShot(const Circuit &circuit, Precision precision,
+                      Philox rng);
+
+// Exact values of the observables of `circuit`, from one evolution of its
+// gates; throws std::runtime_error if it measures or resets a qubit before
+// its last gate
+std::vector<double> expectationValues(const Circuit &circuit,
+                                      Precision precision);
+
+// Value of one of a template's observables and its derivative with respect
+// to each of the template's parameters
+struct Gradient {
+  double value = 0.0;
+  std::vector<double> derivatives;
+};
+
+// Gradient of observable `observable` of `tmpl` at `values` by the adjoint
+// method: one forward evolution, then one backward sweep that undoes every
+// gate on both the state and the observable applied to it. Each gate with
+// a symbolic angle adds one inner product, so the cost is about three
+// evolutions whatever the number of parameters, where parameter shift
+// takes two per parameter. Throws std::runtime_error where
+// expectationValues() would.
+Gradient adjointGradient(const CircuitTemplate &tmpl,
+                         const std::vector<double> &values,
+                         unsigned observable, Precision precision);
+
+// Runs the unitary part of `circuit` in single and double precision and
+// returns the fidelity |<psi_single|psi_double>|^2. Intended for small
+// instances: both state vectors are held at once.
+double precisionFidelity(const Circuit &circuit);
+
+Precision parsePrecision(const std::string &name);
+const char *precisionName(Precision precision);
@@ -0,0 +1,116 @@
+#include "statevector.hpp"
+#include "kernels.hpp"
+#include "schedule.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+template <typename Real>
+StateVector<Real>::StateVector(unsigned numQubits)
+    : numQubits(numQubits), amps(uint64_t{1} << numQubits) {
+  amps[0] = 1;
+}
+
+template <typename Real>
+void StateVector<Real>::prepare(const std::vector<QubitState> &states) {
+  if (states.size() != numQubits)
+    throw std::logic_error("Initial state does not match the qubit count");
+  fillProductState(amps.data(), amps.size(), 0, states);
+}
+
+template <typename Real> void StateVector<Real>::apply(const Gate &gate) {
+  if (!isUnitary(gate.kind)) {
+    throw std::logic_error(std::string("Not a unitary gate: ") +
+                           gateName(gate.kind));
+  }
+
+  const auto start =
+      Stats::enabled() ? Stats::Clock::now() : Stats::Clock::time_point{};
+  applyGate(amps.data(), amps.size(), gate);
+  if (Stats::enabled()) {
+    Stats::add(Counter::GatesApplied);
+    Stats::kernel(gateName(gate.kind), start,
+                  2 * amps.size() * sizeof(Complex));
+  }
+}
+
+template <typename Real>
+void StateVector<Real>::run(const std::vector<Gate> &gates) {
+  for (const auto &gate : gates) {
+    if (!isUnitary(gate.kind)) {
+      throw std::logic_error(std::string("Not a unitary gate: ") +
+                             gateName(gate.kind));
+    }
+  }
+
+  runGates(amps.data(), amps.size(), 0, gates);
+}
+
+template <typename Real>
+void runGates(std::complex<Real> *amps, uint64_t size, uint64_t first,
+              const std::vector<Gate> &gates) {
+  Stats::add(Counter::GatesApplied, gates.size());
+  const uint64_t blockSize = uint64_t{1} << StateVector<Real>::kBlockQubits;
+  // Small states fit in cache whole
+  if (size <= blockSize) {
+    TraceSpan span("sim", "gate window", "gates",
+                   static_cast<int64_t>(gates.size()));
+    GateSequence<Real>(gates).apply(amps, size, first);
+    return;
+  }
+
+  for (const auto &window :
+       scheduleWindows(gates, StateVector<Real>::kBlockQubits)) {
+    TraceSpan span("sim", "gate window", "gates",
+                   static_cast<int64_t>(window.gates.size()));
+    GateSequence<Real> sequence(window.gates);
+    if (!window.blockLocal) {
+      sequence.apply(amps, size, first);
+      continue;
+    }
+    for (uint64_t block = 0; block < size; block += blockSize)
+      sequence.apply(amps + block, blockSize, first + block);
+  }
+}
+
+template <typename Real> bool StateVector<Real>::measure(unsigned q, double u) {
+  double p1 = probabilityOne(amps.data(), amps.size(), q);
+  bool outcome = u < p1;
+  double p = outcome ? p1 : 1.0 - p1;
+  collapse(amps.data(), amps.size(), q, outcome,
+           static_cast<Real>(1.0 / std::sqrt(p)));
+  return outcome;
+}
+
+template <typename Real> void StateVector<Real>::reset(unsigned q, double u) {
+  if (measure(q, u)) {
+    Gate flip{GateKind::X, {q, 0}};
+    apply(flip);
+  }
+}
+
+template <typename Real>
+std::vector<double> StateVector<Real>::probabilities() const {
+  std::vector<double> probs(amps.size());
+  for (uint64_t i = 0; i < amps.size(); ++i) {
+    double re = amps[i].real();
+    double im = amps[i].imag();
+    probs[i] = re * re + im * im;
+  }
+  return probs;
+}
+
+template <typename Real>
+double StateVector<Real>::expectation(const Observable &observable) const {
+  double total = 0.0;
+  for (const auto &group : groupPauliTerms(observable.terms))
+    total += pauliExpectation(amps.data(), amps.size(), group);
+  return total;
+}
+
+template class StateVector<float>;
+template class StateVector<double>;
+template void runGates(std::complex<float> *, uint64_t, uint64_t,
+                       const std::vector<Gate> &);
+template void runGates(std::complex<double> *, uint64_t, uint64_t,
+                       const std::vector<Gate> &);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "ir/circuit.hpp"
+
+// Dense state vector over `numQubits` qubits. Qubit k is bit k of the
+// amplitude index. Instantiated for float and double.
+template <typename Real> class StateVector {
+public:
+  using Complex = std::complex<Real>;
+
+  explicit StateVector(unsigned numQubits);
+
+  unsigned qubits() const { return numQubits; }
+  uint64_t size() const { return amps.size(); }
+  Complex *data() { return amps.data(); }
+  const Complex *data() const { return amps.data(); }
+
+  // Replaces the state with the product of one state per qubit, written
+  // in a single pass with no gates applied
+  void prepare(const std::vector<QubitState> &states);
+
+  // Applies a unitary gate
+  void apply(const Gate &gate);
+
+  // Applies a sequence of unitary gates. Diagonal runs are batched, and
+  // gates on low-order bits are applied block by block (see schedule.hpp).
+  void run(const std::vector<Gate> &gates);
+
+  // Blocks of 2^kBlockQubits amplitudes fill 256 KiB, a typical L2 cache
+  static constexpr unsigned kBlockQubits = sizeof(Real) == 4 ? 15 : 14;
+
+  // Measures qubit q using uniform draw u in [0, 1); returns the outcome
+  bool measure(unsigned q, double u);
+  void reset(unsigned q, double u);
+
+  std::vector<double> probabilities() const;
+
+  // <psi|observable|psi>. Strings that flip the same qubits are summed in
+  // one pass, so the cost grows with the number of distinct X/Y patterns
+  // rather than the number of terms.
+  double expectation(const Observable &observable) const;
+
+private:
+  unsigned numQubits;
+  std::vector<Complex> amps;
+};
+
+// StateVector::run() on a span of a larger state: amps[j] is amplitude
+// first + j. Gates other than diagonal ones must act below log2(size).
+template <typename Real>
+void runGates(std::complex<Real> *amps, uint64_t size, uint64_t first,
+              const std::vector<Gate> &gates);
+
+extern template class StateVector<float>;
+extern template class StateVector<double>;
+extern template void runGates(std::complex<float> *, uint64_t, uint64_t,
+                              const std::vector<Gate> &);
+extern template void runGates(std::complex<double> *, uint64_t, uint64_t,
+                              const std::vector<Gate> &);
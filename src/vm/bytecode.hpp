@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Register bytecode for the classical subset of Quanta. Every function
+// gets a fixed-size register window; locals live in the low registers and
+// temporaries above them. Operand types are resolved by the compiler, so
+// arithmetic and comparisons come in int and float flavours and the
+// interpreter never inspects a value's type on the hot path.
+
+// X(name): operands are a, b, c, d (register, constant, function, field or
+// jump target as noted)
+#define QUANTA_OPCODES(X)                                                      \
+  X(LoadConst)    /* r[a] = constants[b] */                                    \
+  X(Move)         /* r[a] = r[b] */                                            \
+  X(AddInt)       /* r[a] = r[b] + r[c] */                                     \
+  X(SubInt)                                                                    \
+  X(MulInt)                                                                    \
+  X(DivInt)                                                                    \
+  X(ModInt)                                                                    \
+  X(NegInt)       /* r[a] = -r[b] */                                           \
+  X(AddFloat)                                                                  \
+  X(SubFloat)                                                                  \
+  X(MulFloat)                                                                  \
+  X(DivFloat)                                                                  \
+  X(NegFloat)                                                                  \
+  X(LessInt)      /* r[a] = r[b] < r[c] */                                     \
+  X(LessEqualInt)                                                              \
+  X(LessFloat)                                                                 \
+  X(LessEqualFloat)                                                            \
+  X(IntToFloat)   /* r[a] = float(r[b]) */                                     \
+  X(FloatToInt)   /* r[a] = int(r[b]), truncating */                           \
+  X(ToText)       /* r[a] = r[b] printed as ValueType c */                     \
+  X(Concat)       /* r[a] = r[b] + r[c], both strings */                       \
+  X(Jump)         /* pc = a */                                                 \
+  X(JumpIfFalse)  /* if r[a] == 0: pc = b */                                   \
+  X(Call)         /* r[a] = functions[b](r[c] .. r[c+d-1]) */                  \
+  X(CallQuantum)  /* r[a] = quantum[b](r[c] .. r[c+d-1]) */                    \
+  X(QuantumGradient) /* r[a] = d quantum[b](r[c+1] .. r[c+d]) / d param r[c] */ \
+  X(Return)       /* return r[a] */                                            \
+  X(ReturnVoid)                                                                \
+  X(Echo)         /* print r[a] as ValueType b */                              \
+  X(NewObject)    /* r[a] = new classes[b] */                                  \
+  X(GetField)     /* r[a] = r[b].fields[c] */                                  \
+  X(SetField)     /* r[a].fields[b] = r[c] */
+
+enum class Opcode : uint8_t {
+#define QUANTA_OPCODE_ENUM(name) name,
+  QUANTA_OPCODES(QUANTA_OPCODE_ENUM)
+#undef QUANTA_OPCODE_ENUM
+};
+
+struct Instruction {
+  Opcode op;
+  int32_t a = 0, b = 0, c = 0, d = 0;
+};
+
+// Static types the compiler tracks per register. Bits and chars are held
+// as ints and only differ when printed.
+enum class ValueType : uint8_t { Int, Float, Bit, Char, String, Object, Void };
+
+struct Object;
+
+// Ints and floats are held widened to 64 bits, but only ever hold values
+// of the generated C++'s 32-bit `int` and `float` (see vm.cpp)
+struct Value {
+  union {
+    int64_t i;
+    double f;
+  };
+  // Strings and objects; null for numbers
+  std::shared_ptr<const std::string> text;
+  std::shared_ptr<Object> object;
+
+  Value() : i(0) {}
+  static Value ofInt(int64_t v) {
+    Value value;
+    value.i = v;
+    return value;
+  }
+  static Value ofFloat(double v) {
+    Value value;
+    value.f = v;
+    return value;
+  }
+};
+
+struct Object {
+  std::vector<Value> fields;
+};
+
+struct BytecodeFunction {
+  std::string name;
+  unsigned numParams = 0; // arguments arrive in r[0] .. r[numParams-1]
+  unsigned numRegisters = 0;
+  std::vector<Instruction> code;
+};
+
+// Arguments of quantum calls are always floats; the result is a bit, or a
+// float for functions returning expect()
+struct QuantumFunction {
+  std::string name;
+  unsigned numParams = 0;
+  bool returnsFloat = false;
+};
+
+struct ClassLayout {
+  std::string name;
+  std::vector<std::string> fields;
+};
+
+struct Module {
+  std::vector<BytecodeFunction> functions;
+  std::vector<QuantumFunction> quantum;
+  std::vector<ClassLayout> classes;
+  std::vector<Value> constants;
+  int entry = -1; // index of main in `functions`
+};
@@ -0,0 +1,783 @@
+#include "compiler.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+struct StaticType {
+  ValueType kind = ValueType::Void;
+  int classId = -1; // for objects
+
+  bool isInteger() const {
+    return kind == ValueType::Int || kind == ValueType::Bit ||
+           kind == ValueType::Char;
+  }
+  bool isNumeric() const { return isInteger() || kind == ValueType::Float; }
+};
+
+// A value in a register
+struct Operand {
+  int reg;
+  StaticType type;
+};
+
+struct Local {
+  int reg;
+  StaticType type;
+};
+
+struct Signature {
+  std::vector<StaticType> params; // including `this` for methods
+  StaticType result;
+};
+
+// A function, method or constructor waiting to be compiled
+struct Pending {
+  int index;
+  const FunctionDeclaration *decl;
+  int classId; // -1 for free functions
+};
+
+struct ClassInfo {
+  const ClassDeclaration *decl;
+  std::vector<StaticType> fieldTypes;
+  std::unordered_map<std::string, int> fieldIndex;
+  std::unordered_map<std::string, int> methods; // name -> function index
+  int constructor = -1;
+};
+
+class BytecodeCompiler {
+public:
+  explicit BytecodeCompiler(const Program &program) : program(program) {
+    for (const auto &func : program.functions)
+      functionDecls[func->name] = func.get();
+    for (const auto &cls : program.classes)
+      classDecls[cls->name] = cls.get();
+  }
+
+  Module run();
+
+private:
+  const Program &program;
+  Module module;
+
+  std::unordered_map<std::string, const FunctionDeclaration *> functionDecls;
+  std::unordered_map<std::string, const ClassDeclaration *> classDecls;
+  std::unordered_map<std::string, int> functionIndex; // free functions
+  std::unordered_map<std::string, int> quantumIndex;
+  std::unordered_map<std::string, int> classIndex;
+  std::vector<ClassInfo> classes;
+  std::vector<Signature> signatures;
+  std::deque<Pending> pending;
+
+  // State of the function being compiled
+  // An index, as compiling can declare further functions
+  int currentFunction = -1;
+  std::vector<std::unordered_map<std::string, Local>> scopes;
+  int nextRegister = 0;
+  int currentClass = -1;
+  StaticType returnType;
+
+  // Declarations
+  int requireFunction(const std::string &name);
+  int requireQuantum(const FunctionDeclaration *decl);
+  int requireClass(const std::string &name);
+  int declareFunction(const FunctionDeclaration *decl, int classId,
+                      const std::string &name);
+  StaticType typeOf(const Type *type);
+  void compileFunction(const Pending &job);
+
+  // Statements
+  void compileStatement(const Statement *stmt);
+  void compileBlock(const BlockStatement *block);
+  void compileDeclaration(const VariableDeclaration *decl);
+  void compileIf(const IfStatement *stmt);
+  void compileFor(const ForStatement *stmt);
+  void compileReturn(const ReturnStatement *stmt);
+
+  // Expressions
+  Operand compileExpression(const Expression *expr);
+  Operand compileLiteral(const LiteralExpression *lit);
+  Operand compileVariable(const std::string &name);
+  Operand compileAssignment(const std::string &name, const Expression *value);
+  Operand compileBinary(const BinaryExpression *bin);
+  Operand compileCall(const CallExpression *call);
+  Operand compileGradient(const FunctionDeclaration *decl,
+                          const std::vector<std::unique_ptr<Expression>> &args);
+  Operand compileInvoke(int function,
+                        const std::vector<Operand> &leading,
+                        const std::vector<std::unique_ptr<Expression>> &args,
+                        const std::string &name);
+  Operand compileConstruct(const ConstructorCallExpression *ctor);
+  Operand compileMember(const MemberAccessExpression *member);
+
+  // Helpers
+  BytecodeFunction &current() { return module.functions[currentFunction]; }
+  int emit(Opcode op, int a = 0, int b = 0, int c = 0, int d = 0);
+  int temporary();
+  int constant(Value value);
+  Operand coerce(Operand value, StaticType to, const std::string &context);
+  Operand toText(Operand value);
+  int condition(const Expression *expr);
+  void pushScope() { scopes.emplace_back(); }
+  void popScope() { scopes.pop_back(); }
+  [[noreturn]] void reportError(const std::string &msg);
+};
+
+Module BytecodeCompiler::run() {
+  if (!functionDecls.count("main"))
+    reportError("Nothing to run: the program defines no `function main()`");
+  module.entry = requireFunction("main");
+
+  while (!pending.empty()) {
+    Pending job = pending.front();
+    pending.pop_front();
+    compileFunction(job);
+  }
+  return std::move(module);
+}
+
+// Declarations
+
+int BytecodeCompiler::declareFunction(const FunctionDeclaration *decl,
+                                      int classId, const std::string &name) {
+  Signature sig;
+  if (classId >= 0)
+    sig.params.push_back({ValueType::Object, classId});
+  for (const auto &param : decl->params)
+    sig.params.push_back(typeOf(param->type.get()));
+  sig.result = decl->isConstructor ? StaticType{} : typeOf(decl->returnType.get());
+
+  int index = static_cast<int>(module.functions.size());
+  BytecodeFunction function;
+  function.name = name;
+  function.numParams = static_cast<unsigned>(sig.params.size());
+  module.functions.push_back(std::move(function));
+  signatures.push_back(sig);
+  pending.push_back({index, decl, classId});
+  return index;
+}
+
+int BytecodeCompiler::requireFunction(const std::string &name) {
+  auto it = functionIndex.find(name);
+  if (it != functionIndex.end())
+    return it->second;
+  // Registered before compiling so recursive calls resolve
+  int index = declareFunction(functionDecls.at(name), -1, name);
+  functionIndex[name] = index;
+  return index;
+}
+
+int BytecodeCompiler::requireQuantum(const FunctionDeclaration *decl) {
+  auto it = quantumIndex.find(decl->name);
+  if (it != quantumIndex.end())
+    return it->second;
+  for (const auto &param : decl->params) {
+    auto *pt = dynamic_cast<const PrimitiveType *>(param->type.get());
+    if (!pt || pt->name == "qubit") {
+      reportError("@quantum function '" + decl->name +
+                  "' takes qubits and cannot be called from classical code");
+    }
+  }
+  auto *ret = dynamic_cast<const PrimitiveType *>(decl->returnType.get());
+  int index = static_cast<int>(module.quantum.size());
+  module.quantum.push_back({decl->name,
+                            static_cast<unsigned>(decl->params.size()),
+                            ret && ret->name == "float"});
+  quantumIndex[decl->name] = index;
+  return index;
+}
+
+int BytecodeCompiler::requireClass(const std::string &name) {
+  auto it = classIndex.find(name);
+  if (it != classIndex.end())
+    return it->second;
+  auto decl = classDecls.find(name);
+  if (decl == classDecls.end())
+    reportError("Unknown class: " + name);
+
+  int id = static_cast<int>(classes.size());
+  classIndex[name] = id;
+  classes.push_back({decl->second, {}, {}, {}});
+  module.classes.push_back({name, {}});
+
+  for (const auto &member : decl->second->members) {
+    StaticType type = typeOf(member->varType.get());
+    classes[id].fieldIndex[member->name] =
+        static_cast<int>(classes[id].fieldTypes.size());
+    classes[id].fieldTypes.push_back(type);
+    module.classes[id].fields.push_back(member->name);
+  }
+  for (const auto &method : decl->second->methods) {
+    int index = declareFunction(method.get(), id, name + "." + method->name);
+    if (method->isConstructor)
+      classes[id].constructor = index;
+    else
+      classes[id].methods[method->name] = index;
+  }
+  return id;
+}
+
+StaticType BytecodeCompiler::typeOf(const Type *type) {
+  if (!type || dynamic_cast<const VoidType *>(type))
+    return {ValueType::Void};
+  if (auto *pt = dynamic_cast<const PrimitiveType *>(type)) {
+    if (pt->name == "int")
+      return {ValueType::Int};
+    if (pt->name == "float")
+      return {ValueType::Float};
+    if (pt->name == "bit")
+      return {ValueType::Bit};
+    if (pt->name == "char")
+      return {ValueType::Char};
+    if (pt->name == "string")
+      return {ValueType::String};
+    if (pt->name == "qubit")
+      reportError("Qubits only exist inside @quantum functions");
+  }
+  if (auto *ot = dynamic_cast<const ObjectType *>(type))
+    return {ValueType::Object, requireClass(ot->className)};
+  reportError("Type not supported by the bytecode VM");
+}
+
+void BytecodeCompiler::compileFunction(const Pending &job) {
+  currentFunction = job.index;
+  const Signature sig = signatures[job.index];
+  currentClass = job.classId;
+  returnType = sig.result;
+  scopes.clear();
+  pushScope();
+  nextRegister = 0;
+
+  if (job.classId >= 0)
+    scopes.back()["this"] = {nextRegister++, sig.params[0]};
+  size_t first = job.classId >= 0 ? 1 : 0;
+  for (size_t i = 0; i < job.decl->params.size(); ++i) {
+    scopes.back()[job.decl->params[i]->name] = {nextRegister++,
+                                                sig.params[first + i]};
+  }
+  current().numRegisters = nextRegister;
+
+  // Constructors start by running the member initialisers
+  if (job.decl->isConstructor) {
+    const ClassInfo &info = classes[job.classId];
+    for (const auto &member : info.decl->members) {
+      if (!member->initializer)
+        continue;
+      int saved = nextRegister;
+      Operand value = coerce(compileExpression(member->initializer.get()),
+                             info.fieldTypes[info.fieldIndex.at(member->name)],
+                             "member '" + member->name + "'");
+      emit(Opcode::SetField, 0, info.fieldIndex.at(member->name), value.reg);
+      nextRegister = saved;
+    }
+  }
+
+  if (job.decl->body)
+    compileBlock(job.decl->body.get());
+  emit(Opcode::ReturnVoid);
+  currentFunction = -1;
+}
+
+// Statements
+
+void BytecodeCompiler::compileStatement(const Statement *stmt) {
+  // Temporaries only live for the statement that made them
+  const int saved = nextRegister;
+
+  if (auto decl = dynamic_cast<const VariableDeclaration *>(stmt)) {
+    compileDeclaration(decl);
+    return; // keeps its register
+  } else if (auto exprStmt = dynamic_cast<const ExpressionStatement *>(stmt)) {
+    compileExpression(exprStmt->expression.get());
+  } else if (auto assign = dynamic_cast<const AssignmentStatement *>(stmt)) {
+    compileAssignment(assign->name, assign->value.get());
+  } else if (auto echo = dynamic_cast<const EchoStatement *>(stmt)) {
+    Operand value = compileExpression(echo->value.get());
+    emit(Opcode::Echo, value.reg, static_cast<int>(value.type.kind));
+  } else if (auto ret = dynamic_cast<const ReturnStatement *>(stmt)) {
+    compileReturn(ret);
+  } else if (auto block = dynamic_cast<const BlockStatement *>(stmt)) {
+    compileBlock(block);
+  } else if (auto ifStmt = dynamic_cast<const IfStatement *>(stmt)) {
+    compileIf(ifStmt);
+  } else if (auto forStmt = dynamic_cast<const ForStatement *>(stmt)) {
+    compileFor(forStmt);
+  } else if (dynamic_cast<const MeasureStatement *>(stmt) ||
+             dynamic_cast<const ResetStatement *>(stmt)) {
+    reportError("Quantum operations belong in @quantum functions");
+  } else {
+    reportError("Statement not supported by the bytecode VM");
+  }
+  nextRegister = saved;
+}
+
+void BytecodeCompiler::compileBlock(const BlockStatement *block) {
+  const int saved = nextRegister;
+  pushScope();
+  for (const auto &stmt : block->statements)
+    compileStatement(stmt.get());
+  popScope();
+  nextRegister = saved;
+}
+
+void BytecodeCompiler::compileDeclaration(const VariableDeclaration *decl) {
+  StaticType type = typeOf(decl->varType.get());
+  if (type.kind == ValueType::Void)
+    reportError("Variable '" + decl->name + "' cannot be void");
+
+  // Declared first so the initialiser's temporaries sit above it
+  int reg = nextRegister++;
+  current().numRegisters = std::max<unsigned>(current().numRegisters, nextRegister);
+
+  if (decl->initializer) {
+    Operand value = coerce(compileExpression(decl->initializer.get()), type,
+                           "variable '" + decl->name + "'");
+    if (value.reg != reg)
+      emit(Opcode::Move, reg, value.reg);
+  } else {
+    // Loop bodies re-run declarations; start from a fresh value each time
+    Value zero;
+    if (type.kind == ValueType::String)
+      zero.text = std::make_shared<const std::string>();
+    emit(Opcode::LoadConst, reg, constant(zero));
+  }
+  nextRegister = reg + 1;
+  scopes.back()[decl->name] = {reg, type};
+}
+
+void BytecodeCompiler::compileIf(const IfStatement *stmt) {
+  int jumpElse = emit(Opcode::JumpIfFalse, condition(stmt->condition.get()));
+  compileStatement(stmt->thenBranch.get());
+  if (stmt->elseBranch) {
+    int jumpEnd = emit(Opcode::Jump);
+    current().code[jumpElse].b = static_cast<int>(current().code.size());
+    compileStatement(stmt->elseBranch.get());
+    current().code[jumpEnd].a = static_cast<int>(current().code.size());
+  } else {
+    current().code[jumpElse].b = static_cast<int>(current().code.size());
+  }
+}
+
+void BytecodeCompiler::compileFor(const ForStatement *stmt) {
+  const int saved = nextRegister;
+  pushScope();
+  if (stmt->initializer)
+    compileStatement(stmt->initializer.get());
+
+  const int loopVars = nextRegister;
+  const int top = static_cast<int>(current().code.size());
+  int exit = emit(Opcode::JumpIfFalse, condition(stmt->condition.get()));
+  nextRegister = loopVars;
+  compileStatement(stmt->body.get());
+  compileExpression(stmt->increment.get());
+  nextRegister = loopVars;
+  emit(Opcode::Jump, top);
+  current().code[exit].b = static_cast<int>(current().code.size());
+
+  popScope();
+  nextRegister = saved;
+}
+
+void BytecodeCompiler::compileReturn(const ReturnStatement *stmt) {
+  if (!stmt->value) {
+    emit(Opcode::ReturnVoid);
+    return;
+  }
+  Operand value = compileExpression(stmt->value.get());
+  if (returnType.kind != ValueType::Void)
+    value = coerce(value, returnType, "return value");
+  emit(Opcode::Return, value.reg);
+}
+
+// Expressions
+
+Operand BytecodeCompiler::compileExpression(const Expression *expr) {
+  if (auto lit = dynamic_cast<const LiteralExpression *>(expr))
+    return compileLiteral(lit);
+  if (auto var = dynamic_cast<const VariableExpression *>(expr))
+    return compileVariable(var->name);
+  if (auto paren = dynamic_cast<const ParenthesizedExpression *>(expr))
+    return compileExpression(paren->expression.get());
+  if (auto assign = dynamic_cast<const AssignmentExpression *>(expr))
+    return compileAssignment(assign->name, assign->value.get());
+  if (auto bin = dynamic_cast<const BinaryExpression *>(expr))
+    return compileBinary(bin);
+  if (auto unary = dynamic_cast<const UnaryExpression *>(expr)) {
+    Operand value = compileExpression(unary->right.get());
+    if (!value.type.isNumeric())
+      reportError("Unary '" + unary->op + "' needs a number");
+    bool isFloat = value.type.kind == ValueType::Float;
+    int reg = temporary();
+    emit(isFloat ? Opcode::NegFloat : Opcode::NegInt, reg, value.reg);
+    return {reg, {isFloat ? ValueType::Float : ValueType::Int}};
+  }
+  if (auto call = dynamic_cast<const CallExpression *>(expr))
+    return compileCall(call);
+  if (auto ctor = dynamic_cast<const ConstructorCallExpression *>(expr))
+    return compileConstruct(ctor);
+  if (auto member = dynamic_cast<const MemberAccessExpression *>(expr))
+    return compileMember(member);
+  if (dynamic_cast<const MeasureExpression *>(expr))
+    reportError("Quantum operations belong in @quantum functions");
+  reportError("Expression not supported by the bytecode VM");
+}
+
+Operand BytecodeCompiler::compileLiteral(const LiteralExpression *lit) {
+  const std::string &text = lit->value;
+  Value value;
+  StaticType type;
+
+  if (text.size() >= 2 && text.front() == '"') {
+    std::string decoded;
+    for (size_t i = 1; i + 1 < text.size(); ++i) {
+      char c = text[i];
+      if (c == '\\' && i + 2 < text.size()) {
+        c = text[++i];
+        c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+      }
+      decoded += c;
+    }
+    value.text = std::make_shared<const std::string>(std::move(decoded));
+    type = {ValueType::String};
+  } else if (text.size() >= 3 && text.front() == '\'') {
+    value.i = static_cast<unsigned char>(text[1]);
+    type = {ValueType::Char};
+  } else if (text.find_first_of(".fF") != std::string::npos) {
+    // As the C++ compiler reads the literal, straight to single precision
+    value.f = std::strtof(text.c_str(), nullptr);
+    type = {ValueType::Float};
+  } else {
+    value.i = static_cast<int32_t>(std::stoll(text));
+    type = {ValueType::Int};
+  }
+
+  int reg = temporary();
+  emit(Opcode::LoadConst, reg, constant(value));
+  return {reg, type};
+}
+
+Operand BytecodeCompiler::compileVariable(const std::string &name) {
+  for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+    auto it = scope->find(name);
+    if (it != scope->end())
+      return {it->second.reg, it->second.type};
+  }
+  if (currentClass >= 0) {
+    const ClassInfo &info = classes[currentClass];
+    auto field = info.fieldIndex.find(name);
+    if (field != info.fieldIndex.end()) {
+      int reg = temporary();
+      emit(Opcode::GetField, reg, 0, field->second);
+      return {reg, info.fieldTypes[field->second]};
+    }
+  }
+  reportError("Unknown variable: " + name);
+}
+
+Operand BytecodeCompiler::compileAssignment(const std::string &name,
+                                            const Expression *valueExpr) {
+  for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+    auto it = scope->find(name);
+    if (it == scope->end())
+      continue;
+    Local local = it->second;
+    Operand value = coerce(compileExpression(valueExpr), local.type,
+                           "variable '" + name + "'");
+    if (value.reg != local.reg)
+      emit(Opcode::Move, local.reg, value.reg);
+    return {local.reg, local.type};
+  }
+  if (currentClass >= 0) {
+    const ClassInfo &info = classes[currentClass];
+    auto field = info.fieldIndex.find(name);
+    if (field != info.fieldIndex.end()) {
+      Operand value =
+          coerce(compileExpression(valueExpr), info.fieldTypes[field->second],
+                 "member '" + name + "'");
+      emit(Opcode::SetField, 0, field->second, value.reg);
+      return value;
+    }
+  }
+  reportError("Unknown variable: " + name);
+}
+
+Operand BytecodeCompiler::compileBinary(const BinaryExpression *bin) {
+  Operand left = compileExpression(bin->left.get());
+  Operand right = compileExpression(bin->right.get());
+  const std::string &op = bin->op;
+
+  if (op == "+" && (left.type.kind == ValueType::String ||
+                    right.type.kind == ValueType::String)) {
+    left = toText(left);
+    right = toText(right);
+    int reg = temporary();
+    emit(Opcode::Concat, reg, left.reg, right.reg);
+    return {reg, {ValueType::String}};
+  }
+
+  if (!left.type.isNumeric() || !right.type.isNumeric())
+    reportError("Operator '" + op + "' needs numbers");
+  const bool isFloat = left.type.kind == ValueType::Float ||
+                       right.type.kind == ValueType::Float;
+  const StaticType operandType{isFloat ? ValueType::Float : ValueType::Int};
+  left = coerce(left, operandType, "operand");
+  right = coerce(right, operandType, "operand");
+
+  int reg = temporary();
+  if (op == "<" || op == ">" || op == "<=" || op == ">=") {
+    // a > b is b < a
+    bool strict = op == "<" || op == ">";
+    bool swap = op == ">" || op == ">=";
+    Opcode code = strict ? (isFloat ? Opcode::LessFloat : Opcode::LessInt)
+                         : (isFloat ? Opcode::LessEqualFloat
+                                    : Opcode::LessEqualInt);
+    emit(code, reg, swap ? right.reg : left.reg, swap ? left.reg : right.reg);
+    return {reg, {ValueType::Bit}};
+  }
+
+  Opcode code;
+  if (op == "+")
+    code = isFloat ? Opcode::AddFloat : Opcode::AddInt;
+  else if (op == "-")
+    code = isFloat ? Opcode::SubFloat : Opcode::SubInt;
+  else if (op == "*")
+    code = isFloat ? Opcode::MulFloat : Opcode::MulInt;
+  else if (op == "/")
+    code = isFloat ? Opcode::DivFloat : Opcode::DivInt;
+  else if (op == "%" && !isFloat)
+    code = Opcode::ModInt;
+  else
+    reportError("Operator '" + op + "' not supported by the bytecode VM");
+  emit(code, reg, left.reg, right.reg);
+  return {reg, operandType};
+}
+
+Operand BytecodeCompiler::compileCall(const CallExpression *call) {
+  if (auto member =
+          dynamic_cast<const MemberAccessExpression *>(call->callee.get())) {
+    // f.gradient(k, args...) on a @quantum function f
+    auto *fn = dynamic_cast<const VariableExpression *>(member->object.get());
+    auto decl = fn ? functionDecls.find(fn->name) : functionDecls.end();
+    if (member->member == "gradient" && decl != functionDecls.end() &&
+        decl->second->hasQuantumAnnotation)
+      return compileGradient(decl->second, call->arguments);
+    Operand object = compileExpression(member->object.get());
+    if (object.type.kind != ValueType::Object)
+      reportError("'" + member->member + "' called on a non-object");
+    const ClassInfo &info = classes[object.type.classId];
+    auto method = info.methods.find(member->member);
+    if (method == info.methods.end())
+      reportError("Class '" + info.decl->name + "' has no method '" +
+                  member->member + "'");
+    return compileInvoke(method->second, {object}, call->arguments,
+                         member->member);
+  }
+
+  auto *callee = dynamic_cast<const VariableExpression *>(call->callee.get());
+  if (!callee)
+    reportError("Only named functions can be called");
+  const std::string &name = callee->name;
+
+  if (name == "echo") {
+    for (const auto &arg : call->arguments) {
+      Operand value = compileExpression(arg.get());
+      emit(Opcode::Echo, value.reg, static_cast<int>(value.type.kind));
+    }
+    return {0, {ValueType::Void}};
+  }
+
+  // Methods of the current class can be called without `this.`
+  if (currentClass >= 0) {
+    auto method = classes[currentClass].methods.find(name);
+    if (method != classes[currentClass].methods.end()) {
+      Operand self{0, {ValueType::Object, currentClass}};
+      return compileInvoke(method->second, {self}, call->arguments, name);
+    }
+  }
+
+  auto decl = functionDecls.find(name);
+  if (decl == functionDecls.end())
+    reportError("Unknown function: " + name);
+
+  if (decl->second->hasQuantumAnnotation) {
+    int index = requireQuantum(decl->second);
+    if (call->arguments.size() != decl->second->params.size())
+      reportError("Wrong number of arguments to '" + name + "'");
+    int base = nextRegister;
+    nextRegister += static_cast<int>(call->arguments.size());
+    for (size_t i = 0; i < call->arguments.size(); ++i) {
+      Operand arg = coerce(compileExpression(call->arguments[i].get()),
+                           {ValueType::Float}, "argument");
+      emit(Opcode::Move, base + static_cast<int>(i), arg.reg);
+    }
+    int reg = temporary();
+    emit(Opcode::CallQuantum, reg, index, base,
+         static_cast<int>(call->arguments.size()));
+    if (module.quantum[index].returnsFloat)
+      return {reg, {ValueType::Float}};
+    return {reg, {ValueType::Bit}};
+  }
+
+  return compileInvoke(requireFunction(name), {}, call->arguments, name);
+}
+
+// Derivative of the expect() value @quantum `decl` returns with respect to
+// the parameter picked by the first argument
+Operand BytecodeCompiler::compileGradient(
+    const FunctionDeclaration *decl,
+    const std::vector<std::unique_ptr<Expression>> &args) {
+  int index = requireQuantum(decl);
+  if (!module.quantum[index].returnsFloat)
+    reportError("'" + decl->name + "' does not return expect(...) and has "
+                "no gradient");
+  if (args.size() != decl->params.size() + 1)
+    reportError("Wrong number of arguments to '" + decl->name +
+                ".gradient'");
+  int base = nextRegister;
+  nextRegister += static_cast<int>(args.size());
+  for (size_t i = 0; i < args.size(); ++i) {
+    StaticType type{i == 0 ? ValueType::Int : ValueType::Float};
+    Operand arg = coerce(compileExpression(args[i].get()), type, "argument");
+    emit(Opcode::Move, base + static_cast<int>(i), arg.reg);
+  }
+  int reg = temporary();
+  emit(Opcode::QuantumGradient, reg, index, base,
+       static_cast<int>(decl->params.size()));
+  return {reg, {ValueType::Float}};
+}
+
+Operand BytecodeCompiler::compileInvoke(
+    int function, const std::vector<Operand> &leading,
+    const std::vector<std::unique_ptr<Expression>> &args,
+    const std::string &name) {
+  const Signature sig = signatures[function];
+  if (leading.size() + args.size() != sig.params.size())
+    reportError("Wrong number of arguments to '" + name + "'");
+
+  // Arguments go to consecutive registers, copied into the callee's window
+  int base = nextRegister;
+  nextRegister += static_cast<int>(sig.params.size());
+  for (size_t i = 0; i < sig.params.size(); ++i) {
+    Operand arg = i < leading.size()
+                      ? leading[i]
+                      : compileExpression(args[i - leading.size()].get());
+    arg = coerce(arg, sig.params[i], "argument");
+    emit(Opcode::Move, base + static_cast<int>(i), arg.reg);
+  }
+  int reg = temporary();
+  emit(Opcode::Call, reg, function, base,
+       static_cast<int>(sig.params.size()));
+  return {reg, sig.result};
+}
+
+Operand BytecodeCompiler::compileConstruct(
+    const ConstructorCallExpression *ctor) {
+  int id = requireClass(ctor->className);
+  int reg = temporary();
+  emit(Opcode::NewObject, reg, id);
+  Operand object{reg, {ValueType::Object, id}};
+
+  if (classes[id].constructor >= 0) {
+    compileInvoke(classes[id].constructor, {object}, ctor->arguments,
+                  ctor->className);
+  } else {
+    if (!ctor->arguments.empty())
+      reportError("Class '" + ctor->className + "' has no constructor");
+    // Member initialisers still need to run
+    for (const auto &member : classes[id].decl->members) {
+      if (!member->initializer)
+        continue;
+      const ClassInfo &info = classes[id];
+      int field = info.fieldIndex.at(member->name);
+      Operand value = coerce(compileExpression(member->initializer.get()),
+                             info.fieldTypes[field],
+                             "member '" + member->name + "'");
+      emit(Opcode::SetField, reg, field, value.reg);
+    }
+  }
+  return object;
+}
+
+Operand BytecodeCompiler::compileMember(const MemberAccessExpression *member) {
+  Operand object = compileExpression(member->object.get());
+  if (object.type.kind != ValueType::Object)
+    reportError("'." + member->member + "' on a non-object");
+  const ClassInfo &info = classes[object.type.classId];
+  auto field = info.fieldIndex.find(member->member);
+  if (field == info.fieldIndex.end())
+    reportError("Class '" + info.decl->name + "' has no member '" +
+                member->member + "'");
+  int reg = temporary();
+  emit(Opcode::GetField, reg, object.reg, field->second);
+  return {reg, info.fieldTypes[field->second]};
+}
+
+// Helpers
+
+int BytecodeCompiler::emit(Opcode op, int a, int b, int c, int d) {
+  current().code.push_back({op, a, b, c, d});
+  return static_cast<int>(current().code.size()) - 1;
+}
+
+int BytecodeCompiler::temporary() {
+  int reg = nextRegister++;
+  current().numRegisters = std::max<unsigned>(current().numRegisters, nextRegister);
+  return reg;
+}
+
+int BytecodeCompiler::constant(Value value) {
+  module.constants.push_back(std::move(value));
+  return static_cast<int>(module.constants.size()) - 1;
+}
+
+Operand BytecodeCompiler::coerce(Operand value, StaticType to,
+                                 const std::string &context) {
+  if (value.type.kind == to.kind && value.type.classId == to.classId)
+    return value;
+  if (value.type.isInteger() && to.isInteger())
+    return {value.reg, to};
+  if (value.type.isInteger() && to.kind == ValueType::Float) {
+    int reg = temporary();
+    emit(Opcode::IntToFloat, reg, value.reg);
+    return {reg, to};
+  }
+  if (value.type.kind == ValueType::Float && to.isInteger()) {
+    int reg = temporary();
+    emit(Opcode::FloatToInt, reg, value.reg);
+    return {reg, to};
+  }
+  reportError("Type mismatch for " + context);
+}
+
+Operand BytecodeCompiler::toText(Operand value) {
+  if (value.type.kind == ValueType::String)
+    return value;
+  int reg = temporary();
+  emit(Opcode::ToText, reg, value.reg, static_cast<int>(value.type.kind));
+  return {reg, {ValueType::String}};
+}
+
+int BytecodeCompiler::condition(const Expression *expr) {
+  Operand value = compileExpression(expr);
+  if (!value.type.isInteger())
+    reportError("Condition must be an int or bit");
+  return value.reg;
+}
+
+void BytecodeCompiler::reportError(const std::string &msg) {
+  std::stringstream err;
+  err << "[Quanta VM Error]\n" << msg << "\n";
+  throw std::runtime_error(err.str());
+}
+
+} // namespace
+
+Module compileBytecode(const Program &program) {
+  return BytecodeCompiler(program).run();
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "ast/ast.hpp"
+#include "bytecode.hpp"
+
+// Compiles the classical part of `program` to bytecode, starting from its
+// `main` function: only functions, classes and methods reachable from main
+// are compiled. As in the C++ backend, top-level statements are not run.
+// Throws std::runtime_error for constructs the VM does not support.
+Module compileBytecode(const Program &program);
@@ -0,0 +1,324 @@
+#include "vm.hpp"
+
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Deep enough for any sensible recursion, shallow enough to report runaway
+// recursion as an error rather than exhausting memory
+constexpr size_t kMaxFrames = 100000;
+
+// Registers are 64 bits wide, but values behave as the `int` and `float`
+// of the generated C++, so that --exec=vm and --exec=native print the
+// same: int results wrap to 32 bits and float results are rounded to
+// single precision. Rounding the exact double result of two floats gives
+// the float result.
+int64_t wrapInt(int64_t value) { return static_cast<int32_t>(value); }
+
+double roundFloat(double value) { return static_cast<float>(value); }
+
+// Out-of-range and NaN values give INT32_MIN, as x86's conversion does
+int64_t truncateToInt(double value) {
+  if (!(value > -2147483649.0 && value < 2147483648.0))
+    return INT32_MIN;
+  return static_cast<int32_t>(value);
+}
+
+std::string formatFloat(double value) {
+  std::ostringstream text;
+  text << value;
+  return text.str();
+}
+
+} // namespace
+
+VirtualMachine::VirtualMachine(const Module &module, QuantumCalls &quantum,
+                               std::ostream &out)
+    : module(module), quantum(quantum), out(out) {}
+
+void VirtualMachine::print(const Value &value, ValueType type) {
+  switch (type) {
+  case ValueType::Int:
+  case ValueType::Bit:
+    out << value.i;
+    break;
+  case ValueType::Float:
+    out << value.f;
+    break;
+  case ValueType::Char:
+    out << static_cast<char>(value.i);
+    break;
+  case ValueType::String:
+    out << *value.text;
+    break;
+  case ValueType::Object:
+    out << "<object>";
+    break;
+  case ValueType::Void:
+    break;
+  }
+}
+
+void VirtualMachine::reportError(const std::string &msg) const {
+  std::stringstream err;
+  err << "[Quanta VM Error]\n" << msg;
+  if (!frames.empty())
+    err << " (in " << frames.back().function->name << ")";
+  err << "\n";
+  throw std::runtime_error(err.str());
+}
+
+int VirtualMachine::run() {
+  if (module.entry < 0)
+    reportError("Nothing to run: the program defines no `function main()`");
+
+  const BytecodeFunction *function = &module.functions[module.entry];
+  const Value *constants = module.constants.data();
+  registers.assign(std::max<size_t>(function->numRegisters, 256), Value());
+  frames.clear();
+  frames.push_back({function, 0, 0, 0});
+
+  const Instruction *code = function->code.data();
+  const Instruction *ip = code;
+  Value *r = registers.data();
+  const Instruction *inst = nullptr;
+
+#if defined(__GNUC__)
+  static void *const labels[] = {
+#define QUANTA_OPCODE_LABEL(name) &&op_##name,
+      QUANTA_OPCODES(QUANTA_OPCODE_LABEL)
+#undef QUANTA_OPCODE_LABEL
+  };
+#define DISPATCH()                                                             \
+  inst = ip++;                                                                 \
+  goto *labels[static_cast<uint8_t>(inst->op)]
+#define OP(name) op_##name:
+#define NEXT() DISPATCH()
+  DISPATCH();
+#else
+#define DISPATCH()                                                             \
+  inst = ip++;                                                                 \
+  switch (inst->op)
+#define OP(name) case Opcode::name:
+#define NEXT() continue
+  for (;;) {
+    DISPATCH() {
+#endif
+
+  OP(LoadConst) {
+    r[inst->a] = constants[inst->b];
+    NEXT();
+  }
+  OP(Move) {
+    r[inst->a] = r[inst->b];
+    NEXT();
+  }
+  OP(AddInt) {
+    r[inst->a].i = wrapInt(r[inst->b].i + r[inst->c].i);
+    NEXT();
+  }
+  OP(SubInt) {
+    r[inst->a].i = wrapInt(r[inst->b].i - r[inst->c].i);
+    NEXT();
+  }
+  OP(MulInt) {
+    r[inst->a].i = wrapInt(r[inst->b].i * r[inst->c].i);
+    NEXT();
+  }
+  OP(DivInt) {
+    if (r[inst->c].i == 0)
+      reportError("Division by zero");
+    r[inst->a].i = wrapInt(r[inst->b].i / r[inst->c].i);
+    NEXT();
+  }
+  OP(ModInt) {
+    if (r[inst->c].i == 0)
+      reportError("Division by zero");
+    r[inst->a].i = r[inst->b].i % r[inst->c].i;
+    NEXT();
+  }
+  OP(NegInt) {
+    r[inst->a].i = wrapInt(-r[inst->b].i);
+    NEXT();
+  }
+  OP(AddFloat) {
+    r[inst->a].f = roundFloat(r[inst->b].f + r[inst->c].f);
+    NEXT();
+  }
+  OP(SubFloat) {
+    r[inst->a].f = roundFloat(r[inst->b].f - r[inst->c].f);
+    NEXT();
+  }
+  OP(MulFloat) {
+    r[inst->a].f = roundFloat(r[inst->b].f * r[inst->c].f);
+    NEXT();
+  }
+  OP(DivFloat) {
+    r[inst->a].f = roundFloat(r[inst->b].f / r[inst->c].f);
+    NEXT();
+  }
+  OP(NegFloat) {
+    r[inst->a].f = -r[inst->b].f;
+    NEXT();
+  }
+  OP(LessInt) {
+    r[inst->a].i = r[inst->b].i < r[inst->c].i;
+    NEXT();
+  }
+  OP(LessEqualInt) {
+    r[inst->a].i = r[inst->b].i <= r[inst->c].i;
+    NEXT();
+  }
+  OP(LessFloat) {
+    r[inst->a].i = r[inst->b].f < r[inst->c].f;
+    NEXT();
+  }
+  OP(LessEqualFloat) {
+    r[inst->a].i = r[inst->b].f <= r[inst->c].f;
+    NEXT();
+  }
+  OP(IntToFloat) {
+    r[inst->a].f = roundFloat(static_cast<double>(r[inst->b].i));
+    NEXT();
+  }
+  OP(FloatToInt) {
+    r[inst->a].i = truncateToInt(r[inst->b].f);
+    NEXT();
+  }
+  OP(ToText) {
+    const Value &value = r[inst->b];
+    std::string text;
+    switch (static_cast<ValueType>(inst->c)) {
+    case ValueType::Float:
+      text = formatFloat(value.f);
+      break;
+    case ValueType::Char:
+      text = std::string(1, static_cast<char>(value.i));
+      break;
+    default:
+      text = std::to_string(value.i);
+      break;
+    }
+    r[inst->a].text = std::make_shared<const std::string>(std::move(text));
+    NEXT();
+  }
+  OP(Concat) {
+    r[inst->a].text =
+        std::make_shared<const std::string>(*r[inst->b].text + *r[inst->c].text);
+    NEXT();
+  }
+  OP(Jump) {
+    ip = code + inst->a;
+    NEXT();
+  }
+  OP(JumpIfFalse) {
+    if (r[inst->a].i == 0)
+      ip = code + inst->b;
+    NEXT();
+  }
+  OP(Call) {
+    const BytecodeFunction *callee = &module.functions[inst->b];
+    if (frames.size() >= kMaxFrames)
+      reportError("Call stack overflow");
+
+    Frame &caller = frames.back();
+    caller.pc = ip - code;
+    const size_t base = caller.base + caller.function->numRegisters;
+    if (base + callee->numRegisters > registers.size()) {
+      registers.resize(2 * (base + callee->numRegisters));
+      r = registers.data() + caller.base;
+    }
+    Value *args = r + inst->c;
+    Value *window = registers.data() + base;
+    for (int k = 0; k < inst->d; ++k)
+      window[k] = args[k];
+
+    frames.push_back({callee, 0, base, inst->a});
+    code = callee->code.data();
+    ip = code;
+    r = window;
+    NEXT();
+  }
+  OP(CallQuantum) {
+    const QuantumFunction &callee = module.quantum[inst->b];
+    std::vector<double> args(inst->d);
+    for (int k = 0; k < inst->d; ++k)
+      args[k] = r[inst->c + k].f;
+    double result = quantum.call(callee.name, args);
+    r[inst->a] = callee.returnsFloat
+                     ? Value::ofFloat(roundFloat(result))
+                     : Value::ofInt(static_cast<int64_t>(result));
+    NEXT();
+  }
+  OP(QuantumGradient) {
+    const QuantumFunction &callee = module.quantum[inst->b];
+    std::vector<double> args(inst->d);
+    for (int k = 0; k < inst->d; ++k)
+      args[k] = r[inst->c + 1 + k].f;
+    r[inst->a] = Value::ofFloat(
+        roundFloat(quantum.gradient(callee.name, args, r[inst->c].i)));
+    NEXT();
+  }
+  OP(Return) {
+    Value result = r[inst->a];
+    const int target = frames.back().resultRegister;
+    frames.pop_back();
+    if (frames.empty()) {
+      out.flush();
+      return static_cast<int>(result.i);
+    }
+    const Frame &caller = frames.back();
+    code = caller.function->code.data();
+    ip = code + caller.pc;
+    r = registers.data() + caller.base;
+    r[target] = std::move(result);
+    NEXT();
+  }
+  OP(ReturnVoid) {
+    frames.pop_back();
+    if (frames.empty()) {
+      out.flush();
+      return 0;
+    }
+    const Frame &caller = frames.back();
+    code = caller.function->code.data();
+    ip = code + caller.pc;
+    r = registers.data() + caller.base;
+    NEXT();
+  }
+  OP(Echo) {
+    print(r[inst->a], static_cast<ValueType>(inst->b));
+    out << '\n';
+    NEXT();
+  }
+  OP(NewObject) {
+    auto object = std::make_shared<Object>();
+    object->fields.resize(module.classes[inst->b].fields.size());
+    r[inst->a].object = std::move(object);
+    NEXT();
+  }
+  OP(GetField) {
+    const Object *object = r[inst->b].object.get();
+    if (!object)
+      reportError("Member access on an uninitialised object");
+    r[inst->a] = object->fields[inst->c];
+    NEXT();
+  }
+  OP(SetField) {
+    Object *object = r[inst->a].object.get();
+    if (!object)
+      reportError("Member access on an uninitialised object");
+    object->fields[inst->b] = r[inst->c];
+    NEXT();
+  }
+
+#if !defined(__GNUC__)
+    }
+  }
+#endif
+#undef DISPATCH
+#undef OP
+#undef NEXT
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "runtime/quantum_calls.hpp"
+
+// Interprets a bytecode Module. Dispatch uses computed goto where the
+// compiler supports it (GCC, Clang) and a switch otherwise. Registers of
+// all active calls live on one stack; each call sees a window starting at
+// its frame's base.
+class VirtualMachine {
+public:
+  VirtualMachine(const Module &module, QuantumCalls &quantum,
+                 std::ostream &out);
+
+  // Runs the entry function and returns its result as the exit code
+  int run();
+
+private:
+  struct Frame {
+    const BytecodeFunction *function;
+    size_t pc;
+    size_t base;
+    int resultRegister; // in the caller's window
+  };
+
+  const Module &module;
+  QuantumCalls &quantum;
+  std::ostream &out;
+  std::vector<Value> registers;
+  std::vector<Frame> frames;
+
+  void print(const Value &value, ValueType type);
+  [[noreturn]] void reportError(const std::string &msg) const;
+};
@@ -0,0 +1,1887 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "codegen/cppgen.hpp"
+#include "codegen/oqasmgen.hpp"
+#include "codegen/parallel.hpp"
+#include "ir/lower.hpp"
+#include "lexer/lexer.hpp"
+#include "opt/cancel.hpp"
+#include "opt/constfold.hpp"
+#include "opt/dce.hpp"
+#include "opt/inline.hpp"
+#include "opt/layout.hpp"
+#include "opt/lightcone.hpp"
+#include "opt/regalloc.hpp"
+#include "opt/unroll.hpp"
+#include "parser/parser.hpp"
+#include "runtime/jit.hpp"
+#include "runtime/quantum_calls.hpp"
+#include "sim/batch.hpp"
+#include "sim/kernels.hpp"
+#include "sim/outofcore.hpp"
+#include "sim/rng.hpp"
+#include "sim/schedule.hpp"
+#include "sim/simulator.hpp"
+#include "sim/statevector.hpp"
+#include "vm/compiler.hpp"
+#include "vm/vm.hpp"
+
+// Checks of the whole pipeline, from source to simulated results, with
+// fixed seeds. Expected counts are those `quanta --seed=N` prints; a
+// change to them means programs no longer reproduce across versions.
+
+namespace {
+
+std::string colorize(const std::string &text, const std::string &colorCode) {
+  return "\033[" + colorCode + "m" + text + "\033[0m";
+}
+
+void require(bool condition, const std::string &what) {
+  if (!condition)
+    throw std::runtime_error(what);
+}
+
+std::unique_ptr<Program> parseOnly(const std::string &source) {
+  Lexer lexer(source);
+  auto tokens = lexer.tokenize();
+  Parser parser(tokens);
+  return parser.parse();
+}
+
+// Source through the same passes as `quanta` with its default limits
+std::unique_ptr<Program> parse(const std::string &source) {
+  auto program = parseOnly(source);
+  foldConstants(*program);
+  unrollLoops(*program, 4096);
+  inlineFunctions(*program, 16);
+  eliminateDeadCode(*program);
+  return program;
+}
+
+Circuit lower(const std::string &source) {
+  auto program = parse(source);
+  return pruneLightCone(cancelGates(lowerProgram(*program)));
+}
+
+SimulationResult run(const std::string &source, uint64_t seed,
+                     size_t shots = 1024,
+                     Precision precision = Precision::Double) {
+  SimulatorOptions options;
+  options.seed = seed;
+  options.shots = shots;
+  options.precision = precision;
+  // As `quanta` picks between them, so counts match its output
+  Circuit circuit = lower(source);
+  Circuit allocated = allocateQubits(circuit);
+  if (cheaperToSimulate(allocated, circuit, options))
+    circuit = std::move(allocated);
+  return simulate(circuit, options);
+}
+
+std::string describe(const std::map<std::string, size_t> &counts) {
+  std::string text;
+  for (const auto &[bits, count] : counts)
+    text += bits + ":" + std::to_string(count) + " ";
+  return text;
+}
+
+void requireCounts(const SimulationResult &result,
+                   const std::map<std::string, size_t> &expected) {
+  require(result.counts == expected,
+          "counts " + describe(result.counts) + "expected " +
+              describe(expected));
+}
+
+// The OpenQASM listing `quanta` prints for `source`
+std::string qasm(const std::string &source) {
+  auto program = parse(source);
+  const Circuit circuit = allocateQubits(lower(source));
+  QasmGenerator gen(circuit);
+  program->accept(gen);
+  return gen.str();
+}
+
+bool contains(const std::string &text, const std::string &part) {
+  return text.find(part) != std::string::npos;
+}
+
+const char *kBell = R"(
+@quantum
+function bell(qubit a, qubit b) -> void {
+  h(a);
+  cx(a, b);
+}
+
+@quantum
+function rot(qubit a, float theta) -> void {
+  ry(theta * 2.0f, a);
+}
+
+qubit q0;
+qubit q1;
+qubit q2;
+bell(q0, q1);
+rot(q2, 0.7853981f);
+bit m0 = measure q0;
+bit m1 = measure q1;
+bit m2 = measure q2;
+)";
+
+// Measures and resets mid-circuit, so every shot is its own trajectory
+const char *kTrajectories = R"(
+@quantum
+function coin() -> bit {
+  qubit c;
+  h(c);
+  return measure c;
+}
+@quantum
+function recycle(qubit q) -> void {
+  reset q;
+  h(q);
+}
+qubit a;
+x(a);
+bit first = measure a;
+recycle(a);
+bit second = measure a;
+bit third = coin();
+)";
+
+// Random123's known-answer vectors for Philox4x32-10
+void philoxKnownAnswers() {
+  const Philox::Block zero = Philox::block(0, 0, 0);
+  require(zero == Philox::Block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c,
+                                0x9b00dbd8},
+          "Philox4x32-10 of zero key and counter");
+  const Philox::Block pi =
+      Philox::block(0x299f31d0a4093822ull, 0x0370734413198a2eull,
+                    0x85a308d3243f6a88ull);
+  require(pi == Philox::Block{0xd16cfe09, 0x94fdcceb, 0x5001e420,
+                              0x24126ea1},
+          "Philox4x32-10 of the digits of pi");
+}
+
+void seedReproducesCounts() {
+  const SimulationResult first = run(kBell, 42);
+  requireCounts(first, {{"000", 292}, {"001", 218}, {"110", 267}, {"111", 247}});
+  requireCounts(run(kBell, 42), first.counts);
+  require(run(kBell, 43).counts != first.counts,
+          "another seed gives other counts");
+}
+
+void seedReproducesTrajectories() {
+  requireCounts(run(kTrajectories, 7, 256),
+                {{"100", 75}, {"101", 45}, {"110", 70}, {"111", 66}});
+}
+
+// A measurement not assigned to a bit is named after its qubit
+void measuredBitsNamedAfterQubits() {
+  const SimulationResult result = run(R"(
+qubit[3] q;
+qubit a;
+x(q[1]);
+measure q[0];
+measure q[1];
+measure q[2];
+measure a;
+)",
+                                      1);
+  require(result.labels ==
+              std::vector<std::string>{"q[0]", "q[1]", "q[2]", "a"},
+          "bits are labelled after their qubits");
+  requireCounts(result, {{"0100", 1024}});
+}
+
+// f followed by f.adjoint is the identity, and the inverse pairs cancel
+void adjointCancelsCall() {
+  auto program = parse(R"(
+@quantum
+@adjoint
+function prep(qubit[] q, float theta) -> void {
+  h(q[0]);
+  s(q[0]);
+  rz(theta, q[1]);
+  cx(q[0], q[1]);
+  t(q[2]);
+}
+qubit[3] q;
+prep(q, 0.3f);
+prep.adjoint(q, 0.3f);
+)");
+  const Circuit circuit = lowerProgram(*program);
+  require(circuit.gates.size() == 10, "prep and its adjoint lower to " +
+                                          std::to_string(circuit.gates.size()) +
+                                          " gates");
+  const Circuit cancelled = cancelGates(circuit);
+  require(cancelled.gates.empty(), std::to_string(cancelled.gates.size()) +
+                                       " gates left after cancellation");
+}
+
+void adjointNeedsAnnotation() {
+  auto program = parse(R"(
+@quantum
+function prep(qubit a) -> void {
+  h(a);
+}
+qubit a;
+prep.adjoint(a);
+)");
+  try {
+    lowerProgram(*program);
+  } catch (const std::runtime_error &) {
+    return;
+  }
+  require(false, "adjoint of a function without @adjoint lowered");
+}
+
+// Statements of `block`, nested blocks included, that declare a variable
+size_t declarations(const BlockStatement &block) {
+  size_t count = 0;
+  for (const auto &stmt : block.statements) {
+    if (dynamic_cast<const VariableDeclaration *>(stmt.get()))
+      count++;
+    else if (auto inner = dynamic_cast<const BlockStatement *>(stmt.get()))
+      count += declarations(*inner);
+  }
+  return count;
+}
+
+// Inlining reads a non-constant classical argument in place rather than
+// binding a local to it
+void inliningSubstitutesArguments() {
+  const std::string source = R"(
+@quantum
+function turn(qubit a, float theta) -> void {
+  rz(theta, a);
+}
+@quantum
+function outer(qubit x, float t) -> void {
+  turn(x, t);
+  turn(x, t * 2.0f);
+}
+qubit q;
+outer(q, 0.5f);
+)";
+  auto program = parse(source);
+  for (const auto &func : program->functions) {
+    if (func->name == "outer") {
+      require(declarations(*func->body) == 0,
+              "arguments of outer's calls bound to locals");
+    }
+  }
+  require(contains(qasm(source), "def outer(qubit x, float[64] t) {\n"
+                                 "  rz(t) x;\n"
+                                 "  rz((t * 2)) x;\n"
+                                 "}\n"),
+          "outer not listed with its arguments:\n" + qasm(source));
+}
+
+// Only a function returning expect() has a gradient to call
+void gradientStubsForFloatFunctions() {
+  auto program = parse(R"(
+@quantum
+function energy(float theta) -> float {
+  qubit a;
+  ry(theta, a);
+  return expect("Z", a);
+}
+@quantum
+function sample(float theta) -> bit {
+  qubit a;
+  ry(theta, a);
+  return measure a;
+}
+function main() -> int {
+  echo(energy.gradient(0, 0.5f));
+  echo(sample(0.5f));
+  return 0;
+}
+)");
+  CppGenerator gen;
+  program->accept(gen);
+  const std::string code = gen.str();
+  require(contains(code, "float energy__gradient("),
+          "no gradient stub for energy");
+  require(!contains(code, "sample__gradient"), "gradient stub for sample");
+}
+
+void requireNear(double value, double expected, double tolerance,
+                 const std::string &what) {
+  require(std::abs(value - expected) <= tolerance,
+          what + " is " + std::to_string(value) + ", expected " +
+              std::to_string(expected));
+}
+
+// ry(theta) then cx leaves cos(theta/2)|00> + sin(theta/2)|11>, where
+// <ZI> = cos(theta) and <XX> = sin(theta)
+const char *kObservable = R"(
+qubit[2] q;
+ry(0.6f, q[0]);
+cx(q[0], q[1]);
+float e = expect("ZI + 0.5*XX", q);
+bit first = measure q[0];
+bit second = measure q[1];
+)";
+
+void expectationsAtFixedSeed() {
+  const SimulationResult result = run(kObservable, 11);
+  requireCounts(result, {{"00", 924}, {"11", 100}});
+  require(result.expectations.size() == 1, "one observable");
+  // The angle passes through single precision on its way to the gate
+  const double theta = 0.6f;
+  requireNear(result.expectations[0],
+              std::cos(theta) + 0.5 * std::sin(theta), 1e-6, "<e>");
+}
+
+// The energy of a VQE step: its gradient by the adjoint method, as
+// f.gradient(k, ...) returns it, against central differences of f(...)
+void gradientsMatchFiniteDifferences() {
+  auto program = parse(R"(
+@quantum
+function energy(float t, float u) -> float {
+  qubit[2] q;
+  ry(t, q[0]);
+  rx(u * 2.0f, q[1]);
+  cx(q[0], q[1]);
+  return expect("ZI + 0.5*XX - 0.25*IZ", q);
+}
+)");
+  SimulatorOptions options;
+  options.seed = 3;
+  QuantumCalls quantum(*program, options);
+  const std::vector<double> at = {0.4, -0.3};
+  const double h = 1e-5;
+  for (int k = 0; k < 2; ++k) {
+    std::vector<double> up = at, down = at;
+    up[k] += h;
+    down[k] -= h;
+    const double difference =
+        (quantum.call("energy", up) - quantum.call("energy", down)) / (2 * h);
+    requireNear(quantum.gradient("energy", at, k), difference, 1e-6,
+                "d energy / d parameter " + std::to_string(k));
+  }
+}
+
+const char *kSweep = R"(
+@quantum
+function energy(float a, float b) -> float {
+  qubit[3] q;
+  h(q[2]);
+  ry(a, q[0]);
+  rz(-b, q[1]);
+  rx(a * b + 0.5f, q[2]);
+  cx(q[0], q[1]);
+  cp(a / (b + 2.0f), q[1], q[2]);
+  ry(a - b * 3.0f, q[0]);
+  rz(b, q[2]);
+  rz(-b, q[2]);
+  return expect("ZZI + 0.5*XIX - 0.25*IYY", q);
+}
+)";
+
+// --sweep lowers `energy` once and binds it per point; each point must
+// give the gates, counts and expectation values of lowering that call
+// from scratch, and the template's chain rule must match differences
+void templateMatchesLoweringEachCall() {
+  auto program = parse(kSweep);
+  const CircuitTemplate raw = lowerTemplate(*program, "energy");
+  CircuitTemplate tmpl = raw;
+  tmpl.circuit = pruneLightCone(cancelGates(tmpl.circuit));
+  SimulatorOptions options;
+  options.seed = 4;
+  options.shots = 2000;
+
+  for (double a : {-1.1, 0.0, 0.35, 2.5}) {
+    for (double b : {-0.7, 0.0, 1.0, 0.25}) {
+      const std::vector<double> values = {a, b};
+      const std::string at =
+          "a=" + std::to_string(a) + " b=" + std::to_string(b);
+      const LoweredCall call = lowerCall(*program, "energy", values);
+
+      const Circuit bound = raw.bind(values);
+      require(bound.gates.size() == call.circuit.gates.size(),
+              at + ": gate count");
+      for (size_t g = 0; g < bound.gates.size(); ++g) {
+        const Gate &x = bound.gates[g], &y = call.circuit.gates[g];
+        require(x.kind == y.kind && x.qubits == y.qubits && x.bit == y.bit,
+                at + ": gate " + std::to_string(g));
+        requireNear(x.angle, y.angle, 1e-12,
+                    at + ": angle of gate " + std::to_string(g));
+      }
+
+      const SimulationResult fromTemplate =
+          simulate(tmpl.bind(values), options);
+      const SimulationResult fromScratch =
+          simulate(pruneLightCone(cancelGates(call.circuit)), options);
+      requireCounts(fromTemplate, fromScratch.counts);
+      requireNear(fromTemplate.expectations[*tmpl.observable],
+                  fromScratch.expectations[*call.observable], 1e-12,
+                  at + ": <energy>");
+
+      // d node / d parameter, node by node
+      const double h = 1e-6;
+      const size_t nodes = raw.nodes.size();
+      for (size_t node = 0; node < nodes; ++node) {
+        std::vector<double> seed(nodes, 0.0);
+        seed[node] = 1.0;
+        const std::vector<double> chain = raw.backpropagate(values, seed);
+        for (size_t p = 0; p < values.size(); ++p) {
+          std::vector<double> up = values, down = values;
+          up[p] += h;
+          down[p] -= h;
+          const double difference =
+              (raw.evaluate(up)[node] - raw.evaluate(down)[node]) / (2 * h);
+          requireNear(chain[p], difference, 1e-6,
+                      at + ": d node " + std::to_string(node) +
+                          " / d parameter " + std::to_string(p));
+        }
+      }
+    }
+  }
+}
+
+// Peak resident memory of this process so far, in KiB
+long peakKib() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// A streaming buffer joined with large parts, as the generators do for
+// every piece made on a worker, holds on to none of them
+void streamedJoinsStayBounded() {
+  const int fd = open("/dev/null", O_WRONLY);
+  require(fd >= 0, "cannot open /dev/null");
+  const std::string line(1023, 'x');
+  const long before = peakKib();
+  {
+    CodeBuffer out;
+    out.setSink(fd);
+    for (int i = 0; i < 1024; ++i) {
+      CodeBuffer part;
+      for (int k = 0; k < 256; ++k)
+        part << line << '\n';
+      out << std::move(part);
+    }
+    out.flush();
+    require(out.size() == size_t{256} << 20, "bytes streamed");
+  }
+  close(fd);
+  const long grown = peakKib() - before;
+  require(grown < 32 * 1024, "streaming 256 MiB grew the peak by " +
+                                 std::to_string(grown) + " KiB");
+}
+
+// A file in the temporary directory, already unlinked
+int temporaryFile() {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "quanta-test-XXXXXX");
+  const int fd = mkstemp(path.data());
+  require(fd >= 0, "cannot create a temporary file");
+  unlink(path.c_str());
+  return fd;
+}
+
+std::string readBack(int fd) {
+  std::string text;
+  char block[1 << 16];
+  lseek(fd, 0, SEEK_SET);
+  for (ssize_t n; (n = read(fd, block, sizeof block)) > 0;)
+    text.append(block, n);
+  return text;
+}
+
+// `size` bytes that differ from their neighbours, so text that is lost,
+// repeated or moved across a chunk boundary shows
+std::string patterned(size_t size, size_t &offset) {
+  std::string text(size, ' ');
+  for (char &c : text)
+    c = static_cast<char>('a' + offset++ % 23);
+  return text;
+}
+
+// Writes to `out`, and to `mirror`, pieces ending just before, on and just
+// after chunk boundaries, numbers, and joined parts small enough to be
+// copied or large enough to be taken over chunk by chunk, more of them
+// than one writev() call accepts
+void emitAcrossChunks(CodeBuffer &out, std::string &mirror) {
+  const size_t chunk = CodeBuffer::kChunkSize;
+  size_t offset = 0;
+  for (size_t size : {size_t{1}, chunk - 1, size_t{1}, chunk, chunk + 1,
+                      3 * chunk + 7, size_t{0}, chunk / 2}) {
+    const std::string text = patterned(size, offset);
+    out << text;
+    mirror += text;
+  }
+  out << int64_t{-1234567890123} << ' ' << 0.1 << '\n';
+  mirror += "-1234567890123 0.1\n";
+  for (size_t size : {size_t{10}, chunk / 2, 2 * chunk + 5}) {
+    CodeBuffer part;
+    const std::string text = patterned(size, offset);
+    part << text;
+    out << std::move(part);
+    mirror += text;
+  }
+  for (int k = 0; k < 1100; ++k) {
+    CodeBuffer part;
+    const std::string text = patterned(chunk / 2 + k % 3, offset);
+    part << text;
+    out << std::move(part);
+    mirror += text;
+  }
+}
+
+// The text must reach the file byte for byte whether it is written in one
+// go or streamed a few chunks at a time
+void writevKeepsChunkBoundaries() {
+  std::string expected;
+  {
+    CodeBuffer out;
+    emitAcrossChunks(out, expected);
+    require(out.size() == expected.size(), "size() of a buffered run");
+    require(out.str() == expected, "str() of a buffered run");
+    const int fd = temporaryFile();
+    out.writeTo(fd);
+    const std::string written = readBack(fd);
+    close(fd);
+    require(written == expected, "writeTo() of a buffered run");
+  }
+  for (size_t maxChunks : {size_t{1}, size_t{2}, CodeBuffer::kStreamChunks}) {
+    const int fd = temporaryFile();
+    std::string mirror;
+    CodeBuffer out;
+    out.setSink(fd, maxChunks);
+    emitAcrossChunks(out, mirror);
+    out.flush();
+    const std::string written = readBack(fd);
+    close(fd);
+    require(out.size() == expected.size(), "size() of a streamed run");
+    require(written == expected, "streamed with " +
+                                     std::to_string(maxChunks) +
+                                     " chunks in flight");
+  }
+}
+
+// Piece i of a generated listing: sizes from a few bytes to several
+// chunks, and later pieces finishing first, so workers complete out of
+// order
+void emitPiece(size_t i, CodeBuffer &part) {
+  std::this_thread::sleep_for(std::chrono::microseconds((200 - i) % 37));
+  size_t offset = i * 7;
+  const size_t size =
+      i % 9 == 0 ? 2 * CodeBuffer::kChunkSize + i : 1 + i * 131 % 4000;
+  part << "// piece " << i << '\n' << patterned(size, offset) << '\n';
+}
+
+// However many threads generate the pieces, buffered or streamed, the
+// listing is the one a single thread writes
+void parallelOutputMatchesSingleThread() {
+  const size_t pieces = 200;
+  CodeBuffer serial;
+  emitInOrder(serial, pieces, emitPiece, 1);
+  const std::string expected = serial.str();
+
+  for (size_t threads : {2, 3, 4, 8, 16}) {
+    const std::string what = std::to_string(threads) + " threads";
+    CodeBuffer buffered;
+    emitInOrder(buffered, pieces, emitPiece, threads);
+    require(buffered.str() == expected, what + ", buffered");
+
+    const int fd = temporaryFile();
+    CodeBuffer streamed;
+    streamed.setSink(fd, 2);
+    emitInOrder(streamed, pieces, emitPiece, threads);
+    streamed.flush();
+    const std::string written = readBack(fd);
+    close(fd);
+    require(written == expected, what + ", streamed");
+
+    // A failing piece stops the run after the pieces before it
+    CodeBuffer failed;
+    try {
+      emitInOrder(
+          failed, pieces,
+          [](size_t i, CodeBuffer &part) {
+            if (i == 57)
+              throw std::runtime_error("piece 57");
+            emitPiece(i, part);
+          },
+          threads);
+      require(false, what + ": the failure was not rethrown");
+    } catch (const std::runtime_error &error) {
+      require(std::string(error.what()) == "piece 57",
+              what + ": " + error.what());
+    }
+    require(failed.str() == expected.substr(0, expected.find("// piece 57")),
+            what + ": pieces before the failure");
+  }
+}
+
+// What `quanta --run` prints for `source`, run on the bytecode VM
+std::string runVm(const std::string &source, uint64_t seed = 1) {
+  auto program = parse(source);
+  Module module = compileBytecode(*program);
+  SimulatorOptions options;
+  options.seed = seed;
+  QuantumCalls quantum(*program, options);
+  std::ostringstream out;
+  VirtualMachine(module, quantum, out).run();
+  return out.str();
+}
+
+// --exec=native runs the program as C++ with 32-bit int and float; the
+// VM has to print the same
+void vmMatchesNativeArithmetic() {
+  const std::string printed = runVm(R"(
+function main() -> int {
+  float sum = 0.0f;
+  for (int i = 0; i < 1000; i = i + 1) {
+    sum = sum + 0.1f;
+  }
+  echo(sum);
+  int big = 2147483647;
+  echo(big + 1);
+  echo(big * 3);
+  float wide = 16777217;
+  echo(wide);
+  return 0;
+}
+)");
+  require(printed == "99.999\n-2147483648\n2147483645\n1.67772e+07\n",
+          "VM printed:\n" + printed);
+}
+
+// `count` random gates of every kind with an arity and angle, on
+// `qubits` qubits
+std::vector<Gate> randomGates(unsigned qubits, size_t count, uint32_t seed) {
+  static const GateKind kinds[] = {
+      GateKind::H,   GateKind::X,     GateKind::Y,  GateKind::Z,
+      GateKind::S,   GateKind::Sdg,   GateKind::T,  GateKind::Tdg,
+      GateKind::Rx,  GateKind::Ry,    GateKind::Rz, GateKind::Phase,
+      GateKind::CX,  GateKind::CY,    GateKind::CZ, GateKind::CPhase,
+      GateKind::Swap};
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> angle(-3.2, 3.2);
+  std::vector<Gate> gates;
+  for (size_t g = 0; g < count; ++g) {
+    Gate gate{kinds[rng() % std::size(kinds)]};
+    gate.qubits[0] = rng() % qubits;
+    if (arity(gate.kind) == 2) {
+      do
+        gate.qubits[1] = rng() % qubits;
+      while (gate.qubits[1] == gate.qubits[0]);
+    }
+    if (isParameterised(gate.kind))
+      gate.angle = angle(rng);
+    gates.push_back(gate);
+  }
+  return gates;
+}
+
+// `gates` followed by a measurement of every qubit
+Circuit measuredCircuit(unsigned qubits, const std::vector<Gate> &gates) {
+  Circuit circuit;
+  for (unsigned q = 0; q < qubits; ++q)
+    circuit.addQubit("q" + std::to_string(q));
+  circuit.gates = gates;
+  for (unsigned q = 0; q < qubits; ++q) {
+    Gate measure{GateKind::Measure, {q, 0}};
+    measure.bit = circuit.addBit("c" + std::to_string(q));
+    circuit.gates.push_back(measure);
+  }
+  return circuit;
+}
+
+std::vector<std::complex<double>>
+evolveInMemory(unsigned qubits, const std::vector<Gate> &gates) {
+  StateVector<double> state(qubits);
+  state.run(gates);
+  return {state.data(), state.data() + state.size()};
+}
+
+void requireSameState(const std::vector<std::complex<double>> &state,
+                      const std::vector<std::complex<double>> &expected,
+                      double tolerance, const std::string &what) {
+  require(state.size() == expected.size(), what + ": amplitude count");
+  for (size_t i = 0; i < state.size(); ++i) {
+    require(std::abs(state[i] - expected[i]) <= tolerance,
+            what + ": amplitude " + std::to_string(i) + " differs");
+  }
+}
+
+// Swapping qubits between ranks must change neither the state nor, for a
+// seed, the counts
+void distributedMatchesInMemory() {
+  const unsigned qubits = 8;
+  const std::vector<Gate> gates = randomGates(qubits, 300, 1);
+  const Circuit circuit = measuredCircuit(qubits, gates);
+  SimulatorOptions options;
+  options.seed = 5;
+  options.shots = 4000;
+  const SimulationResult memory = simulate(circuit, options);
+  const auto expected = evolveInMemory(qubits, gates);
+
+  for (unsigned ranks : {2u, 4u}) {
+    options.ranks = ranks;
+    const SimulationResult distributed = simulate(circuit, options);
+    requireCounts(distributed, memory.counts);
+    require(distributed.comm.qubitSwaps > 0, "no qubit crossed ranks");
+
+    std::vector<std::complex<double>> state;
+    Communicator::launch(ranks, [&](Communicator &comm) {
+      DistributedStateVector<double> shard(qubits, comm);
+      shard.run(gates);
+      state = shard.amplitudes();
+    });
+    requireSameState(state, expected, 1e-12,
+                     std::to_string(ranks) + " ranks");
+  }
+}
+
+// With chunks of 3 qubits most gates need a swap first; neither the
+// swaps nor the layout they leave may change the state or the counts
+void outOfCoreMatchesInMemory() {
+  const unsigned qubits = 8;
+  const std::vector<Gate> gates = randomGates(qubits, 300, 2);
+  const Circuit circuit = measuredCircuit(qubits, gates);
+  const std::string directory = std::filesystem::temp_directory_path();
+  SimulatorOptions options;
+  options.seed = 5;
+  options.shots = 4000;
+  const SimulationResult memory = simulate(circuit, options);
+
+  options.outOfCore.directory = directory;
+  options.outOfCore.chunkQubits = 3;
+  const SimulationResult chunked = simulate(circuit, options);
+  requireCounts(chunked, memory.counts);
+  require(chunked.io.qubitSwaps > 0, "no qubit was swapped into a chunk");
+  require(chunked.io.chunkLoads > 0 && chunked.io.bytesRead > 0 &&
+              chunked.io.bytesWritten > 0,
+          "I/O report is empty");
+
+  ChunkedStateVector<double> state(qubits, 3, directory);
+  state.run(gates);
+  requireSameState(state.amplitudes(), evolveInMemory(qubits, gates),
+                   1e-12, "out-of-core");
+}
+
+template <typename Real>
+std::vector<std::complex<Real>> randomState(unsigned qubits, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> normal;
+  std::vector<std::complex<Real>> state(uint64_t{1} << qubits);
+  for (auto &amp : state)
+    amp = {static_cast<Real>(normal(rng)), static_cast<Real>(normal(rng))};
+  return state;
+}
+
+// The textbook application of gateMatrix2/gateMatrix4, one basis index at
+// a time, that every kernel must agree with
+void applyDense(std::vector<std::complex<double>> &state, const Gate &gate) {
+  const uint64_t bit0 = uint64_t{1} << gate.qubits[0];
+  if (arity(gate.kind) == 1) {
+    const Matrix2 m = gateMatrix2(gate);
+    for (uint64_t i = 0; i < state.size(); ++i) {
+      if (i & bit0)
+        continue;
+      const auto lo = state[i], hi = state[i | bit0];
+      state[i] = m[0] * lo + m[1] * hi;
+      state[i | bit0] = m[2] * lo + m[3] * hi;
+    }
+    return;
+  }
+  const uint64_t bit1 = uint64_t{1} << gate.qubits[1];
+  const Matrix4 m = gateMatrix4(gate);
+  for (uint64_t i = 0; i < state.size(); ++i) {
+    if (i & (bit0 | bit1))
+      continue;
+    const uint64_t index[4] = {i, i | bit0, i | bit1, i | bit0 | bit1};
+    std::complex<double> v[4];
+    for (int c = 0; c < 4; ++c)
+      v[c] = state[index[c]];
+    for (int r = 0; r < 4; ++r) {
+      std::complex<double> sum = 0.0;
+      for (int c = 0; c < 4; ++c)
+        sum += m[r * 4 + c] * v[c];
+      state[index[r]] = sum;
+    }
+  }
+}
+
+template <typename Real>
+void requireSameAmplitudes(const std::vector<std::complex<Real>> &state,
+                           const std::vector<std::complex<double>> &expected,
+                           const std::string &what) {
+  const double tolerance = sizeof(Real) == sizeof(float) ? 1e-5 : 1e-12;
+  std::vector<std::complex<double>> widened(state.begin(), state.end());
+  requireSameState(widened, expected, tolerance, what);
+}
+
+const GateKind kUnitaryKinds[] = {
+    GateKind::H,  GateKind::X,   GateKind::Y,     GateKind::Z,
+    GateKind::S,  GateKind::Sdg, GateKind::T,     GateKind::Tdg,
+    GateKind::Rx, GateKind::Ry,  GateKind::Rz,    GateKind::Phase,
+    GateKind::CX, GateKind::CY,  GateKind::CZ,    GateKind::CPhase,
+    GateKind::Swap};
+
+// Every gate kind on the lowest, a middle and the highest qubit, in both
+// orders for two-qubit gates, through applyGate and through each kernel
+// that accepts it
+template <typename Real> void kernelsMatchDenseMatrices() {
+  const unsigned qubits = 6;
+  const unsigned placements[][2] = {{0, 1}, {1, 0}, {0, 5}, {5, 0},
+                                    {2, 4}, {4, 2}, {5, 3}};
+  uint32_t seed = 0;
+  for (GateKind kind : kUnitaryKinds) {
+    for (const auto &[a, b] : placements) {
+      Gate gate{kind, {a, b}, 0.7 + seed * 0.01};
+      const std::string what =
+          std::string(gateName(kind)) + " on " + std::to_string(a) +
+          (arity(kind) == 2 ? "," + std::to_string(b) : "");
+      const auto start = randomState<Real>(qubits, ++seed);
+      std::vector<std::complex<double>> expected(start.begin(), start.end());
+      applyDense(expected, gate);
+
+      auto state = start;
+      applyGate(state.data(), state.size(), gate);
+      requireSameAmplitudes(state, expected, what + " (applyGate)");
+
+      if (arity(kind) == 1) {
+        state = start;
+        applyMatrix1(state.data(), state.size(), a,
+                     Mat2<Real>(gateMatrix2(gate)));
+        requireSameAmplitudes(state, expected, what + " (applyMatrix1)");
+        if (kind == GateKind::X) {
+          state = start;
+          applyPermutation(state.data(), state.size(), gate);
+          requireSameAmplitudes(state, expected,
+                                what + " (applyPermutation)");
+        }
+        continue;
+      }
+
+      state = start;
+      applyMatrix2(state.data(), state.size(), a, b,
+                   Mat4<Real>(gateMatrix4(gate)));
+      requireSameAmplitudes(state, expected, what + " (applyMatrix2)");
+
+      if (kind == GateKind::CX || kind == GateKind::Swap) {
+        state = start;
+        applyPermutation(state.data(), state.size(), gate);
+        requireSameAmplitudes(state, expected, what + " (applyPermutation)");
+      }
+      if (kind != GateKind::Swap) {
+        const Matrix4 m = gateMatrix4(gate);
+        state = start;
+        applyControlled1(state.data(), state.size(), a, b,
+                         Mat2<Real>(Matrix2{m[5], m[7], m[13], m[15]}));
+        requireSameAmplitudes(state, expected, what + " (applyControlled1)");
+      }
+    }
+  }
+}
+
+// A batch of diagonal gates, over the whole state and block by block with
+// `first` set, for blocks smaller than, equal to and larger than the
+// batch's lowest qubit and its span of 256 amplitudes
+template <typename Real> void diagonalBatchesMatchDenseMatrices() {
+  const unsigned qubits = 11;
+  const GateKind kinds[] = {GateKind::Z,  GateKind::S,     GateKind::Sdg,
+                            GateKind::T,  GateKind::Tdg,   GateKind::Rz,
+                            GateKind::Phase, GateKind::CZ, GateKind::CPhase};
+  // The lowest qubit decides between per-run and per-span phases
+  for (unsigned lowest : {0u, 3u, 8u, 9u}) {
+    std::mt19937 rng(lowest);
+    DiagonalBatch<Real> batch;
+    std::vector<Gate> gates;
+    while (true) {
+      Gate gate{kinds[rng() % std::size(kinds)]};
+      gate.qubits[0] = lowest + rng() % (qubits - lowest);
+      do
+        gate.qubits[1] = lowest + rng() % (qubits - lowest);
+      while (gate.qubits[1] == gate.qubits[0]);
+      gate.angle = 0.1 * (rng() % 60);
+      if (gates.size() > 40 || !batch.add(gate))
+        break;
+      gates.push_back(gate);
+    }
+
+    const auto start = randomState<Real>(qubits, lowest + 100);
+    std::vector<std::complex<double>> expected(start.begin(), start.end());
+    for (const auto &gate : gates)
+      applyDense(expected, gate);
+
+    for (unsigned block : {1u, 2u, 3u, 6u, 8u, 9u, 10u, 11u}) {
+      auto state = start;
+      const uint64_t blockSize = uint64_t{1} << block;
+      for (uint64_t first = 0; first < state.size(); first += blockSize)
+        batch.apply(state.data() + first, blockSize, first);
+      requireSameAmplitudes(state, expected,
+                            std::to_string(gates.size()) +
+                                " diagonal gates from qubit " +
+                                std::to_string(lowest) + " in blocks of 2^" +
+                                std::to_string(block));
+    }
+  }
+}
+
+// Random disjoint swaps, batched until the batch refuses one
+template <typename Real> void swapBatchesMatchDenseMatrices() {
+  const unsigned qubits = 12;
+  for (uint32_t seed = 1; seed <= 20; ++seed) {
+    std::mt19937 rng(seed);
+    SwapBatch<Real> batch;
+    std::vector<Gate> gates;
+    while (true) {
+      Gate gate{GateKind::Swap};
+      gate.qubits[0] = rng() % qubits;
+      do
+        gate.qubits[1] = rng() % qubits;
+      while (gate.qubits[1] == gate.qubits[0]);
+      if (!batch.add(gate))
+        break;
+      gates.push_back(gate);
+    }
+
+    const auto start = randomState<Real>(qubits, seed + 200);
+    std::vector<std::complex<double>> expected(start.begin(), start.end());
+    for (const auto &gate : gates)
+      applyDense(expected, gate);
+    auto state = start;
+    batch.apply(state.data(), state.size());
+    requireSameAmplitudes(state, expected,
+                          "batch of " + std::to_string(gates.size()) +
+                              " swaps, seed " + std::to_string(seed));
+  }
+}
+
+// Gates applied one at a time to the whole state, with no windows
+template <typename Real>
+std::vector<std::complex<double>>
+evolveUnblocked(unsigned qubits, const std::vector<Gate> &gates) {
+  std::vector<std::complex<Real>> state(uint64_t{1} << qubits);
+  state[0] = 1;
+  for (const auto &gate : gates)
+    applyGate(state.data(), state.size(), gate);
+  return {state.begin(), state.end()};
+}
+
+// 16 qubits is past kBlockQubits in both precisions, so run() splits the
+// gates into block-local and full-state windows and reorders them
+template <typename Real> void blockedRunMatchesUnblocked() {
+  const unsigned qubits = 16;
+  const std::vector<Gate> gates = randomGates(qubits, 400, 3);
+  const auto windows =
+      scheduleWindows(gates, StateVector<Real>::kBlockQubits);
+  size_t local = 0, scheduled = 0;
+  for (const auto &window : windows) {
+    local += window.blockLocal;
+    scheduled += window.gates.size();
+  }
+  require(scheduled == gates.size(), "windows lost or duplicated gates");
+  require(local > 0 && local < windows.size(),
+          "expected both block-local and full-state windows");
+
+  StateVector<Real> state(qubits);
+  state.run(gates);
+  const std::vector<std::complex<Real>> amps(state.data(),
+                                             state.data() + state.size());
+  requireSameAmplitudes(amps, evolveUnblocked<Real>(qubits, gates),
+                        "blocked run");
+}
+
+// The layout pass on 16 qubits, past the 14 it keeps local: it must swap
+// qubits into the low bits, and neither the counts of the measured circuit
+// nor the amplitudes of the unmeasured one may change
+void layoutMatchesUnplannedRun() {
+  const unsigned qubits = 16;
+  const std::vector<Gate> gates = randomGates(qubits, 400, 4);
+  const Circuit measured = measuredCircuit(qubits, gates);
+  const Circuit planned = planLayout(measured);
+  require(planned.gates.size() > measured.gates.size(),
+          "layout inserted no swaps");
+
+  SimulatorOptions options;
+  options.seed = 5;
+  options.shots = 4000;
+  requireCounts(simulate(planned, options),
+                simulate(measured, options).counts);
+
+  Circuit unmeasured = measuredCircuit(qubits, {});
+  unmeasured.gates = gates;
+  const Circuit restored = planLayout(unmeasured);
+  StateVector<double> state(qubits);
+  state.run(restored.gates);
+  requireSameState({state.data(), state.data() + state.size()},
+                   evolveUnblocked<double>(qubits, gates), 1e-12,
+                   "layout");
+}
+
+const char *kAnsatz = R"(
+@quantum
+function ansatz(float a, float b) -> bit {
+  qubit[3] q;
+  h(q[0]);
+  ry(a, q[1]);
+  cx(q[0], q[2]);
+  rz(b * 2.0f, q[2]);
+  rx(a - b, q[1]);
+  cx(q[1], q[2]);
+  ry(b, q[0]);
+  return measure q[2];
+}
+)";
+
+// A sweep of more bindings than there are lanes, with a partly filled
+// last batch, against simulate() on each bound circuit
+template <typename Real> void batchedSweepMatchesOneAtATime() {
+  const Precision precision =
+      sizeof(Real) == sizeof(float) ? Precision::Single : Precision::Double;
+  auto program = parse(kAnsatz);
+  const CircuitTemplate tmpl = lowerTemplate(*program, "ansatz");
+  require(tmpl.circuit.numQubits <= BatchedStateVector<Real>::kMaxQubits,
+          "ansatz too large to batch");
+
+  std::vector<std::vector<double>> bindings;
+  for (int k = 0; k < 2 * int(BatchedStateVector<Real>::kLanes) + 3; ++k)
+    bindings.push_back({0.1 * k, 1.3 - 0.07 * k});
+  SimulatorOptions options;
+  options.precision = precision;
+  options.seed = 9;
+  options.shots = 2000;
+  const auto batched = simulateSweep(tmpl, bindings, options);
+  require(batched.size() == bindings.size(), "one result per binding");
+  for (size_t k = 0; k < bindings.size(); ++k) {
+    const Circuit bound = tmpl.bind(bindings[k]);
+    requireCounts(batched[k], simulate(bound, options).counts);
+  }
+}
+
+// Shots of a circuit with mid-circuit measurements and resets, a batch of
+// lanes at a time, against simulateShot() on each shot's own stream
+template <typename Real> void batchedShotsMatchOneAtATime() {
+  const Precision precision =
+      sizeof(Real) == sizeof(float) ? Precision::Single : Precision::Double;
+  const unsigned qubits = 5;
+  Circuit circuit = measuredCircuit(qubits, randomGates(qubits, 20, 6));
+  for (const Gate &gate : randomGates(qubits, 20, 7)) {
+    circuit.gates.push_back(gate);
+    if (gate.kind == GateKind::H)
+      circuit.gates.push_back(Gate{GateKind::Reset, {gate.qubits[0], 0}});
+  }
+  for (unsigned q = 0; q < qubits; ++q) {
+    Gate measure{GateKind::Measure, {q, 0}};
+    measure.bit = static_cast<int>(q);
+    circuit.gates.push_back(measure);
+  }
+  require(circuit.numQubits <= BatchedStateVector<Real>::kMaxQubits,
+          "circuit too large to batch");
+
+  SimulatorOptions options;
+  options.precision = precision;
+  options.seed = 3;
+  options.shots = 1000;
+  std::map<std::string, size_t> expected;
+  for (size_t shot = 0; shot < options.shots; ++shot) {
+    const uint64_t bits =
+        simulateShot(circuit, precision, Philox(options.seed, shot));
+    std::string key(qubits, '0');
+    for (unsigned k = 0; k < qubits; ++k)
+      key[k] = (bits >> k) & 1 ? '1' : '0';
+    expected[key]++;
+  }
+  requireCounts(simulate(circuit, options), expected);
+}
+
+// Single precision keeps about 7 digits; over a few hundred gates the
+// state may drift by rounding but no further
+void singlePrecisionTracksDouble() {
+  const unsigned qubits = 10;
+  const std::vector<Gate> gates = randomGates(qubits, 500, 8);
+  StateVector<float> single(qubits);
+  single.run(gates);
+  const std::vector<std::complex<float>> amps(single.data(),
+                                              single.data() + single.size());
+  requireSameAmplitudes(amps, evolveInMemory(qubits, gates), "single");
+
+  Circuit circuit = measuredCircuit(qubits, {});
+  circuit.gates = gates;
+  const double fidelity = precisionFidelity(circuit);
+  require(fidelity > 1.0 - 1e-5 && fidelity < 1.0 + 1e-5,
+          "fidelity " + std::to_string(fidelity) + " is not close to 1");
+
+  const double theta = 0.6f;
+  const SimulationResult result =
+      run(kObservable, 11, 1024, Precision::Single);
+  require(result.expectations.size() == 1, "one observable");
+  requireNear(result.expectations[0],
+              std::cos(theta) + 0.5 * std::sin(theta), 1e-6,
+              "single-precision <ZI + 0.5*XX>");
+}
+
+// The C++ the backend writes for the function declared as `signature`
+std::string cppFunction(Program &program, const std::string &signature) {
+  CppGenerator gen;
+  program.accept(gen);
+  const std::string code = gen.str();
+  const size_t begin = code.find(signature + " {\n");
+  require(begin != std::string::npos, "no C++ for " + signature);
+  return code.substr(begin, code.find("\n}\n", begin) + 3 - begin);
+}
+
+const char *kFoldable = R"(
+final int k = 3;
+function f(int x) -> int {
+  int a = 2 + 3 * 4;
+  float b = 1.5f * 2;
+  int c = 7 / 2 - 10 % 4;
+  bit less = k < 2;
+  int over = 2147483647 + 1;
+  int under = -2147483647 - 2;
+  float huge = 300000000000000000000000000000000000000.0f * 10.0f;
+  int z = x / 0;
+  int y = 5 / 0;
+  int m = 5 % 0;
+  float w = 1.0f / 0.0f;
+  if (k > 2) {
+    a = a + k;
+  }
+  if (k < 2) {
+    a = 0;
+  }
+  return a + c + y + m + over;
+}
+function main() -> int {
+  echo(f(1));
+  return 0;
+}
+)";
+
+// Arithmetic, finals and constant ifs fold; overflow and division by zero
+// are left for the program to hit at run time
+void constantsFoldToGoldenOutput() {
+  auto program = parseOnly(kFoldable);
+  foldConstants(*program);
+  const std::string expected = R"(int f(int x) {
+  int a = 14;
+  float b = 3.0f;
+  int c = 1;
+  bit less = 0;
+  int over = (2147483647 + 1);
+  int under = ((-2147483647) - 2);
+  float huge = (300000000000000000000000000000000000000.0f * 10.0f);
+  int z = (x / 0);
+  int y = (5 / 0);
+  int m = (5 % 0);
+  float w = (1.0f / 0.0f);
+  {
+  a = (a + 3);
+  }
+  return ((((a + c) + y) + m) + over);
+}
+)";
+  const std::string code = cppFunction(*program, "int f(int x)");
+  require(code == expected, "folded to\n" + code);
+}
+
+// Every function the C++ backend writes, in order, without the preamble
+// and entry point around them
+std::string cppFunctions(Program &program) {
+  CppGenerator gen;
+  program.accept(gen);
+  const std::string code = gen.str();
+  const size_t begin = code.find("#endif\n\n") + 8;
+  return code.substr(begin, code.find("\n\n#ifdef QUANTA_JIT", begin) -
+                                begin);
+}
+
+const char *kDeadCode = R"(
+final int k = 3;
+function used(int x) -> int {
+  return x + k;
+}
+function unused() -> int {
+  return 1;
+}
+function noisy() -> int {
+  echo("side effect");
+  return 2;
+}
+function swept(float t) -> float {
+  return t;
+}
+function main() -> int {
+  int dead = 4 * 5;
+  int kept = noisy();
+  int read = used(2);
+  int overwritten = 1;
+  overwritten = read + 1;
+  echo(read);
+  return 0;
+}
+)";
+
+// Unreachable functions go, and so do variables that are never read unless
+// a value stored in them has a side effect; an entry point is reachable
+void deadCodeToGoldenOutput() {
+  auto program = parseOnly(kDeadCode);
+  foldConstants(*program);
+  eliminateDeadCode(*program);
+  const std::string expected = R"(int used(int x) {
+  return (x + 3);
+}
+
+int noisy() {
+  std::cout << "side effect" << std::endl;
+  return 2;
+}
+
+int main__() {
+  int kept = noisy();
+  int read = used(2);
+  std::cout << read << std::endl;
+  return 0;
+}
+)";
+  std::string code = cppFunctions(*program);
+  require(code == expected, "eliminated to\n" + code);
+
+  program = parseOnly(kDeadCode);
+  foldConstants(*program);
+  eliminateDeadCode(*program, {"swept"});
+  code = cppFunctions(*program);
+  require(contains(code, "float swept(float t)"), "entry point removed");
+  require(!contains(code, "unused"), "unreachable function kept");
+
+  // Without main or top-level statements a program is a library
+  program = parseOnly(R"(
+function helper() -> int {
+  return 1;
+}
+)");
+  eliminateDeadCode(*program);
+  require(contains(cppFunctions(*program), "int helper()"),
+          "library function removed");
+}
+
+// One gate per line, on qubit names, as `measure a -> m` for measurements
+std::string gateListing(const Circuit &circuit) {
+  std::string text = "qubits";
+  for (const auto &name : circuit.qubitNames)
+    text += " " + name;
+  text += "\n";
+  for (const Gate &gate : circuit.gates) {
+    text += gateName(gate.kind);
+    for (int k = 0; k < arity(gate.kind); ++k)
+      text += (k ? "," : " ") + circuit.qubitNames[gate.qubits[k]];
+    if (gate.kind == GateKind::Measure)
+      text += " -> " + circuit.bitNames[gate.bit];
+    text += "\n";
+  }
+  return text;
+}
+
+Circuit lowerUnpruned(const std::string &source) {
+  return lowerProgram(*parse(source));
+}
+
+// Gates on qubits no measurement reads, phases right before measurements,
+// gates overwritten by a reset and gates after the last measurement of
+// their qubit all go; an unused qubit is removed and the rest renumbered
+void lightConeToGoldenOutput() {
+  const Circuit pruned = pruneLightCone(lowerUnpruned(R"(
+@quantum
+function recycle(qubit q) -> void {
+  reset q;
+}
+qubit a;
+qubit e;
+qubit b;
+qubit c;
+qubit d;
+h(a);
+h(e);
+cx(a, b);
+h(c);
+cx(c, d);
+x(b);
+recycle(b);
+h(b);
+rz(0.3f, a);
+cz(a, b);
+t(d);
+bit ma = measure a;
+bit mb = measure b;
+h(a);
+bit md = measure d;
+)"));
+  std::string listing = gateListing(pruned);
+  require(listing == R"(qubits a b c d
+h a
+cx a,b
+h c
+cx c,d
+reset b
+h b
+measure a -> ma
+measure b -> mb
+measure d -> md
+)",
+          "pruned to\n" + listing);
+
+  // An observable keeps its qubits live to the end
+  listing = gateListing(pruneLightCone(lowerUnpruned(R"(
+qubit a;
+qubit b;
+qubit c;
+h(a);
+h(b);
+h(c);
+s(b);
+float e = expect("X", b);
+bit m = measure a;
+)")));
+  require(listing == R"(qubits a b
+h a
+h b
+s b
+measure a -> m
+)",
+          "pruned to\n" + listing);
+
+  // Without measurements every qubit is reported
+  const Circuit unmeasured = lowerUnpruned(R"(
+qubit a;
+qubit b;
+h(a);
+t(b);
+)");
+  require(gateListing(pruneLightCone(unmeasured)) == gateListing(unmeasured),
+          "pruned a circuit without measurements");
+}
+
+// Each @state, undone by the gates that map it back to |0> or |1>, must
+// measure deterministically; unrotated, the X and Y expectation values
+// tell |+> from |-> and |i> from |-i>
+void stateAnnotationsPrepareTheirStates() {
+  requireCounts(run(R"(
+@state("+") qubit plus;
+@state("-") qubit minus;
+@state("i") qubit iplus;
+@state("-i") qubit iminus;
+@state("1") qubit one;
+h(plus);
+h(minus);
+sdg(iplus);
+h(iplus);
+s(iminus);
+h(iminus);
+bit a = measure plus;
+bit b = measure minus;
+bit c = measure iplus;
+bit d = measure iminus;
+bit e = measure one;
+)",
+                    5, 256),
+                {{"01001", 256}});
+
+  const SimulationResult result = run(R"(
+@state("+") qubit plus;
+@state("-") qubit minus;
+@state("i") qubit iplus;
+@state("-i") qubit iminus;
+float x = expect("XX", plus, minus);
+float y = expect("YY", iplus, iminus);
+float xy = expect("XY", plus, iplus);
+float z = expect("Z", minus);
+)",
+                                      5);
+  require(result.expectations.size() == 4, "four observables");
+  requireNear(result.expectations[0], -1.0, 1e-12, "<+-|XX|+->");
+  requireNear(result.expectations[1], -1.0, 1e-12, "<i,-i|YY|i,-i>");
+  requireNear(result.expectations[2], 1.0, 1e-12, "<+i|XY|+i>");
+  requireNear(result.expectations[3], 0.0, 1e-12, "<-|Z|->");
+}
+
+// fillProductState over 14 qubits, past the 12 its table expands, whole
+// and as spans of a larger state, against the product written out
+void productStatesMatchTheirFactors() {
+  const double r = 1 / std::sqrt(2.0);
+  const std::map<QubitState, std::array<std::complex<double>, 2>> factors = {
+      {QubitState::Zero, {1.0, 0.0}},
+      {QubitState::One, {0.0, 1.0}},
+      {QubitState::Plus, {r, r}},
+      {QubitState::Minus, {r, -r}},
+      {QubitState::PlusI, {r, std::complex<double>(0, r)}},
+      {QubitState::MinusI, {r, std::complex<double>(0, -r)}}};
+  const unsigned qubits = 14;
+  std::vector<QubitState> states;
+  for (unsigned q = 0; q < qubits; ++q)
+    states.push_back(static_cast<QubitState>((q * 5 + 2) % 6));
+
+  std::vector<std::complex<double>> expected(uint64_t{1} << qubits);
+  for (uint64_t i = 0; i < expected.size(); ++i) {
+    expected[i] = 1.0;
+    for (unsigned q = 0; q < qubits; ++q)
+      expected[i] *= factors.at(states[q])[(i >> q) & 1];
+  }
+
+  for (unsigned span : {2u, 5u, 13u, 14u}) {
+    std::vector<std::complex<double>> state(expected.size());
+    const uint64_t size = uint64_t{1} << span;
+    for (uint64_t first = 0; first < state.size(); first += size)
+      fillProductState(state.data() + first, size, first, states);
+    requireSameState(state, expected, 1e-12,
+                     "spans of 2^" + std::to_string(span));
+  }
+}
+
+// Ranks only follow measurements at the end of the circuit; anything else
+// is an error for the driver to report, not a crash
+void distributedRejectsMidCircuitMeasure() {
+  SimulatorOptions options;
+  options.ranks = 2;
+  try {
+    simulate(lower(kTrajectories), options);
+  } catch (const std::runtime_error &) {
+    return;
+  }
+  require(false, "mid-circuit measurement accepted with ranks");
+}
+
+// OpenQASM subroutines take sized arrays only
+void qasmDefsSizeArrays() {
+  const std::string listing = qasm(R"(
+@quantum
+function ghz(qubit[] q) -> void {
+  h(q[0]);
+  cx(q[0], q[1]);
+}
+@quantum
+function pair(qubit[2] q) -> void {
+  cx(q[0], q[1]);
+}
+qubit[2] r;
+ghz(r);
+pair(r);
+)");
+  require(!contains(listing, "qubit[] "), "unsized array in:\n" + listing);
+  require(contains(listing, "def pair(qubit[2] q)"),
+          "sized array dropped from:\n" + listing);
+}
+
+// A def cannot declare qubits; one that would is left to the circuit
+void qasmDefsDeclareNoQubits() {
+  const std::string listing = qasm(R"(
+@quantum
+function coin() -> bit {
+  qubit c;
+  h(c);
+  return measure c;
+}
+@quantum
+function flip(qubit a) -> bit {
+  h(a);
+  return measure a;
+}
+qubit b;
+bit first = coin();
+bit second = flip(b);
+)");
+  require(!contains(listing, "def coin"), "def declaring qubits:\n" + listing);
+  require(contains(listing, "def flip(qubit a) -> bit {\n"
+                            "  bit[1] m;\n"
+                            "  h a;\n"
+                            "  m[0] = measure a;\n"
+                            "  return m[0];\n"
+                            "}\n"),
+          "def flip not listed as lowered:\n" + listing);
+}
+
+// Just enough JSON to check what --stats=json and --trace write: values
+// are parsed strictly and kept as a tree
+struct Json {
+  enum Kind { Null, Bool, Number, String, Array, Object } kind = Null;
+  double number = 0.0;
+  std::string text;
+  std::vector<Json> items;
+  std::vector<std::pair<std::string, Json>> members;
+
+  const Json *find(const std::string &key) const {
+    for (const auto &[name, value] : members) {
+      if (name == key)
+        return &value;
+    }
+    return nullptr;
+  }
+  const Json &at(const std::string &key, Kind expected) const {
+    const Json *value = find(key);
+    require(value && value->kind == expected, "no member \"" + key + "\"");
+    return *value;
+  }
+};
+
+class JsonReader {
+public:
+  explicit JsonReader(const std::string &text) : text(text) {}
+
+  Json document() {
+    Json value = read();
+    skipSpace();
+    require(pos == text.size(), "text after the JSON value");
+    return value;
+  }
+
+private:
+  const std::string &text;
+  size_t pos = 0;
+
+  void skipSpace() {
+    while (pos < text.size() && std::isspace((unsigned char)text[pos]))
+      pos++;
+  }
+  bool accept(char c) {
+    skipSpace();
+    if (pos < text.size() && text[pos] == c) {
+      pos++;
+      return true;
+    }
+    return false;
+  }
+  void expect(char c) {
+    require(accept(c), std::string("expected '") + c + "' at offset " +
+                           std::to_string(pos));
+  }
+  bool literal(const char *word) {
+    if (text.compare(pos, std::strlen(word), word) != 0)
+      return false;
+    pos += std::strlen(word);
+    return true;
+  }
+
+  std::string string() {
+    expect('"');
+    std::string value;
+    while (pos < text.size() && text[pos] != '"') {
+      char c = text[pos++];
+      require((unsigned char)c >= 0x20, "control character in a string");
+      if (c == '\\') {
+        require(pos < text.size(), "unterminated escape");
+        c = text[pos++];
+        require(c && std::strchr("\"\\/bfnrtu", c), "bad escape");
+        if (c == 'u') {
+          require(pos + 4 <= text.size() &&
+                      std::all_of(text.begin() + pos,
+                                  text.begin() + pos + 4,
+                                  [](unsigned char h) {
+                                    return std::isxdigit(h);
+                                  }),
+                  "bad \\u escape");
+          pos += 4;
+          c = '?';
+        }
+      }
+      value += c;
+    }
+    expect('"');
+    return value;
+  }
+
+  Json read() {
+    Json value;
+    skipSpace();
+    require(pos < text.size(), "unexpected end of JSON");
+    if (accept('{')) {
+      value.kind = Json::Object;
+      if (accept('}'))
+        return value;
+      do {
+        skipSpace();
+        std::string key = string();
+        expect(':');
+        value.members.emplace_back(std::move(key), read());
+      } while (accept(','));
+      expect('}');
+    } else if (accept('[')) {
+      value.kind = Json::Array;
+      if (accept(']'))
+        return value;
+      do
+        value.items.push_back(read());
+      while (accept(','));
+      expect(']');
+    } else if (text[pos] == '"') {
+      value.kind = Json::String;
+      value.text = string();
+    } else if (literal("true") || literal("false")) {
+      value.kind = Json::Bool;
+    } else if (literal("null")) {
+      value.kind = Json::Null;
+    } else {
+      // JSON numbers are a subset of what strtod reads; check the grammar
+      static const std::regex number(
+          R"(-?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?)");
+      std::smatch match;
+      const std::string rest = text.substr(pos, 64);
+      require(std::regex_search(rest, match, number,
+                                std::regex_constants::match_continuous),
+              "bad value at offset " + std::to_string(pos));
+      value.kind = Json::Number;
+      value.number = std::stod(match.str());
+      pos += match.length();
+    }
+    return value;
+  }
+};
+
+// Runs the `quanta` executable on `source` with `arguments`; standard
+// output is dropped and standard error returned
+std::string runQuanta(const std::string &source,
+                      const std::string &arguments) {
+  const std::string base = std::filesystem::temp_directory_path() /
+                           ("quanta-test-" + std::to_string(getpid()));
+  {
+    std::ofstream out(base + ".qt");
+    out << source;
+  }
+  const std::string command = std::string(QUANTA_BINARY) + " " + base +
+                              ".qt " + arguments + " >/dev/null 2>" + base +
+                              ".err";
+  const int status = std::system(command.c_str());
+  std::ifstream in(base + ".err");
+  std::stringstream errors;
+  errors << in.rdbuf();
+  std::filesystem::remove(base + ".qt");
+  std::filesystem::remove(base + ".err");
+  require(status == 0, "quanta " + arguments + " failed: " + errors.str());
+  return errors.str();
+}
+
+// --stats=json is one JSON object with every phase that ran, every
+// counter, and the kernels the simulation used
+void statsJsonIsValid() {
+  const Json stats = JsonReader(runQuanta(kBell, "--seed=5 --stats=json"))
+                         .document();
+  require(stats.kind == Json::Object, "stats are not an object");
+
+  std::vector<std::string> phases;
+  for (const Json &phase : stats.at("phases", Json::Array).items) {
+    phases.push_back(phase.at("name", Json::String).text);
+    require(phase.at("ms", Json::Number).number >= 0, "negative time");
+    require(phase.at("calls", Json::Number).number >= 1, "phase not run");
+    phase.at("rss_mib", Json::Number);
+  }
+  for (const char *name : {"lex", "parse", "constfold", "unroll", "inline",
+                           "dce", "cppgen", "lower", "cancel", "lightcone",
+                           "regalloc", "qasmgen", "simulate"}) {
+    require(std::find(phases.begin(), phases.end(), name) != phases.end(),
+            std::string("no phase ") + name);
+  }
+
+  const Json &counters = stats.at("counters", Json::Object);
+  for (const char *name : {"source_bytes", "tokens", "ast_nodes",
+                           "allocations", "allocated_bytes",
+                           "gates_applied", "bytes_moved"}) {
+    require(counters.at(name, Json::Number).number > 0,
+            std::string("counter ") + name + " is zero");
+  }
+  stats.at("tokens_per_sec", Json::Number);
+  require(stats.at("peak_rss_mib", Json::Number).number > 0, "peak RSS");
+  const Json &kernels = stats.at("kernels", Json::Array);
+  require(!kernels.items.empty(), "no kernels");
+  for (const Json &kernel : kernels.items) {
+    kernel.at("name", Json::String);
+    require(kernel.at("runs", Json::Number).number >= 1, "kernel not run");
+    kernel.at("ms", Json::Number);
+    kernel.at("bytes", Json::Number);
+  }
+}
+
+// --trace writes a Chrome trace: a traceEvents array of complete ("X")
+// and metadata ("M") events. With --ranks=2 the forked rank's spans come
+// back as a process of their own.
+void traceIsChromeTrace() {
+  const std::string path = std::filesystem::temp_directory_path() /
+                           ("quanta-trace-" + std::to_string(getpid()));
+  runQuanta(kBell, "--seed=5 --ranks=2 --trace=" + path);
+  std::ifstream in(path);
+  std::stringstream text;
+  text << in.rdbuf();
+  std::filesystem::remove(path);
+  const Json trace = JsonReader(text.str()).document();
+
+  std::map<int, std::string> processes;
+  std::map<int, std::vector<std::string>> spans; // "category/name" by pid
+  for (const Json &event : trace.at("traceEvents", Json::Array).items) {
+    const std::string &name = event.at("name", Json::String).text;
+    const std::string &phase = event.at("ph", Json::String).text;
+    const int pid = static_cast<int>(event.at("pid", Json::Number).number);
+    event.at("tid", Json::Number);
+    if (phase == "M") {
+      const std::string &value =
+          event.at("args", Json::Object).at("name", Json::String).text;
+      if (name == "process_name")
+        processes[pid] = value;
+      continue;
+    }
+    require(phase == "X", "event " + name + " has phase " + phase);
+    require(event.at("ts", Json::Number).number >= 0 &&
+                event.at("dur", Json::Number).number >= 0,
+            "event " + name + " has a negative time");
+    spans[pid].push_back(event.at("cat", Json::String).text + "/" + name);
+  }
+
+  require(processes[0] == "quanta" && processes[1] == "rank 1",
+          "process names");
+  require(processes.size() == 2, "expected two processes");
+  auto has = [&](int pid, const std::string &span) {
+    return std::find(spans[pid].begin(), spans[pid].end(), span) !=
+           spans[pid].end();
+  };
+  for (const char *phase : {"phase/lex", "phase/parse", "phase/simulate"})
+    require(has(0, phase), std::string("rank 0 has no ") + phase);
+  require(has(0, "sim/gate window") && has(1, "sim/gate window"),
+          "gate windows on both ranks");
+  require(has(1, "sim/qubit swap"), "no qubit swap on rank 1");
+  require(!has(1, "phase/lex"), "rank 1 repeats the phases before the fork");
+}
+
+// A failed native compile reports the compiler's output and leaves
+// nothing behind in the cache
+void failedJitLeavesNoFiles() {
+  const std::filesystem::path dir =
+      std::filesystem::temp_directory_path() /
+      ("quanta-jit-" + std::to_string(getpid()));
+  std::filesystem::remove_all(dir);
+  const char *previous = std::getenv("QUANTA_CXX");
+  const std::string saved = previous ? previous : "";
+  setenv("QUANTA_CXX", "quanta-no-such-compiler", 1);
+
+  auto program = parse("function main() -> int {\n  return 0;\n}\n");
+  JitOptions options;
+  options.cacheDirectory = dir;
+  std::string error;
+  try {
+    runJit(*program, options);
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+  if (previous)
+    setenv("QUANTA_CXX", saved.c_str(), 1);
+  else
+    unsetenv("QUANTA_CXX");
+
+  const bool empty = std::filesystem::is_empty(dir);
+  std::filesystem::remove_all(dir);
+  require(contains(error, "quanta-no-such-compiler"), "error: " + error);
+  require(empty, "compile failure left files in the cache");
+}
+
+} // namespace
+
+int main() {
+  const std::pair<const char *, void (*)()> tests[] = {
+      {"Philox known answers", philoxKnownAnswers},
+      {"seed reproduces counts", seedReproducesCounts},
+      {"seed reproduces trajectories", seedReproducesTrajectories},
+      {"distributed run rejects mid-circuit measure",
+       distributedRejectsMidCircuitMeasure},
+      {"distributed run matches in-memory", distributedMatchesInMemory},
+      {"out-of-core run matches in-memory", outOfCoreMatchesInMemory},
+      {"kernels match dense matrices (double)",
+       kernelsMatchDenseMatrices<double>},
+      {"kernels match dense matrices (float)",
+       kernelsMatchDenseMatrices<float>},
+      {"diagonal batches match dense matrices (double)",
+       diagonalBatchesMatchDenseMatrices<double>},
+      {"diagonal batches match dense matrices (float)",
+       diagonalBatchesMatchDenseMatrices<float>},
+      {"swap batches match dense matrices (double)",
+       swapBatchesMatchDenseMatrices<double>},
+      {"swap batches match dense matrices (float)",
+       swapBatchesMatchDenseMatrices<float>},
+      {"blocked run matches unblocked (double)",
+       blockedRunMatchesUnblocked<double>},
+      {"blocked run matches unblocked (float)",
+       blockedRunMatchesUnblocked<float>},
+      {"layout matches unplanned run", layoutMatchesUnplannedRun},
+      {"constants fold to golden output", constantsFoldToGoldenOutput},
+      {"dead code to golden output", deadCodeToGoldenOutput},
+      {"light cone to golden output", lightConeToGoldenOutput},
+      {"single precision tracks double", singlePrecisionTracksDouble},
+      {"batched sweep matches one at a time (double)",
+       batchedSweepMatchesOneAtATime<double>},
+      {"batched sweep matches one at a time (float)",
+       batchedSweepMatchesOneAtATime<float>},
+      {"batched shots match one at a time (double)",
+       batchedShotsMatchOneAtATime<double>},
+      {"batched shots match one at a time (float)",
+       batchedShotsMatchOneAtATime<float>},
+      {"VM matches native int and float arithmetic",
+       vmMatchesNativeArithmetic},
+      {"measured bits named after qubits", measuredBitsNamedAfterQubits},
+      {"adjoint cancels the call before it", adjointCancelsCall},
+      {"adjoint needs @adjoint", adjointNeedsAnnotation},
+      {"inlining substitutes classical arguments",
+       inliningSubstitutesArguments},
+      {"gradient stubs only for float functions",
+       gradientStubsForFloatFunctions},
+      {"streamed joins stay bounded in memory", streamedJoinsStayBounded},
+      {"writev keeps chunk boundaries", writevKeepsChunkBoundaries},
+      {"parallel output matches a single thread",
+       parallelOutputMatchesSingleThread},
+      {"expectations at a fixed seed", expectationsAtFixedSeed},
+      {"gradients match finite differences", gradientsMatchFiniteDifferences},
+      {"template matches lowering each call",
+       templateMatchesLoweringEachCall},
+      {"@state annotations prepare their states",
+       stateAnnotationsPrepareTheirStates},
+      {"product states match their factors", productStatesMatchTheirFactors},
+      {"OpenQASM defs size their arrays", qasmDefsSizeArrays},
+      {"OpenQASM defs declare no qubits", qasmDefsDeclareNoQubits},
+      {"--stats=json is valid", statsJsonIsValid},
+      {"--trace is a Chrome trace", traceIsChromeTrace},
+      {"failed JIT leaves no files", failedJitLeavesNoFiles},
+  };
+
+  int passed = 0;
+  for (const auto &[name, test] : tests) {
+    std::cout << colorize("[INFO] Running test: ", "1;34") << name << "\n";
+    try {
+      test();
+      std::cout << colorize("[PASS] ", "1;32") << name << "\n";
+      passed++;
+    } catch (const std::exception &e) {
+      std::cout << colorize("[FAIL] ", "1;31") << name << "\n";
+      std::cerr << colorize(e.what(), "1;31") << "\n";
+    }
+  }
+
+  const int total = static_cast<int>(std::size(tests));
+  std::cout << "\n"
+            << colorize("[SUMMARY] ", "1;36") << passed << "/" << total
+            << " tests passed\n";
+  return passed == total ? 0 : 1;
+}
@@ -61,8 +61,14 @@ bool runTest(const std::string &path, bool expectSuccess) {
   return true;
 }
 
+// The build passes the source tree's test directory in, so the suite runs
+// from any working directory
+#ifndef QUANTA_TEST_DIR
+#define QUANTA_TEST_DIR "../test"
+#endif
+
 int main() {
-  const std::string testDir = "../test";
+  const std::string testDir = QUANTA_TEST_DIR;
   const std::string validDir = testDir + "/valid";
   const std::string invalidDir = testDir + "/invalid";
 